@@ -1097,8 +1097,8 @@ AMF3_Decode(AMFObject *obj, const char *pBuffer, int nSize, int bAMFData)
             /*std::string str = className; */
 
             RTMP_Log(RTMP_LOGDEBUG,
-                     "Class name: %s, externalizable: %d, dynamic: %d, classMembers: %d",
-                     cd.cd_name.av_val, cd.cd_externalizable, cd.cd_dynamic,
+                     "Class name: %.*s, externalizable: %d, dynamic: %d, classMembers: %d",
+                     cd.cd_name.av_len, cd.cd_name.av_val, cd.cd_externalizable, cd.cd_dynamic,
                      cd.cd_num);
 
             for (i = 0; i < cdnum; i++)
@@ -1112,7 +1112,8 @@ AMF3_Decode(AMFObject *obj, const char *pBuffer, int nSize, int bAMFData)
                     return nOriginalSize;
                 }
                 len = AMF3ReadString(pBuffer, &memberName);
-                RTMP_Log(RTMP_LOGDEBUG, "Member: %s", memberName.av_val);
+                RTMP_Log(RTMP_LOGDEBUG, "Member: %.*s", memberName.av_len,
+                         memberName.av_val);
                 AMF3CD_AddProp(&cd, &memberName);
                 nSize -= len;
                 pBuffer += len;
@@ -1316,3 +1317,465 @@ AMF3CD_GetProp(AMF3ClassDef *cd, int nIndex)
         return (AVal *)&AV_empty;
     return &cd->cd_props[nIndex];
 }
+
+/* AMFReader */
+
+enum
+{
+    READER_OBJECT = 1,	/* named members up to an end marker */
+    READER_ARRAY,		/* f_left unnamed items */
+    READER_AMF3_OBJECT,	/* f_left sealed members, then dynamic ones */
+    READER_AMF3_ARRAY	/* named members up to an empty name, then f_left items */
+};
+
+static const AVal av_DEFAULT_ATTRIBUTE = AVC("DEFAULT_ATTRIBUTE");
+
+static int
+ReaderU29(AMFReader *r, const char **p, uint32_t *val)
+{
+    const char *cur = *p;
+    uint32_t v = 0;
+    int i;
+
+    for (i = 0; i < 4; i++)
+    {
+        unsigned char b;
+
+        if (cur >= r->r_end)
+            return FALSE;
+        b = (unsigned char)*cur++;
+
+        if (i == 3)
+        {
+            v = (v << 8) | b;
+            break;
+        }
+        v = (v << 7) | (b & 0x7f);
+        if (!(b & 0x80))
+            break;
+    }
+
+    *val = v;
+    *p = cur;
+    return TRUE;
+}
+
+/* names in a traits record are read once where they are defined and again
+ * for every object that refers to the traits, only the first read may
+ * add them to the string table */
+static int
+ReaderAMF3String(AMFReader *r, const char **p, AVal *str, int bRemember)
+{
+    uint32_t ref;
+
+    if (!ReaderU29(r, p, &ref))
+        return FALSE;
+
+    if (!(ref & 1))
+    {
+        if ((ref >> 1) >= (uint32_t)r->r_numStrings)
+            return FALSE;
+        *str = r->r_strings[ref >> 1];
+        return TRUE;
+    }
+
+    ref >>= 1;
+    if (ref > (uint32_t)(r->r_end - *p))
+        return FALSE;
+
+    str->av_val = (char *)*p;
+    str->av_len = ref;
+    *p += ref;
+
+    if (bRemember && ref && r->r_numStrings < AMF3_READER_MAX_STRINGS)
+        r->r_strings[r->r_numStrings++] = *str;
+    return TRUE;
+}
+
+static int
+ReaderPush(AMFReader *r, int kind, int amf3, uint32_t left)
+{
+    AMFReaderFrame *f;
+
+    if (r->r_depth >= AMF_READER_MAX_DEPTH)
+    {
+        RTMP_Log(RTMP_LOGDEBUG, "%s, nesting deeper than %d", __FUNCTION__,
+                 AMF_READER_MAX_DEPTH);
+        return FALSE;
+    }
+
+    f = &r->r_stack[r->r_depth++];
+    f->f_kind = kind;
+    f->f_amf3 = amf3;
+    f->f_dynamic = FALSE;
+    f->f_left = left;
+    f->f_names = NULL;
+    return TRUE;
+}
+
+static int
+ReaderAMF3Object(AMFReader *r, AMFObjectProperty *prop)
+{
+    AMF3ReaderTraits t;
+    AMFReaderFrame *f;
+    uint32_t ref;
+    AVal name;
+    int i;
+
+    if (!ReaderU29(r, &r->r_cur, &ref))
+        return FALSE;
+
+    if (!(ref & 1))
+    {
+        prop->p_type = AMF_REFERENCE;
+        prop->p_vu.p_number = (double)(ref >> 1);
+        return TRUE;
+    }
+
+    if (!(ref & 2))
+    {
+        if ((ref >> 2) >= (uint32_t)r->r_numTraits)
+            return FALSE;
+        t = r->r_traits[ref >> 2];
+    }
+    else
+    {
+        t.t_externalizable = (ref >> 2) & 1;
+        t.t_dynamic = (ref >> 3) & 1;
+        t.t_num = ref >> 4;
+
+        /* class name */
+        if (!ReaderAMF3String(r, &r->r_cur, &name, TRUE))
+            return FALSE;
+
+        t.t_names = r->r_cur;
+        for (i = 0; i < t.t_num; i++)
+            if (!ReaderAMF3String(r, &r->r_cur, &name, TRUE))
+                return FALSE;
+
+        if (r->r_numTraits < AMF3_READER_MAX_TRAITS)
+            r->r_traits[r->r_numTraits++] = t;
+    }
+
+    if (!ReaderPush(r, READER_AMF3_OBJECT, TRUE,
+                    t.t_externalizable ? 1 : t.t_num))
+        return FALSE;
+
+    f = &r->r_stack[r->r_depth - 1];
+    f->f_dynamic = t.t_dynamic && !t.t_externalizable;
+    f->f_names = t.t_externalizable ? NULL : t.t_names;
+
+    prop->p_type = AMF_OBJECT;
+    return TRUE;
+}
+
+static int
+ReaderAMF3Value(AMFReader *r, AMFObjectProperty *prop)
+{
+    uint32_t ref;
+
+    if (r->r_cur >= r->r_end)
+        return FALSE;
+
+    switch (*r->r_cur++)
+    {
+    case AMF3_UNDEFINED:
+    case AMF3_NULL:
+        prop->p_type = AMF_NULL;
+        return TRUE;
+    case AMF3_FALSE:
+    case AMF3_TRUE:
+        prop->p_type = AMF_BOOLEAN;
+        prop->p_vu.p_number = r->r_cur[-1] == AMF3_TRUE;
+        return TRUE;
+    case AMF3_INTEGER:
+        if (!ReaderU29(r, &r->r_cur, &ref))
+            return FALSE;
+        /* 29 bit two's complement */
+        prop->p_type = AMF_NUMBER;
+        prop->p_vu.p_number = (ref & 0x10000000) ?
+            (double)((int32_t)ref - (1 << 29)) : (double)ref;
+        return TRUE;
+    case AMF3_DOUBLE:
+        if (r->r_end - r->r_cur < 8)
+            return FALSE;
+        prop->p_type = AMF_NUMBER;
+        prop->p_vu.p_number = AMF_DecodeNumber(r->r_cur);
+        r->r_cur += 8;
+        return TRUE;
+    case AMF3_STRING:
+        prop->p_type = AMF_STRING;
+        return ReaderAMF3String(r, &r->r_cur, &prop->p_vu.p_aval, TRUE);
+    case AMF3_XML_DOC:
+    case AMF3_XML:
+    case AMF3_BYTE_ARRAY:
+        /* these reference the object table, not the string one */
+        if (!ReaderU29(r, &r->r_cur, &ref))
+            return FALSE;
+        if (!(ref & 1))
+        {
+            prop->p_type = AMF_REFERENCE;
+            prop->p_vu.p_number = (double)(ref >> 1);
+            return TRUE;
+        }
+        ref >>= 1;
+        if (ref > (uint32_t)(r->r_end - r->r_cur))
+            return FALSE;
+        prop->p_type = AMF_STRING;
+        prop->p_vu.p_aval.av_val = (char *)r->r_cur;
+        prop->p_vu.p_aval.av_len = ref;
+        r->r_cur += ref;
+        return TRUE;
+    case AMF3_DATE:
+        if (!ReaderU29(r, &r->r_cur, &ref))
+            return FALSE;
+        if (!(ref & 1))
+        {
+            prop->p_type = AMF_REFERENCE;
+            prop->p_vu.p_number = (double)(ref >> 1);
+            return TRUE;
+        }
+        if (r->r_end - r->r_cur < 8)
+            return FALSE;
+        prop->p_type = AMF_NUMBER;
+        prop->p_vu.p_number = AMF_DecodeNumber(r->r_cur);
+        r->r_cur += 8;
+        return TRUE;
+    case AMF3_ARRAY:
+        if (!ReaderU29(r, &r->r_cur, &ref))
+            return FALSE;
+        if (!(ref & 1))
+        {
+            prop->p_type = AMF_REFERENCE;
+            prop->p_vu.p_number = (double)(ref >> 1);
+            return TRUE;
+        }
+        if (!ReaderPush(r, READER_AMF3_ARRAY, TRUE, ref >> 1))
+            return FALSE;
+        r->r_stack[r->r_depth - 1].f_dynamic = TRUE;
+        prop->p_type = AMF_ECMA_ARRAY;
+        return TRUE;
+    case AMF3_OBJECT:
+        return ReaderAMF3Object(r, prop);
+    default:
+        RTMP_Log(RTMP_LOGDEBUG, "%s, unsupported AMF3 type 0x%02x", __FUNCTION__,
+                 (unsigned char)r->r_cur[-1]);
+        return FALSE;
+    }
+}
+
+static int
+ReaderAMF0Value(AMFReader *r, AMFObjectProperty *prop)
+{
+    uint32_t len;
+
+    if (r->r_cur >= r->r_end)
+        return FALSE;
+
+    prop->p_type = *r->r_cur++;
+    switch (prop->p_type)
+    {
+    case AMF_NUMBER:
+        if (r->r_end - r->r_cur < 8)
+            return FALSE;
+        prop->p_vu.p_number = AMF_DecodeNumber(r->r_cur);
+        r->r_cur += 8;
+        return TRUE;
+    case AMF_BOOLEAN:
+        if (r->r_end - r->r_cur < 1)
+            return FALSE;
+        prop->p_vu.p_number = (double)AMF_DecodeBoolean(r->r_cur);
+        r->r_cur++;
+        return TRUE;
+    case AMF_STRING:
+        if (r->r_end - r->r_cur < 2)
+            return FALSE;
+        len = AMF_DecodeInt16(r->r_cur);
+        if (len > (uint32_t)(r->r_end - r->r_cur) - 2)
+            return FALSE;
+        AMF_DecodeString(r->r_cur, &prop->p_vu.p_aval);
+        r->r_cur += 2 + len;
+        return TRUE;
+    case AMF_LONG_STRING:
+    case AMF_XML_DOC:
+        if (r->r_end - r->r_cur < 4)
+            return FALSE;
+        len = AMF_DecodeInt32(r->r_cur);
+        if (len > (uint32_t)(r->r_end - r->r_cur) - 4)
+            return FALSE;
+        AMF_DecodeLongString(r->r_cur, &prop->p_vu.p_aval);
+        r->r_cur += 4 + len;
+        prop->p_type = AMF_STRING;
+        return TRUE;
+    case AMF_NULL:
+    case AMF_UNDEFINED:
+    case AMF_UNSUPPORTED:
+        prop->p_type = AMF_NULL;
+        return TRUE;
+    case AMF_DATE:
+        if (r->r_end - r->r_cur < 10)
+            return FALSE;
+        prop->p_vu.p_number = AMF_DecodeNumber(r->r_cur);
+        prop->p_UTCoffset = AMF_DecodeInt16(r->r_cur + 8);
+        r->r_cur += 10;
+        return TRUE;
+    case AMF_OBJECT:
+        return ReaderPush(r, READER_OBJECT, FALSE, 0);
+    case AMF_TYPED_OBJECT:
+    {
+        /* class name, then members as in a plain object */
+        if (r->r_end - r->r_cur < 2)
+            return FALSE;
+        len = AMF_DecodeInt16(r->r_cur);
+        if (len > (uint32_t)(r->r_end - r->r_cur) - 2)
+            return FALSE;
+        r->r_cur += 2 + len;
+        prop->p_type = AMF_OBJECT;
+        return ReaderPush(r, READER_OBJECT, FALSE, 0);
+    }
+    case AMF_ECMA_ARRAY:
+        /* the count is only a hint, the end marker is what counts */
+        if (r->r_end - r->r_cur < 4)
+            return FALSE;
+        r->r_cur += 4;
+        return ReaderPush(r, READER_OBJECT, FALSE, 0);
+    case AMF_STRICT_ARRAY:
+        if (r->r_end - r->r_cur < 4)
+            return FALSE;
+        len = AMF_DecodeInt32(r->r_cur);
+        r->r_cur += 4;
+        return ReaderPush(r, READER_ARRAY, FALSE, len);
+    case AMF_AVMPLUS:
+        return ReaderAMF3Value(r, prop);
+    default:
+        RTMP_Log(RTMP_LOGDEBUG, "%s, unsupported AMF0 type 0x%02x", __FUNCTION__,
+                 (unsigned char)prop->p_type);
+        return FALSE;
+    }
+}
+
+void
+AMFReader_Init(AMFReader *r, const char *pBuffer, int nSize)
+{
+    r->r_cur = pBuffer;
+    r->r_end = pBuffer + (nSize > 0 ? nSize : 0);
+    r->r_depth = 0;
+    r->r_numStrings = 0;
+    r->r_numTraits = 0;
+}
+
+int
+AMFReader_Next(AMFReader *r, AMFObjectProperty *prop)
+{
+    AMFReaderFrame *f;
+    int amf3 = FALSE;
+
+    prop->p_name = AV_empty;
+    prop->p_vu.p_object = AMFObj_Invalid;
+    prop->p_UTCoffset = 0;
+
+    if (r->r_depth == 0)
+    {
+        if (r->r_cur >= r->r_end)
+            return 0;
+    }
+    else
+    {
+        f = &r->r_stack[r->r_depth - 1];
+        amf3 = f->f_amf3;
+
+        switch (f->f_kind)
+        {
+        case READER_OBJECT:
+        {
+            uint32_t len;
+
+            if (r->r_end - r->r_cur < 3)
+                return -1;
+            len = AMF_DecodeInt16(r->r_cur);
+            if (len == 0 && r->r_cur[2] == AMF_OBJECT_END)
+            {
+                r->r_cur += 3;
+                goto end;
+            }
+            if (len > (uint32_t)(r->r_end - r->r_cur) - 2)
+                return -1;
+            AMF_DecodeString(r->r_cur, &prop->p_name);
+            r->r_cur += 2 + len;
+            break;
+        }
+        case READER_ARRAY:
+            if (f->f_left == 0)
+                goto end;
+            f->f_left--;
+            break;
+        case READER_AMF3_OBJECT:
+            if (f->f_left)
+            {
+                if (f->f_names)
+                {
+                    if (!ReaderAMF3String(r, &f->f_names, &prop->p_name, FALSE))
+                        return -1;
+                }
+                else
+                {
+                    prop->p_name = av_DEFAULT_ATTRIBUTE;
+                }
+                f->f_left--;
+                break;
+            }
+            if (!f->f_dynamic)
+                goto end;
+            if (!ReaderAMF3String(r, &r->r_cur, &prop->p_name, TRUE))
+                return -1;
+            if (prop->p_name.av_len == 0)
+                goto end;
+            break;
+        case READER_AMF3_ARRAY:
+            if (f->f_dynamic)
+            {
+                if (!ReaderAMF3String(r, &r->r_cur, &prop->p_name, TRUE))
+                    return -1;
+                if (prop->p_name.av_len)
+                    break;
+                f->f_dynamic = FALSE;
+            }
+            if (f->f_left == 0)
+                goto end;
+            f->f_left--;
+            break;
+        }
+    }
+
+    if (!(amf3 ? ReaderAMF3Value(r, prop) : ReaderAMF0Value(r, prop)))
+        return -1;
+    return 1;
+
+end:
+    r->r_depth--;
+    prop->p_name = AV_empty;
+    prop->p_type = AMF_OBJECT_END;
+    return 1;
+}
+
+int
+AMFReader_Skip(AMFReader *r, const AMFObjectProperty *prop)
+{
+    AMFObjectProperty p;
+    int depth = r->r_depth;
+
+    if (prop->p_type != AMF_OBJECT && prop->p_type != AMF_ECMA_ARRAY &&
+            prop->p_type != AMF_STRICT_ARRAY)
+        return TRUE;
+
+    while (r->r_depth >= depth)
+        if (AMFReader_Next(r, &p) != 1)
+            return FALSE;
+    return TRUE;
+}
+
+int
+AMFReader_Depth(const AMFReader *r)
+{
+    return r->r_depth;
+}
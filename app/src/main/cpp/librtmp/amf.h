@@ -25,6 +25,8 @@
  *  http://www.gnu.org/copyleft/lgpl.html
  */
 
+#include <stdint.h>
+
 #ifndef TRUE
 #define TRUE	1
 #define FALSE	0
@@ -158,6 +160,55 @@ extern "C"
     void AMF3CD_AddProp(AMF3ClassDef * cd, AVal * prop);
     AVal *AMF3CD_GetProp(AMF3ClassDef * cd, int idx);
 
+    /* Pull decoder over an AMF0 buffer, with AMF3 values behind an
+     * AMF_AVMPLUS marker. Each call returns the next value in place, its
+     * strings point into the buffer and nothing is allocated. Objects and
+     * arrays come back as AMF_OBJECT, AMF_ECMA_ARRAY or AMF_STRICT_ARRAY,
+     * followed by their members one level deeper and then an
+     * AMF_OBJECT_END. AMF3 values are mapped onto the AMF0 types the way
+     * AMF3Prop_Decode does, AMF3 arrays come back as ecma arrays, and
+     * object references as AMF_REFERENCE with the index as the number. */
+#define AMF_READER_MAX_DEPTH	16
+#define AMF3_READER_MAX_STRINGS	64
+#define AMF3_READER_MAX_TRAITS	16
+
+    typedef struct AMFReaderFrame
+    {
+        char f_kind;
+        char f_amf3;
+        char f_dynamic;
+        uint32_t f_left;	/* strict array items or sealed members */
+        const char *f_names;	/* next sealed member name */
+    } AMFReaderFrame;
+
+    typedef struct AMF3ReaderTraits
+    {
+        const char *t_names;
+        int t_num;
+        char t_dynamic;
+        char t_externalizable;
+    } AMF3ReaderTraits;
+
+    typedef struct AMFReader
+    {
+        const char *r_cur;
+        const char *r_end;
+        int r_depth;
+        AMFReaderFrame r_stack[AMF_READER_MAX_DEPTH];
+        AVal r_strings[AMF3_READER_MAX_STRINGS];
+        int r_numStrings;
+        AMF3ReaderTraits r_traits[AMF3_READER_MAX_TRAITS];
+        int r_numTraits;
+    } AMFReader;
+
+    void AMFReader_Init(AMFReader * r, const char *pBuffer, int nSize);
+    /* 1 with the next value in prop, 0 at the end of the buffer, -1 on a
+     * malformed or unsupported value */
+    int AMFReader_Next(AMFReader * r, AMFObjectProperty * prop);
+    /* skips the members of the object or array Next just returned */
+    int AMFReader_Skip(AMFReader * r, const AMFObjectProperty * prop);
+    int AMFReader_Depth(const AMFReader * r);
+
 #ifdef __cplusplus
 }
 #endif
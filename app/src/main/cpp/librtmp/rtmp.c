@@ -81,7 +81,9 @@ static const char *my_dhm_G = "4";
 #include <openssl/bio.h>
 #include <openssl/buffer.h>
 #endif
+#endif
 
+#if defined(CRYPTO) || defined(USE_TLS)
 TLS_CTX RTMP_TLS_ctx = NULL;
 #endif
 
@@ -160,11 +162,20 @@ static void HandleClientBW(RTMP *r, const RTMPPacket *packet);
 
 static int ReadN(RTMP *r, char *buffer, int n);
 static int WriteN(RTMP *r, const char *buffer, int n);
+static int WriteBatch(RTMP *r);
+static void DiscardBatch(RTMP *r);
 
 static void DecodeTEA(AVal *key, AVal *text);
 
-static int HTTP_Post(RTMP *r, RTMPTCmd cmd, const char *buf, int len);
+static int HTTP_Post(RTMP *r, RTMPTCmd cmd, char *buf, int len, int room);
 static int HTTP_read(RTMP *r, int fill);
+static int TunnelWrite(RTMP *r, const char *buf, int len);
+static int TunnelRelease(RTMP *r);
+static int TunnelFlush(RTMP *r);
+static int TunnelPost(RTMP *r);
+static int TunnelCollect(RTMP *r, int keep, int until);
+static void TunnelPollWait(RTMP *r);
+static void TunnelFree(RTMPTunnel *t);
 
 #if !defined(_WIN32) && !defined(_DEBUG)
 static int clk_tck;
@@ -250,6 +261,7 @@ RTMPPacket_Alloc(RTMPPacket *p, uint32_t nSize)
     if (!ptr)
         return FALSE;
     p->m_body = ptr + RTMP_MAX_HEADER_SIZE;
+    p->m_nBodyCapacity = nSize;
     p->m_nBytesRead = 0;
     return TRUE;
 }
@@ -262,6 +274,47 @@ RTMPPacket_Free(RTMPPacket *p)
         free(p->m_body - RTMP_MAX_HEADER_SIZE);
         p->m_body = NULL;
     }
+    p->m_nBodyCapacity = 0;
+}
+
+int
+RTMPPacket_Reserve(RTMPPacket *p, uint32_t nSize)
+{
+    uint32_t nCapacity;
+    char *ptr;
+
+    if (p->m_body && p->m_nBodyCapacity >= nSize)
+        return TRUE;
+
+    /* 1/8 headroom, in whole pages */
+    nCapacity = nSize + nSize / 8;
+    if (nCapacity < nSize || nCapacity > UINT32_MAX - 4095)
+        nCapacity = nSize;
+    else
+        nCapacity = (nCapacity + 4095) & ~4095u;
+
+#if ARCH_BITS == 32
+    if (nCapacity > SIZE_MAX - RTMP_MAX_HEADER_SIZE)
+        return FALSE;
+#endif
+
+    RTMPPacket_Free(p);
+    ptr = malloc(nCapacity + RTMP_MAX_HEADER_SIZE);
+    if (!ptr)
+        return FALSE;
+    p->m_body = ptr + RTMP_MAX_HEADER_SIZE;
+    p->m_nBodyCapacity = nCapacity;
+    return TRUE;
+}
+
+/* next size for a channel table that has to hold channel */
+static int
+GrowChannels(int allocated, int channel)
+{
+    int n = allocated ? allocated * 2 : 16;
+    while (n <= channel)
+        n *= 2;
+    return n;
 }
 
 void
@@ -279,6 +332,48 @@ RTMP_LibVersion()
     return RTMP_LIB_VERSION;
 }
 
+#if defined(USE_OPENSSL) && defined(__ANDROID__)
+/* the system store is named by the old subject hash, which OpenSSL no
+ * longer looks up, so the certificates go in one by one. Returns how many
+ * were added. */
+static int
+TLS_LoadCertDir(X509_STORE *store, const char *dirname)
+{
+    struct dirent *ent;
+    DIR *dir = opendir(dirname);
+    int added = 0;
+
+    if (!dir)
+        return 0;
+
+    while ((ent = readdir(dir)) != NULL)
+    {
+        char path[PATH_MAX];
+        X509 *cert;
+        FILE *f;
+
+        if (ent->d_name[0] == '.')
+            continue;
+
+        snprintf(path, sizeof(path), "%s/%s", dirname, ent->d_name);
+        f = fopen(path, "r");
+        if (!f)
+            continue;
+
+        cert = PEM_read_X509(f, NULL, NULL, NULL);
+        fclose(f);
+        if (cert)
+        {
+            if (X509_STORE_add_cert(store, cert))
+                added++;
+            X509_free(cert);
+        }
+    }
+    closedir(dir);
+    return added;
+}
+#endif
+
 void
 RTMP_TLS_LoadCerts() {
 #ifdef USE_MBEDTLS
@@ -351,13 +446,21 @@ error:
     mbedtls_x509_crt_free(chain);
     free(chain);
     RTMP_TLS_ctx->cacert = NULL;
+#elif defined(USE_OPENSSL) && defined(__ANDROID__)
+    /* since Android 14 the roots are updated through the conscrypt APEX
+     * and the copy in /system is no longer kept current */
+    X509_STORE *store = SSL_CTX_get_cert_store(RTMP_TLS_ctx);
+
+    if (!TLS_LoadCertDir(store, "/apex/com.android.conscrypt/cacerts"))
+        TLS_LoadCertDir(store, "/system/etc/security/cacerts");
 #endif /* USE_MBEDTLS */
 }
 
+
 void
 RTMP_TLS_Init()
 {
-#ifdef CRYPTO
+#if defined(CRYPTO) || defined(USE_TLS)
 #if defined(USE_MBEDTLS)
     const char * pers = "RTMP_TLS";
     RTMP_TLS_ctx = calloc(1,sizeof(struct tls_ctx));
@@ -395,7 +498,10 @@ RTMP_TLS_Init()
     OpenSSL_add_all_digests();
     RTMP_TLS_ctx = SSL_CTX_new(SSLv23_method());
     SSL_CTX_set_options(RTMP_TLS_ctx, SSL_OP_ALL);
+    SSL_CTX_set_min_proto_version(RTMP_TLS_ctx, TLS1_2_VERSION);
     SSL_CTX_set_default_verify_paths(RTMP_TLS_ctx);
+    RTMP_TLS_LoadCerts();
+    SSL_CTX_set_verify(RTMP_TLS_ctx, SSL_VERIFY_PEER, NULL);
 #endif
 #else
 #endif
@@ -420,11 +526,24 @@ RTMP_TLS_Free() {
 #endif
 }
 
+int
+RTMP_TLS_LoadCAFile(const char *file)
+{
+#if defined(USE_TLS) && defined(USE_OPENSSL)
+    if (!RTMP_TLS_ctx)
+        RTMP_TLS_Init();
+    return SSL_CTX_load_verify_locations(RTMP_TLS_ctx, file, NULL) == 1;
+#else
+    (void)file;
+    return FALSE;
+#endif
+}
+
 void *
 RTMP_TLS_AllocServerContext(const char* cert, const char* key)
 {
     void *ctx = NULL;
-#ifdef CRYPTO
+#if defined(CRYPTO) || defined(USE_TLS)
     if (!RTMP_TLS_ctx)
         RTMP_TLS_Init();
 #if defined(USE_MBEDTLS)
@@ -493,7 +612,7 @@ RTMP_TLS_AllocServerContext(const char* cert, const char* key)
 void
 RTMP_TLS_FreeServerContext(void *ctx)
 {
-#ifdef CRYPTO
+#if defined(CRYPTO) || defined(USE_TLS)
 #if defined(USE_MBEDTLS)
     mbedtls_x509_crt_free(&((tls_server_ctx*)ctx)->cert);
     mbedtls_pk_free(&((tls_server_ctx*)ctx)->key);
@@ -532,7 +651,7 @@ RTMP_Free(RTMP *r)
 void
 RTMP_Init(RTMP *r)
 {
-#ifdef CRYPTO
+#if defined(CRYPTO) || defined(USE_TLS)
     if (!RTMP_TLS_ctx)
         RTMP_TLS_Init();
 #endif
@@ -552,6 +671,10 @@ RTMP_Init(RTMP *r)
     r->Link.nStreams = 0;
     r->Link.timeout = 30;
     r->Link.swfAge = 30;
+    r->m_tunnel.t_window = RTMPT_WINDOW_BYTES;
+    r->m_tunnel.t_windowMs = RTMPT_WINDOW_MS;
+    r->m_tunnel.t_maxInflight = RTMPT_MAX_INFLIGHT;
+    r->m_tunnel.t_maxPollMs = RTMPT_MAX_POLL_MS;
 }
 
 void
@@ -590,6 +713,12 @@ RTMP_SetBufferMS(RTMP *r, int size)
     r->m_nBufferMS = size;
 }
 
+void
+RTMP_SetTunnelInflight(RTMP *r, int posts)
+{
+    r->m_tunnel.t_maxInflight = posts < 0 ? 0 : posts;
+}
+
 void
 RTMP_UpdateBufferMS(RTMP *r)
 {
@@ -998,10 +1127,44 @@ RTMP_Connect0(RTMP *r, struct sockaddr * service, socklen_t addrlen)
     return TRUE;
 }
 
+#if defined(USE_TLS) && defined(USE_OPENSSL)
+/* With kTLS OpenSSL installs the session keys in the socket (TCP_ULP "tls")
+ * once the handshake is done, and whatever is written to the socket from
+ * then on goes out as TLS records sealed by the kernel. Where the kernel,
+ * the OpenSSL build or the cipher suite can't do it, the session stays in
+ * user space and every write goes through SSL_write. */
+static void
+TLS_RequestKTLS(RTMP *r)
+{
+#ifdef SSL_OP_ENABLE_KTLS
+    if (!(r->Link.lFlags & RTMP_LF_NOKTLS))
+        SSL_set_options(r->m_sb.sb_ssl, SSL_OP_ENABLE_KTLS);
+#else
+    (void)r;
+#endif
+}
+
+static void
+TLS_CheckKTLS(RTMP *r)
+{
+    SSL *ssl = r->m_sb.sb_ssl;
+
+    /* OpenSSL 1.1.1 has neither the option nor the query */
+#if defined(SSL_OP_ENABLE_KTLS) && defined(BIO_get_ktls_send)
+    r->m_sb.sb_ktls = BIO_get_ktls_send(SSL_get_wbio(ssl)) ? TRUE : FALSE;
+#else
+    r->m_sb.sb_ktls = FALSE;
+#endif
+    RTMP_Log(RTMP_LOGINFO, "%s, %s %s, %s", __FUNCTION__,
+             SSL_get_version(ssl), SSL_get_cipher_name(ssl),
+             r->m_sb.sb_ktls ? "kernel TLS" : "user space TLS");
+}
+#endif
+
 int
 RTMP_TLS_Accept(RTMP *r, void *ctx)
 {
-#if defined(CRYPTO) && !defined(NO_SSL)
+#ifdef USE_TLS
     tls_server_ctx *srv_ctx = ctx;
     TLS_server(srv_ctx, r->m_sb.sb_ssl);
 
@@ -1013,13 +1176,19 @@ RTMP_TLS_Accept(RTMP *r, void *ctx)
 #else
     TLS_setfd(r->m_sb.sb_ssl, r->m_sb.sb_socket);
 #endif
+#if defined(USE_OPENSSL)
+    TLS_RequestKTLS(r);
+#endif
 
-    int connect_return = TLS_connect(r->m_sb.sb_ssl);
+    int connect_return = TLS_accept(r->m_sb.sb_ssl);
     if (connect_return < 0)
     {
-        RTMP_Log(RTMP_LOGERROR, "%s, TLS_Connect failed", __FUNCTION__);
+        RTMP_Log(RTMP_LOGERROR, "%s, TLS_Accept failed", __FUNCTION__);
         return FALSE;
     }
+#if defined(USE_OPENSSL)
+    TLS_CheckKTLS(r);
+#endif
     return TRUE;
 #else
     (void)r;
@@ -1033,7 +1202,7 @@ RTMP_Connect1(RTMP *r, RTMPPacket *cp)
 {
     if (r->Link.protocol & RTMP_FEATURE_SSL)
     {
-#if defined(CRYPTO) && !defined(NO_SSL)
+#ifdef USE_TLS
         TLS_client(RTMP_TLS_ctx, r->m_sb.sb_ssl);
 
 #if defined(USE_MBEDTLS)
@@ -1055,6 +1224,24 @@ RTMP_Connect1(RTMP *r, RTMPPacket *cp)
 #else
         TLS_setfd(r->m_sb.sb_ssl, r->m_sb.sb_socket);
 #endif
+#if defined(USE_OPENSSL)
+        {
+            char hostname[256];
+
+            if (r->Link.hostname.av_len >= (int)sizeof(hostname))
+            {
+                RTMP_Close(r);
+                return FALSE;
+            }
+            memcpy(hostname, r->Link.hostname.av_val, r->Link.hostname.av_len);
+            hostname[r->Link.hostname.av_len] = 0;
+
+            /* SNI, and the name the certificate has to match */
+            SSL_set_tlsext_host_name(r->m_sb.sb_ssl, hostname);
+            SSL_set1_host(r->m_sb.sb_ssl, hostname);
+        }
+        TLS_RequestKTLS(r);
+#endif
 
         int connect_return = TLS_connect(r->m_sb.sb_ssl);
         if (connect_return < 0)
@@ -1088,9 +1275,16 @@ RTMP_Connect1(RTMP *r, RTMPPacket *cp)
             // output the error in a format that matches mbedTLS
             connect_return = abs(connect_return);
             RTMP_Log(RTMP_LOGERROR, "%s, TLS_Connect failed: -0x%x", __FUNCTION__, connect_return);
+#if defined(USE_OPENSSL)
+            RTMP_Log(RTMP_LOGERROR, "%s, certificate verification: %s", __FUNCTION__,
+                     X509_verify_cert_error_string(SSL_get_verify_result(r->m_sb.sb_ssl)));
+#endif
             RTMP_Close(r);
             return FALSE;
         }
+#if defined(USE_OPENSSL)
+        TLS_CheckKTLS(r);
+#endif
 #else
         RTMP_Log(RTMP_LOGERROR, "%s, no SSL/TLS support", __FUNCTION__);
         RTMP_Close(r);
@@ -1102,7 +1296,7 @@ RTMP_Connect1(RTMP *r, RTMPPacket *cp)
         r->m_msgCounter = 1;
         r->m_clientID.av_val = NULL;
         r->m_clientID.av_len = 0;
-        HTTP_Post(r, RTMPT_OPEN, "", 1);
+        HTTP_Post(r, RTMPT_OPEN, "", 1, 0);
         if (HTTP_read(r, 1) != 0)
         {
             r->m_msgCounter = 0;
@@ -1256,12 +1450,12 @@ RTMP_ConnectStream(RTMP *r, int seekTime)
                     (packet.m_packetType == RTMP_PACKET_TYPE_INFO))
             {
                 RTMP_Log(RTMP_LOGWARNING, "Received FLV packet before play()! Ignoring.");
-                RTMPPacket_Free(&packet);
+                RTMP_RecyclePacket(r, &packet);
                 continue;
             }
 
             RTMP_ClientPacket(r, &packet);
-            RTMPPacket_Free(&packet);
+            RTMP_RecyclePacket(r, &packet);
         }
     }
 
@@ -1332,7 +1526,7 @@ RTMP_GetNextMediaPacket(RTMP *r, RTMPPacket *packet)
 
         if (!bHasMediaPacket)
         {
-            RTMPPacket_Free(packet);
+            RTMP_RecyclePacket(r, packet);
         }
         else if (r->m_pausing == 3)
         {
@@ -1346,7 +1540,7 @@ RTMP_GetNextMediaPacket(RTMP *r, RTMPPacket *packet)
                          packet->m_nTimeStamp, packet->m_hasAbsTimestamp,
                          r->m_mediaStamp);
 #endif
-                RTMPPacket_Free(packet);
+                RTMP_RecyclePacket(r, packet);
                 continue;
             }
             r->m_pausing = 0;
@@ -1531,8 +1725,8 @@ static int
 ReadN(RTMP *r, char *buffer, int n)
 {
     int nOriginalSize = n;
-    int avail;
-    char *ptr;
+    int avail, early;
+    char *ptr, *src;
 
     r->m_sb.sb_timedout = FALSE;
 
@@ -1544,16 +1738,32 @@ ReadN(RTMP *r, char *buffer, int n)
     while (n > 0)
     {
         int nBytes = 0, nRead;
+        RTMPTunnel *t = &r->m_tunnel;
+
+        early = FALSE;
         if (r->Link.protocol & RTMP_FEATURE_HTTP)
         {
             int refill = 0;
-            while (!r->m_resplen)
+            while (!r->m_resplen && t->t_inOff == t->t_inLen)
             {
                 int ret;
                 if (r->m_sb.sb_size < 13 || refill)
                 {
+                    /* waiting chunks go out instead of an idle poll */
+                    if (t->t_outLen)
+                    {
+                        if (!TunnelFlush(r))
+                        {
+                            RTMP_Close(r);
+                            return 0;
+                        }
+                        continue;
+                    }
                     if (!r->m_unackd)
-                        HTTP_Post(r, RTMPT_IDLE, "", 1);
+                    {
+                        TunnelPollWait(r);
+                        HTTP_Post(r, RTMPT_IDLE, "", 1, 0);
+                    }
                     if (RTMPSockBuf_Fill(&r->m_sb) < 1)
                     {
                         if (!r->m_sb.sb_timedout)
@@ -1576,14 +1786,26 @@ ReadN(RTMP *r, char *buffer, int n)
                     refill = 0;
                 }
             }
-            if (r->m_resplen && !r->m_sb.sb_size)
-                RTMPSockBuf_Fill(&r->m_sb);
-            avail = r->m_sb.sb_size;
-            if (avail > r->m_resplen)
-                avail = r->m_resplen;
+            if (t->t_inOff < t->t_inLen)
+            {
+                /* read ahead while posting, it comes before m_sb */
+                early = TRUE;
+                src = t->t_in + t->t_inOff;
+                avail = t->t_inLen - t->t_inOff;
+            }
+            else
+            {
+                if (r->m_resplen && !r->m_sb.sb_size)
+                    RTMPSockBuf_Fill(&r->m_sb);
+                src = r->m_sb.sb_start;
+                avail = r->m_sb.sb_size;
+                if (avail > r->m_resplen)
+                    avail = r->m_resplen;
+            }
         }
         else
         {
+            src = r->m_sb.sb_start;
             avail = r->m_sb.sb_size;
             if (avail == 0)
             {
@@ -1593,15 +1815,23 @@ ReadN(RTMP *r, char *buffer, int n)
                         RTMP_Close(r);
                     return 0;
                 }
+                src = r->m_sb.sb_start;
                 avail = r->m_sb.sb_size;
             }
         }
         nRead = ((n < avail) ? n : avail);
         if (nRead > 0)
         {
-            memcpy(ptr, r->m_sb.sb_start, nRead);
-            r->m_sb.sb_start += nRead;
-            r->m_sb.sb_size -= nRead;
+            memcpy(ptr, src, nRead);
+            if (early)
+            {
+                t->t_inOff += nRead;
+            }
+            else
+            {
+                r->m_sb.sb_start += nRead;
+                r->m_sb.sb_size -= nRead;
+            }
             nBytes = nRead;
             r->m_nBytesIn += nRead;
             if (r->m_bSendCounter
@@ -1622,7 +1852,7 @@ ReadN(RTMP *r, char *buffer, int n)
             break;
         }
 
-        if (r->Link.protocol & RTMP_FEATURE_HTTP)
+        if ((r->Link.protocol & RTMP_FEATURE_HTTP) && !early)
             r->m_resplen -= nBytes;
 
 #ifdef CRYPTO
@@ -1643,6 +1873,10 @@ static int
 WriteN(RTMP *r, const char *buffer, int n)
 {
     const char *ptr = buffer;
+
+    /* anything queued in a batch has to go out first */
+    if (r->m_batch.b_numMsgs && !r->m_batch.b_writing && !WriteBatch(r))
+        return FALSE;
 #ifdef CRYPTO
     char *encrypted = 0;
     char buf[RTMP_BUFFER_CACHE_SIZE];
@@ -1663,7 +1897,7 @@ WriteN(RTMP *r, const char *buffer, int n)
         int nBytes;
 
         if (r->Link.protocol & RTMP_FEATURE_HTTP)
-            nBytes = HTTP_Post(r, RTMPT_SEND, ptr, n);
+            nBytes = TunnelWrite(r, ptr, n);
         else if(r->m_bCustomSend && r->m_customSendFunc)
             nBytes = r->m_customSendFunc(&r->m_sb, ptr, n, r->m_customSendParam);
         else
@@ -1706,6 +1940,7 @@ WriteN(RTMP *r, const char *buffer, int n)
 SAVC(app);
 SAVC(connect);
 SAVC(flashVer);
+SAVC(fourCcList);
 SAVC(swfUrl);
 SAVC(pageUrl);
 SAVC(tcUrl);
@@ -1720,6 +1955,41 @@ SAVC(secureTokenResponse);
 SAVC(type);
 SAVC(nonprivate);
 
+/* fourCcList as a named strict array of strings */
+static char *
+EncodeFourCcList(char *enc, char *pend, const AVal *list)
+{
+    const char *p = list->av_val, *end = list->av_val + list->av_len;
+    int count = 1;
+
+    for (; p < end; p++)
+        if (*p == ',')
+            count++;
+
+    if (enc + 2 + av_fourCcList.av_len + 5 > pend)
+        return NULL;
+
+    enc = AMF_EncodeInt16(enc, pend, av_fourCcList.av_len);
+    memcpy(enc, av_fourCcList.av_val, av_fourCcList.av_len);
+    enc += av_fourCcList.av_len;
+    *enc++ = AMF_STRICT_ARRAY;
+    enc = AMF_EncodeInt32(enc, pend, count);
+
+    for (p = list->av_val; enc && p <= end; p++)
+    {
+        const char *next = p;
+        AVal item;
+
+        while (next < end && *next != ',')
+            next++;
+        item.av_val = (char *)p;
+        item.av_len = (int)(next - p);
+        enc = AMF_EncodeString(enc, pend, &item);
+        p = next;
+    }
+    return enc;
+}
+
 static int
 SendConnectPacket(RTMP *r, RTMPPacket *cp)
 {
@@ -1812,6 +2082,12 @@ SendConnectPacket(RTMP *r, RTMPPacket *cp)
                 return FALSE;
         }
     }
+    if (r->Link.fourCcList.av_len)
+    {
+        enc = EncodeFourCcList(enc, pend, &r->Link.fourCcList);
+        if (!enc)
+            return FALSE;
+    }
     if (r->m_fEncoding != 0.0 || r->m_bSendEncoding)
     {
         /* AMF0, AMF3 not fully supported yet */
@@ -3157,14 +3433,77 @@ static const AVal av_NetStream_Publish_Start = AVC("NetStream.Publish.Start");
 static const AVal av_NetStream_Publish_Rejected = AVC("NetStream.Publish.Rejected");
 static const AVal av_NetStream_Publish_Denied = AVC("NetStream.Publish.Denied");
 
-/* Returns 0 for OK/Failed/error, 1 for 'Stop or Complete' */
+/* Skips the command object of an invoke and reads the first argument
+ * after it */
+static int
+ReadInvokeArg(AMFReader *reader, AMFObjectProperty *prop)
+{
+    if (AMFReader_Next(reader, prop) != 1 || !AMFReader_Skip(reader, prop))
+        return FALSE;
+    return AMFReader_Next(reader, prop) == 1;
+}
+
+/* code, level and description of the info object that follows the
+ * command object of an onStatus or _error */
+static void
+ReadInvokeStatus(AMFReader *reader, AVal *code, AVal *level, AVal *description)
+{
+    AMFObjectProperty prop;
+    int depth;
+
+    code->av_val = level->av_val = description->av_val = NULL;
+    code->av_len = level->av_len = description->av_len = 0;
+
+    if (!ReadInvokeArg(reader, &prop) ||
+            (prop.p_type != AMF_OBJECT && prop.p_type != AMF_ECMA_ARRAY))
+        return;
+
+    depth = AMFReader_Depth(reader);
+    while (AMFReader_Next(reader, &prop) == 1 && AMFReader_Depth(reader) >= depth)
+    {
+        if (prop.p_type == AMF_STRING)
+        {
+            if (AVMATCH(&prop.p_name, &av_code))
+                *code = prop.p_vu.p_aval;
+            else if (AVMATCH(&prop.p_name, &av_level))
+                *level = prop.p_vu.p_aval;
+            else if (AVMATCH(&prop.p_name, &av_description))
+                *description = prop.p_vu.p_aval;
+        }
+        else if (!AMFReader_Skip(reader, &prop))
+        {
+            break;
+        }
+    }
+}
+
+/* first string property with the given name, at any depth */
+static int
+FindInvokeString(AMFReader *reader, const AVal *name, AVal *val)
+{
+    AMFObjectProperty prop;
+
+    while (AMFReader_Next(reader, &prop) == 1)
+    {
+        if (prop.p_type == AMF_STRING && AVMATCH(&prop.p_name, name))
+        {
+            *val = prop.p_vu.p_aval;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/* Returns 0 for OK/Failed/error, 1 for 'Stop or Complete'. The command is
+ * read in place with an AMFReader, only what is acted on gets decoded. */
 static int
 HandleInvoke(RTMP *r, const char *body, unsigned int nBodySize)
 {
-    AMFObject obj;
+    AMFReader reader;
+    AMFObjectProperty prop;
     AVal method;
-    double txn;
-    int ret = 0, nRes;
+    double txn = 0;
+    int ret = 0;
     if (body[0] != 0x02)		/* make sure it is a string method name we start with */
     {
         RTMP_Log(RTMP_LOGWARNING, "%s, Sanity failed. no string method in invoke packet",
@@ -3172,17 +3511,26 @@ HandleInvoke(RTMP *r, const char *body, unsigned int nBodySize)
         return 0;
     }
 
-    nRes = AMF_Decode(&obj, body, nBodySize, FALSE);
-    if (nRes < 0)
+    AMFReader_Init(&reader, body, nBodySize);
+    if (AMFReader_Next(&reader, &prop) != 1)
     {
         RTMP_Log(RTMP_LOGERROR, "%s, error decoding invoke packet", __FUNCTION__);
         return 0;
     }
+    method = prop.p_vu.p_aval;
 
-    AMF_Dump(&obj);
-    AMFProp_GetString(AMF_GetProp(&obj, NULL, 0), &method);
-    txn = AMFProp_GetNumber(AMF_GetProp(&obj, NULL, 1));
-    RTMP_Log(RTMP_LOGDEBUG, "%s, server invoking <%s>", __FUNCTION__, method.av_val);
+    if (AMFReader_Next(&reader, &prop) == 1)
+        txn = AMFProp_GetNumber(&prop);
+
+    if (RTMP_debuglevel >= RTMP_LOGDEBUG)
+    {
+        AMFObject obj;
+        if (AMF_Decode(&obj, body, nBodySize, FALSE) >= 0)
+            AMF_Dump(&obj);
+        AMF_Reset(&obj);
+    }
+    RTMP_Log(RTMP_LOGDEBUG, "%s, server invoking <%.*s>", __FUNCTION__,
+             method.av_len, method.av_val);
 
     if (AVMATCH(&method, &av__result))
     {
@@ -3212,11 +3560,11 @@ HandleInvoke(RTMP *r, const char *body, unsigned int nBodySize)
         {
             if (r->Link.token.av_len)
             {
-                AMFObjectProperty p;
-                if (RTMP_FindFirstMatchingProperty(&obj, &av_secureToken, &p))
+                AVal token;
+                if (FindInvokeString(&reader, &av_secureToken, &token))
                 {
-                    DecodeTEA(&r->Link.token, &p.p_vu.p_aval);
-                    SendSecureTokenResponse(r, &p.p_vu.p_aval);
+                    DecodeTEA(&r->Link.token, &token);
+                    SendSecureTokenResponse(r, &token);
                 }
             }
             if (r->Link.protocol & RTMP_FEATURE_WRITE)
@@ -3252,7 +3600,9 @@ HandleInvoke(RTMP *r, const char *body, unsigned int nBodySize)
         }
         else if (AVMATCH(&methodInvoked, &av_createStream))
         {
-            int id = (int)AMFProp_GetNumber(AMF_GetProp(&obj, NULL, 3));
+            int id = 0;
+            if (ReadInvokeArg(&reader, &prop))
+                id = (int)AMFProp_GetNumber(&prop);
             r->Link.streams[r->Link.curStreamIdx].id = id;
 
             if (r->Link.protocol & RTMP_FEATURE_WRITE)
@@ -3336,13 +3686,10 @@ HandleInvoke(RTMP *r, const char *body, unsigned int nBodySize)
 
             if (AVMATCH(&methodInvoked, &av_connect))
             {
-                AMFObject obj2;
                 AVal code, level, description;
-                AMFProp_GetObject(AMF_GetProp(&obj, NULL, 3), &obj2);
-                AMFProp_GetString(AMF_GetProp(&obj2, &av_code, -1), &code);
-                AMFProp_GetString(AMF_GetProp(&obj2, &av_level, -1), &level);
-                AMFProp_GetString(AMF_GetProp(&obj2, &av_description, -1), &description);
-                RTMP_Log(RTMP_LOGDEBUG, "%s, error description: %s", __FUNCTION__, description.av_val);
+                ReadInvokeStatus(&reader, &code, &level, &description);
+                RTMP_Log(RTMP_LOGDEBUG, "%s, error description: %.*s", __FUNCTION__,
+                         description.av_len, description.av_val);
                 /* if PublisherAuth returns 1, then reconnect */
                 if (PublisherAuth(r, &description) == 1)
                 {
@@ -3393,14 +3740,11 @@ HandleInvoke(RTMP *r, const char *body, unsigned int nBodySize)
     }
     else if (AVMATCH(&method, &av_onStatus))
     {
-        AMFObject obj2;
         AVal code, level, description;
-        AMFProp_GetObject(AMF_GetProp(&obj, NULL, 3), &obj2);
-        AMFProp_GetString(AMF_GetProp(&obj2, &av_code, -1), &code);
-        AMFProp_GetString(AMF_GetProp(&obj2, &av_level, -1), &level);
-        AMFProp_GetString(AMF_GetProp(&obj2, &av_description, -1), &description);
+        ReadInvokeStatus(&reader, &code, &level, &description);
 
-        RTMP_Log(RTMP_LOGDEBUG, "%s, onStatus: %s", __FUNCTION__, code.av_val);
+        RTMP_Log(RTMP_LOGDEBUG, "%s, onStatus: %.*s", __FUNCTION__,
+                 code.av_len, code.av_val);
         if (AVMATCH(&code, &av_NetStream_Failed)
                 || AVMATCH(&code, &av_NetStream_Play_Failed)
                 || AVMATCH(&code, &av_NetStream_Play_StreamNotFound)
@@ -3412,9 +3756,11 @@ HandleInvoke(RTMP *r, const char *body, unsigned int nBodySize)
             RTMP_Close(r);
 
             if (description.av_len)
-                RTMP_Log(RTMP_LOGERROR, "%s:\n%s (%s)", r->Link.tcUrl.av_val, code.av_val, description.av_val);
+                RTMP_Log(RTMP_LOGERROR, "%s:\n%.*s (%.*s)", r->Link.tcUrl.av_val,
+                         code.av_len, code.av_val, description.av_len, description.av_val);
             else
-                RTMP_Log(RTMP_LOGERROR, "%s:\n%s", r->Link.tcUrl.av_val, code.av_val);
+                RTMP_Log(RTMP_LOGERROR, "%s:\n%.*s", r->Link.tcUrl.av_val,
+                         code.av_len, code.av_val);
         }
 
         else if (AVMATCH(&code, &av_NetStream_Play_Start)
@@ -3486,7 +3832,6 @@ HandleInvoke(RTMP *r, const char *body, unsigned int nBodySize)
 
     }
 leave:
-    AMF_Reset(&obj);
     return ret;
 }
 
@@ -3895,7 +4240,7 @@ RTMP_ReadPacket(RTMP *r, RTMPPacket *packet)
 
     if (packet->m_nChannel >= r->m_channelsAllocatedIn)
     {
-        int n = packet->m_nChannel + 10;
+        int n = GrowChannels(r->m_channelsAllocatedIn, packet->m_nChannel);
         int *timestamp = realloc(r->m_channelTimestamp, sizeof(int) * n);
         RTMPPacket **packets = realloc(r->m_vecChannelsIn, sizeof(RTMPPacket*) * n);
         if (!timestamp)
@@ -3973,14 +4318,39 @@ RTMP_ReadPacket(RTMP *r, RTMPPacket *packet)
 
     RTMP_LogHexString(RTMP_LOGDEBUG2, (uint8_t *)hbuf, hSize);
 
-    if (packet->m_nBodySize > 0 && packet->m_body == NULL)
+    if (packet->m_nBodySize > 0 && packet->m_nBytesRead == 0)
     {
-        if (!RTMPPacket_Alloc(packet, packet->m_nBodySize))
+        RTMPPacket *channel = r->m_vecChannelsIn[packet->m_nChannel];
+
+        /* A new message. Its body is the one the chunk stream kept when
+         * the last message was recycled, unless the caller brought one.
+         * A body not allocated here is never written to. */
+        if (packet->m_body && !packet->m_nBodyCapacity)
+            packet->m_body = NULL;
+
+        if (channel && channel->m_body && channel->m_body != packet->m_body)
+        {
+            if (!packet->m_body)
+            {
+                packet->m_body = channel->m_body;
+                packet->m_nBodyCapacity = channel->m_nBodyCapacity;
+            }
+            else
+            {
+                RTMPPacket_Free(channel);
+            }
+        }
+        if (channel)
+        {
+            channel->m_body = NULL;
+            channel->m_nBodyCapacity = 0;
+        }
+
+        if (!RTMPPacket_Reserve(packet, packet->m_nBodySize))
         {
             RTMP_Log(RTMP_LOGDEBUG, "%s, failed to allocate packet", __FUNCTION__);
             return FALSE;
         }
-        // didAlloc = TRUE;
         packet->m_headerType = (hbuf[0] & 0xc0) >> 6;
     }
 
@@ -4027,17 +4397,105 @@ RTMP_ReadPacket(RTMP *r, RTMPPacket *packet)
         /* reset the data from the stored packet. we keep the header since we may use it later if a new packet for this channel */
         /* arrives and requests to re-use some info (small packet header) */
         r->m_vecChannelsIn[packet->m_nChannel]->m_body = NULL;
+        r->m_vecChannelsIn[packet->m_nChannel]->m_nBodyCapacity = 0;
         r->m_vecChannelsIn[packet->m_nChannel]->m_nBytesRead = 0;
         r->m_vecChannelsIn[packet->m_nChannel]->m_hasAbsTimestamp = FALSE;	/* can only be false if we reuse header */
     }
     else
     {
         packet->m_body = NULL;	/* so it won't be erased on free */
+        packet->m_nBodyCapacity = 0;
     }
 
     return TRUE;
 }
 
+void
+RTMP_RecyclePacket(RTMP *r, RTMPPacket *packet)
+{
+    RTMPPacket *channel = NULL;
+
+    if (packet->m_nChannel >= 0 && packet->m_nChannel < r->m_channelsAllocatedIn)
+        channel = r->m_vecChannelsIn[packet->m_nChannel];
+
+    if (channel && !channel->m_body && channel->m_nBytesRead == 0 &&
+            packet->m_body && packet->m_nBodyCapacity &&
+            packet->m_nBodyCapacity <= RTMP_BODY_KEEP_SIZE)
+    {
+        channel->m_body = packet->m_body;
+        channel->m_nBodyCapacity = packet->m_nBodyCapacity;
+        packet->m_body = NULL;
+        packet->m_nBodyCapacity = 0;
+        return;
+    }
+
+    RTMPPacket_Free(packet);
+}
+
+int
+RTMP_ChunkBuffered(RTMP *r)
+{
+    const uint8_t *p = (const uint8_t *)r->m_sb.sb_start;
+    int avail = r->m_sb.sb_size;
+    int fmt, channel, hSize, nSize, nChunk;
+    const RTMPPacket *prev = NULL;
+    uint32_t bodySize, bytesRead = 0;
+
+    if (avail < 1)
+        return FALSE;
+
+    /* the same walk as RTMP_ReadPacket, without consuming anything */
+    fmt = p[0] >> 6;
+    channel = p[0] & 0x3f;
+    hSize = 1;
+    if (channel == 0)
+    {
+        if (avail < 2)
+            return FALSE;
+        channel = p[1] + 64;
+        hSize = 2;
+    }
+    else if (channel == 1)
+    {
+        if (avail < 3)
+            return FALSE;
+        channel = (p[2] << 8) + p[1] + 64;
+        hSize = 3;
+    }
+
+    nSize = packetSize[fmt] - 1;
+    if (avail < hSize + nSize)
+        return FALSE;
+
+    if (channel < r->m_channelsAllocatedIn)
+        prev = r->m_vecChannelsIn[channel];
+
+    if (fmt != RTMP_PACKET_SIZE_LARGE && !prev)
+        return -1;
+
+    if (fmt == RTMP_PACKET_SIZE_MINIMUM)
+    {
+        bodySize = prev->m_nBodySize;
+        bytesRead = prev->m_nBytesRead;
+    }
+    else
+    {
+        if (prev && prev->m_nBytesRead)
+            return -1;
+        if (fmt == RTMP_PACKET_SIZE_SMALL)
+            bodySize = prev->m_nBodySize;
+        else
+            bodySize = AMF_DecodeInt24((const char *)p + hSize + 3);
+        if (AMF_DecodeInt24((const char *)p + hSize) == 0xffffff)
+            nSize += 4;
+    }
+
+    nChunk = bodySize - bytesRead;
+    if (nChunk > r->m_inChunkSize)
+        nChunk = r->m_inChunkSize;
+    return avail >= hSize + nSize + nChunk;
+}
+
 #ifndef CRYPTO
 static int
 HandShake(RTMP *r, int FP9HandShake)
@@ -4194,22 +4652,12 @@ RTMP_SendChunk(RTMP *r, RTMPChunk *chunk)
     return wrote;
 }
 
-int
-RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
+static int
+EnsureChannelsOut(RTMP *r, int channel)
 {
-    const RTMPPacket *prevPacket;
-    uint32_t last = 0;
-    int nSize;
-    int hSize, cSize;
-    char *header, *hptr, *hend, hbuf[RTMP_MAX_HEADER_SIZE], c;
-    uint32_t t;
-    char *buffer, *tbuf = NULL, *toff = NULL;
-    int nChunkSize;
-    int tlen;
-
-    if (packet->m_nChannel >= r->m_channelsAllocatedOut)
+    if (channel >= r->m_channelsAllocatedOut)
     {
-        int n = packet->m_nChannel + 10;
+        int n = GrowChannels(r->m_channelsAllocatedOut, channel);
         RTMPPacket **packets = realloc(r->m_vecChannelsOut, sizeof(RTMPPacket*) * n);
         if (!packets)
         {
@@ -4222,6 +4670,20 @@ RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
         memset(r->m_vecChannelsOut + r->m_channelsAllocatedOut, 0, sizeof(RTMPPacket*) * (n - r->m_channelsAllocatedOut));
         r->m_channelsAllocatedOut = n;
     }
+    return TRUE;
+}
+
+/* Encodes the header of the first chunk of packet into hbuf, compressed
+ * against the previous packet on the same chunk stream. Returns the header
+ * length, or -1 on failure; *pcSize gets the extra basic header bytes. */
+static int
+EncodePacketHeader(RTMP *r, RTMPPacket *packet, char *hbuf, int *pcSize)
+{
+    const RTMPPacket *prevPacket;
+    uint32_t last = 0;
+    int nSize, hSize, cSize;
+    char *hptr, *hend = hbuf + RTMP_MAX_HEADER_SIZE, c;
+    uint32_t t;
 
     prevPacket = r->m_vecChannelsOut[packet->m_nChannel];
     if (prevPacket && packet->m_headerType != RTMP_PACKET_SIZE_LARGE)
@@ -4242,7 +4704,7 @@ RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
     {
         RTMP_Log(RTMP_LOGERROR, "sanity failed!! trying to send header of type: 0x%02x.",
                  (unsigned char)packet->m_headerType);
-        return FALSE;
+        return -1;
     }
 
     nSize = packetSize[packet->m_headerType];
@@ -4250,34 +4712,16 @@ RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
     cSize = 0;
     t = packet->m_nTimeStamp - last;
 
-    if (packet->m_body)
-    {
-        header = packet->m_body - nSize;
-        hend = packet->m_body;
-    }
-    else
-    {
-        header = hbuf + 6;
-        hend = hbuf + sizeof(hbuf);
-    }
-
     if (packet->m_nChannel > 319)
         cSize = 2;
     else if (packet->m_nChannel > 63)
         cSize = 1;
-    if (cSize)
-    {
-        header -= cSize;
-        hSize += cSize;
-    }
+    hSize += cSize;
 
     if (nSize > 1 && t >= 0xffffff)
-    {
-        header -= 4;
         hSize += 4;
-    }
 
-    hptr = header;
+    hptr = hbuf;
     c = packet->m_headerType << 6;
     switch (cSize)
     {
@@ -4316,25 +4760,47 @@ RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
     if (nSize > 1 && t >= 0xffffff)
         hptr = AMF_EncodeInt32(hptr, hend, t);
 
-    nSize = packet->m_nBodySize;
-    buffer = packet->m_body;
-    nChunkSize = r->m_outChunkSize;
+    *pcSize = cSize;
+    return hSize;
+}
 
-    RTMP_Log(RTMP_LOGDEBUG2, "%s: fd=%d, size=%d", __FUNCTION__, (int)r->m_sb.sb_socket,
-             nSize);
-    /* send all chunks in one HTTP request */
-    if (r->Link.protocol & RTMP_FEATURE_HTTP)
-    {
-        int chunks = (nSize+nChunkSize-1) / nChunkSize;
-        if (chunks > 1)
-        {
-            tlen = chunks * (cSize + 1) + nSize + hSize;
-            tbuf = malloc(tlen);
-            if (!tbuf)
-                return FALSE;
-            toff = tbuf;
-        }
+int
+RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
+{
+    int nSize;
+    int hSize, cSize;
+    char *header, hbuf[RTMP_MAX_HEADER_SIZE], c;
+    char *buffer;
+    int nChunkSize;
+    int http = r->Link.protocol & RTMP_FEATURE_HTTP;
+
+    if (!EnsureChannelsOut(r, packet->m_nChannel))
+        return FALSE;
+
+    hSize = EncodePacketHeader(r, packet, hbuf, &cSize);
+    if (hSize < 0)
+        return FALSE;
+    c = hbuf[0];
+
+    if (packet->m_body)
+    {
+        header = packet->m_body - hSize;
+        memcpy(header, hbuf, hSize);
+    }
+    else
+    {
+        header = hbuf;
     }
+
+    nSize = packet->m_nBodySize;
+    buffer = packet->m_body;
+    nChunkSize = r->m_outChunkSize;
+
+    RTMP_Log(RTMP_LOGDEBUG2, "%s: fd=%d, size=%d", __FUNCTION__, (int)r->m_sb.sb_socket,
+             nSize);
+    /* send all chunks in one HTTP request */
+    if (http)
+        r->m_tunnel.t_hold++;
     while (nSize + hSize)
     {
         int wrote;
@@ -4344,16 +4810,12 @@ RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
 
         RTMP_LogHexString(RTMP_LOGDEBUG2, (uint8_t *)header, hSize);
         RTMP_LogHexString(RTMP_LOGDEBUG2, (uint8_t *)buffer, nChunkSize);
-        if (tbuf)
-        {
-            memcpy(toff, header, nChunkSize + hSize);
-            toff += nChunkSize + hSize;
-        }
-        else
+        wrote = WriteN(r, header, nChunkSize + hSize);
+        if (!wrote)
         {
-            wrote = WriteN(r, header, nChunkSize + hSize);
-            if (!wrote)
-                return FALSE;
+            if (http)
+                TunnelRelease(r);
+            return FALSE;
         }
         nSize -= nChunkSize;
         buffer += nChunkSize;
@@ -4378,14 +4840,8 @@ RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
             }
         }
     }
-    if (tbuf)
-    {
-        int wrote = WriteN(r, tbuf, toff-tbuf);
-        free(tbuf);
-        tbuf = NULL;
-        if (!wrote)
-            return FALSE;
-    }
+    if (http && !TunnelRelease(r))
+        return FALSE;
 
     /* we invoked a remote method */
     if (packet->m_packetType == RTMP_PACKET_TYPE_INVOKE)
@@ -4411,6 +4867,463 @@ RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
     return TRUE;
 }
 
+static int
+CanWriteV(RTMP *r)
+{
+    if (r->Link.protocol & RTMP_FEATURE_HTTP)
+        return FALSE;
+    if (r->m_bCustomSend && r->m_customSendFunc)
+        return FALSE;
+#ifdef CRYPTO
+    if (r->Link.rc4keyOut)
+        return FALSE;
+#endif
+    /* with kTLS the kernel seals what sendmsg gathers */
+    if (r->m_sb.sb_ssl && !r->m_sb.sb_ktls)
+        return FALSE;
+    return TRUE;
+}
+
+/* grows the flatten buffer like a packet body, see RTMPPacket_Reserve */
+static int
+ReserveFlat(RTMPBatch *b, uint32_t nSize)
+{
+    uint32_t nCapacity;
+
+    if (b->b_flat && b->b_flatCapacity >= nSize)
+        return TRUE;
+
+    nCapacity = nSize + nSize / 8;
+    if (nCapacity < nSize || nCapacity > UINT32_MAX - 4095)
+        nCapacity = nSize;
+    else
+        nCapacity = (nCapacity + 4095) & ~4095u;
+
+    free(b->b_flat);
+    b->b_flatCapacity = 0;
+    b->b_flat = malloc(nCapacity);
+    if (!b->b_flat)
+        return FALSE;
+    b->b_flatCapacity = nCapacity;
+    return TRUE;
+}
+
+static void
+FreeFlat(RTMPBatch *b)
+{
+    free(b->b_flat);
+    b->b_flat = NULL;
+    b->b_flatCapacity = 0;
+}
+
+static int
+WriteV(RTMP *r, struct iovec *iov, int count, int n)
+{
+    RTMPBatch *b = &r->m_batch;
+    char *ptr;
+    int i, ret;
+
+    if (r->Link.protocol & RTMP_FEATURE_HTTP)
+    {
+        /* the tunnel gathers the pieces into its post by itself */
+        r->m_tunnel.t_hold++;
+        for (i = 0, ret = TRUE; i < count && ret; i++)
+            ret = WriteN(r, iov[i].iov_base, iov[i].iov_len);
+        return TunnelRelease(r) && ret;
+    }
+
+    if (!CanWriteV(r))
+    {
+        /* transports that wrap every write get the batch in one piece,
+         * gathered into a buffer that is kept for the next batch */
+        if (!ReserveFlat(b, (uint32_t)n))
+            return FALSE;
+        for (i = 0, ptr = b->b_flat; i < count; i++)
+        {
+            memcpy(ptr, iov[i].iov_base, iov[i].iov_len);
+            ptr += iov[i].iov_len;
+        }
+        ret = WriteN(r, b->b_flat, n);
+        if (b->b_flatCapacity > RTMP_BODY_KEEP_SIZE)
+            FreeFlat(b);
+        return ret;
+    }
+
+#if defined(RTMP_NETSTACK_DUMP)
+    for (i = 0; i < count; i++)
+        fwrite(iov[i].iov_base, 1, iov[i].iov_len, netstackdump);
+#endif
+
+    while (count > 0)
+    {
+        struct msghdr msg;
+        ssize_t nBytes;
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+#ifdef MSG_NOSIGNAL
+        /* as in RTMPSockBuf_Send, a reset peer is an error, not SIGPIPE */
+        nBytes = sendmsg(r->m_sb.sb_socket, &msg, MSG_NOSIGNAL);
+#else
+        nBytes = sendmsg(r->m_sb.sb_socket, &msg, 0);
+#endif
+
+        if (nBytes < 0)
+        {
+            int sockerr = GetSockError();
+            RTMP_Log(RTMP_LOGERROR, "%s, RTMP send error %d (%d bytes)", __FUNCTION__,
+                     sockerr, n);
+
+            if (sockerr == EINTR && !RTMP_ctrlC)
+                continue;
+
+            r->last_error_code = sockerr;
+
+            RTMP_Close(r);
+            return FALSE;
+        }
+
+        if (nBytes == 0)
+            break;
+
+        n -= (int)nBytes;
+
+        /* skip what the kernel took, resume inside a partial entry */
+        while (count > 0 && (size_t)nBytes >= iov->iov_len)
+        {
+            nBytes -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + nBytes;
+            iov->iov_len -= nBytes;
+        }
+    }
+
+    return n == 0;
+}
+
+/* keeps a written body for RTMP_Write to fill again */
+static void
+PoolBatchBody(RTMPBatch *b, char *body, uint32_t capacity)
+{
+    if (!body)
+        return;
+
+    if (b->b_numPool < RTMP_BATCH_POOL_SIZE && capacity &&
+            capacity <= RTMP_BODY_KEEP_SIZE)
+    {
+        b->b_pool[b->b_numPool].bb_body = body;
+        b->b_pool[b->b_numPool].bb_capacity = capacity;
+        b->b_numPool++;
+        return;
+    }
+
+    free(body - RTMP_MAX_HEADER_SIZE);
+}
+
+static void
+FreeBatchPool(RTMPBatch *b)
+{
+    int i;
+
+    for (i = 0; i < b->b_numPool; i++)
+        free(b->b_pool[i].bb_body - RTMP_MAX_HEADER_SIZE);
+    b->b_numPool = 0;
+    FreeFlat(b);
+}
+
+/* Gives pkt a body of at least nSize bytes: its own if that fits, else
+ * the smallest pooled one that fits, else the largest pooled one grown.
+ * Whatever pkt held before goes back to the pool. */
+static int
+ReserveWriteBody(RTMP *r, RTMPPacket *pkt, uint32_t nSize)
+{
+    RTMPBatch *b = &r->m_batch;
+    int i, best = -1;
+
+    if (pkt->m_body && pkt->m_nBodyCapacity >= nSize)
+        return TRUE;
+
+    for (i = 0; i < b->b_numPool; i++)
+    {
+        uint32_t capacity = b->b_pool[i].bb_capacity;
+
+        if (best < 0)
+            best = i;
+        else if (capacity >= nSize)
+        {
+            if (b->b_pool[best].bb_capacity < nSize ||
+                    capacity < b->b_pool[best].bb_capacity)
+                best = i;
+        }
+        else if (b->b_pool[best].bb_capacity < nSize &&
+                 capacity > b->b_pool[best].bb_capacity)
+        {
+            best = i;
+        }
+    }
+
+    if (best >= 0)
+    {
+        RTMPBatchBody taken = b->b_pool[best];
+
+        if (pkt->m_body && pkt->m_nBodyCapacity)
+        {
+            b->b_pool[best].bb_body = pkt->m_body;
+            b->b_pool[best].bb_capacity = pkt->m_nBodyCapacity;
+        }
+        else
+        {
+            b->b_pool[best] = b->b_pool[--b->b_numPool];
+        }
+
+        pkt->m_body = taken.bb_body;
+        pkt->m_nBodyCapacity = taken.bb_capacity;
+    }
+
+    return RTMPPacket_Reserve(pkt, nSize);
+}
+
+static void
+DiscardBatch(RTMP *r)
+{
+    RTMPBatch *b = &r->m_batch;
+    int i;
+
+    for (i = 0; i < b->b_numMsgs; i++)
+        PoolBatchBody(b, b->b_msgs[i].bm_body, b->b_msgs[i].bm_capacity);
+
+    b->b_numMsgs = 0;
+    b->b_pending = 0;
+}
+
+static RTMPBatchMsg *
+NextBatchMsg(RTMPBatch *b)
+{
+    RTMPBatchMsg *next = NULL;
+    int i;
+
+    /* audio first, otherwise the oldest message keeps its order */
+    for (i = 0; i < b->b_numMsgs; i++)
+    {
+        RTMPBatchMsg *m = &b->b_msgs[i];
+        if (m->bm_started && m->bm_offset == m->bm_bodySize)
+            continue;
+        if (m->bm_priority)
+            return m;
+        if (!next)
+            next = m;
+    }
+    return next;
+}
+
+/* Cuts chunks off the queued messages into b_iov until about maxBytes
+ * (0 for no limit) or the scratch space is used up. */
+static int
+BuildBatchIov(RTMP *r, int maxBytes, int *pSize)
+{
+    RTMPBatch *b = &r->m_batch;
+    int count = 0, hdrLen = 0, size = 0;
+    RTMPBatchMsg *m;
+
+    while (count + 2 <= RTMP_BATCH_MAX_IOV && hdrLen + 3 <= RTMP_BATCH_HDR_SIZE)
+    {
+        int nChunk;
+        char *hdr;
+
+        if (maxBytes > 0 && size >= maxBytes)
+            break;
+        if (!(m = NextBatchMsg(b)))
+            break;
+
+        nChunk = m->bm_bodySize - m->bm_offset;
+        if (nChunk > r->m_outChunkSize)
+            nChunk = r->m_outChunkSize;
+
+        if (!m->bm_started)
+        {
+            b->b_iov[count].iov_base = m->bm_header;
+            b->b_iov[count].iov_len = m->bm_headerSize;
+            m->bm_started = TRUE;
+        }
+        else
+        {
+            hdr = b->b_hdr + hdrLen;
+            hdr[0] = (0xc0 | m->bm_header[0]);
+            if (m->bm_cSize)
+            {
+                int tmp = m->bm_channel - 64;
+                hdr[1] = tmp & 0xff;
+                if (m->bm_cSize == 2)
+                    hdr[2] = tmp >> 8;
+            }
+            b->b_iov[count].iov_base = hdr;
+            b->b_iov[count].iov_len = 1 + m->bm_cSize;
+            hdrLen += 1 + m->bm_cSize;
+        }
+        size += b->b_iov[count].iov_len;
+        count++;
+
+        if (nChunk)
+        {
+            b->b_iov[count].iov_base = m->bm_body + m->bm_offset;
+            b->b_iov[count].iov_len = nChunk;
+            m->bm_offset += nChunk;
+            size += nChunk;
+            count++;
+        }
+    }
+
+    *pSize = size;
+    return count;
+}
+
+static void
+ReleaseWrittenMsgs(RTMPBatch *b)
+{
+    int i, n = 0;
+
+    for (i = 0; i < b->b_numMsgs; i++)
+    {
+        RTMPBatchMsg *m = &b->b_msgs[i];
+        if (m->bm_started && m->bm_offset == m->bm_bodySize)
+        {
+            PoolBatchBody(b, m->bm_body, m->bm_capacity);
+            continue;
+        }
+        if (n != i)
+            b->b_msgs[n] = *m;
+        n++;
+    }
+    b->b_numMsgs = n;
+}
+
+static int
+WriteBatchSlice(RTMP *r, int maxBytes)
+{
+    RTMPBatch *b = &r->m_batch;
+    int written = 0, ret = TRUE;
+
+    b->b_writing = TRUE;
+    while (b->b_numMsgs)
+    {
+        int size, count;
+
+        if (maxBytes > 0 && written >= maxBytes)
+            break;
+
+        count = BuildBatchIov(r, maxBytes > 0 ? maxBytes - written : 0, &size);
+        if (!count)
+            break;
+
+        ret = WriteV(r, b->b_iov, count, size);
+        if (!ret)
+            break;
+
+        written += size;
+        b->b_pending -= size;
+        ReleaseWrittenMsgs(b);
+    }
+    b->b_writing = FALSE;
+
+    if (!ret)
+        DiscardBatch(r);
+    return ret;
+}
+
+static int
+WriteBatch(RTMP *r)
+{
+    return WriteBatchSlice(r, 0);
+}
+
+#define RTMP_CHANNEL_AUDIO	0x04	/* source channel */
+#define RTMP_CHANNEL_DATA	0x05
+#define RTMP_CHANNEL_VIDEO	0x06
+
+/* Queues packet into the open batch and takes ownership of its body, which
+ * is released once the message has been written. */
+static int
+QueuePacket(RTMP *r, RTMPPacket *packet)
+{
+    RTMPBatch *b = &r->m_batch;
+    RTMPBatchMsg *m;
+    int chunks;
+
+    if (!EnsureChannelsOut(r, packet->m_nChannel))
+        return FALSE;
+
+    if (b->b_numMsgs == RTMP_BATCH_MAX_MSGS && !WriteBatch(r))
+        return FALSE;
+
+    m = &b->b_msgs[b->b_numMsgs];
+    m->bm_headerSize = EncodePacketHeader(r, packet, m->bm_header, &m->bm_cSize);
+    if (m->bm_headerSize < 0)
+        return FALSE;
+
+    m->bm_body = packet->m_body;
+    m->bm_capacity = packet->m_nBodyCapacity;
+    m->bm_bodySize = packet->m_nBodySize;
+    m->bm_offset = 0;
+    m->bm_started = FALSE;
+    m->bm_channel = packet->m_nChannel;
+    /* aggregates of audio tags ride the audio chunk stream */
+    m->bm_priority = packet->m_packetType == RTMP_PACKET_TYPE_AUDIO ||
+        (packet->m_packetType == RTMP_PACKET_TYPE_FLASH_VIDEO &&
+         packet->m_nChannel == RTMP_CHANNEL_AUDIO);
+    b->b_numMsgs++;
+
+    chunks = (m->bm_bodySize + r->m_outChunkSize - 1) / r->m_outChunkSize;
+    b->b_pending += m->bm_headerSize + m->bm_bodySize;
+    if (chunks > 1)
+        b->b_pending += (chunks - 1) * (1 + m->bm_cSize);
+
+    if (!r->m_vecChannelsOut[packet->m_nChannel])
+        r->m_vecChannelsOut[packet->m_nChannel] = malloc(sizeof(RTMPPacket));
+    memcpy(r->m_vecChannelsOut[packet->m_nChannel], packet, sizeof(RTMPPacket));
+
+    packet->m_body = NULL;
+    packet->m_nBodyCapacity = 0;
+    return TRUE;
+}
+
+void
+RTMP_BeginBatch(RTMP *r)
+{
+    r->m_batch.b_active = TRUE;
+}
+
+int
+RTMP_FlushBatch(RTMP *r)
+{
+    r->m_batch.b_active = FALSE;
+    if (!WriteBatch(r))
+        return FALSE;
+    if ((r->Link.protocol & RTMP_FEATURE_HTTP) && !TunnelFlush(r))
+    {
+        RTMP_Log(RTMP_LOGERROR, "%s, RTMPT post failed", __FUNCTION__);
+        RTMP_Close(r);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+int
+RTMP_WriteBatchSlice(RTMP *r, int maxBytes)
+{
+    return WriteBatchSlice(r, maxBytes);
+}
+
+int
+RTMP_BatchPending(RTMP *r)
+{
+    return r->m_batch.b_pending;
+}
+
 int
 RTMP_Serve(RTMP *r)
 {
@@ -4437,7 +5350,8 @@ RTMP_Close(RTMP *r)
         }
         if (r->m_clientID.av_val)
         {
-            HTTP_Post(r, RTMPT_CLOSE, "", 1);
+            TunnelPost(r);
+            HTTP_Post(r, RTMPT_CLOSE, "", 1, 0);
             free(r->m_clientID.av_val);
             r->m_clientID.av_val = NULL;
             r->m_clientID.av_len = 0;
@@ -4468,6 +5382,9 @@ RTMP_Close(RTMP *r)
 
     r->m_write.m_nBytesRead = 0;
     RTMPPacket_Free(&r->m_write);
+    DiscardBatch(r);
+    FreeBatchPool(&r->m_batch);
+    r->m_batch.b_active = FALSE;
 
     for (i = 0; i < r->m_channelsAllocatedIn; i++)
     {
@@ -4506,6 +5423,7 @@ RTMP_Close(RTMP *r)
     r->m_msgCounter = 0;
     r->m_resplen = 0;
     r->m_unackd = 0;
+    TunnelFree(&r->m_tunnel);
 
     if (r->Link.lFlags & RTMP_LF_FTCU)
     {
@@ -4580,7 +5498,7 @@ RTMPSockBuf_Fill(RTMPSockBuf *sb)
     while (1)
     {
         nBytes = (int)sizeof(sb->sb_buf) - 1 - sb->sb_size - (sb->sb_start - sb->sb_buf);
-#if defined(CRYPTO) && !defined(NO_SSL)
+#ifdef USE_TLS
         if (sb->sb_ssl)
         {
             nBytes = TLS_read(sb->sb_ssl, sb->sb_start + sb->sb_size, nBytes);
@@ -4633,15 +5551,20 @@ RTMPSockBuf_Send(RTMPSockBuf *sb, const char *buf, int len)
     fwrite(buf, 1, len, netstackdump);
 #endif
 
-#if defined(CRYPTO) && !defined(NO_SSL)
-    if (sb->sb_ssl)
+#ifdef USE_TLS
+    if (sb->sb_ssl && !sb->sb_ktls)
     {
         rc = TLS_write(sb->sb_ssl, buf, len);
     }
     else
 #endif
     {
+#ifdef MSG_NOSIGNAL
+        /* a peer gone away is an error here, not a signal */
+        rc = send(sb->sb_socket, buf, len, MSG_NOSIGNAL);
+#else
         rc = send(sb->sb_socket, buf, len, 0);
+#endif
     }
     return rc;
 }
@@ -4649,7 +5572,7 @@ RTMPSockBuf_Send(RTMPSockBuf *sb, const char *buf, int len)
 int
 RTMPSockBuf_Close(RTMPSockBuf *sb)
 {
-#if defined(CRYPTO) && !defined(NO_SSL)
+#ifdef USE_TLS
     if (sb->sb_ssl)
     {
         TLS_shutdown(sb->sb_ssl);
@@ -4657,6 +5580,7 @@ RTMPSockBuf_Close(RTMPSockBuf *sb)
         sb->sb_ssl = NULL;
     }
 #endif
+    sb->sb_ktls = FALSE;
     if (sb->sb_socket != INVALID_SOCKET)
         return closesocket(sb->sb_socket);
     return 0;
@@ -4735,9 +5659,35 @@ DecodeTEA(AVal *key, AVal *text)
 }
 
 static int
-HTTP_Post(RTMP *r, RTMPTCmd cmd, const char *buf, int len)
+SendAll(RTMPSockBuf *sb, const char *buf, int len)
+{
+    int n = len;
+
+    while (n > 0)
+    {
+        int nBytes = RTMPSockBuf_Send(sb, buf, n);
+        if (nBytes < 0)
+        {
+            if (GetSockError() == EINTR && !RTMP_ctrlC)
+                continue;
+            return -1;
+        }
+        if (nBytes == 0)
+            return -1;
+        buf += nBytes;
+        n -= nBytes;
+    }
+    return len;
+}
+
+/* room is how many bytes in front of buf may be overwritten. The request
+ * goes out in one send when the headers fit there or the body is small,
+ * so a Nagle socket doesn't hold the body back for an ACK of the headers.
+ * Returns len, or -1 on error. */
+static int
+HTTP_Post(RTMP *r, RTMPTCmd cmd, char *buf, int len, int room)
 {
-    char hbuf[512];
+    char hbuf[RTMPT_HDR_ROOM];
     int hlen = snprintf(hbuf, sizeof(hbuf), "POST /%s%s/%d HTTP/1.1\r\n"
                         "Host: %.*s:%d\r\n"
                         "Accept: */*\r\n"
@@ -4749,11 +5699,29 @@ HTTP_Post(RTMP *r, RTMPTCmd cmd, const char *buf, int len)
                         r->m_clientID.av_val ? r->m_clientID.av_val : "",
                         r->m_msgCounter, r->Link.hostname.av_len, r->Link.hostname.av_val,
                         r->Link.port, len);
-    RTMPSockBuf_Send(&r->m_sb, hbuf, hlen);
-    hlen = RTMPSockBuf_Send(&r->m_sb, buf, len);
+    int ret;
+
+    if (hlen < 0 || hlen >= (int)sizeof(hbuf))
+        return -1;
+    if (hlen <= room)
+    {
+        memcpy(buf - hlen, hbuf, hlen);
+        ret = SendAll(&r->m_sb, buf - hlen, hlen + len);
+    }
+    else if (len <= (int)sizeof(hbuf) - hlen)
+    {
+        memcpy(hbuf + hlen, buf, len);
+        ret = SendAll(&r->m_sb, hbuf, hlen + len);
+    }
+    else
+    {
+        ret = SendAll(&r->m_sb, hbuf, hlen);
+        if (ret >= 0)
+            ret = SendAll(&r->m_sb, buf, len);
+    }
     r->m_msgCounter++;
     r->m_unackd++;
-    return hlen;
+    return ret < 0 ? -1 : len;
 }
 
 static int
@@ -4817,14 +5785,228 @@ restart:
     }
     else
     {
-        r->m_polling = *ptr++;
+        r->m_polling = (unsigned char)*ptr++;
         r->m_resplen = hlen - 1;
         r->m_sb.sb_start++;
         r->m_sb.sb_size--;
+        r->m_tunnel.t_replyTime = RTMP_GetTime();
+        r->m_tunnel.t_replyEmpty = r->m_resplen <= 0;
     }
     return 0;
 }
 
+static int
+TunnelReserve(char **buf, int *size, int need, int room)
+{
+    char *p;
+    int n;
+
+    if (need + room <= *size)
+        return TRUE;
+    n = *size ? *size : 4096 + room;
+    while (n < need + room)
+        n *= 2;
+    p = realloc(*buf, n);
+    if (!p)
+        return FALSE;
+    *buf = p;
+    *size = n;
+    return TRUE;
+}
+
+static int
+TunnelDue(RTMPTunnel *t)
+{
+    return t->t_outLen >= t->t_window
+           || (int)(RTMP_GetTime() - t->t_outTime) >= t->t_windowMs;
+}
+
+/* queues len bytes for the next /send, posting once the window is full
+ * unless a message is still being written */
+static int
+TunnelWrite(RTMP *r, const char *buf, int len)
+{
+    RTMPTunnel *t = &r->m_tunnel;
+
+    if (!TunnelReserve(&t->t_out, &t->t_outSize, t->t_outLen + len,
+                       RTMPT_HDR_ROOM))
+        return -1;
+    if (!t->t_outLen)
+        t->t_outTime = RTMP_GetTime();
+    memcpy(t->t_out + RTMPT_HDR_ROOM + t->t_outLen, buf, len);
+    t->t_outLen += len;
+
+    if (!t->t_hold && TunnelDue(t) && !TunnelFlush(r))
+        return -1;
+    return len;
+}
+
+static int
+TunnelRelease(RTMP *r)
+{
+    RTMPTunnel *t = &r->m_tunnel;
+
+    if (t->t_hold > 0)
+        t->t_hold--;
+    if (!t->t_hold && t->t_outLen && TunnelDue(t))
+        return TunnelFlush(r);
+    return TRUE;
+}
+
+static int
+TunnelPost(RTMP *r)
+{
+    RTMPTunnel *t = &r->m_tunnel;
+    int len = t->t_outLen;
+
+    if (!len)
+        return TRUE;
+    t->t_outLen = 0;
+    return HTTP_Post(r, RTMPT_SEND, t->t_out + RTMPT_HDR_ROOM, len,
+                     RTMPT_HDR_ROOM) == len;
+}
+
+/* posts what is waiting, first reading responses if t_maxInflight posts
+ * are already unanswered */
+static int
+TunnelFlush(RTMP *r)
+{
+    RTMPTunnel *t = &r->m_tunnel;
+
+    if (!t->t_outLen)
+        return TRUE;
+    if (t->t_maxInflight > 0 && r->m_unackd >= t->t_maxInflight
+            && !TunnelCollect(r, TRUE, t->t_maxInflight - 1))
+        return FALSE;
+    return TunnelPost(r);
+}
+
+static int
+TunnelReadable(RTMP *r)
+{
+    struct timeval tv = { 0, 0 };
+    fd_set fds;
+
+    /* records already decrypted by TLS don't show here, they are picked
+     * up on the next call or by ReadN */
+    FD_ZERO(&fds);
+    FD_SET(r->m_sb.sb_socket, &fds);
+    return select(r->m_sb.sb_socket + 1, &fds, NULL, NULL, &tv) > 0;
+}
+
+/* reads responses until at most until posts are unanswered, or while
+ * something is readable when until is negative. Payloads are moved to
+ * t_in in order, or dropped without keep. */
+static int
+TunnelCollect(RTMP *r, int keep, int until)
+{
+    RTMPTunnel *t = &r->m_tunnel;
+
+    for (;;)
+    {
+        if (r->m_resplen && r->m_sb.sb_size)
+        {
+            int len = r->m_sb.sb_size < r->m_resplen ? r->m_sb.sb_size : r->m_resplen;
+
+            if (keep)
+            {
+                if (t->t_inOff == t->t_inLen)
+                    t->t_inOff = t->t_inLen = 0;
+                if (t->t_inOff && t->t_inLen + len > t->t_inSize)
+                {
+                    memmove(t->t_in, t->t_in + t->t_inOff, t->t_inLen - t->t_inOff);
+                    t->t_inLen -= t->t_inOff;
+                    t->t_inOff = 0;
+                }
+                if (!TunnelReserve(&t->t_in, &t->t_inSize, t->t_inLen + len, 0))
+                    return FALSE;
+                memcpy(t->t_in + t->t_inLen, r->m_sb.sb_start, len);
+                t->t_inLen += len;
+            }
+            r->m_sb.sb_start += len;
+            r->m_sb.sb_size -= len;
+            r->m_resplen -= len;
+            continue;
+        }
+        if (!r->m_resplen)
+        {
+            if (until >= 0 && r->m_unackd <= until)
+                return TRUE;
+            if (r->m_unackd && r->m_sb.sb_size >= 13)
+            {
+                int ret = HTTP_read(r, 0);
+                if (ret == -1)
+                {
+                    RTMP_Log(RTMP_LOGDEBUG, "%s, No valid HTTP response found", __FUNCTION__);
+                    return FALSE;
+                }
+                if (ret == 0)
+                    continue;
+            }
+            else if (!r->m_unackd)
+            {
+                return TRUE;
+            }
+        }
+        else if (until >= 0 && r->m_unackd <= until)
+        {
+            /* the rest of this payload is read by ReadN */
+            return TRUE;
+        }
+        if (until < 0 && !TunnelReadable(r))
+            return TRUE;
+        if (RTMPSockBuf_Fill(&r->m_sb) < 1)
+            return FALSE;
+    }
+}
+
+/* the server raises its polling hint while it has nothing to send, so an
+ * idle poll after an empty reply waits that long first */
+static void
+TunnelPollWait(RTMP *r)
+{
+    RTMPTunnel *t = &r->m_tunnel;
+    int delay, elapsed;
+
+    if (!t->t_replyEmpty)
+        return;
+    delay = r->m_polling * RTMPT_POLL_UNIT_MS;
+    if (delay > t->t_maxPollMs)
+        delay = t->t_maxPollMs;
+    elapsed = (int)(RTMP_GetTime() - t->t_replyTime);
+    if (delay > elapsed)
+        msleep(delay - elapsed);
+}
+
+static void
+TunnelFree(RTMPTunnel *t)
+{
+    free(t->t_out);
+    free(t->t_in);
+    t->t_out = t->t_in = NULL;
+    t->t_outLen = t->t_outSize = 0;
+    t->t_inOff = t->t_inLen = t->t_inSize = 0;
+    t->t_hold = 0;
+    t->t_replyEmpty = FALSE;
+}
+
+int
+RTMP_TunnelCollect(RTMP *r, int keep)
+{
+    RTMPTunnel *t = &r->m_tunnel;
+
+    if (!(r->Link.protocol & RTMP_FEATURE_HTTP) || !RTMP_IsConnected(r))
+        return TRUE;
+    if (!TunnelCollect(r, keep, -1))
+    {
+        RTMP_Close(r);
+        return FALSE;
+    }
+    if (!keep)
+        t->t_inOff = t->t_inLen = 0;
+    return TRUE;
+}
+
 #define MAX_IGNORED_FRAMES	50
 
 /* Read from the stream until we get a media packet.
@@ -5292,7 +6474,7 @@ stopKeyframeSearch:
     }
 
     if (rtnGetNextMediaPacket)
-        RTMPPacket_Free(&packet);
+        RTMP_RecyclePacket(r, &packet);
 
     if (recopy)
     {
@@ -5434,9 +6616,8 @@ RTMP_Write(RTMP *r, const char *buf, int size, int streamIdx)
 {
     RTMPPacket *pkt = &r->m_write;
     char *pend, *enc;
-    int s2 = size, ret, num;
+    int s2 = size, ret, num, type;
 
-    pkt->m_nChannel = 0x04;	/* source channel */
     pkt->m_nInfoField2 = r->Link.streams[streamIdx].id;
 
     while (s2)
@@ -5464,9 +6645,24 @@ RTMP_Write(RTMP *r, const char *buf, int size, int streamIdx)
             buf += 3;
             s2 -= 11;
 
+            /* separate chunk streams let audio interleave with video, an
+             * aggregate goes with the media of its first tag */
+            type = pkt->m_packetType;
+            if (type == RTMP_PACKET_TYPE_FLASH_VIDEO && s2 > 0)
+                type = *buf;
+
+            if (type == RTMP_PACKET_TYPE_AUDIO)
+                pkt->m_nChannel = RTMP_CHANNEL_AUDIO;
+            else if (type == RTMP_PACKET_TYPE_VIDEO)
+                pkt->m_nChannel = RTMP_CHANNEL_VIDEO;
+            else
+                pkt->m_nChannel = RTMP_CHANNEL_DATA;
+
             if (((pkt->m_packetType == RTMP_PACKET_TYPE_AUDIO
                     || pkt->m_packetType == RTMP_PACKET_TYPE_VIDEO) &&
-                    !pkt->m_nTimeStamp) || pkt->m_packetType == RTMP_PACKET_TYPE_INFO)
+                    !pkt->m_nTimeStamp) || pkt->m_packetType == RTMP_PACKET_TYPE_INFO
+                    || pkt->m_nChannel >= r->m_channelsAllocatedOut
+                    || !r->m_vecChannelsOut[pkt->m_nChannel])
             {
                 pkt->m_headerType = RTMP_PACKET_SIZE_LARGE;
                 if (pkt->m_packetType == RTMP_PACKET_TYPE_INFO)
@@ -5477,7 +6673,7 @@ RTMP_Write(RTMP *r, const char *buf, int size, int streamIdx)
                 pkt->m_headerType = RTMP_PACKET_SIZE_MEDIUM;
             }
 
-            if (!RTMPPacket_Alloc(pkt, pkt->m_nBodySize))
+            if (!ReserveWriteBody(r, pkt, pkt->m_nBodySize))
             {
                 RTMP_Log(RTMP_LOGDEBUG, "%s, failed to allocate packet", __FUNCTION__);
                 return FALSE;
@@ -5503,8 +6699,14 @@ RTMP_Write(RTMP *r, const char *buf, int size, int streamIdx)
         buf += num;
         if (pkt->m_nBytesRead == pkt->m_nBodySize)
         {
-            ret = RTMP_SendPacket(r, pkt, FALSE);
-            RTMPPacket_Free(pkt);
+            /* the body stays with m_write for the next message, or goes
+             * with the batch and comes back through its pool */
+            if (r->m_batch.b_active)
+                ret = QueuePacket(r, pkt);
+            else
+                ret = RTMP_SendPacket(r, pkt, FALSE);
+            if (pkt->m_nBodyCapacity > RTMP_BODY_KEEP_SIZE)
+                RTMPPacket_Free(pkt);
             pkt->m_nBytesRead = 0;
             if (!ret)
                 return -1;
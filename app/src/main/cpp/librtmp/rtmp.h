@@ -31,6 +31,12 @@
 #include <sys/types.h> //for off_t
 #endif
 
+/* TLS for rtmps comes with CRYPTO, or on its own with USE_TLS: OpenSSL
+ * only, without RTMPE or SWF verification */
+#if defined(CRYPTO) && !defined(NO_SSL) && !defined(USE_TLS)
+#define USE_TLS
+#endif
+
 #include <errno.h>
 #include <stdint.h>
 
@@ -43,6 +49,7 @@
 #include <ws2tcpip.h>
 #else
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #define SOCKET int
 #endif
@@ -136,6 +143,7 @@ extern "C"
         uint32_t m_nBytesRead;
         RTMPChunk *m_chunk;
         char *m_body;
+        uint32_t m_nBodyCapacity;	/* of m_body, 0 when not owned */
     } RTMPPacket;
 
     typedef struct RTMPSockBuf
@@ -146,6 +154,7 @@ extern "C"
         char sb_buf[RTMP_BUFFER_CACHE_SIZE];	/* data read from socket */
         int sb_timedout;
         void *sb_ssl;
+        int sb_ktls;		/* the kernel seals TLS records, plain writes */
     } RTMPSockBuf;
 
     void RTMPPacket_Reset(RTMPPacket *p);
@@ -153,8 +162,103 @@ extern "C"
     int RTMPPacket_Alloc(RTMPPacket *p, uint32_t nSize);
     void RTMPPacket_Free(RTMPPacket *p);
 
+    /* Bodies are reused per chunk stream instead of allocated per message.
+     * They only grow, with some headroom so slowly growing frames don't
+     * reallocate each time, and anything over RTMP_BODY_KEEP_SIZE is
+     * released after use so one huge message doesn't pin its memory. */
+#define RTMP_BODY_KEEP_SIZE	(1024 * 1024)
+
+    /* makes room for nSize body bytes, reusing the current body when it
+     * is large enough. The contents are not kept. */
+    int RTMPPacket_Reserve(RTMPPacket *p, uint32_t nSize);
+
 #define RTMPPacket_IsReady(a)	((a)->m_nBytesRead == (a)->m_nBodySize)
 
+    /* outgoing media messages coalesced into one sendmsg(), see
+     * RTMP_BeginBatch/RTMP_FlushBatch. Queued messages are cut into chunks
+     * only when written, so audio chunks can be slotted in between the
+     * chunks of a large video message. */
+#define RTMP_BATCH_MAX_IOV	512
+#define RTMP_BATCH_MAX_MSGS	256
+#define RTMP_BATCH_HDR_SIZE	(RTMP_BATCH_MAX_IOV * 2)
+
+#ifdef _WIN32
+    struct iovec
+    {
+        void *iov_base;
+        size_t iov_len;
+    };
+#endif
+
+    typedef struct RTMPBatchMsg
+    {
+        char *bm_body;		/* owned, freed once fully written */
+        int bm_bodySize;
+        int bm_offset;		/* body bytes already cut into chunks */
+        int bm_started;		/* first chunk header went out */
+        int bm_channel;
+        int bm_priority;	/* audio goes ahead of other chunk streams */
+        int bm_headerSize;
+        int bm_cSize;
+        char bm_header[RTMP_MAX_HEADER_SIZE];
+        uint32_t bm_capacity;
+    } RTMPBatchMsg;
+
+    /* written message bodies waiting to be reused by RTMP_Write */
+#define RTMP_BATCH_POOL_SIZE	16
+
+    typedef struct RTMPBatchBody
+    {
+        char *bb_body;
+        uint32_t bb_capacity;
+    } RTMPBatchBody;
+
+    typedef struct RTMPBatch
+    {
+        int b_active;
+        int b_writing;
+        int b_numMsgs;
+        int b_pending;		/* bytes queued, chunk headers included */
+        RTMPBatchMsg b_msgs[RTMP_BATCH_MAX_MSGS];
+        struct iovec b_iov[RTMP_BATCH_MAX_IOV];
+        char b_hdr[RTMP_BATCH_HDR_SIZE];	/* continuation headers */
+        RTMPBatchBody b_pool[RTMP_BATCH_POOL_SIZE];
+        int b_numPool;
+        char *b_flat;		/* the batch in one piece, for transports */
+        uint32_t b_flatCapacity;	/* that can't gather it themselves */
+    } RTMPBatch;
+
+    /* RTMPT output is gathered into one /send post per window instead of
+     * one per write, and up to t_maxInflight posts are on the connection
+     * before their responses are read. Payloads read early to make room
+     * wait in t_in for ReadN. */
+#define RTMPT_WINDOW_BYTES	16384
+#define RTMPT_WINDOW_MS		20
+#define RTMPT_MAX_INFLIGHT	32
+#define RTMPT_POLL_UNIT_MS	10
+#define RTMPT_MAX_POLL_MS	320
+#define RTMPT_HDR_ROOM		512	/* request line and headers go in front */
+
+    typedef struct RTMPTunnel
+    {
+        char *t_out;		/* RTMPT_HDR_ROOM, then chunks for the next post */
+        int t_outLen;
+        int t_outSize;
+        uint32_t t_outTime;	/* when the first waiting byte came in */
+        int t_hold;		/* a message is being written, don't post yet */
+        char *t_in;
+        int t_inOff;
+        int t_inLen;
+        int t_inSize;
+        uint32_t t_replyTime;	/* last response, and whether it was empty */
+        int t_replyEmpty;
+
+        int t_window;		/* bytes that make a post, 0 posts every write */
+        int t_windowMs;		/* age of the oldest byte that makes a post */
+        int t_maxInflight;	/* 0 never waits for responses */
+        int t_maxPollMs;	/* cap on the server's polling hint */
+    } RTMPTunnel;
+
     typedef struct RTMP_Stream {
         int id;
         AVal playpath;
@@ -182,6 +286,7 @@ extern "C"
         AVal token;
         AVal pubUser;
         AVal pubPasswd;
+        AVal fourCcList;	/* comma separated, sent as enhanced rtmp fourCcList */
         AMFObject extras;
         int edepth;
 
@@ -194,6 +299,7 @@ extern "C"
 #define RTMP_LF_PLST	0x0008	/* send playlist before play */
 #define RTMP_LF_BUFX	0x0010	/* toggle stream on BufferEmpty msg */
 #define RTMP_LF_FTCU	0x0020	/* free tcUrl on close */
+#define RTMP_LF_NOKTLS	0x0040	/* keep TLS in user space */
         int lFlags;
 
         int swfAge;
@@ -319,9 +425,11 @@ extern "C"
         int m_resplen;
         int m_unackd;
         AVal m_clientID;
+        RTMPTunnel m_tunnel;
 
         RTMP_READ m_read;
         RTMPPacket m_write;
+        RTMPBatch m_batch;
         RTMPSockBuf m_sb;
         RTMP_LNK Link;
         int connect_time_ms;
@@ -333,6 +441,7 @@ extern "C"
 
     void RTMP_ParsePlaypath(AVal *in, AVal *out);
     void RTMP_SetBufferMS(RTMP *r, int size);
+    void RTMP_SetTunnelInflight(RTMP *r, int posts);
     void RTMP_UpdateBufferMS(RTMP *r);
 
     int RTMP_SetOpt(RTMP *r, const AVal *opt, AVal *arg);
@@ -364,6 +473,15 @@ extern "C"
     int RTMP_TLS_Accept(RTMP *r, void *ctx);
 
     int RTMP_ReadPacket(RTMP *r, RTMPPacket *packet);
+    /* hands the body of a packet from RTMP_ReadPacket back to its chunk
+     * stream for the next message, instead of RTMPPacket_Free */
+    void RTMP_RecyclePacket(RTMP *r, RTMPPacket *packet);
+    /* for event driven servers: TRUE when m_sb already holds the whole
+     * next chunk, so RTMP_ReadPacket returns without touching the socket.
+     * -1 when that chunk breaks its chunk stream: a compressed header with
+     * nothing before it, or a new message while the last one on the same
+     * chunk stream is incomplete. */
+    int RTMP_ChunkBuffered(RTMP *r);
     int RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue);
     int RTMP_SendChunk(RTMP *r, RTMPChunk *chunk);
     int RTMP_IsConnected(RTMP *r);
@@ -385,6 +503,8 @@ extern "C"
     void RTMP_EnableWrite(RTMP *r);
 
     void *RTMP_TLS_AllocServerContext(const char* cert, const char* key);
+    /* trusts the PEM certificates in file as well as the system store */
+    int RTMP_TLS_LoadCAFile(const char *file);
     void RTMP_TLS_FreeServerContext(void *ctx);
 
     int RTMP_LibVersion(void);
@@ -414,6 +534,18 @@ extern "C"
     int RTMP_Read(RTMP *r, char *buf, int size);
     int RTMP_Write(RTMP *r, const char *buf, int size, int streamIdx);
 
+    /* while a batch is open RTMP_Write only queues messages; they go out
+     * with a single sendmsg() on RTMP_FlushBatch, or a slice at a time */
+    void RTMP_BeginBatch(RTMP *r);
+    int RTMP_FlushBatch(RTMP *r);
+    int RTMP_WriteBatchSlice(RTMP *r, int maxBytes);
+    int RTMP_BatchPending(RTMP *r);
+
+    /* RTMPT: reads the responses that have already arrived, without
+     * blocking, keeping their payloads for RTMP_ReadPacket or dropping
+     * them. Waiting posts go out on RTMP_FlushBatch or before a read. */
+    int RTMP_TunnelCollect(RTMP *r, int keep);
+
     /* hashswf.c */
     int RTMP_HashSWF(const char *url, unsigned int *size, unsigned char *hash,
                      int age);
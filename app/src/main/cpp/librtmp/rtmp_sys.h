@@ -71,7 +71,7 @@
 #define SetSockError(e)	errno = e
 #undef closesocket
 #define closesocket(s)	close(s)
-#define msleep(n)	usleep(n*1000)
+#define msleep(n)	usleep((n)*1000)
 #define SET_RCVTIMEO(tv,s)	struct timeval tv = {s,0}
 #ifndef INVALID_SOCKET
 #define INVALID_SOCKET -1
@@ -216,18 +216,33 @@ typedef struct tls_ctx
 #define TLS_shutdown(s)	gnutls_bye(s, GNUTLS_SHUT_RDWR)
 #define TLS_close(s)	gnutls_deinit(s)
 
-#elif defined(USE_ONLY_MD5)
+#elif defined(USE_ONLY_MD5) && !defined(USE_TLS)
 #include "md5.h"
 #include "cencode.h"
 #define MD5_DIGEST_LENGTH 16
 
 #else	/* USE_OPENSSL */
+#if defined(USE_ONLY_MD5)
+#include "md5.h"
+#include "cencode.h"
+#define MD5_DIGEST_LENGTH 16
+#endif
+#include <openssl/ssl.h>
+#include <openssl/pem.h>
+#ifdef __ANDROID__
+#include <dirent.h>
+#endif
+
+#ifndef USE_OPENSSL
+#define USE_OPENSSL
+#endif
 #define TLS_CTX	SSL_CTX *
+typedef SSL_CTX tls_server_ctx;
 #define TLS_client(ctx,s)	s = SSL_new(ctx)
 #define TLS_server(ctx,s)	s = SSL_new(ctx)
 #define TLS_setfd(s,fd)	SSL_set_fd(s,fd)
-#define TLS_connect(s)	SSL_connect(s)
-#define TLS_accept(s)	SSL_accept(s)
+#define TLS_connect(s)	(SSL_connect(s) == 1 ? 0 : -1)
+#define TLS_accept(s)	(SSL_accept(s) == 1 ? 0 : -1)
 #define TLS_read(s,b,l)	SSL_read(s,b,l)
 #define TLS_write(s,b,l)	SSL_write(s,b,l)
 #define TLS_shutdown(s)	SSL_shutdown(s)
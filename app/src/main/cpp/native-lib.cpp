@@ -51,6 +51,106 @@ Java_com_heculess_rtmppush_RtmpClient_init_1video_1info(JNIEnv *env, jobject ins
 
 }
 
+extern "C" JNIEXPORT void JNICALL
+Java_com_heculess_rtmppush_RtmpClient_setVariableFrameRate(JNIEnv *env, jobject instance,
+                                                            jboolean enable) {
+
+    if(!pusher)
+        pusher = new RtmpPush;
+
+    pusher->videoVfr = enable;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_heculess_rtmppush_RtmpClient_setVideoCodec(JNIEnv *env, jobject instance,
+                                                    jstring codec_) {
+    const char *codec = env->GetStringUTFChars(codec_, 0);
+
+    if(!pusher)
+        pusher = new RtmpPush;
+
+    pusher->videoCodec = codec;
+
+    env->ReleaseStringUTFChars(codec_, codec);
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_heculess_rtmppush_RtmpClient_setReorderFrames(JNIEnv *env, jobject instance,
+                                                       jint frames) {
+
+    if(!pusher)
+        pusher = new RtmpPush;
+
+    pusher->videoReorderFrames = frames;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_heculess_rtmppush_RtmpClient_setRecordPath(JNIEnv *env, jobject instance,
+                                                    jstring path_) {
+    const char *path = env->GetStringUTFChars(path_, 0);
+
+    if(!pusher)
+        pusher = new RtmpPush;
+
+    pusher->recordPath = path;
+
+    env->ReleaseStringUTFChars(path_, path);
+}
+
+extern "C" JNIEXPORT jint JNICALL
+Java_com_heculess_rtmppush_RtmpClient_getRecordDroppedTags(JNIEnv *env, jobject instance) {
+
+    if(!pusher)
+        return 0;
+
+    return pusher->Get_record_dropped_tags();
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_heculess_rtmppush_RtmpClient_setMp4RecordPath(JNIEnv *env, jobject instance,
+                                                       jstring path_) {
+    const char *path = env->GetStringUTFChars(path_, 0);
+
+    if(!pusher)
+        pusher = new RtmpPush;
+
+    pusher->recordMp4Path = path;
+
+    env->ReleaseStringUTFChars(path_, path);
+}
+
+extern "C" JNIEXPORT jint JNICALL
+Java_com_heculess_rtmppush_RtmpClient_getMp4RecordDroppedPackets(JNIEnv *env, jobject instance) {
+
+    if(!pusher)
+        return 0;
+
+    return pusher->Get_mp4_record_dropped_packets();
+}
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_heculess_rtmppush_RtmpClient_repairMp4Recording(JNIEnv *env, jobject instance,
+                                                         jstring path_) {
+    const char *path = env->GetStringUTFChars(path_, 0);
+
+    jboolean ret = Mp4Recorder::repair(path);
+
+    env->ReleaseStringUTFChars(path_, path);
+    return ret;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_heculess_rtmppush_RtmpClient_setLogLevel(JNIEnv *env, jobject instance, jint level) {
+
+    rtmp_log_set_level(level);
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_heculess_rtmppush_RtmpClient_dumpLog(JNIEnv *env, jobject instance) {
+
+    rtmp_log_dump();
+}
+
 extern "C" JNIEXPORT void JNICALL
 Java_com_heculess_rtmppush_RtmpClient_pushAudioData(JNIEnv *env, jobject instance, jlong tms,
                                                     jbyteArray data_) {
@@ -68,6 +168,31 @@ Java_com_heculess_rtmppush_RtmpClient_pushAudioData(JNIEnv *env, jobject instanc
     env->ReleaseByteArrayElements(data_, data, 0);
 }
 
+extern "C" JNIEXPORT void JNICALL
+Java_com_heculess_rtmppush_RtmpClient_pushAudioSourceData(JNIEnv *env, jobject instance,
+                                                          jint source, jlong tms,
+                                                          jbyteArray data_) {
+    jbyte *data = env->GetByteArrayElements(data_, NULL);
+
+    if(pusher){
+        media_data audiodata;
+        audiodata.data.resize(env->GetArrayLength(data_),0);
+        memcpy(&audiodata.data[0],data,audiodata.data.size());
+        audiodata.timestamp = tms;
+
+        pusher->Push_audio_source_data((size_t)source, audiodata);
+    }
+
+    env->ReleaseByteArrayElements(data_, data, 0);
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_heculess_rtmppush_RtmpClient_setAudioSourceGain(JNIEnv *env, jobject instance,
+                                                         jint source, jfloat gain) {
+    if(pusher)
+        pusher->Set_audio_source_gain((size_t)source, gain);
+}
+
 extern "C" JNIEXPORT void JNICALL
 Java_com_heculess_rtmppush_RtmpClient_initAudioHeader(JNIEnv *env, jobject instance,
                                                       jbyteArray csd0_) {
@@ -118,11 +243,8 @@ Java_com_heculess_rtmppush_RtmpClient_initVideoHeader(JNIEnv *env, jobject insta
         std::shared_ptr<VideoOutput> video_output =
                 std::dynamic_pointer_cast<VideoOutput>(pusher->video);
 
-        video_output->format_csd0.resize(csdsize0,0);
-        video_output->format_csd1.resize(csdsize1,0);
-
-        memcpy(&video_output->format_csd0[0], csd0, video_output->format_csd0.size());
-        memcpy(&video_output->format_csd1[0], csd1, video_output->format_csd1.size());
+        video_output->format_csd0.assign((uint8_t*)csd0, (uint8_t*)csd0 + csdsize0);
+        video_output->format_csd1.assign((uint8_t*)csd1, (uint8_t*)csd1 + csdsize1);
 
     }
 
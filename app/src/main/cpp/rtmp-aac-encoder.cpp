@@ -0,0 +1,1320 @@
+#include <math.h>
+#include <string.h>
+#include <float.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define AUDIO_USE_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define AUDIO_USE_SSE2
+#endif
+
+#include "rtmp-defs.h"
+#include "rtmp-aac-encoder.h"
+
+#define AAC_OBJECT_LC       2
+#define AAC_ID_SCE          0
+#define AAC_ID_CPE          1
+#define AAC_ID_END          7
+#define AAC_ZERO_BOOK       0
+#define AAC_ESC_BOOK        11
+#define AAC_MAX_QUANT       8191
+/* decoder input buffer per channel, 4.5.3.2 */
+#define AAC_CHANNEL_BITS    6144
+
+/* scalefactors are sent with this offset, 0 means a quantizer step of 1 */
+#define SF_OFFSET           100
+#define SF_MAX_DIFF         60
+#define SF_MIN              (-SF_OFFSET)
+#define SF_MAX              100
+
+/* range of the global offset the rate control adds to every band's
+ * scalefactor, in 1.5 dB steps */
+#define GAIN_MIN            -32
+#define GAIN_MAX            96
+
+/* float input is scaled to 16 bit range, which the spec's filterbank and
+ * the absolute threshold levels assume */
+#define PCM_SCALE           32768.0f
+#define FULL_SCALE_DB       96.0f
+
+/* a sub-block this much louder than the ones before it is an attack */
+#define ATTACK_RATIO        10.0f
+#define ATTACK_FLOOR        1e-5f
+
+/* masking spread per bark towards higher and lower frequencies */
+#define SPREAD_UP_DB        15.0f
+#define SPREAD_DOWN_DB      30.0f
+#define MAX_SNR_DB          30.0f
+/* a long block may only raise a band's threshold this much over the
+ * previous block, which keeps pre-echo out of onsets */
+#define PRE_ECHO_RATIO      2.0f
+
+/* ------------------------------------------------------------------------- */
+
+#if defined(AUDIO_USE_NEON)
+static inline float32x4_t neon_sqrt(float32x4_t a)
+{
+#if defined(__aarch64__)
+	return vsqrtq_f32(a);
+#else
+	/* two refinements of the reciprocal estimate, zero lanes stay zero */
+	uint32x4_t zero = vceqq_f32(a, vdupq_n_f32(0.0f));
+	float32x4_t e = vrsqrteq_f32(a);
+	e = vmulq_f32(e, vrsqrtsq_f32(vmulq_f32(a, e), e));
+	e = vmulq_f32(e, vrsqrtsq_f32(vmulq_f32(a, e), e));
+	return vbslq_f32(zero, a, vmulq_f32(a, e));
+#endif
+}
+#endif
+
+static void vec_mul(float *dst, const float *a, const float *b, size_t count)
+{
+	size_t i = 0;
+
+#if defined(AUDIO_USE_NEON)
+	for (; i + 4 <= count; i += 4)
+		vst1q_f32(dst + i, vmulq_f32(vld1q_f32(a + i), vld1q_f32(b + i)));
+#elif defined(AUDIO_USE_SSE2)
+	for (; i + 4 <= count; i += 4)
+		_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_loadu_ps(a + i),
+				_mm_loadu_ps(b + i)));
+#endif
+
+	/* an indexed tail here is taken for an unbounded loop by gcc 12 once
+	 * the short window call is inlined */
+	for (dst += i, a += i, b += i; i < count; i++)
+		*dst++ = *a++ * *b++;
+}
+
+/* (out_re, out_im) = (re, im) * (wr, wi) */
+static void vec_cmul(float *out_re, float *out_im, const float *re,
+		const float *im, const float *wr, const float *wi, size_t count)
+{
+	size_t i = 0;
+
+#if defined(AUDIO_USE_NEON)
+	for (; i + 4 <= count; i += 4) {
+		float32x4_t a = vld1q_f32(re + i), b = vld1q_f32(im + i);
+		float32x4_t c = vld1q_f32(wr + i), d = vld1q_f32(wi + i);
+		vst1q_f32(out_re + i, vmlsq_f32(vmulq_f32(a, c), b, d));
+		vst1q_f32(out_im + i, vmlaq_f32(vmulq_f32(a, d), b, c));
+	}
+#elif defined(AUDIO_USE_SSE2)
+	for (; i + 4 <= count; i += 4) {
+		__m128 a = _mm_loadu_ps(re + i), b = _mm_loadu_ps(im + i);
+		__m128 c = _mm_loadu_ps(wr + i), d = _mm_loadu_ps(wi + i);
+		_mm_storeu_ps(out_re + i, _mm_sub_ps(_mm_mul_ps(a, c),
+				_mm_mul_ps(b, d)));
+		_mm_storeu_ps(out_im + i, _mm_add_ps(_mm_mul_ps(a, d),
+				_mm_mul_ps(b, c)));
+	}
+#endif
+
+	for (; i < count; i++) {
+		float a = re[i], b = im[i];
+		out_re[i] = a * wr[i] - b * wi[i];
+		out_im[i] = a * wi[i] + b * wr[i];
+	}
+}
+
+/* one radix-2 pass over n butterflies, b *= w, (a, b) = (a + b, a - b) */
+static void fft_butterflies(float *ar, float *ai, float *br, float *bi,
+		const float *wr, const float *wi, size_t n)
+{
+	size_t j = 0;
+
+#if defined(AUDIO_USE_NEON)
+	for (; j + 4 <= n; j += 4) {
+		float32x4_t xr = vld1q_f32(br + j), xi = vld1q_f32(bi + j);
+		float32x4_t cr = vld1q_f32(wr + j), ci = vld1q_f32(wi + j);
+		float32x4_t tr = vmlsq_f32(vmulq_f32(xr, cr), xi, ci);
+		float32x4_t ti = vmlaq_f32(vmulq_f32(xr, ci), xi, cr);
+		float32x4_t yr = vld1q_f32(ar + j), yi = vld1q_f32(ai + j);
+		vst1q_f32(br + j, vsubq_f32(yr, tr));
+		vst1q_f32(bi + j, vsubq_f32(yi, ti));
+		vst1q_f32(ar + j, vaddq_f32(yr, tr));
+		vst1q_f32(ai + j, vaddq_f32(yi, ti));
+	}
+#elif defined(AUDIO_USE_SSE2)
+	for (; j + 4 <= n; j += 4) {
+		__m128 xr = _mm_loadu_ps(br + j), xi = _mm_loadu_ps(bi + j);
+		__m128 cr = _mm_loadu_ps(wr + j), ci = _mm_loadu_ps(wi + j);
+		__m128 tr = _mm_sub_ps(_mm_mul_ps(xr, cr), _mm_mul_ps(xi, ci));
+		__m128 ti = _mm_add_ps(_mm_mul_ps(xr, ci), _mm_mul_ps(xi, cr));
+		__m128 yr = _mm_loadu_ps(ar + j), yi = _mm_loadu_ps(ai + j);
+		_mm_storeu_ps(br + j, _mm_sub_ps(yr, tr));
+		_mm_storeu_ps(bi + j, _mm_sub_ps(yi, ti));
+		_mm_storeu_ps(ar + j, _mm_add_ps(yr, tr));
+		_mm_storeu_ps(ai + j, _mm_add_ps(yi, ti));
+	}
+#endif
+
+	for (; j < n; j++) {
+		float tr = br[j] * wr[j] - bi[j] * wi[j];
+		float ti = br[j] * wi[j] + bi[j] * wr[j];
+		br[j] = ar[j] - tr;
+		bi[j] = ai[j] - ti;
+		ar[j] += tr;
+		ai[j] += ti;
+	}
+}
+
+/* energy, sum of square roots and peak magnitude of a band */
+static void band_stats(const float *x, size_t count, float *energy,
+		float *root_sum, float *peak)
+{
+	float e = 0.0f, r = 0.0f, p = 0.0f;
+	size_t i = 0;
+
+#if defined(AUDIO_USE_SSE2)
+	const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	__m128 ve = _mm_setzero_ps(), vr = _mm_setzero_ps();
+	__m128 vp = _mm_setzero_ps();
+	float lanes[4];
+
+	for (; i + 4 <= count; i += 4) {
+		__m128 v = _mm_loadu_ps(x + i);
+		__m128 a = _mm_and_ps(v, abs_mask);
+		ve = _mm_add_ps(ve, _mm_mul_ps(v, v));
+		vr = _mm_add_ps(vr, _mm_sqrt_ps(a));
+		vp = _mm_max_ps(vp, a);
+	}
+
+	_mm_storeu_ps(lanes, ve);
+	e = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	_mm_storeu_ps(lanes, vr);
+	r = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	_mm_storeu_ps(lanes, vp);
+	p = fmaxf(fmaxf(lanes[0], lanes[1]), fmaxf(lanes[2], lanes[3]));
+#elif defined(AUDIO_USE_NEON)
+	float32x4_t ve = vdupq_n_f32(0.0f), vr = vdupq_n_f32(0.0f);
+	float32x4_t vp = vdupq_n_f32(0.0f);
+	float lanes[4];
+
+	for (; i + 4 <= count; i += 4) {
+		float32x4_t v = vld1q_f32(x + i);
+		float32x4_t a = vabsq_f32(v);
+		ve = vmlaq_f32(ve, v, v);
+		vr = vaddq_f32(vr, neon_sqrt(a));
+		vp = vmaxq_f32(vp, a);
+	}
+
+	vst1q_f32(lanes, ve);
+	e = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	vst1q_f32(lanes, vr);
+	r = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	vst1q_f32(lanes, vp);
+	p = fmaxf(fmaxf(lanes[0], lanes[1]), fmaxf(lanes[2], lanes[3]));
+#endif
+
+	for (; i < count; i++) {
+		float a = fabsf(x[i]);
+		e += x[i] * x[i];
+		r += sqrtf(a);
+		if (a > p)
+			p = a;
+	}
+
+	*energy   = e;
+	*root_sum = r;
+	*peak     = p;
+}
+
+/* q = (|x| * scale)^(3/4) + 0.4054 truncated, with the sign of x. Returns
+ * the largest magnitude. */
+static int quantize_band(const float *x, int *q, size_t count, float scale)
+{
+	const float bias = 0.4054f;
+	float peak = 0.0f;
+	size_t i = 0;
+
+#if defined(AUDIO_USE_SSE2)
+	const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	const __m128 vscale = _mm_set1_ps(scale);
+	const __m128 vbias = _mm_set1_ps(bias);
+	const __m128 vmax = _mm_set1_ps((float)AAC_MAX_QUANT);
+	__m128 vpeak = _mm_setzero_ps();
+	float lanes[4];
+
+	for (; i + 4 <= count; i += 4) {
+		__m128 v = _mm_loadu_ps(x + i);
+		__m128 a = _mm_mul_ps(_mm_and_ps(v, abs_mask), vscale);
+		__m128 r = _mm_sqrt_ps(a);
+		a = _mm_add_ps(_mm_mul_ps(r, _mm_sqrt_ps(r)), vbias);
+		a = _mm_min_ps(a, vmax);
+		vpeak = _mm_max_ps(vpeak, a);
+
+		__m128i iq = _mm_cvttps_epi32(a);
+		__m128i sign = _mm_srai_epi32(_mm_castps_si128(v), 31);
+		iq = _mm_sub_epi32(_mm_xor_si128(iq, sign), sign);
+		_mm_storeu_si128((__m128i *)(q + i), iq);
+	}
+
+	_mm_storeu_ps(lanes, vpeak);
+	peak = fmaxf(fmaxf(lanes[0], lanes[1]), fmaxf(lanes[2], lanes[3]));
+#elif defined(AUDIO_USE_NEON)
+	const float32x4_t vbias = vdupq_n_f32(bias);
+	const float32x4_t vmax = vdupq_n_f32((float)AAC_MAX_QUANT);
+	float32x4_t vpeak = vdupq_n_f32(0.0f);
+
+	for (; i + 4 <= count; i += 4) {
+		float32x4_t v = vld1q_f32(x + i);
+		float32x4_t a = vmulq_n_f32(vabsq_f32(v), scale);
+		float32x4_t r = neon_sqrt(a);
+		float32x4_t rr = neon_sqrt(r);
+		a = vminq_f32(vaddq_f32(vmulq_f32(r, rr), vbias), vmax);
+		vpeak = vmaxq_f32(vpeak, a);
+
+		int32x4_t iq = vcvtq_s32_f32(a);
+		uint32x4_t neg = vcltq_f32(v, vdupq_n_f32(0.0f));
+		iq = vbslq_s32(neg, vnegq_s32(iq), iq);
+		vst1q_s32(q + i, iq);
+	}
+
+	float lanes[4];
+	vst1q_f32(lanes, vpeak);
+	peak = fmaxf(fmaxf(lanes[0], lanes[1]), fmaxf(lanes[2], lanes[3]));
+#endif
+
+	for (; i < count; i++) {
+		float a = fabsf(x[i]) * scale;
+		a = sqrtf(a) * sqrtf(sqrtf(a)) + bias;
+		if (a > (float)AAC_MAX_QUANT)
+			a = (float)AAC_MAX_QUANT;
+		if (a > peak)
+			peak = a;
+		q[i] = x[i] < 0.0f ? -(int)a : (int)a;
+	}
+
+	return (int)peak;
+}
+
+/* ------------------------------------------------------------------------- */
+
+struct bit_writer {
+	std::vector<uint8_t> *out;
+	uint64_t             acc;
+	int                  bits;
+
+	explicit bit_writer(std::vector<uint8_t> &dst) : out(&dst), acc(0), bits(0) {}
+
+	void put(uint32_t value, int count)
+	{
+		acc = (acc << count) | (value & ((1ULL << count) - 1));
+		bits += count;
+		while (bits >= 8) {
+			bits -= 8;
+			out->push_back((uint8_t)(acc >> bits));
+		}
+	}
+
+	void align()
+	{
+		if (bits)
+			put(0, 8 - bits);
+	}
+};
+
+static inline bool book_is_unsigned(int book)
+{
+	return book == 3 || book == 4 || book >= 7;
+}
+
+static inline int book_dim(int book)
+{
+	return book <= 4 ? 4 : 2;
+}
+
+/* largest magnitude each book can code, the escape book goes beyond */
+static const int book_lav[AAC_SPECTRAL_BOOKS + 1] = {
+	0, 1, 1, 2, 2, 4, 4, 7, 7, 12, 12, 16
+};
+
+static inline int clamp_int(int v, int lo, int hi)
+{
+	return v < lo ? lo : (v > hi ? hi : v);
+}
+
+static int tuple_index(int book, const int *q)
+{
+	switch (book) {
+	case 1:
+	case 2:
+		return 27 * (q[0] + 1) + 9 * (q[1] + 1) + 3 * (q[2] + 1) + q[3] + 1;
+	case 3:
+	case 4:
+		return 27 * abs(q[0]) + 9 * abs(q[1]) + 3 * abs(q[2]) + abs(q[3]);
+	case 5:
+	case 6:
+		return 9 * (q[0] + 4) + q[1] + 4;
+	case 7:
+	case 8:
+		return 8 * abs(q[0]) + abs(q[1]);
+	case 9:
+	case 10:
+		return 13 * abs(q[0]) + abs(q[1]);
+	default:
+		return 17 * (abs(q[0]) < 16 ? abs(q[0]) : 16) +
+		       (abs(q[1]) < 16 ? abs(q[1]) : 16);
+	}
+}
+
+/* escape sequence length for a magnitude of at least 16 */
+static inline int escape_bits(int v)
+{
+	int n = 4;
+	while ((v >> (n + 1)) != 0)
+		n++;
+	return 2 * n - 3;
+}
+
+static int spectral_bits(int book, const int *q, int count)
+{
+	const uint8_t *bits = aac_spectral_bits[book];
+	int dim = book_dim(book);
+	bool is_unsigned = book_is_unsigned(book);
+	int total = 0;
+
+	for (int i = 0; i < count; i += dim) {
+		total += bits[tuple_index(book, q + i)];
+		if (!is_unsigned)
+			continue;
+		for (int j = 0; j < dim; j++) {
+			int v = abs(q[i + j]);
+			if (v)
+				total++;
+			if (book == AAC_ESC_BOOK && v >= 16)
+				total += escape_bits(v);
+		}
+	}
+
+	return total;
+}
+
+static void write_spectral(bit_writer &bw, int book, const int *q, int count)
+{
+	const uint16_t *codes = aac_spectral_codes[book];
+	const uint8_t *bits = aac_spectral_bits[book];
+	int dim = book_dim(book);
+	bool is_unsigned = book_is_unsigned(book);
+
+	for (int i = 0; i < count; i += dim) {
+		int idx = tuple_index(book, q + i);
+		bw.put(codes[idx], bits[idx]);
+		if (!is_unsigned)
+			continue;
+
+		for (int j = 0; j < dim; j++) {
+			if (q[i + j])
+				bw.put(q[i + j] < 0 ? 1 : 0, 1);
+		}
+
+		if (book != AAC_ESC_BOOK)
+			continue;
+
+		for (int j = 0; j < dim; j++) {
+			int v = abs(q[i + j]);
+			if (v < 16)
+				continue;
+
+			int n = 4;
+			while ((v >> (n + 1)) != 0)
+				n++;
+			bw.put((1u << (n - 4)) - 1, n - 4);
+			bw.put(0, 1);
+			bw.put((uint32_t)(v - (1 << n)), n);
+		}
+	}
+}
+
+/* cheapest book for a band whose largest magnitude is peak */
+static int choose_book(const int *q, int count, int peak, int *bits)
+{
+	int first;
+
+	if (peak == 0) {
+		*bits = 0;
+		return AAC_ZERO_BOOK;
+	}
+
+	for (first = 1; first < AAC_ESC_BOOK; first += 2) {
+		if (peak <= book_lav[first])
+			break;
+	}
+
+	if (first == AAC_ESC_BOOK) {
+		*bits = spectral_bits(AAC_ESC_BOOK, q, count);
+		return AAC_ESC_BOOK;
+	}
+
+	int a = spectral_bits(first, q, count);
+	int b = spectral_bits(first + 1, q, count);
+	*bits = a <= b ? a : b;
+	return a <= b ? first : first + 1;
+}
+
+/* ------------------------------------------------------------------------- */
+
+void aac_mdct::init(size_t size)
+{
+	size_t m = size / 2;
+	size_t l = size / 4;
+	int log2l = 0;
+
+	n = size;
+	while ((1u << log2l) < l)
+		log2l++;
+
+	pre_re.resize(l);
+	pre_im.resize(l);
+	post_re.resize(l);
+	post_im.resize(l);
+	bitrev.resize(l);
+
+	for (size_t i = 0; i < l; i++) {
+		double a = -M_PI * (i + 0.25) / m;
+		double b = -M_PI * (double)i / m;
+		pre_re[i]  = (float)cos(a);
+		pre_im[i]  = (float)sin(a);
+		/* the spec's analysis scale of 2 */
+		post_re[i] = (float)(2.0 * cos(b));
+		post_im[i] = (float)(2.0 * sin(b));
+
+		uint32_t r = 0;
+		for (int bit = 0; bit < log2l; bit++)
+			r |= ((i >> bit) & 1) << (log2l - 1 - bit);
+		bitrev[i] = (uint16_t)r;
+	}
+
+	/* twiddles of the pass with half size h start at h - 1 */
+	fft_re.resize(l);
+	fft_im.resize(l);
+	for (size_t h = 1; h < l; h <<= 1) {
+		for (size_t j = 0; j < h; j++) {
+			double a = -M_PI * (double)j / h;
+			fft_re[h - 1 + j] = (float)cos(a);
+			fft_im[h - 1 + j] = (float)sin(a);
+		}
+	}
+
+	fold.resize(m);
+	re.resize(l);
+	im.resize(l);
+	tmp_re.resize(l);
+	tmp_im.resize(l);
+}
+
+/* The MDCT of quarters (a, b, c, d) is the DCT-IV of (-c_r - d, a - b_r),
+ * which in turn is an n/8 point complex FFT between two twiddles. */
+void aac_mdct::forward(const float *in, float *out)
+{
+	size_t m = n / 2;
+	size_t l = n / 4;
+	size_t h = m / 2;
+
+	for (size_t j = 0; j < h; j++)
+		fold[j] = -in[3 * h - 1 - j] - in[3 * h + j];
+	for (size_t j = h; j < m; j++)
+		fold[j] = in[j - h] - in[3 * h - 1 - j];
+
+	for (size_t i = 0; i < l; i++) {
+		tmp_re[i] = fold[2 * i];
+		tmp_im[i] = fold[m - 1 - 2 * i];
+	}
+
+	vec_cmul(&tmp_re[0], &tmp_im[0], &tmp_re[0], &tmp_im[0],
+			&pre_re[0], &pre_im[0], l);
+
+	for (size_t i = 0; i < l; i++) {
+		re[bitrev[i]] = tmp_re[i];
+		im[bitrev[i]] = tmp_im[i];
+	}
+
+	for (size_t half = 1; half < l; half <<= 1) {
+		for (size_t i = 0; i < l; i += 2 * half)
+			fft_butterflies(&re[i], &im[i], &re[i + half], &im[i + half],
+					&fft_re[half - 1], &fft_im[half - 1], half);
+	}
+
+	vec_cmul(&tmp_re[0], &tmp_im[0], &re[0], &im[0],
+			&post_re[0], &post_im[0], l);
+
+	for (size_t i = 0; i < l; i++) {
+		out[2 * i]         = tmp_re[i];
+		out[m - 1 - 2 * i] = -tmp_im[i];
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* where the first of the eight short windows starts in a block */
+#define SHORT_START        ((AAC_FRAME_SAMPLES - AAC_SHORT_SAMPLES) / 2)
+/* 4 * log2(8191^(4/3)): below peak's 4 * log2 minus this a band would
+ * quantize past the largest value the escape book can send */
+#define QUANT_LIMIT_LOG    69.3f
+
+/* absolute threshold of hearing in dB SPL, after Terhardt */
+static float ath_db(float freq)
+{
+	float f = (freq < 20.0f ? 20.0f : freq) / 1000.0f;
+
+	return 3.64f * powf(f, -0.8f) -
+	       6.5f * expf(-0.6f * (f - 3.3f) * (f - 3.3f)) +
+	       0.001f * f * f * f * f;
+}
+
+static float bark(float freq)
+{
+	return 13.0f * atanf(0.00076f * freq) +
+	       3.5f * atanf((freq / 7500.0f) * (freq / 7500.0f));
+}
+
+static inline float band_freq(float bin, size_t m, uint32_t sample_rate)
+{
+	return bin * (float)sample_rate / (2.0f * (float)m);
+}
+
+/* absolute threshold of each band as MDCT energy, taking a full scale
+ * sine as FULL_SCALE_DB, and the band centers in bark */
+static void init_band_levels(const uint16_t *offsets, int num_bands,
+		size_t m, uint32_t sample_rate, float *ath, float *barks)
+{
+	double full_scale = (double)PCM_SCALE * (double)m;
+
+	full_scale *= full_scale;
+
+	for (int b = 0; b < num_bands; b++) {
+		float lowest = FLT_MAX;
+
+		for (int k = offsets[b]; k < offsets[b + 1]; k++) {
+			float db = ath_db(band_freq(k + 0.5f, m, sample_rate));
+			if (db < lowest)
+				lowest = db;
+		}
+
+		ath[b]   = (float)(full_scale *
+				pow(10.0, (lowest - FULL_SCALE_DB) / 10.0));
+		barks[b] = bark(band_freq((offsets[b] + offsets[b + 1]) * 0.5f,
+				m, sample_rate));
+	}
+}
+
+static int band_limit(const uint16_t *offsets, int num_bands, size_t m,
+		uint32_t sample_rate, uint32_t cutoff)
+{
+	int b = 0;
+
+	while (b < num_bands &&
+	       band_freq(offsets[b] + 0.5f, m, sample_rate) < (float)cutoff)
+		b++;
+	return b;
+}
+
+AacLcEncoder::AacLcEncoder():
+layout(NULL),
+sample_rate(0),
+channels(0),
+frame_bits(0),
+reservoir(0),
+reservoir_max(0),
+frames(0),
+sequence(AAC_ONLY_LONG),
+offsets(NULL),
+num_windows(1),
+window_len(AAC_FRAME_SAMPLES),
+cutoff_band(0),
+cutoff_long(0),
+cutoff_short(0),
+max_band(0),
+any_ms(false)
+{
+}
+
+AacLcEncoder::~AacLcEncoder()
+{
+	close();
+}
+
+bool AacLcEncoder::open(uint32_t rate, uint32_t channels_, uint32_t bitrate)
+{
+	close();
+
+	const struct aac_band_layout *found = aac_find_band_layout(rate);
+	if (!found || !channels_ || channels_ > AAC_MAX_CHANNELS) {
+		LOGI("AacLcEncoder: no support for %u Hz with %u channels",
+		     rate, channels_);
+		return false;
+	}
+
+	uint32_t max_bitrate = AAC_CHANNEL_BITS * channels_ * rate /
+			AAC_FRAME_SAMPLES;
+	if (bitrate > max_bitrate)
+		bitrate = max_bitrate;
+	if (bitrate < 8000 * channels_)
+		bitrate = 8000 * channels_;
+
+	sample_rate   = rate;
+	channels      = channels_;
+	frame_bits    = (uint32_t)((uint64_t)bitrate * AAC_FRAME_SAMPLES / rate);
+	reservoir     = 0;
+	reservoir_max = (int)(AAC_CHANNEL_BITS * channels) - (int)frame_bits;
+	if (reservoir_max < 0)
+		reservoir_max = 0;
+	frames        = 0;
+	sequence      = AAC_ONLY_LONG;
+
+	for (int i = 0; i < 2 * AAC_SHORT_SAMPLES; i++)
+		short_window[i] = PCM_SCALE *
+				(float)sin(M_PI * (i + 0.5) / (2 * AAC_SHORT_SAMPLES));
+
+	for (int i = 0; i < 2 * AAC_FRAME_SAMPLES; i++) {
+		float w = PCM_SCALE *
+				(float)sin(M_PI * (i + 0.5) / (2 * AAC_FRAME_SAMPLES));
+		int start_end = AAC_FRAME_SAMPLES + SHORT_START;
+		int stop_begin = SHORT_START;
+
+		long_windows[0][i] = w;
+
+		if (i < start_end)
+			long_windows[1][i] = i < AAC_FRAME_SAMPLES ? w : PCM_SCALE;
+		else if (i < start_end + AAC_SHORT_SAMPLES)
+			long_windows[1][i] = short_window[AAC_SHORT_SAMPLES +
+					i - start_end];
+		else
+			long_windows[1][i] = 0.0f;
+
+		if (i >= AAC_FRAME_SAMPLES)
+			long_windows[2][i] = w;
+		else if (i < stop_begin)
+			long_windows[2][i] = 0.0f;
+		else if (i < stop_begin + AAC_SHORT_SAMPLES)
+			long_windows[2][i] = short_window[i - stop_begin];
+		else
+			long_windows[2][i] = PCM_SCALE;
+	}
+
+	/* leave the top of the spectrum out rather than starving the rest */
+	uint32_t per_channel = bitrate / channels;
+	uint32_t cutoff = per_channel >= 96000 ? 20000 :
+			per_channel >= 64000 ? 16000 :
+			per_channel >= 48000 ? 14000 :
+			per_channel >= 32000 ? 11000 : 8000;
+
+	cutoff_long  = band_limit(found->long_offsets, found->num_long,
+			AAC_FRAME_SAMPLES, rate, cutoff);
+	cutoff_short = band_limit(found->short_offsets, found->num_short,
+			AAC_SHORT_SAMPLES, rate, cutoff);
+
+	init_band_levels(found->long_offsets, found->num_long,
+			AAC_FRAME_SAMPLES, rate, ath_long, bark_long);
+	init_band_levels(found->short_offsets, found->num_short,
+			AAC_SHORT_SAMPLES, rate, ath_short, bark_short);
+
+	mdct_long.init(2 * AAC_FRAME_SAMPLES);
+	mdct_short.init(2 * AAC_SHORT_SAMPLES);
+
+	chans.assign(channels, aac_channel());
+	for (size_t c = 0; c < chans.size(); c++) {
+		for (int b = 0; b < AAC_MAX_BANDS; b++)
+			chans[c].last_threshold[b] = FLT_MAX;
+	}
+
+	layout = found;
+	make_config(rate);
+	return true;
+}
+
+void AacLcEncoder::close()
+{
+	layout = NULL;
+	chans.clear();
+}
+
+bool AacLcEncoder::encode(const float *pcm, size_t count, const float *tail,
+		size_t tail_count, std::vector<uint8_t> &out)
+{
+	bool attack = false;
+	bool attack_next = false;
+
+	if (!layout || count + tail_count != AAC_FRAME_SAMPLES * channels)
+		return false;
+
+	load_frame(pcm, count, tail, tail_count);
+
+	for (size_t c = 0; c < chans.size(); c++) {
+		aac_channel &ch = chans[c];
+		attack |= ch.attack_next;
+		ch.attack_next = detect_attack(ch);
+		attack_next |= ch.attack_next;
+	}
+
+	/* the first frame only fills the lookahead */
+	if (frames++ == 0)
+		return false;
+
+	sequence = next_sequence(attack, attack_next);
+	if (sequence == AAC_EIGHT_SHORT) {
+		offsets     = layout->short_offsets;
+		num_windows = AAC_SHORT_WINDOWS;
+		window_len  = AAC_SHORT_SAMPLES;
+		cutoff_band = cutoff_short;
+	} else {
+		offsets     = layout->long_offsets;
+		num_windows = 1;
+		window_len  = AAC_FRAME_SAMPLES;
+		cutoff_band = cutoff_long;
+	}
+
+	for (size_t c = 0; c < chans.size(); c++) {
+		transform(chans[c]);
+		analyze(chans[c]);
+	}
+
+	any_ms = false;
+	if (channels == 2)
+		decide_mid_side();
+
+	/* transients draw harder on the reservoir than steady frames */
+	int target = (int)frame_bits +
+			reservoir / (sequence == AAC_EIGHT_SHORT ? 2 : 8);
+	int limit = AAC_CHANNEL_BITS * (int)channels;
+	if (target > limit)
+		target = limit;
+
+	choose_gain(target);
+
+	out.clear();
+	write_frame(out);
+
+	reservoir += (int)frame_bits - (int)out.size() * 8;
+	reservoir = clamp_int(reservoir, 0, reservoir_max);
+	return true;
+}
+
+void AacLcEncoder::load_frame(const float *pcm, size_t count,
+		const float *tail, size_t tail_count)
+{
+	float *dst[AAC_MAX_CHANNELS];
+	size_t c = 0;
+	size_t pos = 0;
+
+	for (size_t i = 0; i < chans.size(); i++) {
+		float *input = chans[i].input;
+		memmove(input, input + AAC_FRAME_SAMPLES,
+				2 * AAC_FRAME_SAMPLES * sizeof(float));
+		dst[i] = input + 2 * AAC_FRAME_SAMPLES;
+	}
+
+	for (int part = 0; part < 2; part++) {
+		for (size_t i = 0; i < count; i++) {
+			dst[c][pos] = pcm[i];
+			if (++c == channels) {
+				c = 0;
+				pos++;
+			}
+		}
+
+		pcm   = tail;
+		count = tail_count;
+	}
+}
+
+/* Checks the short window span of the block that ends with the newest
+ * frame: the back half of the frame before and the front half of the new
+ * one, in sub-blocks of a short window's hop. */
+bool AacLcEncoder::detect_attack(aac_channel &ch)
+{
+	const float *x = ch.input + 2 * AAC_FRAME_SAMPLES;
+	float *e = ch.sub_energy;
+	float last = ch.hp_last;
+
+	memmove(e, e + AAC_SHORT_WINDOWS, AAC_SHORT_WINDOWS * sizeof(float));
+
+	for (int s = 0; s < AAC_SHORT_WINDOWS; s++) {
+		float sum = 0.0f;
+
+		for (int i = 0; i < AAC_SHORT_SAMPLES; i++) {
+			float v = x[s * AAC_SHORT_SAMPLES + i];
+			float d = v - last;
+			sum += d * d;
+			last = v;
+		}
+
+		e[AAC_SHORT_WINDOWS + s] = sum;
+	}
+
+	ch.hp_last = last;
+
+	for (int s = AAC_SHORT_WINDOWS / 2; s < AAC_SHORT_WINDOWS * 3 / 2; s++) {
+		float before = (e[s - 1] + e[s - 2] + e[s - 3] + e[s - 4]) * 0.25f;
+		if (e[s] > ATTACK_FLOOR && e[s] > ATTACK_RATIO * before)
+			return true;
+	}
+
+	return false;
+}
+
+/* a short block has to be entered through a start block and left through
+ * a stop block so the window halves keep overlapping cleanly */
+enum aac_window_sequence AacLcEncoder::next_sequence(bool attack,
+		bool attack_next)
+{
+	switch (sequence) {
+	case AAC_LONG_START:
+		return AAC_EIGHT_SHORT;
+	case AAC_EIGHT_SHORT:
+		return attack || attack_next ? AAC_EIGHT_SHORT : AAC_LONG_STOP;
+	default:
+		return attack_next ? AAC_LONG_START : AAC_ONLY_LONG;
+	}
+}
+
+void AacLcEncoder::transform(aac_channel &ch)
+{
+	if (sequence == AAC_EIGHT_SHORT) {
+		for (int w = 0; w < AAC_SHORT_WINDOWS; w++) {
+			vec_mul(ch.windowed, ch.input + SHORT_START +
+					w * AAC_SHORT_SAMPLES, short_window,
+					2 * AAC_SHORT_SAMPLES);
+			mdct_short.forward(ch.windowed,
+					ch.spectrum + w * AAC_SHORT_SAMPLES);
+		}
+		return;
+	}
+
+	int idx = sequence == AAC_ONLY_LONG ? 0 :
+			(sequence == AAC_LONG_START ? 1 : 2);
+
+	vec_mul(ch.windowed, ch.input, long_windows[idx], 2 * AAC_FRAME_SAMPLES);
+	mdct_long.forward(ch.windowed, ch.spectrum);
+}
+
+/* Masking threshold per band: the band energy lowered by a signal to
+ * noise ratio that grows with tonality, spread across neighbouring bands,
+ * and kept above the threshold of hearing. */
+void AacLcEncoder::analyze(aac_channel &ch)
+{
+	bool is_short = sequence == AAC_EIGHT_SHORT;
+	const float *ath = is_short ? ath_short : ath_long;
+	const float *barks = is_short ? bark_short : bark_long;
+
+	for (int w = 0; w < num_windows; w++) {
+		const float *spec = ch.spectrum + w * window_len;
+		float *thr = ch.threshold + w * AAC_MAX_BANDS;
+
+		for (int b = 0; b < cutoff_band; b++) {
+			int idx = w * AAC_MAX_BANDS + b;
+			int start = offsets[b];
+			int width = offsets[b + 1] - start;
+			float tonality = 0.0f;
+
+			band_stats(spec + start, width, &ch.energy[idx],
+					&ch.root_sum[idx], &ch.peak[idx]);
+
+			/* spectral flatness in dB, 0 for noise */
+			if (ch.energy[idx] > 0.0f) {
+				float log_sum = 0.0f;
+				for (int k = start; k < start + width; k++)
+					log_sum += log2f(spec[k] * spec[k] + 1.0f);
+
+				float flatness = 3.0103f * (log_sum / width -
+						log2f(ch.energy[idx] / width + 1.0f));
+				tonality = flatness / -30.0f;
+				if (tonality > 1.0f)
+					tonality = 1.0f;
+				else if (tonality < 0.0f)
+					tonality = 0.0f;
+			}
+
+			float snr = tonality * (14.5f + barks[b]) +
+					(1.0f - tonality) * 5.5f;
+			if (snr > MAX_SNR_DB)
+				snr = MAX_SNR_DB;
+			thr[b] = ch.energy[idx] * powf(10.0f, -snr / 10.0f);
+		}
+
+		for (int b = 1; b < cutoff_band; b++) {
+			float spread = thr[b - 1] * powf(10.0f,
+					-SPREAD_UP_DB * (barks[b] - barks[b - 1]) / 10.0f);
+			if (spread > thr[b])
+				thr[b] = spread;
+		}
+		for (int b = cutoff_band - 2; b >= 0; b--) {
+			float spread = thr[b + 1] * powf(10.0f,
+					-SPREAD_DOWN_DB * (barks[b + 1] - barks[b]) / 10.0f);
+			if (spread > thr[b])
+				thr[b] = spread;
+		}
+
+		for (int b = 0; b < cutoff_band; b++) {
+			if (!is_short) {
+				float limit = PRE_ECHO_RATIO * ch.last_threshold[b];
+				ch.last_threshold[b] = thr[b];
+				if (thr[b] > limit)
+					thr[b] = limit;
+			}
+
+			if (thr[b] < ath[b])
+				thr[b] = ath[b];
+			estimate_sf(ch, w * AAC_MAX_BANDS + b);
+		}
+	}
+
+	if (is_short) {
+		for (int b = 0; b < AAC_MAX_BANDS; b++)
+			ch.last_threshold[b] = FLT_MAX;
+	}
+}
+
+/* Quantizing with step 2^(s/4) adds about (4/27) * 2^(3s/8) * sum(|x|^1/2)
+ * of noise to a band, so the scalefactor that just meets the threshold
+ * follows from the band's sum of square roots. */
+void AacLcEncoder::estimate_sf(aac_channel &ch, int idx)
+{
+	float thr = ch.threshold[idx];
+
+	if (ch.root_sum[idx] > 0.0f && ch.energy[idx] > thr)
+		ch.sf_estimate[idx] = (8.0f / 3.0f) *
+				log2f(27.0f * thr / (4.0f * ch.root_sum[idx]));
+	else
+		ch.sf_estimate[idx] = (float)SF_MAX;
+}
+
+/* Codes a band as mid and side when that needs fewer bits for the same
+ * noise. Noise in mid and side both ends up in left and right, so each
+ * only gets half of the lower threshold. */
+void AacLcEncoder::decide_mid_side()
+{
+	aac_channel &l = chans[0];
+	aac_channel &r = chans[1];
+
+	for (int w = 0; w < num_windows; w++) {
+		for (int b = 0; b < cutoff_band; b++) {
+			int idx = w * AAC_MAX_BANDS + b;
+			int start = w * window_len + offsets[b];
+			int width = offsets[b + 1] - offsets[b];
+			float *ls = l.spectrum + start;
+			float *rs = r.spectrum + start;
+			float em = 0.0f, es = 0.0f;
+
+			ms_used[idx] = false;
+
+			for (int k = 0; k < width; k++) {
+				float m = (ls[k] + rs[k]) * 0.5f;
+				float s = (ls[k] - rs[k]) * 0.5f;
+				em += m * m;
+				es += s * s;
+			}
+
+			float tl = l.threshold[idx];
+			float tr = r.threshold[idx];
+			float t = (tl < tr ? tl : tr) * 0.5f;
+			float pe_lr = log2f(1.0f + l.energy[idx] / tl) +
+					log2f(1.0f + r.energy[idx] / tr);
+			float pe_ms = log2f(1.0f + em / t) + log2f(1.0f + es / t);
+
+			if (pe_ms >= pe_lr)
+				continue;
+
+			for (int k = 0; k < width; k++) {
+				float m = (ls[k] + rs[k]) * 0.5f;
+				float s = (ls[k] - rs[k]) * 0.5f;
+				ls[k] = m;
+				rs[k] = s;
+			}
+
+			band_stats(ls, width, &l.energy[idx], &l.root_sum[idx],
+					&l.peak[idx]);
+			band_stats(rs, width, &r.energy[idx], &r.root_sum[idx],
+					&r.peak[idx]);
+			l.threshold[idx] = t;
+			r.threshold[idx] = t;
+			estimate_sf(l, idx);
+			estimate_sf(r, idx);
+
+			ms_used[idx] = true;
+			any_ms = true;
+		}
+	}
+}
+
+/* Quantizes every band at its estimated scalefactor moved by gain and
+ * returns the frame size in bits. Bands whose energy is under their
+ * threshold moved by the same gain are dropped. */
+int AacLcEncoder::quantize(int gain)
+{
+	float gain_scale = exp2f(0.375f * (float)gain);
+	int last_band = 0;
+
+	for (size_t c = 0; c < chans.size(); c++) {
+		aac_channel &ch = chans[c];
+		int prev_sf = -1;
+
+		for (int w = 0; w < num_windows; w++) {
+			const float *spec = ch.spectrum + w * window_len;
+			int *q = ch.quant + w * window_len;
+
+			for (int b = 0; b < cutoff_band; b++) {
+				int idx = w * AAC_MAX_BANDS + b;
+				int start = offsets[b];
+				int width = offsets[b + 1] - start;
+
+				ch.book[idx] = AAC_ZERO_BOOK;
+				ch.band_bits[idx] = 0;
+
+				if (ch.peak[idx] == 0.0f ||
+				    ch.energy[idx] <= ch.threshold[idx] * gain_scale) {
+					memset(q + start, 0, width * sizeof(int));
+					continue;
+				}
+
+				int s = (int)lrintf(ch.sf_estimate[idx]) + gain;
+				int s_min = (int)ceilf(4.0f * log2f(ch.peak[idx]) -
+						QUANT_LIMIT_LOG);
+				if (s < s_min)
+					s = s_min;
+
+				int sf = s + SF_OFFSET;
+				if (prev_sf >= 0)
+					sf = clamp_int(sf, prev_sf - SF_MAX_DIFF,
+							prev_sf + SF_MAX_DIFF);
+				sf = clamp_int(sf, SF_MIN + SF_OFFSET, SF_MAX + SF_OFFSET);
+
+				int peak = quantize_band(spec + start, q + start, width,
+						exp2f(-0.25f * (float)(sf - SF_OFFSET)));
+				ch.book[idx] = (uint8_t)choose_book(q + start, width, peak,
+						&ch.band_bits[idx]);
+				if (ch.book[idx] == AAC_ZERO_BOOK)
+					continue;
+
+				ch.sf[idx] = sf;
+				prev_sf = sf;
+				if (b + 1 > last_band)
+					last_band = b + 1;
+			}
+		}
+	}
+
+	max_band = last_band;
+	return count_bits();
+}
+
+/* lowest gain whose frame fits in target_bits, leaving the channels
+ * quantized at it */
+int AacLcEncoder::choose_gain(int target_bits)
+{
+	int lo = GAIN_MIN;
+	int hi = GAIN_MAX;
+	int last = lo;
+
+	if (quantize(lo) <= target_bits)
+		return lo;
+
+	while (hi - lo > 1) {
+		int mid = (lo + hi) / 2;
+		last = mid;
+		if (quantize(mid) <= target_bits)
+			hi = mid;
+		else
+			lo = mid;
+	}
+
+	if (last != hi)
+		quantize(hi);
+	return hi;
+}
+
+static inline int ics_info_bits(bool is_short)
+{
+	return 4 + (is_short ? 4 + 7 : 6 + 1);
+}
+
+int AacLcEncoder::count_bits()
+{
+	bool is_short = sequence == AAC_EIGHT_SHORT;
+	int bits = 3 + 4;
+
+	if (channels == 2) {
+		bits += 1 + ics_info_bits(is_short) + 2;
+		if (any_ms)
+			bits += num_windows * max_band;
+	}
+
+	for (size_t c = 0; c < chans.size(); c++) {
+		bits += count_channel_bits(chans[c]);
+		if (channels == 1)
+			bits += ics_info_bits(is_short);
+	}
+
+	/* end element and byte alignment */
+	return bits + 3 + 7;
+}
+
+int AacLcEncoder::count_channel_bits(const aac_channel &ch)
+{
+	int sect_bits = sequence == AAC_EIGHT_SHORT ? 3 : 5;
+	int sect_esc = (1 << sect_bits) - 1;
+	int prev_sf = -1;
+	/* global gain, then no pulse, tns or gain control data */
+	int bits = 8 + 3;
+
+	for (int w = 0; w < num_windows; w++) {
+		const uint8_t *book = ch.book + w * AAC_MAX_BANDS;
+
+		for (int b = 0; b < max_band;) {
+			int len = 1;
+			while (b + len < max_band && book[b + len] == book[b])
+				len++;
+			bits += 4 + sect_bits * (len / sect_esc + 1);
+			b += len;
+		}
+
+		for (int b = 0; b < max_band; b++) {
+			int idx = w * AAC_MAX_BANDS + b;
+			if (book[b] == AAC_ZERO_BOOK)
+				continue;
+
+			if (prev_sf < 0)
+				prev_sf = ch.sf[idx];
+			bits += aac_scalefactor_bits[ch.sf[idx] - prev_sf +
+					AAC_SCALEFACTOR_ZERO];
+			bits += ch.band_bits[idx];
+			prev_sf = ch.sf[idx];
+		}
+	}
+
+	return bits;
+}
+
+/* ------------------------------------------------------------------------- */
+
+void AacLcEncoder::write_frame(std::vector<uint8_t> &out)
+{
+	bit_writer bw(out);
+
+	if (channels == 1) {
+		bw.put(AAC_ID_SCE, 3);
+		bw.put(0, 4);
+		write_ics(bw, chans[0], false);
+	} else {
+		bw.put(AAC_ID_CPE, 3);
+		bw.put(0, 4);
+		bw.put(1, 1);
+		write_ics_info(bw);
+
+		bw.put(any_ms ? 1 : 0, 2);
+		if (any_ms) {
+			for (int w = 0; w < num_windows; w++) {
+				for (int b = 0; b < max_band; b++)
+					bw.put(ms_used[w * AAC_MAX_BANDS + b] ? 1 : 0, 1);
+			}
+		}
+
+		write_ics(bw, chans[0], true);
+		write_ics(bw, chans[1], true);
+	}
+
+	bw.put(AAC_ID_END, 3);
+	bw.align();
+}
+
+/* sine windows only; short blocks put each window in a group of its own */
+void AacLcEncoder::write_ics_info(bit_writer &bw)
+{
+	bw.put(0, 1);
+	bw.put(sequence, 2);
+	bw.put(0, 1);
+
+	if (sequence == AAC_EIGHT_SHORT) {
+		bw.put(max_band, 4);
+		bw.put(0, 7);
+	} else {
+		bw.put(max_band, 6);
+		bw.put(0, 1);
+	}
+}
+
+void AacLcEncoder::write_ics(bit_writer &bw, const aac_channel &ch,
+		bool common_window)
+{
+	int sect_bits = sequence == AAC_EIGHT_SHORT ? 3 : 5;
+	int sect_esc = (1 << sect_bits) - 1;
+	int global_gain = -1;
+
+	/* the first scalefactor goes out as the global gain */
+	for (int w = 0; w < num_windows && global_gain < 0; w++) {
+		for (int b = 0; b < max_band; b++) {
+			int idx = w * AAC_MAX_BANDS + b;
+			if (ch.book[idx] != AAC_ZERO_BOOK) {
+				global_gain = ch.sf[idx];
+				break;
+			}
+		}
+	}
+
+	if (global_gain < 0)
+		global_gain = SF_OFFSET;
+
+	bw.put(global_gain, 8);
+	if (!common_window)
+		write_ics_info(bw);
+
+	for (int w = 0; w < num_windows; w++) {
+		const uint8_t *book = ch.book + w * AAC_MAX_BANDS;
+
+		for (int b = 0; b < max_band;) {
+			int len = 1;
+			while (b + len < max_band && book[b + len] == book[b])
+				len++;
+
+			bw.put(book[b], 4);
+			int rest = len;
+			while (rest >= sect_esc) {
+				bw.put(sect_esc, sect_bits);
+				rest -= sect_esc;
+			}
+			bw.put(rest, sect_bits);
+			b += len;
+		}
+	}
+
+	int prev_sf = global_gain;
+	for (int w = 0; w < num_windows; w++) {
+		for (int b = 0; b < max_band; b++) {
+			int idx = w * AAC_MAX_BANDS + b;
+			if (ch.book[idx] == AAC_ZERO_BOOK)
+				continue;
+
+			int code = ch.sf[idx] - prev_sf + AAC_SCALEFACTOR_ZERO;
+			bw.put(aac_scalefactor_codes[code], aac_scalefactor_bits[code]);
+			prev_sf = ch.sf[idx];
+		}
+	}
+
+	/* pulse, tns and gain control data */
+	bw.put(0, 3);
+
+	for (int w = 0; w < num_windows; w++) {
+		for (int b = 0; b < max_band; b++) {
+			int idx = w * AAC_MAX_BANDS + b;
+			if (ch.book[idx] != AAC_ZERO_BOOK)
+				write_spectral(bw, ch.book[idx],
+						ch.quant + w * window_len + offsets[b],
+						offsets[b + 1] - offsets[b]);
+		}
+	}
+}
+
+/* object type (5) | rate index (4) | channel config (4) |
+ * GASpecificConfig (3), all flags clear */
+void AacLcEncoder::make_config(uint32_t rate)
+{
+	const struct aac_band_layout *found = aac_find_band_layout(rate);
+	uint32_t idx = found ? found->rate_idx : 0xf;
+
+	config.resize(2);
+	config[0] = (uint8_t)((AAC_OBJECT_LC << 3) | (idx >> 1));
+	config[1] = (uint8_t)(((idx & 1) << 7) | ((channels & 0xf) << 3));
+}
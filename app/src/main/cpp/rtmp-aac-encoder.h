@@ -0,0 +1,152 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#include "rtmp-aac-tables.h"
+
+#define AAC_FRAME_SAMPLES  1024
+#define AAC_SHORT_SAMPLES  128
+#define AAC_SHORT_WINDOWS  8
+#define AAC_MAX_CHANNELS   2
+#define AAC_MAX_BANDS      64
+/* one frame of MDCT overlap plus one frame of lookahead for the block
+ * switching decision */
+#define AAC_ENCODER_DELAY  (2 * AAC_FRAME_SAMPLES)
+
+enum aac_window_sequence {
+	AAC_ONLY_LONG,
+	AAC_LONG_START,
+	AAC_EIGHT_SHORT,
+	AAC_LONG_STOP,
+};
+
+/* MDCT of n windowed samples to n/2 coefficients, scaled like the spec's
+ * analysis filterbank, on top of an n/8 point complex FFT */
+class aac_mdct
+{
+public:
+	void init(size_t n);
+	void forward(const float *in, float *out);
+
+private:
+	size_t                n;
+	std::vector<float>    pre_re, pre_im;
+	std::vector<float>    post_re, post_im;
+	std::vector<float>    fft_re, fft_im;
+	std::vector<uint16_t> bitrev;
+
+	std::vector<float>    fold;
+	std::vector<float>    re, im;
+	std::vector<float>    tmp_re, tmp_im;
+};
+
+struct aac_channel {
+	/* the frame being coded, the lookahead frame and the frame before */
+	float   input[3 * AAC_FRAME_SAMPLES];
+	float   windowed[2 * AAC_FRAME_SAMPLES];
+	float   spectrum[AAC_FRAME_SAMPLES];
+
+	/* transient detector: highpass state and sub-block energies of the
+	 * last two frames */
+	float   hp_last;
+	float   sub_energy[2 * AAC_SHORT_WINDOWS];
+	bool    attack_next;
+
+	/* per window and band, long blocks only use window 0 */
+	float   energy[AAC_SHORT_WINDOWS * AAC_MAX_BANDS];
+	float   root_sum[AAC_SHORT_WINDOWS * AAC_MAX_BANDS];
+	float   peak[AAC_SHORT_WINDOWS * AAC_MAX_BANDS];
+	float   threshold[AAC_SHORT_WINDOWS * AAC_MAX_BANDS];
+	float   sf_estimate[AAC_SHORT_WINDOWS * AAC_MAX_BANDS];
+	float   last_threshold[AAC_MAX_BANDS];
+
+	int     sf[AAC_SHORT_WINDOWS * AAC_MAX_BANDS];
+	uint8_t book[AAC_SHORT_WINDOWS * AAC_MAX_BANDS];
+	int     band_bits[AAC_SHORT_WINDOWS * AAC_MAX_BANDS];
+	int     quant[AAC_FRAME_SAMPLES];
+};
+
+/* AAC-LC encoder: long and eight-short blocks with sine windows, a
+ * simple psychoacoustic model, per band mid/side stereo and a global gain
+ * search against a bit reservoir. Up to two channels. */
+class AacLcEncoder
+{
+public:
+	AacLcEncoder();
+	~AacLcEncoder();
+
+	bool open(uint32_t sample_rate, uint32_t channels, uint32_t bitrate);
+	void close();
+	bool is_open() const {return layout != NULL;}
+
+	/* Takes one frame of interleaved samples in [-1, 1]; tail continues
+	 * pcm for input that wrapped around a ring. A raw AAC frame comes out
+	 * for every frame after the first, AAC_ENCODER_DELAY samples behind
+	 * the input. */
+	bool encode(const float *pcm, size_t count, const float *tail,
+			size_t tail_count, std::vector<uint8_t> &out);
+
+	/* AudioSpecificConfig for the FLV sequence header */
+	const std::vector<uint8_t> &get_config() const {return config;}
+
+private:
+	void load_frame(const float *pcm, size_t count, const float *tail,
+			size_t tail_count);
+	bool detect_attack(aac_channel &ch);
+	enum aac_window_sequence next_sequence(bool attack, bool attack_next);
+
+	void transform(aac_channel &ch);
+	void analyze(aac_channel &ch);
+	void estimate_sf(aac_channel &ch, int idx);
+	void decide_mid_side();
+
+	int quantize(int gain);
+	int choose_gain(int target_bits);
+	int count_bits();
+	int count_channel_bits(const aac_channel &ch);
+
+	void write_frame(std::vector<uint8_t> &out);
+	void write_ics_info(struct bit_writer &bw);
+	void write_ics(struct bit_writer &bw, const aac_channel &ch,
+			bool common_window);
+
+	void make_config(uint32_t sample_rate);
+
+	const struct aac_band_layout *layout;
+	uint32_t             sample_rate;
+	uint32_t             channels;
+	uint32_t             frame_bits;
+	int                  reservoir;
+	int                  reservoir_max;
+	uint32_t             frames;
+
+	/* layout of the block being coded; bands from cutoff_band up are
+	 * above the bandwidth the bitrate allows, max_band is the number of
+	 * bands sent after dropping empty ones at the top */
+	enum aac_window_sequence sequence;
+	const uint16_t       *offsets;
+	int                  num_windows;
+	int                  window_len;
+	int                  cutoff_band;
+	int                  cutoff_long;
+	int                  cutoff_short;
+	int                  max_band;
+
+	std::vector<aac_channel> chans;
+	bool                 ms_used[AAC_SHORT_WINDOWS * AAC_MAX_BANDS];
+	bool                 any_ms;
+
+	/* only long, long start and long stop, scaled to 16 bit range */
+	float                long_windows[3][2 * AAC_FRAME_SAMPLES];
+	float                short_window[2 * AAC_SHORT_SAMPLES];
+	float                ath_long[AAC_MAX_BANDS];
+	float                ath_short[AAC_MAX_BANDS];
+	float                bark_long[AAC_MAX_BANDS];
+	float                bark_short[AAC_MAX_BANDS];
+	aac_mdct             mdct_long;
+	aac_mdct             mdct_short;
+
+	std::vector<uint8_t> config;
+};
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+
+#define AAC_SPECTRAL_BOOKS     11
+#define AAC_SCALEFACTOR_CODES  121
+/* index of a scalefactor difference of 0 in the scalefactor codebook */
+#define AAC_SCALEFACTOR_ZERO   60
+
+extern const uint16_t *const aac_spectral_codes[AAC_SPECTRAL_BOOKS + 1];
+extern const uint8_t *const aac_spectral_bits[AAC_SPECTRAL_BOOKS + 1];
+
+extern const uint32_t aac_scalefactor_codes[AAC_SCALEFACTOR_CODES];
+extern const uint8_t aac_scalefactor_bits[AAC_SCALEFACTOR_CODES];
+
+/* Scalefactor bands of one sample rate. Offsets run from 0 up to the
+ * window length, so band b covers [offsets[b], offsets[b + 1]). */
+struct aac_band_layout {
+	uint32_t       sample_rate;
+	uint8_t        rate_idx;
+	uint8_t        num_long;
+	const uint16_t *long_offsets;
+	uint8_t        num_short;
+	const uint16_t *short_offsets;
+};
+
+/* NULL for rates the encoder has no band tables for */
+const struct aac_band_layout *aac_find_band_layout(uint32_t sample_rate);
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "rtmp-span-writer.h"
+
+/* AMF0 objects whose members are fixed where they are written. Each member
+ * is a named field of a known type, the list of them is the schema, and
+ * the encoded size and the writes are unrolled by the compiler over it, so
+ * an object is sized exactly and written in one pass with no map, no
+ * temporary and no allocation besides the span itself. A field that is not
+ * present is left out of both. */
+struct amf_str {
+	const char *data;
+	size_t      len;
+};
+
+template<typename T>
+struct amf_field {
+	const char *name;
+	size_t      name_len;
+	T           value;
+	bool        present;
+};
+
+template<size_t N>
+inline amf_field<double> amf_number_field(const char (&name)[N], double value,
+		bool present = true)
+{
+	amf_field<double> f = {name, N - 1, value, present};
+	return f;
+}
+
+template<size_t N>
+inline amf_field<bool> amf_bool_field(const char (&name)[N], bool value,
+		bool present = true)
+{
+	amf_field<bool> f = {name, N - 1, value, present};
+	return f;
+}
+
+template<size_t N>
+inline amf_field<amf_str> amf_string_field(const char (&name)[N],
+		const char *value, size_t len, bool present = true)
+{
+	amf_field<amf_str> f = {name, N - 1, {value, len}, present};
+	return f;
+}
+
+inline constexpr size_t amf_value_size(double)
+{
+	return span_writer::amf_number_size();
+}
+
+inline constexpr size_t amf_value_size(bool)
+{
+	return span_writer::amf_bool_size();
+}
+
+inline constexpr size_t amf_value_size(const amf_str &str)
+{
+	return span_writer::amf_string_size(str.len);
+}
+
+inline void write_amf_value(span_writer &s, double value)
+{
+	s.write_amf_number(value);
+}
+
+inline void write_amf_value(span_writer &s, bool value)
+{
+	s.write_amf_bool(value);
+}
+
+inline void write_amf_value(span_writer &s, const amf_str &str)
+{
+	s.write_amf_string(str.data, str.len);
+}
+
+inline constexpr size_t amf_fields_size()
+{
+	return 0;
+}
+
+template<typename T, typename... Fields>
+inline constexpr size_t amf_fields_size(const amf_field<T> &field,
+		const Fields&... rest)
+{
+	return (field.present ? span_writer::amf_name_size(field.name_len) +
+	                        amf_value_size(field.value) : 0) +
+	       amf_fields_size(rest...);
+}
+
+inline constexpr uint32_t amf_fields_count()
+{
+	return 0;
+}
+
+template<typename T, typename... Fields>
+inline constexpr uint32_t amf_fields_count(const amf_field<T> &field,
+		const Fields&... rest)
+{
+	return (field.present ? 1 : 0) + amf_fields_count(rest...);
+}
+
+inline void write_amf_fields(span_writer &)
+{
+}
+
+template<typename T, typename... Fields>
+inline void write_amf_fields(span_writer &s, const amf_field<T> &field,
+		const Fields&... rest)
+{
+	if (field.present) {
+		s.write_amf_name(field.name, field.name_len);
+		write_amf_value(s, field.value);
+	}
+	write_amf_fields(s, rest...);
+}
+
+/* marker, count, members, end marker */
+template<typename... Fields>
+inline constexpr size_t amf_ecma_array_size(const Fields&... fields)
+{
+	return 1 + 4 + amf_fields_size(fields...) +
+	       span_writer::amf_object_end_size();
+}
+
+template<typename... Fields>
+inline void write_amf_ecma_array(span_writer &s, const Fields&... fields)
+{
+	s.write_uint8(AMF_ECMA_ARRAY);
+	s.write_uint32(amf_fields_count(fields...));
+	write_amf_fields(s, fields...);
+	s.write_amf_object_end();
+}
+
+template<typename... Fields>
+inline constexpr size_t amf_object_size(const Fields&... fields)
+{
+	return 1 + amf_fields_size(fields...) + span_writer::amf_object_end_size();
+}
+
+template<typename... Fields>
+inline void write_amf_object(span_writer &s, const Fields&... fields)
+{
+	s.write_uint8(AMF_OBJECT);
+	write_amf_fields(s, fields...);
+	s.write_amf_object_end();
+}
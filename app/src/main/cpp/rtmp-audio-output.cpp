@@ -4,6 +4,10 @@
 #include "util/dstr.h"
 #include "util/util_uint128.h"
 #include "rtmp-defs.h"
+#include "rtmp-audio-resampler.h"
+
+#define SOURCE_JITTER_MS  40
+#define SOURCE_RESYNC_NS  50000000ULL
 
 AudioOutput::AudioOutput(audio_output_info &audio_info):
 block_size(0),
@@ -14,12 +18,21 @@ sample_rate(0)
 	channels     = audio_info.speakers;
 	sample_rate  = audio_info.samples_per_sec;
 	block_size   = get_audio_bytes_per_channel(audio_info.format);
+
+	pthread_mutex_init(&mix_mutex, NULL);
 }
 
 AudioOutput::~AudioOutput()
 {
     output_close();
     mixe.inputs.clear();
+    free_unused_converters();
+
+    for (size_t i = 0; i < mixe.sources.size(); i++)
+        destroy_source(mixe.sources[i]);
+    mixe.sources.clear();
+    audio_resampler_destroy(mixe.encoder);
+    pthread_mutex_destroy(&mix_mutex);
 }
 
 size_t AudioOutput::get_audio_bytes_per_channel(enum audio_format format)
@@ -54,9 +67,102 @@ void AudioOutput::on_media_thread_create()
 
 void AudioOutput::on_input_mutex(media_data &frame)
 {
+    for (size_t i = 0; i < mixe.converters.size(); i++)
+        mixe.converters[i].ready = false;
+
     for (size_t i = mixe.inputs.size(); i > 0; i--) {
-        mixe.inputs[i-1].callback(mixe.inputs[i-1].param, frame);
+        audio_input &input = mixe.inputs[i-1];
+        input.callback(input.param, convert_frame(input.conversion, frame));
+    }
+}
+
+bool AudioOutput::is_output_format(const audio_convert_info &conversion)
+{
+    return conversion.format == info.format &&
+           conversion.speakers == info.speakers &&
+           conversion.samples_per_sec == info.samples_per_sec;
+}
+
+audio_convert_cache *AudioOutput::get_converter(
+        const audio_convert_info &conversion)
+{
+    for (size_t i = 0; i < mixe.converters.size(); i++) {
+        audio_convert_info &cur = mixe.converters[i].conversion;
+        if (cur.format == conversion.format &&
+            cur.speakers == conversion.speakers &&
+            cur.samples_per_sec == conversion.samples_per_sec)
+            return &mixe.converters[i];
+    }
+
+    audio_convert_info src;
+    src.format          = info.format;
+    src.speakers        = info.speakers;
+    src.samples_per_sec = info.samples_per_sec;
+
+    audio_convert_cache cache;
+    cache.conversion = conversion;
+    cache.resampler  = audio_resampler_create(&conversion, &src);
+    if (!cache.resampler) {
+        LOGI("AudioOutput: cannot convert to format %d, %d channels, %u Hz",
+             (int)conversion.format, (int)conversion.speakers,
+             conversion.samples_per_sec);
+        return NULL;
+    }
+
+    mixe.converters.push_back(cache);
+    return &mixe.converters.back();
+}
+
+void AudioOutput::free_unused_converters()
+{
+    for (size_t i = mixe.converters.size(); i > 0; i--) {
+        audio_convert_cache &cache = mixe.converters[i-1];
+        bool used = false;
+
+        for (size_t j = 0; j < mixe.inputs.size(); j++) {
+            const audio_convert_info &cur = mixe.inputs[j].conversion;
+            if (cur.format == cache.conversion.format &&
+                cur.speakers == cache.conversion.speakers &&
+                cur.samples_per_sec == cache.conversion.samples_per_sec)
+                used = true;
+        }
+
+        if (!used) {
+            audio_resampler_destroy(cache.resampler);
+            mixe.converters.erase(mixe.converters.begin() + (i-1));
+        }
+    }
+}
+
+/* inputs that share a target format share one conversion of the frame */
+media_data &AudioOutput::convert_frame(const audio_convert_info &conversion,
+        media_data &frame)
+{
+    if (is_output_format(conversion))
+        return frame;
+
+    audio_convert_cache *cache = get_converter(conversion);
+    if (!cache)
+        return frame;
+
+    if (!cache->ready) {
+        size_t frame_size = get_audio_bytes_per_channel(info.format) *
+                            audio_get_channels(info.speakers);
+        uint32_t in_frames = frame_size ?
+                             (uint32_t)(frame.data.size() / frame_size) : 0;
+        uint32_t out_frames = 0;
+        uint64_t ts_offset = 0;
+
+        cache->data.data.clear();
+        if (in_frames)
+            audio_resampler_resample(cache->resampler, cache->data.data,
+                    &out_frames, &ts_offset, &frame.data[0], in_frames);
+
+        cache->data.timestamp = frame.timestamp - ts_offset;
+        cache->ready = true;
     }
+
+    return cache->data;
 }
 
 uint32_t AudioOutput::get_sample_rate()
@@ -121,8 +227,10 @@ void AudioOutput::disconnect(audio_output_callback_t callback, void *param)
     pthread_mutex_lock(&input_mutex);
 
     size_t idx = audio_get_input_idx(callback, param);
-    if (idx != DARRAY_INVALID)
+    if (idx != DARRAY_INVALID) {
         mixe.inputs.erase(mixe.inputs.begin()+idx);
+        free_unused_converters();
+    }
 
     pthread_mutex_unlock(&input_mutex);
 }
@@ -135,4 +243,302 @@ void AudioOutput::UpdateCache(media_data &input_frame)
     update_input_frame(input_frame);
 }
 
+audio_mix_source *AudioOutput::find_source(size_t id)
+{
+    for (size_t i = 0; i < mixe.sources.size(); i++) {
+        if (mixe.sources[i]->id == id)
+            return mixe.sources[i];
+    }
+    return NULL;
+}
+
+audio_mix_source *AudioOutput::create_source(size_t id,
+        const struct audio_convert_info *conversion, float gain,
+        uint32_t jitter_ms)
+{
+    audio_convert_info dst;
+    dst.format          = AUDIO_FORMAT_FLOAT_PLANAR;
+    dst.speakers        = info.speakers;
+    dst.samples_per_sec = info.samples_per_sec;
+
+    audio_convert_info src = dst;
+    if (conversion)
+        src = *conversion;
+    if (src.format == AUDIO_FORMAT_UNKNOWN)
+        src.format = info.format;
+    if (src.speakers == SPEAKERS_UNKNOWN)
+        src.speakers = info.speakers;
+    if (!src.samples_per_sec)
+        src.samples_per_sec = info.samples_per_sec;
+
+    size_t channels = audio_get_channels(info.speakers);
+    if (!channels || channels > MAX_AUDIO_CHANNELS)
+        return NULL;
+
+    audio_resampler_t *resampler = audio_resampler_create(&dst, &src);
+    if (!resampler)
+        return NULL;
+
+    audio_mix_source *source = new audio_mix_source;
+    source->id         = id;
+    source->conversion = src;
+    source->gain       = gain;
+    source->jitter_ns  = (uint64_t)jitter_ms * 1000000ULL;
+    source->resampler  = resampler;
+    source->channels   = channels;
+    return source;
+}
+
+void AudioOutput::destroy_source(audio_mix_source *source)
+{
+    audio_resampler_destroy(source->resampler);
+    delete source;
+}
 
+bool AudioOutput::add_source(size_t id, const struct audio_convert_info *conversion,
+        float gain, uint32_t jitter_ms)
+{
+    audio_mix_source *source = create_source(id, conversion, gain, jitter_ms);
+    if (!source)
+        return false;
+
+    pthread_mutex_lock(&mix_mutex);
+    bool added = !find_source(id);
+    if (added)
+        mixe.sources.push_back(source);
+    pthread_mutex_unlock(&mix_mutex);
+
+    if (!added)
+        destroy_source(source);
+    return added;
+}
+
+void AudioOutput::remove_source(size_t id)
+{
+    pthread_mutex_lock(&mix_mutex);
+    for (size_t i = 0; i < mixe.sources.size(); i++) {
+        if (mixe.sources[i]->id == id) {
+            destroy_source(mixe.sources[i]);
+            mixe.sources.erase(mixe.sources.begin() + i);
+            break;
+        }
+    }
+
+    /* whatever the others were waiting on may be complete now */
+    mix_ready_ticks();
+    pthread_mutex_unlock(&mix_mutex);
+}
+
+void AudioOutput::set_source_gain(size_t id, float gain)
+{
+    pthread_mutex_lock(&mix_mutex);
+    audio_mix_source *source = find_source(id);
+    if (source)
+        source->gain = gain;
+    pthread_mutex_unlock(&mix_mutex);
+}
+
+size_t AudioOutput::source_frames(audio_mix_source &source)
+{
+    return source.planes[0].size / sizeof(float);
+}
+
+uint64_t AudioOutput::source_end_ts(audio_mix_source &source)
+{
+    return source.start_ts + (uint64_t)source_frames(source) *
+           1000000000ULL / info.samples_per_sec;
+}
+
+void AudioOutput::drop_source_frames(audio_mix_source &source, size_t frames)
+{
+    for (size_t c = 0; c < source.channels; c++)
+        source.planes[c].pop_front(frames * sizeof(float));
+    source.start_ts += (uint64_t)frames * 1000000000ULL / info.samples_per_sec;
+}
+
+/* the front of a plane may wrap around the end of its storage */
+void AudioOutput::mix_source_plane(float *dst, circlebuffer &plane,
+        float gain, size_t frames)
+{
+    size_t bytes = frames * sizeof(float);
+    size_t head  = plane.capacity - plane.start_pos;
+    if (head > bytes)
+        head = bytes;
+
+    audio_mix_float(dst, (const float *)plane.get_data(0), gain,
+            head / sizeof(float));
+    if (head < bytes)
+        audio_mix_float(dst + head / sizeof(float),
+                (const float *)plane.data, gain,
+                (bytes - head) / sizeof(float));
+}
+
+void AudioOutput::push_source_data(size_t id, media_data &frame)
+{
+    pthread_mutex_lock(&mix_mutex);
+
+    audio_mix_source *source = find_source(id);
+    if (!source) {
+        source = create_source(id, NULL, 1.0f, SOURCE_JITTER_MS);
+        if (!source) {
+            pthread_mutex_unlock(&mix_mutex);
+            return;
+        }
+        mixe.sources.push_back(source);
+    }
+
+    size_t frame_size =
+            audio_get_bytes_per_channel(source->conversion.format) *
+            audio_get_channels(source->conversion.speakers);
+    uint32_t in_frames = frame_size ?
+            (uint32_t)(frame.data.size() / frame_size) : 0;
+    uint32_t out_frames = 0;
+    uint64_t ts_offset = 0;
+
+    if (!in_frames || !audio_resampler_resample(source->resampler,
+            mixe.scratch, &out_frames, &ts_offset, &frame.data[0],
+            in_frames) || !out_frames) {
+        pthread_mutex_unlock(&mix_mutex);
+        return;
+    }
+
+    uint64_t ts = frame.timestamp - ts_offset;
+
+    /* sample continuity wins over timestamp jitter, only a real gap or
+     * overlap restarts the source at the new timestamp */
+    if (!source->started || !source_frames(*source)) {
+        source->start_ts = ts;
+        source->started  = true;
+    } else {
+        uint64_t expected = source_end_ts(*source);
+        uint64_t diff = ts > expected ? ts - expected : expected - ts;
+        if (diff > SOURCE_RESYNC_NS) {
+            for (size_t c = 0; c < source->channels; c++)
+                source->planes[c].clear();
+            source->start_ts = ts;
+        }
+    }
+
+    const float *planes = (const float *)&mixe.scratch[0];
+    for (size_t c = 0; c < source->channels; c++)
+        source->planes[c].push_back(planes + c * out_frames,
+                out_frames * sizeof(float));
+
+    uint64_t end_ts = source_end_ts(*source);
+    if (end_ts > mixe.newest_ts)
+        mixe.newest_ts = end_ts;
+
+    if (!mixe.mix_started) {
+        mixe.mix_start_ts = source->start_ts;
+        mixe.mix_ticks    = 0;
+        mixe.mix_started  = true;
+    }
+
+    mix_ready_ticks();
+    pthread_mutex_unlock(&mix_mutex);
+}
+
+/* a tick goes out once every source covers it, or once a source is
+ * further behind the newest data than its jitter allowance */
+void AudioOutput::mix_ready_ticks()
+{
+    if (!mixe.mix_started || mixe.sources.empty())
+        return;
+
+    for (;;) {
+        uint64_t tick_ts  = mixe.mix_start_ts + mixe.mix_ticks *
+                AUDIO_OUTPUT_FRAMES * 1000000000ULL / info.samples_per_sec;
+        uint64_t tick_end = mixe.mix_start_ts + (mixe.mix_ticks + 1) *
+                AUDIO_OUTPUT_FRAMES * 1000000000ULL / info.samples_per_sec;
+        bool ready = true;
+
+        for (size_t i = 0; i < mixe.sources.size(); i++) {
+            audio_mix_source &source = *mixe.sources[i];
+            bool covered = source.started && source_end_ts(source) >= tick_end;
+            bool late    = mixe.newest_ts >= tick_end + source.jitter_ns;
+            if (!covered && !late) {
+                ready = false;
+                break;
+            }
+        }
+
+        if (!ready)
+            break;
+
+        mix_tick(tick_ts);
+        mixe.mix_ticks++;
+    }
+}
+
+void AudioOutput::mix_tick(uint64_t tick_ts)
+{
+    size_t channels = audio_get_channels(info.speakers);
+    uint32_t rate = info.samples_per_sec;
+
+    mixe.buffer.assign(channels * AUDIO_OUTPUT_FRAMES, 0.0f);
+
+    for (size_t i = 0; i < mixe.sources.size(); i++) {
+        audio_mix_source &source = *mixe.sources[i];
+        size_t buffered = source_frames(source);
+        size_t offset = 0;
+
+        if (!source.started || !buffered)
+            continue;
+
+        /* too old for this tick */
+        if (source.start_ts < tick_ts) {
+            size_t skip = (size_t)((tick_ts - source.start_ts) * rate /
+                                   1000000000ULL);
+            drop_source_frames(source, skip < buffered ? skip : buffered);
+            buffered = source_frames(source);
+        } else {
+            offset = (size_t)((source.start_ts - tick_ts) * rate /
+                              1000000000ULL);
+        }
+
+        if (offset >= AUDIO_OUTPUT_FRAMES || !buffered)
+            continue;
+
+        size_t frames = AUDIO_OUTPUT_FRAMES - offset;
+        if (frames > buffered)
+            frames = buffered;
+
+        for (size_t c = 0; c < channels; c++)
+            mix_source_plane(&mixe.buffer[c * AUDIO_OUTPUT_FRAMES + offset],
+                    source.planes[c], source.gain, frames);
+
+        drop_source_frames(source, frames);
+    }
+
+    audio_clamp_float(&mixe.buffer[0], mixe.buffer.size());
+
+    media_data &frame = mixe.frame;
+    frame.timestamp = tick_ts;
+
+    if (info.format == AUDIO_FORMAT_FLOAT_PLANAR) {
+        frame.data.resize(mixe.buffer.size() * sizeof(float));
+        memcpy(&frame.data[0], &mixe.buffer[0], frame.data.size());
+    } else {
+        if (!mixe.encoder) {
+            audio_convert_info src;
+            src.format          = AUDIO_FORMAT_FLOAT_PLANAR;
+            src.speakers        = info.speakers;
+            src.samples_per_sec = info.samples_per_sec;
+
+            audio_convert_info dst = src;
+            dst.format = info.format;
+            mixe.encoder = audio_resampler_create(&dst, &src);
+        }
+
+        uint32_t out_frames = 0;
+        uint64_t ts_offset = 0;
+        if (!audio_resampler_resample(mixe.encoder, frame.data, &out_frames,
+                &ts_offset, (const uint8_t *)&mixe.buffer[0],
+                AUDIO_OUTPUT_FRAMES))
+            return;
+    }
+
+    /* straight to the inputs: the single frame cache behind UpdateCache
+     * would drop ticks that are mixed back to back */
+    output_frame(frame);
+}
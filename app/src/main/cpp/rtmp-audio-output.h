@@ -48,6 +48,15 @@ public:
 
 	const audio_output_info* get_info();
 
+	/* several pcm sources (mic, app audio, ...) can be pushed instead of
+	 * UpdateCache, they are mixed per AUDIO_OUTPUT_FRAMES tick. A source
+	 * is added with the output format on its first push if needed. */
+	bool add_source(size_t id, const struct audio_convert_info *conversion,
+			float gain, uint32_t jitter_ms);
+	void remove_source(size_t id);
+	void set_source_gain(size_t id, float gain);
+	void push_source_data(size_t id, media_data &frame);
+
 protected:
 	void on_media_thread_create() override ;
 	void on_input_mutex(media_data &frame) override ;
@@ -55,6 +64,27 @@ protected:
 private:
     size_t get_audio_bytes_per_channel(enum audio_format format);
 	size_t audio_get_input_idx(audio_output_callback_t callback, void *param);
+
+	bool is_output_format(const audio_convert_info &conversion);
+	audio_convert_cache *get_converter(const audio_convert_info &conversion);
+	void free_unused_converters();
+	media_data &convert_frame(const audio_convert_info &conversion,
+			media_data &frame);
+
+	audio_mix_source *find_source(size_t id);
+	audio_mix_source *create_source(size_t id,
+			const struct audio_convert_info *conversion, float gain,
+			uint32_t jitter_ms);
+	void destroy_source(audio_mix_source *source);
+	size_t source_frames(audio_mix_source &source);
+	uint64_t source_end_ts(audio_mix_source &source);
+	void drop_source_frames(audio_mix_source &source, size_t frames);
+	void mix_source_plane(float *dst, circlebuffer &plane, float gain,
+			size_t frames);
+	void mix_ready_ticks();
+	void mix_tick(uint64_t tick_ts);
+
+	pthread_mutex_t            mix_mutex;
 };
 
 #ifdef __cplusplus
@@ -0,0 +1,741 @@
+#include <math.h>
+#include <string.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define AUDIO_USE_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define AUDIO_USE_SSE2
+#endif
+
+#include "rtmp-audio-resampler.h"
+
+#define RESAMPLER_TAPS       32
+#define RESAMPLER_MAX_PHASES 1024
+#define MAX_CHANNELS         8
+
+enum speaker_position {
+	SPEAKER_FL,
+	SPEAKER_FR,
+	SPEAKER_FC,
+	SPEAKER_LFE,
+	SPEAKER_RL,
+	SPEAKER_RR,
+	SPEAKER_SL,
+	SPEAKER_SR,
+	SPEAKER_RC,
+	SPEAKER_NONE
+};
+
+struct audio_resampler {
+	struct audio_convert_info src;
+	struct audio_convert_info dst;
+
+	uint32_t src_channels;
+	uint32_t dst_channels;
+
+	bool     remix;
+	float    matrix[MAX_CHANNELS][MAX_CHANNELS];
+
+	/* polyphase state: output n sits at input position n * down / up */
+	bool     resample;
+	uint32_t up;
+	uint32_t down;
+	uint32_t phases;
+	uint32_t frac;
+	size_t   ipos;
+	std::vector<float> coefs;
+	std::vector<float> history[MAX_CHANNELS];
+
+	uint64_t in_count;
+	uint64_t out_count;
+
+	std::vector<float> planes[MAX_CHANNELS];
+	std::vector<float> mixed[MAX_CHANNELS];
+	std::vector<float> resampled[MAX_CHANNELS];
+};
+
+/* ------------------------------------------------------------------------- */
+
+uint32_t audio_get_channels(enum speaker_layout speakers)
+{
+	switch (speakers) {
+	case SPEAKERS_MONO:    return 1;
+	case SPEAKERS_STEREO:  return 2;
+	case SPEAKERS_2POINT1: return 3;
+	case SPEAKERS_4POINT0: return 4;
+	case SPEAKERS_4POINT1: return 5;
+	case SPEAKERS_5POINT1: return 6;
+	case SPEAKERS_7POINT1: return 8;
+	case SPEAKERS_UNKNOWN: return 0;
+	}
+
+	return 0;
+}
+
+size_t audio_get_bytes_per_channel(enum audio_format format)
+{
+	switch (format) {
+	case AUDIO_FORMAT_U8BIT:
+	case AUDIO_FORMAT_U8BIT_PLANAR:
+		return 1;
+
+	case AUDIO_FORMAT_16BIT:
+	case AUDIO_FORMAT_16BIT_PLANAR:
+		return 2;
+
+	case AUDIO_FORMAT_FLOAT:
+	case AUDIO_FORMAT_FLOAT_PLANAR:
+	case AUDIO_FORMAT_32BIT:
+	case AUDIO_FORMAT_32BIT_PLANAR:
+		return 4;
+
+	case AUDIO_FORMAT_UNKNOWN:
+		return 0;
+	}
+
+	return 0;
+}
+
+bool audio_is_planar(enum audio_format format)
+{
+	switch (format) {
+	case AUDIO_FORMAT_U8BIT_PLANAR:
+	case AUDIO_FORMAT_16BIT_PLANAR:
+	case AUDIO_FORMAT_32BIT_PLANAR:
+	case AUDIO_FORMAT_FLOAT_PLANAR:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+
+void audio_s16_to_float(const int16_t *src, float *dst, size_t count)
+{
+	const float scale = 1.0f / 32768.0f;
+	size_t i = 0;
+
+#if defined(AUDIO_USE_NEON)
+	for (; i + 8 <= count; i += 8) {
+		int16x8_t s = vld1q_s16(src + i);
+		float32x4_t a = vcvtq_f32_s32(vmovl_s16(vget_low_s16(s)));
+		float32x4_t b = vcvtq_f32_s32(vmovl_s16(vget_high_s16(s)));
+		vst1q_f32(dst + i,     vmulq_n_f32(a, scale));
+		vst1q_f32(dst + i + 4, vmulq_n_f32(b, scale));
+	}
+#elif defined(AUDIO_USE_SSE2)
+	const __m128 vscale = _mm_set1_ps(scale);
+
+	for (; i + 8 <= count; i += 8) {
+		__m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i a = _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16);
+		__m128i b = _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16);
+		_mm_storeu_ps(dst + i,     _mm_mul_ps(_mm_cvtepi32_ps(a), vscale));
+		_mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(b), vscale));
+	}
+#endif
+
+	for (; i < count; i++)
+		dst[i] = (float)src[i] * scale;
+}
+
+void audio_float_to_s16(const float *src, int16_t *dst, size_t count)
+{
+	size_t i = 0;
+
+#if defined(AUDIO_USE_NEON)
+	const float32x4_t lo = vdupq_n_f32(-1.0f);
+	const float32x4_t hi = vdupq_n_f32(1.0f);
+
+	for (; i + 8 <= count; i += 8) {
+		float32x4_t a = vld1q_f32(src + i);
+		float32x4_t b = vld1q_f32(src + i + 4);
+		a = vmulq_n_f32(vminq_f32(vmaxq_f32(a, lo), hi), 32767.0f);
+		b = vmulq_n_f32(vminq_f32(vmaxq_f32(b, lo), hi), 32767.0f);
+		int16x4_t sa = vqmovn_s32(vcvtq_s32_f32(a));
+		int16x4_t sb = vqmovn_s32(vcvtq_s32_f32(b));
+		vst1q_s16(dst + i, vcombine_s16(sa, sb));
+	}
+#elif defined(AUDIO_USE_SSE2)
+	const __m128 lo    = _mm_set1_ps(-1.0f);
+	const __m128 hi    = _mm_set1_ps(1.0f);
+	const __m128 scale = _mm_set1_ps(32767.0f);
+
+	for (; i + 8 <= count; i += 8) {
+		__m128 a = _mm_loadu_ps(src + i);
+		__m128 b = _mm_loadu_ps(src + i + 4);
+		a = _mm_mul_ps(_mm_min_ps(_mm_max_ps(a, lo), hi), scale);
+		b = _mm_mul_ps(_mm_min_ps(_mm_max_ps(b, lo), hi), scale);
+		__m128i s = _mm_packs_epi32(_mm_cvttps_epi32(a),
+				_mm_cvttps_epi32(b));
+		_mm_storeu_si128((__m128i *)(dst + i), s);
+	}
+#endif
+
+	for (; i < count; i++) {
+		float v = src[i];
+		if (v > 1.0f)
+			v = 1.0f;
+		else if (v < -1.0f)
+			v = -1.0f;
+		dst[i] = (int16_t)(v * 32767.0f);
+	}
+}
+
+void audio_mix_float(float *dst, const float *src, float gain, size_t count)
+{
+	size_t i = 0;
+
+#if defined(AUDIO_USE_NEON)
+	for (; i + 4 <= count; i += 4) {
+		float32x4_t d = vld1q_f32(dst + i);
+		vst1q_f32(dst + i, vmlaq_n_f32(d, vld1q_f32(src + i), gain));
+	}
+#elif defined(AUDIO_USE_SSE2)
+	const __m128 vgain = _mm_set1_ps(gain);
+
+	for (; i + 4 <= count; i += 4) {
+		__m128 d = _mm_loadu_ps(dst + i);
+		__m128 s = _mm_mul_ps(_mm_loadu_ps(src + i), vgain);
+		_mm_storeu_ps(dst + i, _mm_add_ps(d, s));
+	}
+#endif
+
+	for (; i < count; i++)
+		dst[i] += src[i] * gain;
+}
+
+void audio_clamp_float(float *data, size_t count)
+{
+	size_t i = 0;
+
+#if defined(AUDIO_USE_NEON)
+	const float32x4_t lo = vdupq_n_f32(-1.0f);
+	const float32x4_t hi = vdupq_n_f32(1.0f);
+
+	for (; i + 4 <= count; i += 4) {
+		float32x4_t v = vld1q_f32(data + i);
+		vst1q_f32(data + i, vminq_f32(vmaxq_f32(v, lo), hi));
+	}
+#elif defined(AUDIO_USE_SSE2)
+	const __m128 lo = _mm_set1_ps(-1.0f);
+	const __m128 hi = _mm_set1_ps(1.0f);
+
+	for (; i + 4 <= count; i += 4) {
+		__m128 v = _mm_loadu_ps(data + i);
+		_mm_storeu_ps(data + i, _mm_min_ps(_mm_max_ps(v, lo), hi));
+	}
+#endif
+
+	for (; i < count; i++) {
+		if (data[i] > 1.0f)
+			data[i] = 1.0f;
+		else if (data[i] < -1.0f)
+			data[i] = -1.0f;
+	}
+}
+
+float audio_dot_float(const float *a, const float *b, size_t count)
+{
+	float sum = 0.0f;
+	size_t i = 0;
+
+#if defined(AUDIO_USE_NEON)
+	float32x4_t acc = vdupq_n_f32(0.0f);
+
+	for (; i + 4 <= count; i += 4)
+		acc = vmlaq_f32(acc, vld1q_f32(a + i), vld1q_f32(b + i));
+
+	float32x2_t s = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+	sum = vget_lane_f32(vpadd_f32(s, s), 0);
+#elif defined(AUDIO_USE_SSE2)
+	__m128 acc = _mm_setzero_ps();
+
+	for (; i + 4 <= count; i += 4)
+		acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i),
+				_mm_loadu_ps(b + i)));
+
+	acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+	acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+	sum = _mm_cvtss_f32(acc);
+#endif
+
+	for (; i < count; i++)
+		sum += a[i] * b[i];
+	return sum;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void get_positions(enum speaker_layout speakers,
+		enum speaker_position *pos)
+{
+	static const enum speaker_position layouts[][MAX_CHANNELS] = {
+		{SPEAKER_NONE},
+		{SPEAKER_FC},
+		{SPEAKER_FL, SPEAKER_FR},
+		{SPEAKER_FL, SPEAKER_FR, SPEAKER_LFE},
+		{SPEAKER_FL, SPEAKER_FR, SPEAKER_FC, SPEAKER_RC},
+		{SPEAKER_FL, SPEAKER_FR, SPEAKER_FC, SPEAKER_LFE, SPEAKER_RC},
+		{SPEAKER_FL, SPEAKER_FR, SPEAKER_FC, SPEAKER_LFE,
+		 SPEAKER_RL, SPEAKER_RR},
+		{SPEAKER_NONE},
+		{SPEAKER_FL, SPEAKER_FR, SPEAKER_FC, SPEAKER_LFE,
+		 SPEAKER_RL, SPEAKER_RR, SPEAKER_SL, SPEAKER_SR},
+	};
+	uint32_t channels = audio_get_channels(speakers);
+
+	for (uint32_t i = 0; i < MAX_CHANNELS; i++)
+		pos[i] = i < channels ? layouts[speakers][i] : SPEAKER_NONE;
+}
+
+static int find_position(const enum speaker_position *pos, uint32_t channels,
+		enum speaker_position p)
+{
+	for (uint32_t i = 0; i < channels; i++) {
+		if (pos[i] == p)
+			return (int)i;
+	}
+	return -1;
+}
+
+/* spreads src position p over the dst layout, returns false if nothing
+ * suitable exists */
+static bool route_position(float (*matrix)[MAX_CHANNELS],
+		const enum speaker_position *dst, uint32_t dst_channels,
+		enum speaker_position p, uint32_t s, float gain)
+{
+	static const float half = 0.70710678f;
+	int a, b;
+
+	if ((a = find_position(dst, dst_channels, p)) >= 0) {
+		matrix[a][s] += gain;
+		return true;
+	}
+
+	switch (p) {
+	case SPEAKER_FL:
+	case SPEAKER_FR:
+		return route_position(matrix, dst, dst_channels, SPEAKER_FC,
+				s, gain * half);
+
+	case SPEAKER_FC:
+		a = find_position(dst, dst_channels, SPEAKER_FL);
+		b = find_position(dst, dst_channels, SPEAKER_FR);
+		if (a < 0 || b < 0)
+			return false;
+		matrix[a][s] += gain * half;
+		matrix[b][s] += gain * half;
+		return true;
+
+	case SPEAKER_RL:
+		return route_position(matrix, dst, dst_channels, SPEAKER_SL,
+				s, gain) ||
+			route_position(matrix, dst, dst_channels, SPEAKER_FL,
+				s, gain * half);
+	case SPEAKER_RR:
+		return route_position(matrix, dst, dst_channels, SPEAKER_SR,
+				s, gain) ||
+			route_position(matrix, dst, dst_channels, SPEAKER_FR,
+				s, gain * half);
+	case SPEAKER_SL:
+		a = find_position(dst, dst_channels, SPEAKER_RL);
+		if (a >= 0) {
+			matrix[a][s] += gain;
+			return true;
+		}
+		return route_position(matrix, dst, dst_channels, SPEAKER_FL,
+				s, gain * half);
+	case SPEAKER_SR:
+		a = find_position(dst, dst_channels, SPEAKER_RR);
+		if (a >= 0) {
+			matrix[a][s] += gain;
+			return true;
+		}
+		return route_position(matrix, dst, dst_channels, SPEAKER_FR,
+				s, gain * half);
+
+	case SPEAKER_RC:
+		a = find_position(dst, dst_channels, SPEAKER_RL);
+		b = find_position(dst, dst_channels, SPEAKER_RR);
+		if (a >= 0 && b >= 0) {
+			matrix[a][s] += gain * half;
+			matrix[b][s] += gain * half;
+			return true;
+		}
+		return route_position(matrix, dst, dst_channels, SPEAKER_SL,
+				s, gain * half) &&
+			route_position(matrix, dst, dst_channels, SPEAKER_SR,
+				s, gain * half);
+
+	default:
+		/* LFE is dropped when the target has none */
+		return false;
+	}
+}
+
+static void build_matrix(struct audio_resampler *rs)
+{
+	enum speaker_position src[MAX_CHANNELS];
+	enum speaker_position dst[MAX_CHANNELS];
+
+	get_positions(rs->src.speakers, src);
+	get_positions(rs->dst.speakers, dst);
+	memset(rs->matrix, 0, sizeof(rs->matrix));
+
+	for (uint32_t s = 0; s < rs->src_channels; s++) {
+		/* a mono source plays at full level on both sides */
+		if (rs->src_channels == 1 &&
+			find_position(dst, rs->dst_channels, SPEAKER_FC) < 0 &&
+			rs->dst_channels >= 2) {
+			rs->matrix[0][0] = 1.0f;
+			rs->matrix[1][0] = 1.0f;
+			break;
+		}
+
+		route_position(rs->matrix, dst, rs->dst_channels, src[s], s, 1.0f);
+	}
+
+	/* keep downmixes from clipping */
+	for (uint32_t d = 0; d < rs->dst_channels; d++) {
+		float sum = 0.0f;
+		for (uint32_t s = 0; s < rs->src_channels; s++)
+			sum += rs->matrix[d][s];
+		if (sum > 1.0f) {
+			for (uint32_t s = 0; s < rs->src_channels; s++)
+				rs->matrix[d][s] /= sum;
+		}
+	}
+
+	rs->remix = rs->src.speakers != rs->dst.speakers;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+	while (b) {
+		uint32_t t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+static double bessel_i0(double x)
+{
+	double sum = 1.0, term = 1.0;
+
+	for (int k = 1; k < 32; k++) {
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum  += term;
+	}
+	return sum;
+}
+
+/* windowed sinc bank, phase p holds the taps for an output that falls
+ * p / phases of the way past the centre tap */
+static void build_filter(struct audio_resampler *rs)
+{
+	const double beta = 8.0;
+	const double half = RESAMPLER_TAPS / 2;
+	double cutoff = rs->up < rs->down ?
+			(double)rs->up / (double)rs->down : 1.0;
+
+	cutoff *= 0.95;
+	rs->coefs.resize((size_t)rs->phases * RESAMPLER_TAPS);
+
+	for (uint32_t p = 0; p < rs->phases; p++) {
+		double f = (double)p / (double)rs->phases;
+		float *c = &rs->coefs[(size_t)p * RESAMPLER_TAPS];
+		double sum = 0.0;
+
+		for (int j = 0; j < RESAMPLER_TAPS; j++) {
+			double t = (double)(j - (RESAMPLER_TAPS / 2 - 1)) - f;
+			double x = M_PI * cutoff * t;
+			double sinc = fabs(t) < 1e-9 ? 1.0 : sin(x) / x;
+			double r = t / half;
+			double win = fabs(r) >= 1.0 ? 0.0 :
+					bessel_i0(beta * sqrt(1.0 - r * r)) / bessel_i0(beta);
+
+			c[j] = (float)(sinc * win);
+			sum += c[j];
+		}
+
+		for (int j = 0; j < RESAMPLER_TAPS; j++)
+			c[j] = (float)(c[j] / sum);
+	}
+}
+
+static void init_resampler(struct audio_resampler *rs)
+{
+	uint32_t g = gcd(rs->dst.samples_per_sec, rs->src.samples_per_sec);
+
+	rs->up       = rs->dst.samples_per_sec / g;
+	rs->down     = rs->src.samples_per_sec / g;
+	rs->resample = rs->up != rs->down;
+	if (!rs->resample)
+		return;
+
+	rs->phases = rs->up < RESAMPLER_MAX_PHASES ?
+			rs->up : RESAMPLER_MAX_PHASES;
+	rs->frac   = 0;
+	rs->ipos   = 0;
+	build_filter(rs);
+
+	for (uint32_t c = 0; c < rs->dst_channels; c++)
+		rs->history[c].assign(RESAMPLER_TAPS / 2 - 1, 0.0f);
+}
+
+static void resample_channels(struct audio_resampler *rs,
+		std::vector<float> *in, uint32_t in_frames, uint32_t *out_frames)
+{
+	size_t ipos = rs->ipos;
+	uint32_t frac = rs->frac;
+	uint32_t n = 0;
+
+	for (uint32_t c = 0; c < rs->dst_channels; c++)
+		rs->history[c].insert(rs->history[c].end(), in[c].begin(),
+				in[c].begin() + in_frames);
+
+	size_t avail = rs->history[0].size();
+	size_t max_out = (size_t)((uint64_t)(avail + 1) * rs->up / rs->down) + 2;
+
+	for (uint32_t c = 0; c < rs->dst_channels; c++)
+		rs->resampled[c].resize(max_out);
+
+	while (ipos + RESAMPLER_TAPS <= avail && n < max_out) {
+		uint32_t phase = (uint32_t)((uint64_t)frac * rs->phases / rs->up);
+		const float *coef = &rs->coefs[(size_t)phase * RESAMPLER_TAPS];
+
+		for (uint32_t c = 0; c < rs->dst_channels; c++)
+			rs->resampled[c][n] = audio_dot_float(&rs->history[c][ipos],
+					coef, RESAMPLER_TAPS);
+		n++;
+
+		frac += rs->down;
+		ipos += frac / rs->up;
+		frac %= rs->up;
+	}
+
+	for (uint32_t c = 0; c < rs->dst_channels; c++)
+		rs->history[c].erase(rs->history[c].begin(),
+				rs->history[c].begin() + ipos);
+
+	rs->ipos = 0;
+	rs->frac = frac;
+	*out_frames = n;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void decode_input(struct audio_resampler *rs, const uint8_t *input,
+		uint32_t frames)
+{
+	enum audio_format format = rs->src.format;
+	bool planar = audio_is_planar(format);
+	size_t bytes = audio_get_bytes_per_channel(format);
+	uint32_t channels = rs->src_channels;
+
+	for (uint32_t c = 0; c < channels; c++) {
+		std::vector<float> &plane = rs->planes[c];
+		const uint8_t *src = planar ? input + (size_t)c * frames * bytes :
+				input + c * bytes;
+		size_t stride = planar ? 1 : channels;
+
+		plane.resize(frames);
+
+		switch (format) {
+		case AUDIO_FORMAT_U8BIT:
+		case AUDIO_FORMAT_U8BIT_PLANAR:
+			for (uint32_t i = 0; i < frames; i++)
+				plane[i] = ((float)src[i * stride] - 128.0f) / 128.0f;
+			break;
+
+		case AUDIO_FORMAT_16BIT:
+		case AUDIO_FORMAT_16BIT_PLANAR:
+			if (planar) {
+				audio_s16_to_float((const int16_t *)src, &plane[0], frames);
+			} else {
+				const int16_t *s = (const int16_t *)src;
+				for (uint32_t i = 0; i < frames; i++)
+					plane[i] = (float)s[i * stride] / 32768.0f;
+			}
+			break;
+
+		case AUDIO_FORMAT_32BIT:
+		case AUDIO_FORMAT_32BIT_PLANAR: {
+			const int32_t *s = (const int32_t *)src;
+			for (uint32_t i = 0; i < frames; i++)
+				plane[i] = (float)((double)s[i * stride] / 2147483648.0);
+			break;
+		}
+
+		case AUDIO_FORMAT_FLOAT:
+		case AUDIO_FORMAT_FLOAT_PLANAR: {
+			const float *s = (const float *)src;
+			if (planar) {
+				memcpy(&plane[0], s, frames * sizeof(float));
+			} else {
+				for (uint32_t i = 0; i < frames; i++)
+					plane[i] = s[i * stride];
+			}
+			break;
+		}
+
+		case AUDIO_FORMAT_UNKNOWN:
+			break;
+		}
+	}
+}
+
+static inline float clamp_sample(float v)
+{
+	return v > 1.0f ? 1.0f : (v < -1.0f ? -1.0f : v);
+}
+
+static void encode_output(struct audio_resampler *rs, std::vector<float> *in,
+		std::vector<uint8_t> &output, uint32_t frames)
+{
+	enum audio_format format = rs->dst.format;
+	bool planar = audio_is_planar(format);
+	size_t bytes = audio_get_bytes_per_channel(format);
+	uint32_t channels = rs->dst_channels;
+
+	output.resize((size_t)frames * channels * bytes);
+	if (!frames)
+		return;
+
+	for (uint32_t c = 0; c < channels; c++) {
+		const float *plane = &in[c][0];
+		uint8_t *dst = planar ? &output[(size_t)c * frames * bytes] :
+				&output[c * bytes];
+		size_t stride = planar ? 1 : channels;
+
+		switch (format) {
+		case AUDIO_FORMAT_U8BIT:
+		case AUDIO_FORMAT_U8BIT_PLANAR:
+			for (uint32_t i = 0; i < frames; i++)
+				dst[i * stride] = (uint8_t)(clamp_sample(plane[i]) *
+						127.0f + 128.0f);
+			break;
+
+		case AUDIO_FORMAT_16BIT:
+		case AUDIO_FORMAT_16BIT_PLANAR:
+			if (planar) {
+				audio_float_to_s16(plane, (int16_t *)dst, frames);
+			} else {
+				int16_t *d = (int16_t *)dst;
+				for (uint32_t i = 0; i < frames; i++)
+					d[i * stride] = (int16_t)(clamp_sample(plane[i]) *
+							32767.0f);
+			}
+			break;
+
+		case AUDIO_FORMAT_32BIT:
+		case AUDIO_FORMAT_32BIT_PLANAR: {
+			int32_t *d = (int32_t *)dst;
+			for (uint32_t i = 0; i < frames; i++)
+				d[i * stride] = (int32_t)((double)clamp_sample(plane[i]) *
+						2147483647.0);
+			break;
+		}
+
+		case AUDIO_FORMAT_FLOAT:
+		case AUDIO_FORMAT_FLOAT_PLANAR: {
+			float *d = (float *)dst;
+			if (planar) {
+				memcpy(d, plane, frames * sizeof(float));
+			} else {
+				for (uint32_t i = 0; i < frames; i++)
+					d[i * stride] = plane[i];
+			}
+			break;
+		}
+
+		case AUDIO_FORMAT_UNKNOWN:
+			break;
+		}
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+
+audio_resampler_t *audio_resampler_create(const struct audio_convert_info *dst,
+		const struct audio_convert_info *src)
+{
+	uint32_t src_channels = audio_get_channels(src->speakers);
+	uint32_t dst_channels = audio_get_channels(dst->speakers);
+
+	if (!src_channels || !dst_channels ||
+		!src->samples_per_sec || !dst->samples_per_sec ||
+		!audio_get_bytes_per_channel(src->format) ||
+		!audio_get_bytes_per_channel(dst->format))
+		return NULL;
+
+	struct audio_resampler *rs = new audio_resampler();
+	rs->src          = *src;
+	rs->dst          = *dst;
+	rs->src_channels = src_channels;
+	rs->dst_channels = dst_channels;
+	rs->in_count     = 0;
+	rs->out_count    = 0;
+
+	build_matrix(rs);
+	init_resampler(rs);
+	return rs;
+}
+
+void audio_resampler_destroy(audio_resampler_t *rs)
+{
+	delete rs;
+}
+
+bool audio_resampler_resample(audio_resampler_t *rs,
+		std::vector<uint8_t> &output, uint32_t *out_frames,
+		uint64_t *ts_offset, const uint8_t *input, uint32_t in_frames)
+{
+	if (!rs || !in_frames)
+		return false;
+
+	std::vector<float> *planes = rs->planes;
+	uint32_t frames = in_frames;
+
+	decode_input(rs, input, in_frames);
+
+	if (rs->remix) {
+		for (uint32_t d = 0; d < rs->dst_channels; d++) {
+			rs->mixed[d].assign(in_frames, 0.0f);
+			for (uint32_t s = 0; s < rs->src_channels; s++) {
+				if (rs->matrix[d][s] != 0.0f)
+					audio_mix_float(&rs->mixed[d][0], &planes[s][0],
+							rs->matrix[d][s], in_frames);
+			}
+		}
+		planes = rs->mixed;
+	}
+
+	*ts_offset = 0;
+
+	if (rs->resample) {
+		/* the first output still pending lags the new input by the
+		 * filter's look-ahead */
+		uint64_t behind = rs->in_count * rs->up - rs->out_count * rs->down;
+		*ts_offset = behind * 1000000000ULL /
+				((uint64_t)rs->up * rs->src.samples_per_sec);
+
+		resample_channels(rs, planes, in_frames, &frames);
+		planes = rs->resampled;
+
+		rs->in_count  += in_frames;
+		rs->out_count += frames;
+	}
+
+	encode_output(rs, planes, output, frames);
+	*out_frames = frames;
+	return true;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#include "rtmp-struct.h"
+
+/* Converts sample format, channel layout and sample rate in one go.
+ * Buffers hold interleaved samples, or for planar formats one plane per
+ * channel stored back to back. */
+audio_resampler_t *audio_resampler_create(const struct audio_convert_info *dst,
+		const struct audio_convert_info *src);
+void audio_resampler_destroy(audio_resampler_t *rs);
+
+/* Output frame count varies with the rate ratio and may be 0. ts_offset
+ * (ns) is how far the first output frame lies before the first input
+ * frame. */
+bool audio_resampler_resample(audio_resampler_t *rs,
+		std::vector<uint8_t> &output, uint32_t *out_frames,
+		uint64_t *ts_offset, const uint8_t *input, uint32_t in_frames);
+
+uint32_t audio_get_channels(enum speaker_layout speakers);
+size_t audio_get_bytes_per_channel(enum audio_format format);
+bool audio_is_planar(enum audio_format format);
+
+/* SIMD kernels shared by the audio pipeline */
+void audio_s16_to_float(const int16_t *src, float *dst, size_t count);
+void audio_float_to_s16(const float *src, int16_t *dst, size_t count);
+void audio_mix_float(float *dst, const float *src, float gain, size_t count);
+void audio_clamp_float(float *data, size_t count);
+float audio_dot_float(const float *a, const float *b, size_t count);
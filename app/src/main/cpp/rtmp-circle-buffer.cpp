@@ -25,11 +25,50 @@ void circlebuffer::push_back(const void *data,  size_t size)
     circlebuf_push_back(dynamic_cast<circlebuf *>(this), data, size);
 }
 
+/* grows the back by size bytes for the caller to write in place, in two
+ * spans when they wrap around the end of the storage */
+void circlebuffer::push_back_spans(size_t size, uint8_t *span[2],
+                                   size_t span_size[2])
+{
+    size_t new_end_pos = end_pos + size;
+
+    this->size += size;
+    circlebuf_ensure_capacity(dynamic_cast<circlebuf *>(this));
+
+    span[0]      = (uint8_t *)data + end_pos;
+    span[1]      = (uint8_t *)data;
+    span_size[0] = size;
+    span_size[1] = 0;
+
+    if (new_end_pos > capacity) {
+        span_size[0] = capacity - end_pos;
+        span_size[1] = size - span_size[0];
+        new_end_pos -= capacity;
+    }
+
+    end_pos = new_end_pos;
+}
+
+void circlebuffer::peek_back(void *data, size_t size)
+{
+    circlebuf_peek_back(dynamic_cast<circlebuf *>(this), data, size);
+}
+
 void circlebuffer::pop_front(void *data,  size_t size)
 {
     circlebuf_pop_front(dynamic_cast<circlebuf *>(this), data, size);
 }
 
+void circlebuffer::pop_front(size_t size)
+{
+    circlebuf_pop_front(dynamic_cast<circlebuf *>(this), NULL, size);
+}
+
+void circlebuffer::pop_back(size_t size)
+{
+    circlebuf_pop_back(dynamic_cast<circlebuf *>(this), NULL, size);
+}
+
 void *circlebuffer::get_data(size_t idx)
 {
     return circlebuf_data(dynamic_cast<circlebuf *>(this),idx);
@@ -40,6 +79,14 @@ void circlebuffer::reserve(size_t capacity)
     circlebuf_reserve(dynamic_cast<circlebuf *>(this),capacity);
 }
 
+/* empties the buffer but keeps its storage */
+void circlebuffer::clear()
+{
+    size = 0;
+    start_pos = 0;
+    end_pos = 0;
+}
+
 void circlebuffer::free()
 {
     circlebuf_free(dynamic_cast<circlebuf *>(this));
@@ -17,10 +17,16 @@ public:
 
 	void peek_front(void *data, size_t size);
     void push_back(const void *data,  size_t size);
+    void push_back_spans(size_t size, uint8_t *span[2], size_t span_size[2]);
+    void peek_back(void *data, size_t size);
     void pop_front(void *data,  size_t size);
 
+    void pop_front(size_t size);
+    void pop_back(size_t size);
+
     void *get_data(size_t idx);
     void reserve(size_t capacity);
+    void clear();
     void free();
 private:
 
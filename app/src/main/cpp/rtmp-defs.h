@@ -23,8 +23,8 @@
 #include "util/circlebuf.h"
 #include "util/threading.h"
 #include "rtmp-struct.h"
+#include "rtmp-log.h"
 #include <memory>
-#include <android/log.h>
 
 #define MAJOR_VER  1
 #define MINOR_VER  0
@@ -35,10 +35,6 @@
 #define MAX_AV_PLANES       8
 #define AUDIO_OUTPUT_FRAMES 1024
 
-#define TAG "JNITEST"
-
-#define LOGI(...) __android_log_print(ANDROID_LOG_INFO,TAG,__VA_ARGS__)
-
 #define VIDEO_OUTPUT_SUCCESS       0
 #define VIDEO_OUTPUT_INVALIDPARAM -1
 #define VIDEO_OUTPUT_FAIL         -2
@@ -37,7 +37,8 @@ caps(0),
 active(false),
 initialized(false),
 first_received(false),
-destroy_on_stop(false)
+destroy_on_stop(false),
+drift_corrected_ns(0)
 {
 	pthread_mutexattr_t attr;
 
@@ -121,6 +122,16 @@ void media_encoder::do_encode(encoder_frame &frame)
 	send_off_encoder_packet(success, received, pkt);
 }
 
+int64_t media_encoder::get_clock_drift_usec()
+{
+	return drift.get_drift_ns() / 1000;
+}
+
+int64_t media_encoder::get_drift_corrected_usec()
+{
+	return drift_corrected_ns / 1000;
+}
+
 void media_encoder::full_stop()
 {
 	pthread_mutex_lock(&callbacks_mutex);
@@ -285,7 +296,9 @@ bool media_encoder::stop_internal(void (*new_packet)(void *param, encoder_packet
 void media_encoder::actually_destroy()
 {
 	pthread_mutex_lock(&outputs_mutex);
-	output.lock()->remove_encoder(shared_from_this());
+	std::shared_ptr<rtmp_output_base> out = output.lock();
+	if (out)
+		out->remove_encoder(shared_from_this());
 	pthread_mutex_unlock(&outputs_mutex);
 
 	on_actually_destroy();
@@ -374,19 +387,20 @@ static inline size_t get_audio_size(enum audio_format format,
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////
 encoder_packet_info::encoder_packet_info():
+data_ptr(NULL),
 data_size(0),
 pts(0),
 dts(0),
 timebase_num(0),
 timebase_den(0),
+type(OBS_ENCODER_AUDIO),
+keyframe(false),
 dts_usec(0),
 sys_dts_usec(0),
 priority(0),
 drop_priority(0),
 track_idx(0),
-type(OBS_ENCODER_AUDIO),
-keyframe(false),
-data_ptr(NULL)
+fourcc(0)
 {
 }
 
@@ -467,6 +481,7 @@ void encoder_packet::serialize_from(encoder_packet_info &info)
     priority = info.priority;
     drop_priority = info.drop_priority;
     track_idx = info.track_idx;
+    fourcc = info.fourcc;
     type = info.type;
     keyframe = info.keyframe;
 
@@ -480,27 +495,39 @@ void encoder_packet::serialize_from(encoder_packet_info &info)
     }
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+clock_drift::clock_drift()
+{
+    reset();
+}
 
+void clock_drift::reset()
+{
+    updates     = 0;
+    baseline_ns = 0.0;
+    smoothed_ns = 0.0;
+    drift_ns    = 0;
+}
 
+/* capture timestamps jitter by a buffer or two, so the offset the clocks
+ * start with is averaged first and drift is the slow movement away from it */
+void clock_drift::update(uint64_t capture_ns, uint64_t media_ns)
+{
+    double offset = (double)(int64_t)(capture_ns - media_ns);
 
+    if (updates < DRIFT_SETTLE_UPDATES) {
+        baseline_ns += (offset - baseline_ns) / (double)(updates + 1);
+        smoothed_ns  = baseline_ns;
+        updates++;
+        return;
+    }
 
+    smoothed_ns += (offset - smoothed_ns) * DRIFT_SMOOTHING;
+    drift_ns     = (int64_t)(smoothed_ns - baseline_ns);
 
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
+    int64_t bound = (int64_t)(capture_ns / 1000000 * DRIFT_MAX_PPM);
+    if (drift_ns > bound)
+        drift_ns = bound;
+    else if (drift_ns < -bound)
+        drift_ns = -bound;
+}
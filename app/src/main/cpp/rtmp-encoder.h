@@ -19,7 +19,12 @@
 
 #include "rtmp-defs.h"
 #include "rtmp-struct.h"
+#include "rtmp-aac-encoder.h"
 #include "rtmp-circle-buffer.h"
+#include "rtmp-video-bitstream.h"
+
+#include <queue>
+#include <functional>
 
 /**
  * @file
@@ -38,6 +43,37 @@
 extern "C" {
 #endif
 
+/* how far a sample or frame clock may drift from capture time before the
+ * encoder starts correcting it */
+#define DRIFT_BOUND_NS       10000000LL
+/* updates averaged for the starting offset before drift is tracked */
+#define DRIFT_SETTLE_UPDATES 64
+/* weight of each new measurement in the smoothed offset */
+#define DRIFT_SMOOTHING      (1.0 / 256.0)
+/* the most a capture clock is taken to drift, per million of the time
+ * measured; an offset growing faster than that is not drift */
+#define DRIFT_MAX_PPM        1000
+
+/* Estimates how far a clock built from counting samples or frames has
+ * drifted from the capture timestamps, both measured from the start.
+ * Positive drift means capture time runs ahead of the media clock. */
+class clock_drift {
+public:
+    clock_drift();
+
+    void reset();
+    void update(uint64_t capture_ns, uint64_t media_ns);
+
+    bool settled() const {return updates >= DRIFT_SETTLE_UPDATES;}
+    int64_t get_drift_ns() const {return drift_ns;}
+
+private:
+    uint32_t updates;
+    double   baseline_ns;
+    double   smoothed_ns;
+    int64_t  drift_ns;
+};
+
 class rtmp_output_base;
 
 class media_encoder : public std::enable_shared_from_this<media_encoder>{
@@ -64,6 +100,9 @@ public:
     bool destroy_on_stop;
     std::weak_ptr<media_encoder> paired_encoder;
 
+    clock_drift drift;
+    int64_t     drift_corrected_ns;
+
     pthread_mutex_t outputs_mutex;
     std::weak_ptr<rtmp_output_base> output;
 
@@ -88,6 +127,11 @@ public:
 
     void do_encode(encoder_frame &frame);
 
+    /* estimated capture clock drift and how much of it has been
+     * compensated so far */
+    int64_t get_clock_drift_usec();
+    int64_t get_drift_corrected_usec();
+
     void start(void (*new_packet)(void *param, encoder_packet &packet),
                void *param);
 
@@ -124,8 +168,6 @@ private:
 
 };
 
-class SerializeByte;
-
 class X264Encoder : public media_encoder
 {
 public:
@@ -141,16 +183,45 @@ public:
 	bool get_extra_data(std::vector<uint8_t> &extra_data) override;
 	std::vector<uint8_t> get_encode_header() override;
 	bool get_sei_data(std::vector<uint8_t> &sei_data);
-    static encoder_packet parse_avc_packet(encoder_packet &src);
+	uint32_t get_fourcc();
+
+	/* annex B or obu output to flv frame data, codec from packet.fourcc */
+	static encoder_packet parse_packet(encoder_packet &src);
 
 	uint32_t get_width();
 	uint32_t get_height();
 
-	static std::vector<uint8_t> parse_header(const std::vector<uint8_t> &data);
+	void advance_pts(uint64_t timestamp);
+	int64_t get_vfr_pts(uint64_t timestamp);
+	int64_t get_capture_pts(uint64_t timestamp);
+	void reset_reorder();
+
+	/* take pts from capture time in ms instead of counting frames; set
+	 * before set_video, like codec ("h264", "hevc" or "av1") */
+	bool     vfr;
+
+	/* frames the encoder may hold back for b-frames, -1 reads it from the
+	 * sps. Non-zero makes pts follow capture time and rebuilds dts. */
+	int      reorder_frames;
+	int      active_reorder;
+
+	uint64_t sent_frames;
+	uint64_t vfr_start_wall;
+
+	/* the drift estimate runs from drift_start_ts over frames that arrive
+	 * at the frame rate, and restarts on a gap or a burst */
+	uint64_t drift_start_ts;
+	uint64_t drift_frames;
+	uint64_t last_frame_ts;
 
 private:
 	void get_video_info(video_scale_info &info);
 	void load_headers();
+	void get_codec_config(std::vector<uint8_t> &config);
+	enum video_codec get_codec_id();
+	int detect_reorder_frames();
+	int64_t get_dts(int64_t pts);
+	int64_t get_frame_duration();
 	bool valid_format(video_format format);
 	void get_info(video_scale_info &info);
 	void clear_data();
@@ -160,20 +231,17 @@ private:
 	enum video_format get_preferred_video_format();
 
 
-    static void get_sps_pps(const uint8_t *data, size_t size,
-								  const uint8_t **sps, size_t *sps_size,
-								  const uint8_t **pps, size_t *pps_size);
-    static const uint8_t * find_startcode(const uint8_t *p, const uint8_t *end);
-    static const uint8_t * ff_avc_find_startcode_internal(const uint8_t *p, const uint8_t *end);
-    static bool  has_start_code(const uint8_t *data);
-
-    static void serialize_avc_data(SerializeByte &s, const uint8_t *data,
-										 size_t size, bool *is_keyframe, int *priority);
-
-
 	std::vector<uint8_t> extra_data;
 	std::vector<uint8_t> sei;
 
+	/* pts not yet used as a dts, smallest first */
+	std::priority_queue<int64_t, std::vector<int64_t>,
+			std::greater<int64_t> > reorder_pts;
+	int64_t decoded_frames;
+	int64_t first_pts;
+	int64_t last_dts;
+	bool    reorder_warned;
+
 	uint32_t scaled_width;
 	uint32_t scaled_height;
 	enum video_format preferred_format;
@@ -194,12 +262,19 @@ public:
 
 	void clear_audio();
 	bool buffer_audio(media_data &data);
+	void track_drift(media_data &data);
 	void send_audio_data();
 
 	uint32_t get_sample_rate();
 
+	/* kbps for the pcm encoder, 0 picks 64 per channel */
+	uint32_t bitrate;
+
     circlebuffer audio_input_buffer;
-	std::vector<uint8_t> audio_output_buffer;
+	size_t frame_bytes;
+
+	/* frames received since first_raw_ts, for the drift estimate */
+	uint64_t received_frames;
 
 private:
 	void get_audio_info(audio_convert_info &info);
@@ -213,6 +288,8 @@ private:
 	void reset_audio_buffers();
 
 	void push_back_audio(media_data &data, size_t size, size_t offset_size);
+	void push_back_planes(media_data &data, size_t size, size_t offset_size);
+	void compensate_drift(size_t size);
 	size_t calc_offset_size(uint64_t v_start_ts, uint64_t a_start_ts);
 	void start_from_buffer(uint64_t v_start_ts);
 
@@ -220,6 +297,10 @@ private:
 
 	void load_headers();
 
+	bool open_pcm_encoder(audio_convert_info &info);
+	bool encode_pcm(encoder_frame &frame,
+				encoder_packet &packet, bool &received_packet);
+
 	std::string type;
 	int64_t total_samples;
 
@@ -234,6 +315,15 @@ private:
 	size_t framesize;
 
 	std::vector<uint8_t> extra_data;
+
+	/* set when the audio output delivers pcm rather than frames already
+	 * encoded on the java side */
+	bool                 pcm_input;
+	bool                 pcm_float;
+	bool                 pcm_planar;
+	uint32_t             pcm_channels;
+	AacLcEncoder         pcm_encoder;
+	std::vector<float>   pcm_scratch;
 };
 
 #ifdef __cplusplus
@@ -2,6 +2,10 @@
 # include "rtmp-encoder.h"
 
 # include "rtmp-audio-output.h"
+# include "rtmp-audio-resampler.h"
+
+/* frames of pcm the input ring holds before it has to grow */
+#define INPUT_BUFFER_FRAMES 8
 
 static void receive_audio(void *param, struct media_data &data);
 
@@ -86,15 +90,22 @@ static inline size_t get_audio_size(enum audio_format format,
 #endif
 
 aacEncoder::aacEncoder():
-samplerate(0),
-blocksize(0),
+bitrate(0),
+frame_bytes(0),
+received_frames(0),
 total_samples(0),
 audio_planes(0),
 audio_size(0),
-framesize(1024),
-frame_size_bytes(0)
+frame_size_bytes(0),
+samplerate(0),
+blocksize(0),
+framesize(AAC_FRAME_SAMPLES),
+pcm_input(false),
+pcm_float(false),
+pcm_planar(false),
+pcm_channels(0)
 {
-    id = "ffmpeg_aac";
+    id = "aac";
     type = OBS_ENCODER_AUDIO;
 }
 
@@ -103,7 +114,7 @@ aacEncoder::~aacEncoder()
 }
 
 std::string aacEncoder::get_name() {
-    return "FFmpegAAC";
+    return "AAC";
 }
 
 void aacEncoder::set_audio(std::shared_ptr<media_output> &audio)
@@ -119,15 +130,59 @@ void aacEncoder::set_audio(std::shared_ptr<media_output> &audio)
 bool aacEncoder::encode(encoder_frame &frame,
             encoder_packet &packet, bool &received_packet) {
 
+    if (pcm_input)
+        return encode_pcm(frame, packet, received_packet);
+
     received_packet = true;
     packet.type = OBS_ENCODER_AUDIO;
-    packet.data = frame.data;
+    packet.data.resize(frame.size());
+    if (!packet.data.empty())
+        frame.copy_to(&packet.data[0]);
     packet.pts  = frame.pts;
     packet.dts  = frame.pts;
 
     return true;
 }
 
+bool aacEncoder::encode_pcm(encoder_frame &frame,
+            encoder_packet &packet, bool &received_packet) {
+
+    const float *pcm  = (const float*)frame.span[0];
+    const float *tail = (const float*)frame.span[1];
+    size_t count      = frame.span_size[0] / sizeof(float);
+    size_t tail_count = frame.span_size[1] / sizeof(float);
+
+    received_packet = false;
+
+    if (!pcm_float) {
+        size_t head = frame.span_size[0] / sizeof(int16_t);
+        size_t rest = frame.span_size[1] / sizeof(int16_t);
+
+        pcm_scratch.resize(head + rest);
+        audio_s16_to_float((const int16_t*)frame.span[0], &pcm_scratch[0], head);
+        if (rest)
+            audio_s16_to_float((const int16_t*)frame.span[1],
+                    &pcm_scratch[head], rest);
+
+        pcm        = &pcm_scratch[0];
+        count      = head + rest;
+        tail       = NULL;
+        tail_count = 0;
+    }
+
+    if (!pcm_encoder.encode(pcm, count, tail, tail_count, packet.data))
+        return true;
+
+    /* the encoder runs behind its input, so like any AAC encoder its
+     * first (priming) frame is stamped before zero */
+    received_packet = true;
+    packet.type = OBS_ENCODER_AUDIO;
+    packet.pts  = frame.pts - AAC_ENCODER_DELAY;
+    packet.dts  = packet.pts;
+
+    return true;
+}
+
 bool aacEncoder::get_extra_data(std::vector<uint8_t> &data){
     if(extra_data.size() == 0)
         load_headers();
@@ -162,6 +217,10 @@ void aacEncoder::add_connection()
     audio_convert_info audio_info = {0};
     get_audio_info(audio_info);
 
+    /* the pcm encoder codes up to stereo, the output mixes down for it */
+    if (pcm_input && get_audio_channels(audio_info.speakers) > pcm_channels)
+        audio_info.speakers = SPEAKERS_STEREO;
+
     std::shared_ptr<AudioOutput> audio =
             std::dynamic_pointer_cast<AudioOutput>(media.lock());
     audio->connect(&audio_info, receive_audio, this);
@@ -200,38 +259,56 @@ static void receive_audio(void *param, media_data &data)
         encoder->first_raw_ts = data.timestamp;
         encoder->first_received = true;
         encoder->clear_audio();
+        encoder->drift.reset();
+        encoder->drift_corrected_ns = 0;
+        encoder->received_frames = 0;
     }
 
+    encoder->track_drift(data);
+
     if (!encoder->buffer_audio(data))
         return;
 
-    while (encoder->audio_input_buffer.size >= encoder->audio_output_buffer.size())
+    while (encoder->frame_bytes &&
+           encoder->audio_input_buffer.size >= encoder->frame_bytes)
         encoder->send_audio_data();
 }
 
 void aacEncoder::reset_audio_buffers()
 {
     free_audio_buffers();
-    audio_output_buffer.resize(blocksize * framesize,0);
+    frame_bytes = blocksize * framesize;
+    audio_input_buffer.reserve(frame_bytes * INPUT_BUFFER_FRAMES);
 }
 
 void aacEncoder::clear_audio()
 {
-    audio_input_buffer.free();
+    audio_input_buffer.clear();
 }
 
+/* hands the encoder a view of the oldest frame in the ring, which is only
+ * released once the encoder is done with it */
 void aacEncoder::send_audio_data()
 {
     encoder_frame enc_frame;
+    size_t start = audio_input_buffer.start_pos;
+    size_t first = audio_input_buffer.capacity - start;
 
-    audio_input_buffer.pop_front(&audio_output_buffer[0], audio_output_buffer.size());
+    if (first > frame_bytes)
+        first = frame_bytes;
 
-    enc_frame.data   = audio_output_buffer;
+    enc_frame.span[0]      = (const uint8_t*)audio_input_buffer.data + start;
+    enc_frame.span_size[0] = first;
+    if (first < frame_bytes) {
+        enc_frame.span[1]      = (const uint8_t*)audio_input_buffer.data;
+        enc_frame.span_size[1] = frame_bytes - first;
+    }
     enc_frame.frames = (uint32_t)framesize;
     enc_frame.pts    = cur_pts;
 
     do_encode(enc_frame);
 
+    audio_input_buffer.pop_front(frame_bytes);
     cur_pts += framesize;
 }
 
@@ -282,21 +359,104 @@ bool aacEncoder::buffer_audio(media_data &data)
 
     push_back_audio(data, size, offset_size);
 
+    if (success && pcm_input)
+        compensate_drift(size - offset_size);
+
     return success;
 }
 
+/* the sample clock counts pcm frames, or one access unit per buffer when
+ * the output carries encoded AAC */
+void aacEncoder::track_drift(media_data &data)
+{
+    if (!blocksize || !samplerate || data.data.empty() ||
+        data.timestamp < first_raw_ts)
+        return;
+
+    drift.update(data.timestamp - first_raw_ts,
+                 received_frames * 1000000000ULL / samplerate);
+    received_frames += pcm_input ? data.data.size() / blocksize :
+                       AAC_FRAME_SAMPLES;
+}
+
+/* keeps the sample clock within half the drift bound of capture time by
+ * repeating or dropping a single sample frame per buffer, which is well
+ * below what can be heard */
+void aacEncoder::compensate_drift(size_t size)
+{
+    int64_t frame_ns = 1000000000LL / samplerate;
+    int64_t residual = drift.get_drift_ns() - drift_corrected_ns;
+
+    if (!drift.settled() || size < blocksize ||
+        blocksize > AAC_MAX_CHANNELS * sizeof(float))
+        return;
+
+    if (residual > DRIFT_BOUND_NS / 2) {
+        uint8_t last[AAC_MAX_CHANNELS * sizeof(float)];
+
+        /* the frame just buffered, already interleaved */
+        audio_input_buffer.peek_back(last, blocksize);
+        audio_input_buffer.push_back(last, blocksize);
+        drift_corrected_ns += frame_ns;
+
+    } else if (residual < -DRIFT_BOUND_NS / 2) {
+        audio_input_buffer.pop_back(blocksize);
+        drift_corrected_ns -= frame_ns;
+    }
+}
+
 void aacEncoder::push_back_audio(media_data &data, size_t size, size_t offset_size)
 {
     size -= offset_size;
 
-    if (size)
+    if (size && pcm_planar)
+        push_back_planes(data, size, offset_size);
+    else if (size)
         audio_input_buffer.push_back(&data.data[offset_size], size);
 }
 
+/* the input ring holds whole sample frames, so float planes from the
+ * output are interleaved straight into it; sizes and offsets count the
+ * interleaved bytes */
+void aacEncoder::push_back_planes(media_data &data, size_t size, size_t offset_size)
+{
+    const float *src = (const float*)data.data.data();
+    size_t plane_frames = data.data.size() / blocksize;
+    size_t frame = offset_size / blocksize;
+    size_t end = frame + size / blocksize;
+    float cut[AAC_MAX_CHANNELS];
+    uint8_t *span[2];
+    size_t span_size[2];
+
+    audio_input_buffer.push_back_spans((end - frame) * blocksize, span,
+                                       span_size);
+
+    for (int s = 0; s < 2 && frame < end; s++) {
+        float *dst = (float*)span[s];
+        size_t whole = MIN(span_size[s] / blocksize, end - frame);
+
+        for (size_t i = 0; i < whole; i++, frame++)
+            for (size_t c = 0; c < pcm_channels; c++)
+                *dst++ = src[c * plane_frames + frame];
+
+        /* a frame cut in two by the end of the ring's storage */
+        size_t head = span_size[s] - whole * blocksize;
+        if (s == 0 && head && frame < end) {
+            for (size_t c = 0; c < pcm_channels; c++)
+                cut[c] = src[c * plane_frames + frame];
+            memcpy(dst, cut, head);
+            memcpy(span[1], (uint8_t*)cut + head, blocksize - head);
+            span[1]      += blocksize - head;
+            span_size[1] -= blocksize - head;
+            frame++;
+        }
+    }
+}
+
 void aacEncoder::free_audio_buffers()
 {
     audio_input_buffer.free();
-    audio_output_buffer.clear();
+    frame_bytes = 0;
 }
 
 void aacEncoder::intitialize_audio_encoder()
@@ -307,23 +467,62 @@ void aacEncoder::intitialize_audio_encoder()
     samplerate = info.samples_per_sec;
     blocksize  = get_audio_size(info.format, info.speakers, 1);
 
+    std::shared_ptr<AudioOutput> audio =
+            std::dynamic_pointer_cast<AudioOutput>(media.lock());
+
+    /* without a codec config from java the output carries raw pcm */
+    pcm_input = audio && audio->format.empty() && open_pcm_encoder(info);
+    if (pcm_input)
+        blocksize = (pcm_float ? sizeof(float) : sizeof(int16_t)) *
+                    pcm_channels;
+
     reset_audio_buffers();
 }
 
+bool aacEncoder::open_pcm_encoder(audio_convert_info &info)
+{
+    pcm_channels = get_audio_channels(info.speakers);
+    if (pcm_channels > AAC_MAX_CHANNELS)
+        pcm_channels = AAC_MAX_CHANNELS;
+
+    pcm_planar = false;
+
+    switch (info.format) {
+        case AUDIO_FORMAT_FLOAT_PLANAR:
+            pcm_planar = pcm_channels > 1;
+            /* fall through */
+        case AUDIO_FORMAT_FLOAT:
+            pcm_float = true;
+            break;
+        case AUDIO_FORMAT_16BIT:
+            pcm_float = false;
+            break;
+        default:
+            LOGI("aacEncoder: unsupported pcm format %d", (int)info.format);
+            return false;
+    }
+
+    uint32_t kbps = bitrate ? bitrate : 64 * pcm_channels;
+    if (pcm_encoder.open(samplerate, pcm_channels, kbps * 1000))
+        return true;
+
+    pcm_planar = false;
+    return false;
+}
+
+/* the ring holds everything since first_raw_ts, so starting at the video
+ * start point only means dropping the front of it */
 void aacEncoder::start_from_buffer(uint64_t v_start_ts)
 {
-    size_t size = audio_input_buffer.size;
-    media_data audio;
     size_t offset_size = 0;
 
-    audio.data.resize(size,0);
-    memcpy(&audio.data[0],audio_input_buffer.data,audio.data.size());
-    clear_audio();
-
     if (first_raw_ts < v_start_ts)
         offset_size = calc_offset_size(v_start_ts, first_raw_ts);
 
-    push_back_audio(audio, size, offset_size);
+    if (offset_size >= audio_input_buffer.size)
+        clear_audio();
+    else if (offset_size)
+        audio_input_buffer.pop_front(offset_size);
 }
 
 size_t aacEncoder::calc_offset_size(uint64_t v_start_ts, uint64_t a_start_ts)
@@ -341,6 +540,11 @@ void aacEncoder::on_initialize_internal()
 
 void aacEncoder::load_headers()
 {
+    if (pcm_input) {
+        extra_data = pcm_encoder.get_config();
+        return;
+    }
+
     std::shared_ptr<AudioOutput> audio =
             std::dynamic_pointer_cast<AudioOutput>(media.lock());
     if(!audio)
@@ -352,6 +556,7 @@ void aacEncoder::load_headers()
 
 void aacEncoder::on_actually_destroy()
 {
+    pcm_encoder.close();
     free_audio_buffers();
 }
 
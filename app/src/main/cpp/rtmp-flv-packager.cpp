@@ -1,145 +1,271 @@
 
+#include <stdio.h>
+#include <string.h>
 #include <string>
 
-#include "util/array-serializer.h"
-#include "util/darray.h"
-#include "util/dstr.h"
-
 #include "rtmp-helpers.h"
 #include "rtmp-flv-packager.h"
-#include "rtmp-serialize-byte.h"
-
-std::vector<uint8_t> FLVPackager::flv_meta_data(bool write_header)
+#include "rtmp-span-writer.h"
+#include "rtmp-amf-schema.h"
+#include "rtmp-video-bitstream.h"
+
+/* enhanced rtmp video header, IsExHeader | FrameType | PacketType */
+#define FLV_EX_HEADER              0x80
+#define FLV_EX_FRAME_KEY           0x10
+#define FLV_EX_FRAME_INTER         0x20
+#define FLV_EX_SEQUENCE_START      0
+#define FLV_EX_CODED_FRAMES        1
+#define FLV_EX_CODED_FRAMES_X      3
+
+#define FLV_FILE_HEADER_SIZE       13
+#define FLV_TAG_HEADER_SIZE        11
+#define FLV_TAG_TRAILER_SIZE       4
+
+/* everything is sized up front so a tag is one allocation and one pass */
+static constexpr size_t flv_tag_size(size_t body_size)
 {
-    std::vector<uint8_t> meta_data = build_flv_meta_data();
-    int data_size = meta_data.size();
-    if (data_size == 0)
-        return std::vector<uint8_t>();
-
-    SerializeByte serialize_byte;
-    if (write_header) {
-        serialize_byte.write("FLV", 3);
-        serialize_byte.write_uint8(1);
-        serialize_byte.write_uint8(5);
-        serialize_byte.write_uint32(9);
-        serialize_byte.write_uint32(0);
-    }
-
-    uint32_t start_pos = serialize_byte.get_pos();
-
-    serialize_byte.write_uint8(RTMP_PACKET_TYPE_INFO);
-
-    serialize_byte.write_uint24(data_size);
-    serialize_byte.write_uint32(0);
-    serialize_byte.write_uint24(0);
+    return FLV_TAG_HEADER_SIZE + body_size + FLV_TAG_TRAILER_SIZE;
+}
 
-    serialize_byte.write(&meta_data[0], data_size);
+static constexpr size_t flv_video_body_size(size_t payload_size)
+{
+    return 5 + payload_size;
+}
 
-    serialize_byte.write_uint32((uint32_t)serialize_byte.get_pos() - start_pos - 1);
+static constexpr size_t flv_video_ex_body_size(size_t payload_size,
+                                               bool with_cts)
+{
+    return 5 + (with_cts ? 3 : 0) + payload_size;
+}
 
-    return serialize_byte.GetDataByte();
+static constexpr size_t flv_audio_body_size(size_t payload_size)
+{
+    return 2 + payload_size;
 }
 
-std::vector<uint8_t> FLVPackager::build_flv_meta_data()
+static void write_tag_header(span_writer &s, uint8_t type, size_t body_size,
+                             int32_t time_ms)
 {
-    char buf[4096];
-    char *enc = buf;
-    char *end = enc+sizeof(buf);
-    struct dstr encoder_name = {0};
+    s.write_uint8(type);
+    s.write_uint24((uint32_t)body_size);
+    s.write_flv_time(time_ms);
+    s.write_uint24(0);
+}
 
-    enc_str(&enc, end, "onMetaData");
+FLVPackager::FLVPackager():
+has_video(false),
+width(0),
+height(0),
+video_codec_id(0),
+frame_rate(0),
+has_audio(false),
+audio_codec_id(0),
+audio_data_rate(0),
+audio_sample_rate(0),
+has_file_info(false),
+duration(0),
+file_size(0)
+{
+}
 
-    *enc++ = AMF_ECMA_ARRAY;
-    enc    = AMF_EncodeInt32(enc, end,  20);
+/* onMetaData is sized from its fields and written in one pass, straight
+ * into the tag */
+std::vector<uint8_t> FLVPackager::flv_meta_data(bool write_header)
+{
+    static const char on_meta_data[] = "onMetaData";
+    char encoder_name[64];
+    int name_len = snprintf(encoder_name, sizeof(encoder_name),
+                            "%s ( version %d.%d.%d )", "rtmp-output module",
+                            MAJOR_VER, MINOR_VER, PATCH_VER);
+
+#define META_DATA_FIELDS \
+        amf_number_field("duration",        duration,          has_file_info), \
+        amf_number_field("filesize",        file_size,         has_file_info), \
+        amf_number_field("width",           width,             has_video), \
+        amf_number_field("height",          height,            has_video), \
+        amf_number_field("videocodecid",    video_codec_id,    has_video), \
+        amf_number_field("framerate",       frame_rate,        has_video && frame_rate > 0), \
+        amf_number_field("audiocodecid",    audio_codec_id,    has_audio), \
+        amf_number_field("audiodatarate",   audio_data_rate,   has_audio), \
+        amf_number_field("audiosamplerate", audio_sample_rate, has_audio), \
+        amf_string_field("encoder",         encoder_name,      (size_t)name_len)
+
+    size_t data_size = span_writer::amf_string_size(sizeof(on_meta_data) - 1) +
+                       amf_ecma_array_size(META_DATA_FIELDS);
+    size_t header_size = write_header ? FLV_FILE_HEADER_SIZE : 0;
+
+    std::vector<uint8_t> out;
+    span_writer s(out, header_size + flv_tag_size(data_size));
 
-    for(PropertyMap::iterator it = properties.begin();it!=properties.end();it++){
-        enc_num_val(&enc, end, it->first.c_str(), it->second);
+    if (write_header) {
+        s.write("FLV", 3);
+        s.write_uint8(1);
+        s.write_uint8(5);
+        s.write_uint32(9);
+        s.write_uint32(0);
     }
 
-    dstr_printf(&encoder_name, "%s ( version %d.%d.%d )", "rtmp-output module",
-                MAJOR_VER, MINOR_VER, PATCH_VER);
-
-    enc_str_val(&enc, end, "encoder", encoder_name.array);
-    dstr_free(&encoder_name);
+    write_tag_header(s, RTMP_PACKET_TYPE_INFO, data_size, 0);
+    s.write_amf_string(on_meta_data, sizeof(on_meta_data) - 1);
+    write_amf_ecma_array(s, META_DATA_FIELDS);
 
-    *enc++  = 0;
-    *enc++  = 0;
-    *enc++  = AMF_OBJECT_END;
+#undef META_DATA_FIELDS
 
-    std::vector<uint8_t> buffer(enc-buf,0);
-
-    if(enc-buf > 0)
-        memcpy(&buffer[0],buf,buffer.size());
-
-    return buffer;
+    s.write_uint32((uint32_t)(s.pos() - header_size));
+    return out;
 }
 
-void FLVPackager::setProperty(std::string name,double value)
-{
-    properties.insert(std::make_pair(name,value));
-}
-
-void FLVPackager::flv_video(SerializeByte &s, int32_t dts_offset,
+void FLVPackager::flv_video(std::vector<uint8_t> &out, int32_t dts_offset,
                       encoder_packet &packet, bool is_header)
 {
-    int64_t offset  = packet.pts - packet.dts;
+    /* composition time is signed, b-frames decode ahead of display. Both
+     * ends are rounded to ms first so dts + cts lands on the rounded pts */
+    int32_t cts     = packet.get_ms_time(packet.pts) -
+                      packet.get_ms_time(packet.dts);
     int32_t time_ms = packet.get_ms_time(packet.dts) - dts_offset;
 
     size_t pk_size = packet.data.size();
-    if (pk_size==0)
+    if (pk_size==0) {
+        out.clear();
+        return;
+    }
+
+    if (packet.fourcc && packet.fourcc != VIDEO_FOURCC_AVC) {
+        flv_video_ex(out, time_ms, cts, packet, is_header);
         return;
+    }
 
-    s.write_uint8(RTMP_PACKET_TYPE_VIDEO);
+    size_t body_size = flv_video_body_size(pk_size);
+    span_writer s(out, flv_tag_size(body_size));
 
-    s.write_uint24((uint32_t)pk_size + 5);
-    s.write_uint24(time_ms);
-    s.write_uint8((time_ms >> 24) & 0x7F);
-    s.write_uint24(0);
+    write_tag_header(s, RTMP_PACKET_TYPE_VIDEO, body_size, time_ms);
 
     /* these are the 5 extra bytes mentioned above */
     s.write_uint8(packet.keyframe ? 0x17 : 0x27);
     s.write_uint8(is_header ? 0 : 1);
-    s.write_uint24(packet.get_ms_time(offset));
+    s.write_uint24((uint32_t)cts);
     s.write(&packet.data[0], pk_size);
 
-    /* write tag size (starting byte doesn't count) */
-    s.write_uint32((uint32_t)s.get_pos() - 1);
+    /* previous tag size: the 11 byte header plus the body */
+    s.write_uint32((uint32_t)s.pos());
 }
 
-void FLVPackager::flv_audio(SerializeByte &s, int32_t dts_offset,
+/* FourCC tags for codecs legacy flv has no id for. Only hevc carries a
+ * composition time, and CodedFramesX leaves it out when it is zero. */
+void FLVPackager::flv_video_ex(std::vector<uint8_t> &out, int32_t time_ms,
+                      int32_t cts, encoder_packet &packet, bool is_header)
+{
+    size_t pk_size = packet.data.size();
+    bool with_cts = !is_header && packet.fourcc == VIDEO_FOURCC_HEVC && cts;
+    uint8_t packet_type;
+
+    if (is_header)
+        packet_type = FLV_EX_SEQUENCE_START;
+    else if (packet.fourcc == VIDEO_FOURCC_HEVC && !cts)
+        packet_type = FLV_EX_CODED_FRAMES_X;
+    else
+        packet_type = FLV_EX_CODED_FRAMES;
+
+    size_t body_size = flv_video_ex_body_size(pk_size, with_cts);
+    span_writer s(out, flv_tag_size(body_size));
+
+    write_tag_header(s, RTMP_PACKET_TYPE_VIDEO, body_size, time_ms);
+
+    s.write_uint8(FLV_EX_HEADER | packet_type |
+                  (packet.keyframe ? FLV_EX_FRAME_KEY : FLV_EX_FRAME_INTER));
+    s.write_uint32(packet.fourcc);
+    if (with_cts)
+        s.write_uint24((uint32_t)cts);
+    s.write(&packet.data[0], pk_size);
+
+    s.write_uint32((uint32_t)s.pos());
+}
+
+void FLVPackager::flv_audio(std::vector<uint8_t> &out, int32_t dts_offset,
                       encoder_packet &packet, bool is_header)
 {
     int32_t time_ms = packet.get_ms_time(packet.dts) - dts_offset;
 
     size_t pk_size = packet.data.size();
-    if (pk_size==0)
+    if (pk_size==0) {
+        out.clear();
         return;
+    }
 
-    s.write_uint8(RTMP_PACKET_TYPE_AUDIO);
+    size_t body_size = flv_audio_body_size(pk_size);
+    span_writer s(out, flv_tag_size(body_size));
 
-    s.write_uint24((uint32_t)pk_size + 2);
-    s.write_uint24(time_ms);
-    s.write_uint8((time_ms >> 24) & 0x7F);
-    s.write_uint24(0);
+    write_tag_header(s, RTMP_PACKET_TYPE_AUDIO, body_size, time_ms);
 
     /* these are the two extra bytes mentioned above */
     s.write_uint8(0xaf);
     s.write_uint8(is_header ? 0 : 1);
     s.write(&packet.data[0], pk_size);
 
-    /* write tag size (starting byte doesn't count) */
-    s.write_uint32((uint32_t)s.get_pos() - 1);
+    /* previous tag size: the 11 byte header plus the body */
+    s.write_uint32((uint32_t)s.pos());
+}
+
+void FLVPackager::flv_packet_mux(std::vector<uint8_t> &out,
+                    encoder_packet &packet, int32_t dts_offset, bool is_header)
+{
+    if (packet.type == OBS_ENCODER_VIDEO)
+        flv_video(out, dts_offset, packet, is_header);
+    else
+        flv_audio(out, dts_offset, packet, is_header);
 }
 
 std::vector<uint8_t> FLVPackager::flv_packet_mux(encoder_packet &packet, int32_t dts_offset,
                     bool is_header)
 {
-    SerializeByte serialize_byte;
+    std::vector<uint8_t> out;
+    flv_packet_mux(out, packet, dts_offset, is_header);
+    return out;
+}
+
+void FLVPackager::flv_aggregate_mux(std::vector<uint8_t> &out,
+                    const std::vector<uint8_t> &tags, int32_t time_ms)
+{
+    size_t tags_size = tags.size();
+    if (tags_size == 0) {
+        out.clear();
+        return;
+    }
 
-    if (packet.type == OBS_ENCODER_VIDEO)
-        flv_video(serialize_byte, dts_offset, packet, is_header);
-    else
-        flv_audio(serialize_byte, dts_offset, packet, is_header);
+    span_writer s(out, flv_tag_size(tags_size));
+
+    /* the aggregate body is the complete sub tags, back pointers included */
+    write_tag_header(s, RTMP_PACKET_TYPE_FLASH_VIDEO, tags_size, time_ms);
+    s.write(&tags[0], tags_size);
+
+    s.write_uint32((uint32_t)s.pos());
+}
 
-    return serialize_byte.GetDataByte();
+void FLVPackager::flv_body_mux(std::vector<uint8_t> &out, uint8_t type,
+                               int32_t time_ms, const uint8_t *body, size_t size)
+{
+    span_writer s(out, flv_tag_size(size));
+
+    write_tag_header(s, type, size, time_ms);
+    s.write(body, size);
+    s.write_uint32((uint32_t)s.pos());
+}
+
+std::vector<uint8_t> FLVPackager::flv_file_header(bool has_audio, bool has_video)
+{
+    std::vector<uint8_t> out;
+    span_writer s(out, FLV_FILE_HEADER_SIZE);
+
+    s.write("FLV", 3);
+    s.write_uint8(1);
+    s.write_uint8((has_audio ? 4 : 0) | (has_video ? 1 : 0));
+    s.write_uint32(9);
+    s.write_uint32(0);
+    return out;
+}
+
+int32_t FLVPackager::flv_tag_time_ms(const uint8_t *tag)
+{
+    return (int32_t)(((uint32_t)tag[7] << 24) | ((uint32_t)tag[4] << 16) |
+                     ((uint32_t)tag[5] << 8) | (uint32_t)tag[6]);
 }
@@ -2,38 +2,61 @@
 
 #pragma once
 
-#include <map>
-#include <string>
 #include <vector>
 #include "rtmp-defs.h"
-#include "util/serializer.h"
 
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-class SerializeByte;
-
 class FLVPackager {
 public:
+    FLVPackager();
+
+    /* onMetaData, the video and audio groups are only written when their
+     * has_ flag is set, duration and filesize only for files */
+    bool   has_video;
+    double width;
+    double height;
+    double video_codec_id;
+    double frame_rate;
+
+    bool   has_audio;
+    double audio_codec_id;
+    double audio_data_rate;
+    double audio_sample_rate;
+
+    bool   has_file_info;
+    double duration;
+    double file_size;
+
     std::vector<uint8_t> flv_meta_data(bool write_header);
 
+    /* out is resized to the tag, reusing its capacity */
+    static void flv_packet_mux(std::vector<uint8_t> &out, encoder_packet &packet,
+                        int32_t dts_offset, bool is_header);
     static std::vector<uint8_t> flv_packet_mux(encoder_packet &packet, int32_t dts_offset,
                         bool is_header);
 
-    void setProperty(std::string name, double value);
-
-private:
+    static void flv_aggregate_mux(std::vector<uint8_t> &out,
+                        const std::vector<uint8_t> &tags, int32_t time_ms);
 
-    typedef std::map<std::string, double> PropertyMap;
-    PropertyMap properties;
+    /* a tag around a body that is in FLV form already, as the audio, video
+     * and data messages of an RTMP publisher are */
+    static void flv_body_mux(std::vector<uint8_t> &out, uint8_t type,
+                        int32_t time_ms, const uint8_t *body, size_t size);
+    /* file header for files without an onMetaData of our own */
+    static std::vector<uint8_t> flv_file_header(bool has_audio, bool has_video);
 
-    std::vector<uint8_t> build_flv_meta_data();
+    static int32_t flv_tag_time_ms(const uint8_t *tag);
 
-    static void flv_video(SerializeByte &s, int32_t dts_offset,
+private:
+    static void flv_video(std::vector<uint8_t> &out, int32_t dts_offset,
                                        encoder_packet &packet, bool is_header);
-    static void flv_audio(SerializeByte &s, int32_t dts_offset,
+    static void flv_video_ex(std::vector<uint8_t> &out, int32_t time_ms,
+                                       int32_t cts, encoder_packet &packet, bool is_header);
+    static void flv_audio(std::vector<uint8_t> &out, int32_t dts_offset,
                                        encoder_packet &packet, bool is_header);
 };
 
@@ -0,0 +1,490 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "librtmp/rtmp.h"
+#include "rtmp-defs.h"
+#include "rtmp-flv-recorder.h"
+#include "rtmp-flv-packager.h"
+#include "rtmp-span-writer.h"
+
+#define RECORD_BUFFER_SIZE   (512 * 1024)
+#define RECORD_BUFFER_COUNT  16
+#define RECORD_BUFFER_ALIGN  4096
+#define RECORD_PREALLOC_SIZE (32 * 1024 * 1024)
+
+#define FLV_EX_HEADER_BIT    0x80
+
+/* offset of the value of an onMetaData number property, 0 if missing */
+static size_t find_amf_number(const std::vector<uint8_t> &data,
+		const char *name)
+{
+	size_t len = strlen(name);
+	size_t need = span_writer::amf_name_size(len) +
+	              span_writer::amf_number_size();
+
+	for (size_t i = 0; i + need <= data.size(); i++) {
+		const uint8_t *p = &data[i];
+
+		if (p[0] == (uint8_t)(len >> 8) && p[1] == (uint8_t)len &&
+			memcmp(p + 2, name, len) == 0 && p[2 + len] == AMF_NUMBER)
+			return i + 2 + len + 1;
+	}
+
+	return 0;
+}
+
+FlvRecorder::FlvRecorder():
+fd(-1),
+write_sem(NULL),
+cur_buffer(NULL),
+cur_size(0),
+opened(false),
+stopping(false),
+failed(false),
+header_written(false),
+wait_keyframe(true),
+prealloc_end(0),
+file_size(0),
+queued_size(0),
+last_time_ms(0),
+duration_offset(0),
+filesize_offset(0),
+bytes_written(0),
+dropped_tags(0),
+dropped_bytes(0)
+{
+	pthread_mutex_init(&mutex, NULL);
+}
+
+FlvRecorder::~FlvRecorder()
+{
+	close();
+	pthread_mutex_destroy(&mutex);
+}
+
+bool FlvRecorder::open(const char *path)
+{
+	close();
+
+	fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_LARGEFILE,
+			0644);
+	if (fd < 0) {
+		LOGI("flv recorder: failed to open %s: %s", path, strerror(errno));
+		return false;
+	}
+
+	for (int i = 0; i < RECORD_BUFFER_COUNT; i++) {
+		void *buf = NULL;
+		if (posix_memalign(&buf, RECORD_BUFFER_ALIGN, RECORD_BUFFER_SIZE) != 0)
+			break;
+		free_buffers.push_back((uint8_t *)buf);
+	}
+
+	if (free_buffers.empty() || os_sem_init(&write_sem, 0) != 0) {
+		free_pool();
+		::close(fd);
+		fd = -1;
+		return false;
+	}
+
+	stopping       = false;
+	failed         = false;
+	header_written = false;
+	wait_keyframe  = true;
+	prealloc_end   = 0;
+	file_size      = 0;
+	queued_size    = 0;
+	last_time_ms   = 0;
+	duration_offset = 0;
+	filesize_offset = 0;
+	bytes_written  = 0;
+	dropped_tags   = 0;
+	dropped_bytes  = 0;
+
+	if (pthread_create(&write_thread, NULL, write_thread_fun, this) != 0) {
+		os_sem_destroy(write_sem);
+		write_sem = NULL;
+		free_pool();
+		::close(fd);
+		fd = -1;
+		return false;
+	}
+
+	pthread_mutex_lock(&mutex);
+	opened = true;
+	pthread_mutex_unlock(&mutex);
+	return true;
+}
+
+void FlvRecorder::close()
+{
+	pthread_mutex_lock(&mutex);
+	if (!opened) {
+		pthread_mutex_unlock(&mutex);
+		return;
+	}
+
+	opened   = false;
+	stopping = true;
+
+	/* the tail is the only write that isn't a whole buffer */
+	if (cur_buffer && cur_size) {
+		record_buffer tail = {cur_buffer, cur_size};
+		full_buffers.push_back(tail);
+	} else if (cur_buffer) {
+		free_buffers.push_back(cur_buffer);
+	}
+	cur_buffer = NULL;
+	cur_size   = 0;
+	pthread_mutex_unlock(&mutex);
+
+	os_sem_post(write_sem);
+	pthread_join(write_thread, NULL);
+
+	patch_meta_data();
+
+	/* truncating to the current size gives back the blocks preallocated
+	 * past the end */
+	if (prealloc_end > file_size)
+		ftruncate64(fd, file_size);
+
+	::close(fd);
+	fd = -1;
+
+	os_sem_destroy(write_sem);
+	write_sem = NULL;
+	free_pool();
+
+	if (dropped_tags || failed)
+		LOGI("flv recorder: dropped %d tags (%llu bytes)", dropped_tags,
+				(unsigned long long)dropped_bytes);
+}
+
+bool FlvRecorder::active()
+{
+	pthread_mutex_lock(&mutex);
+	bool ret = opened;
+	pthread_mutex_unlock(&mutex);
+	return ret;
+}
+
+bool FlvRecorder::has_header()
+{
+	return header_written;
+}
+
+void FlvRecorder::write_header(FLVPackager &packager)
+{
+	/* placeholders, the real values are only known on close */
+	packager.has_file_info = true;
+	packager.duration      = 0;
+	packager.file_size     = 0;
+
+	std::vector<uint8_t> header = packager.flv_meta_data(true);
+
+	duration_offset = find_amf_number(header, "duration");
+	filesize_offset = find_amf_number(header, "filesize");
+
+	header_written = queue_data(&header[0], header.size());
+}
+
+void FlvRecorder::write_packet(encoder_packet &packet, int32_t dts_offset,
+		bool is_header)
+{
+	bool video = packet.type == OBS_ENCODER_VIDEO;
+
+	if (!header_written)
+		return;
+
+	/* a decoder can't pick video back up before the next keyframe */
+	if (video && !is_header && wait_keyframe && !packet.keyframe) {
+		pthread_mutex_lock(&mutex);
+		if (opened)
+			dropped_tags++;
+		pthread_mutex_unlock(&mutex);
+		return;
+	}
+
+	FLVPackager::flv_packet_mux(tag, packet, is_header ? 0 : dts_offset,
+			is_header);
+	if (tag.empty())
+		return;
+
+	if (!queue_data(&tag[0], tag.size())) {
+		if (video)
+			wait_keyframe = true;
+		return;
+	}
+
+	if (video && !is_header)
+		wait_keyframe = false;
+	if (!is_header)
+		last_time_ms = FLVPackager::flv_tag_time_ms(&tag[0]);
+}
+
+void FlvRecorder::write_file_header(bool has_audio, bool has_video)
+{
+	std::vector<uint8_t> header = FLVPackager::flv_file_header(has_audio,
+			has_video);
+
+	header_written = queue_data(&header[0], header.size());
+}
+
+void FlvRecorder::write_message(uint8_t type, int32_t time_ms,
+		const uint8_t *body, size_t size)
+{
+	bool video = type == RTMP_PACKET_TYPE_VIDEO;
+	bool is_header = false;
+
+	if (!header_written || !size)
+		return;
+
+	if (type == RTMP_PACKET_TYPE_INFO) {
+		/* "@setDataFrame" is for the server, the file keeps what follows */
+		static const char set_data_frame[] = "\x02\x00\x0d@setDataFrame";
+		size_t len = sizeof(set_data_frame) - 1;
+
+		if (size > len && memcmp(body, set_data_frame, len) == 0) {
+			body += len;
+			size -= len;
+		}
+	} else if (video && size >= 2) {
+		/* sequence headers, legacy AVC/HEVC or enhanced */
+		if (body[0] & FLV_EX_HEADER_BIT)
+			is_header = (body[0] & 0x0f) == 0;
+		else
+			is_header = body[1] == 0;
+	}
+
+	if (video && !is_header && wait_keyframe &&
+			((body[0] >> 4) & 0x07) != 1) {
+		pthread_mutex_lock(&mutex);
+		if (opened)
+			dropped_tags++;
+		pthread_mutex_unlock(&mutex);
+		return;
+	}
+
+	FLVPackager::flv_body_mux(tag, type, is_header ? 0 : time_ms, body, size);
+
+	if (type == RTMP_PACKET_TYPE_INFO && !duration_offset && !filesize_offset) {
+		size_t duration = find_amf_number(tag, "duration");
+		size_t filesize = find_amf_number(tag, "filesize");
+
+		/* offsets are into the file, the tag goes where the queue ends */
+		if (duration)
+			duration_offset = (size_t)queued_size + duration;
+		if (filesize)
+			filesize_offset = (size_t)queued_size + filesize;
+	}
+
+	if (!queue_data(&tag[0], tag.size())) {
+		if (video)
+			wait_keyframe = true;
+		return;
+	}
+
+	if (video && !is_header)
+		wait_keyframe = false;
+	if (!is_header && type != RTMP_PACKET_TYPE_INFO)
+		last_time_ms = time_ms;
+}
+
+uint64_t FlvRecorder::get_bytes_written()
+{
+	return bytes_written;
+}
+
+int FlvRecorder::get_dropped_tags()
+{
+	return dropped_tags;
+}
+
+uint64_t FlvRecorder::get_dropped_bytes()
+{
+	return dropped_bytes;
+}
+
+/* Copies data into the buffer pool as one unit, or not at all when the
+ * pool can't take all of it. Tags run across buffer boundaries so every
+ * buffer but the last goes to disk full. */
+bool FlvRecorder::queue_data(const uint8_t *data, size_t size)
+{
+	bool signal = false;
+
+	pthread_mutex_lock(&mutex);
+
+	if (!opened)
+		goto done;
+
+	if (failed || (cur_buffer ? RECORD_BUFFER_SIZE - cur_size : 0) +
+			free_buffers.size() * RECORD_BUFFER_SIZE < size) {
+		dropped_tags++;
+		dropped_bytes += size;
+		goto done;
+	}
+
+	while (size) {
+		if (!cur_buffer) {
+			cur_buffer = free_buffers.back();
+			cur_size   = 0;
+			free_buffers.pop_back();
+		}
+
+		size_t bytes = RECORD_BUFFER_SIZE - cur_size;
+		if (bytes > size)
+			bytes = size;
+
+		memcpy(cur_buffer + cur_size, data, bytes);
+		cur_size += bytes;
+		data     += bytes;
+		size     -= bytes;
+
+		queued_size += bytes;
+
+		if (cur_size == RECORD_BUFFER_SIZE) {
+			record_buffer full = {cur_buffer, cur_size};
+			full_buffers.push_back(full);
+			cur_buffer = NULL;
+			signal     = true;
+		}
+	}
+
+	pthread_mutex_unlock(&mutex);
+
+	if (signal)
+		os_sem_post(write_sem);
+	return true;
+
+done:
+	pthread_mutex_unlock(&mutex);
+	return false;
+}
+
+void *FlvRecorder::write_thread_fun(void *data)
+{
+	FlvRecorder *recorder = (FlvRecorder *)data;
+	std::vector<record_buffer> batch;
+
+	os_set_thread_name("flv-recorder: write_thread");
+
+	while (os_sem_wait(recorder->write_sem) == 0) {
+		pthread_mutex_lock(&recorder->mutex);
+		batch.swap(recorder->full_buffers);
+		bool stop = recorder->stopping;
+		pthread_mutex_unlock(&recorder->mutex);
+
+		if (!batch.empty())
+			recorder->write_buffers(batch);
+
+		pthread_mutex_lock(&recorder->mutex);
+		for (size_t i = 0; i < batch.size(); i++)
+			recorder->free_buffers.push_back(batch[i].data);
+		stop = stop && recorder->full_buffers.empty();
+		pthread_mutex_unlock(&recorder->mutex);
+
+		batch.clear();
+
+		if (stop)
+			break;
+	}
+
+	return NULL;
+}
+
+void FlvRecorder::write_buffers(std::vector<record_buffer> &batch)
+{
+	struct iovec iov[RECORD_BUFFER_COUNT];
+	int count = 0;
+	size_t total = 0;
+
+	for (size_t i = 0; i < batch.size(); i++) {
+		iov[count].iov_base = batch[i].data;
+		iov[count].iov_len  = batch[i].size;
+		total += batch[i].size;
+		count++;
+	}
+
+	preallocate(file_size + (int64_t)total);
+
+	struct iovec *cur = iov;
+	size_t left = total;
+
+	while (left && !failed) {
+		ssize_t ret = writev(fd, cur, count);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			LOGI("flv recorder: write failed: %s", strerror(errno));
+			pthread_mutex_lock(&mutex);
+			failed = true;
+			dropped_bytes += left;
+			pthread_mutex_unlock(&mutex);
+			break;
+		}
+
+		left          -= (size_t)ret;
+		file_size     += ret;
+		bytes_written += (uint64_t)ret;
+
+		while (count && (size_t)ret >= cur->iov_len) {
+			ret -= cur->iov_len;
+			cur++;
+			count--;
+		}
+		if (count) {
+			cur->iov_base = (uint8_t *)cur->iov_base + ret;
+			cur->iov_len -= ret;
+		}
+	}
+}
+
+/* keeps the blocks ahead of the write position allocated so the file
+ * grows in large contiguous extents instead of one buffer at a time */
+void FlvRecorder::preallocate(int64_t end)
+{
+	if (prealloc_end < 0 || end <= prealloc_end)
+		return;
+
+	int64_t start = prealloc_end > file_size ? prealloc_end : file_size;
+	if (fallocate64(fd, FALLOC_FL_KEEP_SIZE, start,
+				end - start + RECORD_PREALLOC_SIZE) != 0) {
+		/* not supported by every filesystem, plain writes still work */
+		prealloc_end = -1;
+		return;
+	}
+
+	prealloc_end = end + RECORD_PREALLOC_SIZE;
+}
+
+void FlvRecorder::patch_meta_data()
+{
+	uint8_t value[8];
+
+	if (failed)
+		return;
+
+	if (duration_offset) {
+		span_writer s(value, sizeof(value));
+		s.write_double((double)last_time_ms / 1000.0);
+		pwrite64(fd, value, sizeof(value), (off64_t)duration_offset);
+	}
+
+	if (filesize_offset) {
+		span_writer s(value, sizeof(value));
+		s.write_double((double)file_size);
+		pwrite64(fd, value, sizeof(value), (off64_t)filesize_offset);
+	}
+}
+
+void FlvRecorder::free_pool()
+{
+	for (size_t i = 0; i < free_buffers.size(); i++)
+		free(free_buffers[i]);
+	free_buffers.clear();
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdint.h>
+#include <pthread.h>
+#include <vector>
+
+#include "util/threading.h"
+#include "rtmp-struct.h"
+
+class FLVPackager;
+
+/* Writes the packets of a live stream to a local FLV file. Tags are muxed
+ * on the caller's thread into a fixed pool of page aligned buffers and a
+ * writer thread hands every full buffer to the disk in one writev, so the
+ * caller never waits on the disk. When the pool is exhausted the tag is
+ * dropped and counted, video then resumes at the next keyframe. */
+class FlvRecorder {
+public:
+	FlvRecorder();
+	virtual ~FlvRecorder();
+
+	bool open(const char *path);
+	/* waits for queued data, then patches duration and filesize into the
+	 * onMetaData written by write_header */
+	void close();
+
+	bool active();
+	bool has_header();
+
+	/* FLV file header and onMetaData, goes first */
+	void write_header(FLVPackager &packager);
+	void write_packet(encoder_packet &packet, int32_t dts_offset,
+			bool is_header);
+
+	/* for streams that arrive muxed, as from an RTMP publisher: a bare
+	 * file header, then each audio, video or data message as a tag. An
+	 * onMetaData among them gets duration and filesize patched on close
+	 * when it has them. */
+	void write_file_header(bool has_audio, bool has_video);
+	void write_message(uint8_t type, int32_t time_ms, const uint8_t *body,
+			size_t size);
+
+	uint64_t get_bytes_written();
+	int get_dropped_tags();
+	uint64_t get_dropped_bytes();
+
+private:
+	struct record_buffer {
+		uint8_t *data;
+		size_t   size;
+	};
+
+	int                        fd;
+	pthread_t                  write_thread;
+	os_sem_t                   *write_sem;
+	pthread_mutex_t            mutex;
+
+	/* everything below but tag is guarded by mutex */
+	std::vector<uint8_t *>     free_buffers;
+	std::vector<record_buffer> full_buffers;
+	uint8_t                    *cur_buffer;
+	size_t                     cur_size;
+	bool                       opened;
+	bool                       stopping;
+	bool                       failed;
+	bool                       header_written;
+	bool                       wait_keyframe;
+
+	int64_t                    prealloc_end;
+	int64_t                    file_size;
+	int64_t                    queued_size;
+	int32_t                    last_time_ms;
+	size_t                     duration_offset;
+	size_t                     filesize_offset;
+
+	uint64_t                   bytes_written;
+	int                        dropped_tags;
+	uint64_t                   dropped_bytes;
+
+	std::vector<uint8_t>       tag;
+
+	static void *write_thread_fun(void *data);
+
+	bool queue_data(const uint8_t *data, size_t size);
+	void write_buffers(std::vector<record_buffer> &batch);
+	void preallocate(int64_t end);
+	void patch_meta_data();
+	void free_pool();
+};
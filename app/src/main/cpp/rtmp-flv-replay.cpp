@@ -0,0 +1,516 @@
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "util/platform.h"
+#include "librtmp/amf.h"
+
+#include "rtmp-defs.h"
+#include "rtmp-flv-replay.h"
+#include "rtmp-video-bitstream.h"
+#include "rtmp-video-output.h"
+#include "rtmp-audio-output.h"
+
+#define FLV_TAG_AUDIO         8
+#define FLV_TAG_VIDEO         9
+#define FLV_TAG_SCRIPT        18
+
+#define FLV_CODEC_AVC         7
+#define FLV_CODEC_HEVC        12
+#define FLV_SOUND_AAC         10
+
+/* enhanced rtmp packet types */
+#define FLV_EX_HEADER         0x80
+#define FLV_EX_SEQUENCE_START 0
+#define FLV_EX_CODED_FRAMES   1
+#define FLV_EX_CODED_FRAMES_X 3
+
+#define SAVC(x) static const AVal av_##x = {(char *)#x, sizeof(#x) - 1}
+
+SAVC(width);
+SAVC(height);
+SAVC(framerate);
+
+static const uint8_t start_code[4] = {0, 0, 0, 1};
+
+static uint32_t read_uint24(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+}
+
+static int32_t read_int24(const uint8_t *p)
+{
+	return (int32_t)(read_uint24(p) << 8) >> 8;
+}
+
+/* length prefixed nals to annex b, appended to out */
+static void append_annexb(std::vector<uint8_t> &out, const uint8_t *data,
+		size_t size, int length_size)
+{
+	const uint8_t *end = data + size;
+
+	while ((size_t)(end - data) >= (size_t)length_size) {
+		size_t nal_size = 0;
+
+		for (int i = 0; i < length_size; i++)
+			nal_size = (nal_size << 8) | data[i];
+		data += length_size;
+
+		if (nal_size > (size_t)(end - data))
+			break;
+
+		out.insert(out.end(), start_code, start_code + 4);
+		out.insert(out.end(), data, data + nal_size);
+		data += nal_size;
+	}
+}
+
+/* parameter sets of an avcC or hvcC record as annex b */
+static bool config_to_annexb(uint32_t fourcc, const uint8_t *data, size_t size,
+		std::vector<uint8_t> &out, int &length_size)
+{
+	const uint8_t *end = data + size;
+	const uint8_t *p;
+	int arrays;
+
+	out.clear();
+
+	if (fourcc == VIDEO_FOURCC_AVC) {
+		if (size < 7)
+			return false;
+		length_size = (data[4] & 3) + 1;
+		p = data + 5;
+		arrays = 2;
+	} else {
+		if (size < 23)
+			return false;
+		length_size = (data[21] & 3) + 1;
+		arrays = data[22];
+		p = data + 23;
+	}
+
+	for (int i = 0; i < arrays && p < end; i++) {
+		int count;
+
+		if (fourcc == VIDEO_FOURCC_AVC) {
+			count = i == 0 ? (*p++ & 0x1f) : *p++;
+		} else {
+			if (end - p < 3)
+				return false;
+			count = (p[1] << 8) | p[2];
+			p += 3;
+		}
+
+		for (int j = 0; j < count; j++) {
+			if (end - p < 2)
+				return false;
+			size_t nal_size = (p[0] << 8) | p[1];
+			p += 2;
+			if (nal_size > (size_t)(end - p))
+				return false;
+
+			out.insert(out.end(), start_code, start_code + 4);
+			out.insert(out.end(), p, p + nal_size);
+			p += nal_size;
+		}
+	}
+
+	return !out.empty();
+}
+
+static const char *codec_name(uint32_t fourcc)
+{
+	switch (fourcc) {
+	case VIDEO_FOURCC_HEVC: return "hevc";
+	case VIDEO_FOURCC_AV1:  return "av1";
+	default:                return "h264";
+	}
+}
+
+FlvReplaySource::FlvReplaySource():
+realtime(true),
+loop(false),
+video_codec("h264"),
+width(0),
+height(0),
+frame_rate(0),
+map(NULL),
+map_size(0),
+first_tag(0),
+nal_length_size(4),
+annexb(true),
+running(false),
+stopping(false),
+frames_sent(0),
+loops(0)
+{
+}
+
+FlvReplaySource::~FlvReplaySource()
+{
+	close();
+}
+
+bool FlvReplaySource::open(const char *path)
+{
+	struct stat st;
+
+	close();
+
+	int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	if (fstat(fd, &st) != 0 || st.st_size < 13) {
+		::close(fd);
+		return false;
+	}
+
+	void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+
+	if (data == MAP_FAILED)
+		return false;
+
+	map      = (const uint8_t *)data;
+	map_size = (size_t)st.st_size;
+	madvise(data, map_size, MADV_SEQUENTIAL);
+
+	uint32_t header_size = ((uint32_t)map[5] << 24) | read_uint24(map + 6);
+	if (memcmp(map, "FLV", 3) != 0 || header_size + 4 > map_size) {
+		close();
+		return false;
+	}
+
+	/* skip the header and the first previous tag size */
+	first_tag = header_size + 4;
+	parse_headers();
+	return true;
+}
+
+void FlvReplaySource::close()
+{
+	stop();
+
+	if (map)
+		munmap((void *)map, map_size);
+
+	map      = NULL;
+	map_size = 0;
+	video_csd.clear();
+	audio_csd.clear();
+}
+
+bool FlvReplaySource::next_tag(size_t &pos, flv_tag &tag)
+{
+	if (pos + 11 > map_size)
+		return false;
+
+	const uint8_t *p = map + pos;
+	uint32_t size = read_uint24(p + 1);
+
+	if (pos + 11 + size + 4 > map_size)
+		return false;
+
+	tag.type    = p[0] & 0x1f;
+	tag.time_ms = (int32_t)(read_uint24(p + 4) | ((uint32_t)p[7] << 24));
+	tag.body    = p + 11;
+	tag.size    = size;
+
+	pos += 11 + size + 4;
+	return true;
+}
+
+/* Points data at the frame inside a video tag, legacy or enhanced. header
+ * is set for a sequence header, anything that is neither is skipped. */
+bool FlvReplaySource::parse_video(const flv_tag &tag, bool &header,
+		int32_t &cts, const uint8_t **data, size_t *size)
+{
+	const uint8_t *p = tag.body;
+	size_t offset;
+
+	if (tag.size < 5)
+		return false;
+
+	cts = 0;
+
+	if (p[0] & FLV_EX_HEADER) {
+		uint32_t fourcc = ((uint32_t)p[1] << 24) | read_uint24(p + 2);
+		int packet_type = p[0] & 0x0f;
+
+		offset = 5;
+		header = packet_type == FLV_EX_SEQUENCE_START;
+
+		if (packet_type == FLV_EX_CODED_FRAMES && fourcc != VIDEO_FOURCC_AV1) {
+			if (tag.size < 8)
+				return false;
+			cts = read_int24(p + 5);
+			offset = 8;
+		} else if (!header && packet_type != FLV_EX_CODED_FRAMES &&
+				packet_type != FLV_EX_CODED_FRAMES_X) {
+			return false;
+		}
+
+		if (header)
+			set_video_header(fourcc, p + offset, tag.size - offset);
+	} else {
+		int codec = p[0] & 0x0f;
+
+		if (codec != FLV_CODEC_AVC && codec != FLV_CODEC_HEVC)
+			return false;
+		if (p[1] > 1)
+			return false;
+
+		header = p[1] == 0;
+		cts    = read_int24(p + 2);
+		offset = 5;
+
+		if (header)
+			set_video_header(codec == FLV_CODEC_HEVC ? VIDEO_FOURCC_HEVC :
+					VIDEO_FOURCC_AVC, p + offset, tag.size - offset);
+	}
+
+	*data = p + offset;
+	*size = tag.size - offset;
+	return true;
+}
+
+void FlvReplaySource::set_video_header(uint32_t fourcc, const uint8_t *data,
+		size_t size)
+{
+	if (!video_csd.empty())
+		return;
+
+	video_codec = codec_name(fourcc);
+
+	/* av1 frames are already obus with size fields and the encoder takes
+	 * an av1C as it is */
+	if (fourcc == VIDEO_FOURCC_AV1) {
+		annexb = false;
+		video_csd.assign(data, data + size);
+	} else {
+		annexb = true;
+		config_to_annexb(fourcc, data, size, video_csd, nal_length_size);
+	}
+}
+
+void FlvReplaySource::parse_meta_data(const flv_tag &tag)
+{
+	AMFReader reader;
+	AMFObjectProperty prop;
+
+	/* "onMetaData", then the object or ecma array with the properties */
+	AMFReader_Init(&reader, (const char *)tag.body, (int)tag.size);
+	if (AMFReader_Next(&reader, &prop) != 1 ||
+		AMFReader_Next(&reader, &prop) != 1 ||
+		AMFReader_Depth(&reader) != 1)
+		return;
+
+	while (AMFReader_Next(&reader, &prop) == 1 &&
+		AMFReader_Depth(&reader) >= 1) {
+		if (prop.p_type != AMF_NUMBER) {
+			AMFReader_Skip(&reader, &prop);
+			continue;
+		}
+
+		if (AVMATCH(&prop.p_name, &av_width))
+			width = (uint32_t)prop.p_vu.p_number;
+		else if (AVMATCH(&prop.p_name, &av_height))
+			height = (uint32_t)prop.p_vu.p_number;
+		else if (AVMATCH(&prop.p_name, &av_framerate))
+			frame_rate = prop.p_vu.p_number;
+	}
+}
+
+/* onMetaData and the sequence headers sit in front of the first frame */
+void FlvReplaySource::parse_headers()
+{
+	size_t pos = first_tag;
+	flv_tag tag;
+
+	while (next_tag(pos, tag) && (video_csd.empty() || audio_csd.empty())) {
+		if (tag.type == FLV_TAG_SCRIPT) {
+			parse_meta_data(tag);
+
+		} else if (tag.type == FLV_TAG_VIDEO) {
+			const uint8_t *data;
+			size_t size;
+			bool header = false;
+			int32_t cts;
+
+			if (parse_video(tag, header, cts, &data, &size) && !header)
+				break;
+
+		} else if (tag.type == FLV_TAG_AUDIO && tag.size >= 2) {
+			if ((tag.body[0] >> 4) == FLV_SOUND_AAC && tag.body[1] == 0)
+				audio_csd.assign(tag.body + 2, tag.body + tag.size);
+		}
+	}
+}
+
+bool FlvReplaySource::start(std::shared_ptr<media_output> video,
+		std::shared_ptr<media_output> audio)
+{
+	if (!map || running)
+		return false;
+
+	std::shared_ptr<VideoOutput> vo = std::dynamic_pointer_cast<VideoOutput>(video);
+	std::shared_ptr<AudioOutput> ao = std::dynamic_pointer_cast<AudioOutput>(audio);
+
+	/* same as the java side hands over from the MediaCodec output format */
+	if (vo) {
+		vo->format_csd0 = video_csd;
+		vo->format_csd1.clear();
+	}
+	if (ao)
+		ao->format = audio_csd;
+
+	video_output = video;
+	audio_output = audio;
+	stopping     = false;
+	frames_sent  = 0;
+	loops        = 0;
+
+	if (pthread_create(&thread, NULL, replay_thread_fun, this) != 0)
+		return false;
+
+	running = true;
+	return true;
+}
+
+void FlvReplaySource::stop()
+{
+	if (!running)
+		return;
+
+	stopping = true;
+	pthread_join(thread, NULL);
+	running = false;
+}
+
+bool FlvReplaySource::active()
+{
+	return running && !stopping;
+}
+
+uint64_t FlvReplaySource::get_frames_sent()
+{
+	return frames_sent;
+}
+
+uint32_t FlvReplaySource::get_loops()
+{
+	return loops;
+}
+
+void *FlvReplaySource::replay_thread_fun(void *data)
+{
+	FlvReplaySource *source = (FlvReplaySource *)data;
+
+	os_set_thread_name("flv-replay: replay_thread");
+	source->replay();
+	source->stopping = true;
+	return NULL;
+}
+
+/* Tag times are taken relative to the first tag and put on the capture
+ * clock as of the start. Each loop continues one frame interval after the
+ * last tag of the previous pass so timestamps never go backwards. */
+void FlvReplaySource::replay()
+{
+	uint64_t base_ns = os_gettime_ns();
+	int64_t offset_ms = 0;
+	int32_t interval_ms = frame_rate > 0 ? (int32_t)(1000.0 / frame_rate) : 33;
+
+	do {
+		size_t pos = first_tag;
+		bool have_first = false;
+		int32_t first_ms = 0;
+		int32_t last_ms = 0;
+		int32_t last_video_ms = -1;
+		flv_tag tag;
+
+		while (!stopping && next_tag(pos, tag)) {
+			const uint8_t *data;
+			size_t size;
+			bool header = false;
+			int32_t cts = 0;
+
+			if (tag.type == FLV_TAG_VIDEO) {
+				if (!parse_video(tag, header, cts, &data, &size) || header)
+					continue;
+			} else if (tag.type == FLV_TAG_AUDIO) {
+				if (tag.size < 2 || (tag.body[0] >> 4) != FLV_SOUND_AAC ||
+					tag.body[1] != 1)
+					continue;
+				data = tag.body + 2;
+				size = tag.size - 2;
+			} else {
+				continue;
+			}
+
+			if (!have_first) {
+				first_ms = tag.time_ms;
+				have_first = true;
+			}
+
+			int64_t time_ms = offset_ms + tag.time_ms - first_ms;
+			if (tag.time_ms > last_ms)
+				last_ms = tag.time_ms;
+
+			if (realtime)
+				os_sleepto_ns(base_ns + (uint64_t)time_ms * 1000000ULL);
+
+			if (tag.type == FLV_TAG_VIDEO) {
+				if (last_video_ms >= 0 && tag.time_ms > last_video_ms)
+					interval_ms = tag.time_ms - last_video_ms;
+				last_video_ms = tag.time_ms;
+
+				send_video(data, size,
+						base_ns + (uint64_t)(time_ms + cts) * 1000000ULL);
+			} else {
+				send_audio(data, size, base_ns + (uint64_t)time_ms * 1000000ULL);
+			}
+		}
+
+		if (!have_first)
+			break;
+
+		offset_ms += last_ms - first_ms + interval_ms;
+		loops++;
+	} while (loop && !stopping);
+}
+
+void FlvReplaySource::send_video(const uint8_t *data, size_t size,
+		uint64_t timestamp)
+{
+	std::shared_ptr<media_output> video = video_output.lock();
+	if (!video)
+		return;
+
+	if (annexb) {
+		frame.data.clear();
+		append_annexb(frame.data, data, size, nal_length_size);
+	} else {
+		frame.data.assign(data, data + size);
+	}
+
+	frame.timestamp = timestamp;
+	video->output_frame(frame);
+	frames_sent++;
+}
+
+void FlvReplaySource::send_audio(const uint8_t *data, size_t size,
+		uint64_t timestamp)
+{
+	std::shared_ptr<media_output> audio = audio_output.lock();
+	if (!audio)
+		return;
+
+	frame.data.assign(data, data + size);
+	frame.timestamp = timestamp;
+	audio->output_frame(frame);
+	frames_sent++;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdint.h>
+#include <pthread.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "rtmp-struct.h"
+
+/* Replays an FLV file into a VideoOutput and an AudioOutput as if the
+ * frames came from MediaCodec, for benchmarks and soak runs without a
+ * device. The file is mapped and its tags are walked in place, the only
+ * copy is the frame handed to the output. Video goes out as Annex B with
+ * the parameter sets in format_csd0, audio as raw AAC with the
+ * AudioSpecificConfig in format. */
+class FlvReplaySource {
+public:
+	FlvReplaySource();
+	virtual ~FlvReplaySource();
+
+	/* sleep until each tag is due instead of pushing as fast as the
+	 * outputs take the frames */
+	bool        realtime;
+	/* start over at the end, timestamps carry on from the last pass */
+	bool        loop;
+
+	/* filled in by open() from onMetaData and the sequence headers, to
+	 * set up RtmpPush with before streaming starts */
+	std::string video_codec;
+	uint32_t    width;
+	uint32_t    height;
+	double      frame_rate;
+
+	bool open(const char *path);
+	void close();
+
+	bool start(std::shared_ptr<media_output> video,
+			std::shared_ptr<media_output> audio);
+	void stop();
+	bool active();
+
+	uint64_t get_frames_sent();
+	uint32_t get_loops();
+
+private:
+	struct flv_tag {
+		uint8_t        type;
+		int32_t        time_ms;
+		const uint8_t  *body;
+		uint32_t       size;
+	};
+
+	const uint8_t                 *map;
+	size_t                        map_size;
+	size_t                        first_tag;
+
+	std::vector<uint8_t>          video_csd;
+	std::vector<uint8_t>          audio_csd;
+	int                           nal_length_size;
+	bool                          annexb;
+
+	std::weak_ptr<media_output>   video_output;
+	std::weak_ptr<media_output>   audio_output;
+	media_data                    frame;
+
+	pthread_t                     thread;
+	volatile bool                 running;
+	volatile bool                 stopping;
+	volatile uint64_t             frames_sent;
+	volatile uint32_t             loops;
+
+	static void *replay_thread_fun(void *data);
+	void replay();
+
+	bool next_tag(size_t &pos, flv_tag &tag);
+	bool parse_video(const flv_tag &tag, bool &header, int32_t &cts,
+			const uint8_t **data, size_t *size);
+	void parse_headers();
+	void parse_meta_data(const flv_tag &tag);
+	void set_video_header(uint32_t fourcc, const uint8_t *data, size_t size);
+	void send_video(const uint8_t *data, size_t size, uint64_t timestamp);
+	void send_audio(const uint8_t *data, size_t size, uint64_t timestamp);
+};
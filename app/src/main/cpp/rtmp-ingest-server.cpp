@@ -0,0 +1,919 @@
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "util/platform.h"
+#include "librtmp/amf.h"
+
+#include "rtmp-defs.h"
+#include "rtmp-ingest-server.h"
+#include "rtmp-flv-recorder.h"
+#include "rtmp-span-writer.h"
+#include "rtmp-amf-schema.h"
+
+#define INGEST_MAX_EVENTS        64
+/* socket reads for one connection per wakeup, the rest waits its turn */
+#define INGEST_READS_PER_EVENT   16
+#define INGEST_IO_TIMEOUT_SEC    5
+/* handshakes and oversize chunks waited out at once */
+#define INGEST_HELPER_THREADS    4
+#define INGEST_REPLY_CHANNEL     0x03
+
+#define AMF_LIT(str) str, sizeof(str) - 1
+
+struct RtmpIngestServer::connection {
+	int         id;
+	int         fd;		/* the socket, even once librtmp closed its own */
+	RTMP        rtmp;
+	RTMPPacket  packet;
+	bool        handshaken;
+	bool        busy;		/* out on a helper, off epoll */
+	bool        helper_ok;
+	bool        publishing;
+	std::string app;
+	std::string stream;
+	uint32_t    next_stream_id;
+	FlvRecorder *recorder;
+
+	uint64_t    bytes;
+	uint64_t    messages;
+	uint64_t    interval_bytes;
+	bool        have_delay;
+	int64_t     min_delay_ms;
+	double      latency_sum;
+	uint32_t    latency_count;
+	double      max_latency_ms;
+};
+
+template<size_t N>
+static bool aval_is(const AVal &val, const char (&str)[N])
+{
+	return val.av_len == (int)(N - 1) && memcmp(val.av_val, str, N - 1) == 0;
+}
+
+static uint32_t read_uint24(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+}
+
+static bool set_nonblocking(int fd, bool nonblocking)
+{
+	int flags = fcntl(fd, F_GETFL);
+
+	if (flags < 0)
+		return false;
+	flags = nonblocking ? flags | O_NONBLOCK : flags & ~O_NONBLOCK;
+	return fcntl(fd, F_SETFL, flags) == 0;
+}
+
+RtmpIngestServer::RtmpIngestServer():
+sink(SINK_DISCARD),
+callback(NULL),
+callback_param(NULL),
+max_connections(1024),
+report_interval_ms(1000),
+log_reports(false),
+listen_fd(-1),
+epoll_fd(-1),
+wake_fd(-1),
+port(0),
+tls_ctx(NULL),
+running(false),
+stopping(false),
+next_id(0),
+last_report_ns(0),
+helper_sem(NULL),
+helpers_stopping(false)
+{
+	memset(&reply, 0, sizeof(reply));
+	pthread_mutex_init(&stats_mutex, NULL);
+	pthread_mutex_init(&helper_mutex, NULL);
+}
+
+RtmpIngestServer::~RtmpIngestServer()
+{
+	stop();
+	RTMPPacket_Free(&reply);
+	pthread_mutex_destroy(&stats_mutex);
+	pthread_mutex_destroy(&helper_mutex);
+}
+
+bool RtmpIngestServer::start(int port_)
+{
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+	struct epoll_event ev;
+	int on = 1;
+
+	if (running)
+		return false;
+
+	if (!tls_cert.empty() && !tls_key.empty()) {
+		tls_ctx = RTMP_TLS_AllocServerContext(tls_cert.c_str(),
+				tls_key.c_str());
+		if (!tls_ctx) {
+			LOGE("ingest server: can't load %s", tls_cert.c_str());
+			return false;
+		}
+	}
+
+	listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (listen_fd < 0)
+		goto fail;
+	setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family      = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port        = htons((uint16_t)port_);
+	if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+		listen(listen_fd, SOMAXCONN) < 0 ||
+		getsockname(listen_fd, (struct sockaddr *)&addr, &addr_len) < 0)
+		goto fail;
+	port = ntohs(addr.sin_port);
+
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	wake_fd  = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (epoll_fd < 0 || wake_fd < 0)
+		goto fail;
+
+	/* the listening socket is NULL, the wake event is the server itself
+	 * and everything else is a connection */
+	ev.events   = EPOLLIN;
+	ev.data.ptr = NULL;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) < 0)
+		goto fail;
+	ev.data.ptr = this;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev) < 0)
+		goto fail;
+
+	stopping = false;
+	if (!start_helpers())
+		goto fail;
+	if (pthread_create(&thread, NULL, serve_thread_fun, this) != 0) {
+		stop_helpers();
+		goto fail;
+	}
+
+	running = true;
+	LOGI("ingest server: listening on port %d%s", port,
+			tls_ctx ? " (rtmps)" : "");
+	return true;
+
+fail:
+	LOGE("ingest server: can't listen on port %d: %s", port_, strerror(errno));
+	close_sockets();
+	return false;
+}
+
+void RtmpIngestServer::stop()
+{
+	uint64_t one = 1;
+
+	if (!running)
+		return;
+
+	stopping = true;
+	if (write(wake_fd, &one, sizeof(one)) < 0)
+		LOGW("ingest server: can't wake the loop: %s", strerror(errno));
+	pthread_join(thread, NULL);
+	running = false;
+
+	close_sockets();
+}
+
+void RtmpIngestServer::close_sockets()
+{
+	if (listen_fd >= 0)
+		::close(listen_fd);
+	if (epoll_fd >= 0)
+		::close(epoll_fd);
+	if (wake_fd >= 0)
+		::close(wake_fd);
+	listen_fd = epoll_fd = wake_fd = -1;
+
+	if (tls_ctx) {
+		RTMP_TLS_FreeServerContext(tls_ctx);
+		tls_ctx = NULL;
+	}
+}
+
+bool RtmpIngestServer::active()
+{
+	return running && !stopping;
+}
+
+int RtmpIngestServer::get_port()
+{
+	return port;
+}
+
+std::vector<ingest_conn_stats> RtmpIngestServer::get_stats()
+{
+	pthread_mutex_lock(&stats_mutex);
+	std::vector<ingest_conn_stats> copy = stats;
+	pthread_mutex_unlock(&stats_mutex);
+	return copy;
+}
+
+std::string RtmpIngestServer::get_report()
+{
+	std::vector<ingest_conn_stats> list = get_stats();
+	std::string out;
+	char line[512];
+
+	for (size_t i = 0; i < list.size(); i++) {
+		const ingest_conn_stats &st = list[i];
+
+		snprintf(line, sizeof(line),
+				"%d %s %.1f kbps, %llu messages, latency %.1f ms, max %.1f ms\n",
+				st.id, st.publishing ? st.stream.c_str() : "-", st.kbps,
+				(unsigned long long)st.messages, st.latency_ms,
+				st.max_latency_ms);
+		out += line;
+	}
+
+	return out;
+}
+
+void *RtmpIngestServer::serve_thread_fun(void *data)
+{
+	RtmpIngestServer *server = (RtmpIngestServer *)data;
+
+	os_set_thread_name("ingest-server: serve_thread");
+	server->serve();
+	return NULL;
+}
+
+void RtmpIngestServer::serve()
+{
+	struct epoll_event events[INGEST_MAX_EVENTS];
+
+	last_report_ns = os_gettime_ns();
+
+	while (!stopping) {
+		int64_t since = (int64_t)((os_gettime_ns() - last_report_ns) / 1000000);
+		int timeout = report_interval_ms - (int)since;
+
+		if (timeout <= 0) {
+			report();
+			timeout = report_interval_ms;
+		}
+
+		int n = epoll_wait(epoll_fd, events, INGEST_MAX_EVENTS, timeout);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			LOGE("ingest server: epoll_wait failed: %s", strerror(errno));
+			break;
+		}
+
+		for (int i = 0; i < n; i++) {
+			void *ptr = events[i].data.ptr;
+
+			if (!ptr) {
+				accept_connections();
+			} else if (ptr == this) {
+				uint64_t count;
+				if (read(wake_fd, &count, sizeof(count)) < 0)
+					continue;
+				take_back();
+			} else {
+				connection *c = (connection *)ptr;
+
+				if (!read_connection(c))
+					close_connection(c);
+			}
+		}
+	}
+
+	stop_helpers();
+	report();
+	while (!connections.empty())
+		close_connection(connections.back());
+}
+
+bool RtmpIngestServer::start_helpers()
+{
+	helpers_stopping = false;
+	if (os_sem_init(&helper_sem, 0) != 0)
+		return false;
+
+	for (int i = 0; i < INGEST_HELPER_THREADS; i++) {
+		pthread_t helper;
+		if (pthread_create(&helper, NULL, helper_thread_fun, this) != 0) {
+			stop_helpers();
+			return false;
+		}
+		helpers.push_back(helper);
+	}
+	return true;
+}
+
+/* busy sockets are shut down so their helpers give up at once instead of
+ * waiting out the timeout. What they had is closed with the rest. */
+void RtmpIngestServer::stop_helpers()
+{
+	if (!helper_sem)
+		return;
+
+	pthread_mutex_lock(&helper_mutex);
+	helpers_stopping = true;
+	for (size_t i = 0; i < connections.size(); i++)
+		if (connections[i]->busy)
+			shutdown(connections[i]->fd, SHUT_RDWR);
+	pthread_mutex_unlock(&helper_mutex);
+
+	for (size_t i = 0; i < helpers.size(); i++)
+		os_sem_post(helper_sem);
+	for (size_t i = 0; i < helpers.size(); i++)
+		pthread_join(helpers[i], NULL);
+	helpers.clear();
+
+	os_sem_destroy(helper_sem);
+	helper_sem = NULL;
+	helper_jobs.clear();
+	helper_done.clear();
+}
+
+void *RtmpIngestServer::helper_thread_fun(void *data)
+{
+	RtmpIngestServer *server = (RtmpIngestServer *)data;
+
+	os_set_thread_name("ingest-server: helper_thread");
+	server->run_helper();
+	return NULL;
+}
+
+void RtmpIngestServer::run_helper()
+{
+	uint64_t one = 1;
+
+	while (os_sem_wait(helper_sem) == 0) {
+		pthread_mutex_lock(&helper_mutex);
+		if (helpers_stopping || helper_jobs.empty()) {
+			bool stop = helpers_stopping;
+			pthread_mutex_unlock(&helper_mutex);
+			if (stop)
+				break;
+			continue;
+		}
+		connection *c = helper_jobs.front();
+		helper_jobs.pop_front();
+		pthread_mutex_unlock(&helper_mutex);
+
+		c->helper_ok = read_blocking(c);
+
+		pthread_mutex_lock(&helper_mutex);
+		helper_done.push_back(c);
+		pthread_mutex_unlock(&helper_mutex);
+
+		if (write(wake_fd, &one, sizeof(one)) < 0)
+			LOGW("ingest server: can't wake the loop: %s", strerror(errno));
+	}
+}
+
+/* the loop leaves the connection alone until take_back */
+void RtmpIngestServer::hand_off(connection *c)
+{
+	c->busy = true;
+
+	pthread_mutex_lock(&helper_mutex);
+	helper_jobs.push_back(c);
+	pthread_mutex_unlock(&helper_mutex);
+
+	os_sem_post(helper_sem);
+}
+
+/* on a helper: the handshake, or the next chunk when it can't fit in m_sb
+ * at all, read blocking within the timeout */
+bool RtmpIngestServer::read_blocking(connection *c)
+{
+	int fd = c->rtmp.m_sb.sb_socket;
+
+	if (!c->handshaken) {
+		if (tls_ctx && !RTMP_TLS_Accept(&c->rtmp, tls_ctx))
+			return false;
+		if (!RTMP_Serve(&c->rtmp)) {
+			LOGW("ingest %d: handshake failed", c->id);
+			return false;
+		}
+		return set_nonblocking(fd, true);
+	}
+
+	bool read = set_nonblocking(fd, false) &&
+			RTMP_ReadPacket(&c->rtmp, &c->packet) != 0;
+	return set_nonblocking(fd, true) && read;
+}
+
+/* back on the loop: what the helper read is handled, then whatever else
+ * m_sb holds, since epoll won't report that again */
+void RtmpIngestServer::take_back()
+{
+	std::vector<connection *> done;
+
+	pthread_mutex_lock(&helper_mutex);
+	done.swap(helper_done);
+	pthread_mutex_unlock(&helper_mutex);
+
+	for (size_t i = 0; i < done.size(); i++) {
+		connection *c = done[i];
+		struct epoll_event ev;
+		bool ok = c->helper_ok;
+		bool chunk = c->handshaken;
+
+		c->busy       = false;
+		c->handshaken = ok;
+
+		ev.events   = EPOLLIN | EPOLLRDHUP;
+		ev.data.ptr = c;
+		if (ok && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, c->rtmp.m_sb.sb_socket,
+					&ev) < 0) {
+			LOGW("ingest server: epoll_ctl failed: %s", strerror(errno));
+			ok = false;
+		}
+
+		if (ok && chunk && RTMPPacket_IsReady(&c->packet)) {
+			ok = handle_packet(c, c->packet);
+			RTMP_RecyclePacket(&c->rtmp, &c->packet);
+		}
+
+		if (!ok || !read_connection(c))
+			close_connection(c);
+	}
+}
+
+void RtmpIngestServer::accept_connections()
+{
+	for (;;) {
+		int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				LOGW("ingest server: accept failed: %s", strerror(errno));
+			return;
+		}
+
+		if ((int)connections.size() >= max_connections) {
+			LOGW("ingest server: %d connections, refusing another",
+					max_connections);
+			::close(fd);
+			continue;
+		}
+
+		/* blocking until the handshake is done, within the timeout,
+		 * on a helper */
+		struct timeval tv = {INGEST_IO_TIMEOUT_SEC, 0};
+		int on = 1;
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+		/* stop shuts the socket down under a helper by this one */
+		int shutdown_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+		if (shutdown_fd < 0) {
+			LOGW("ingest server: can't dup a socket: %s", strerror(errno));
+			::close(fd);
+			continue;
+		}
+
+		connection *c = new connection();
+		c->id = ++next_id;
+		c->fd = shutdown_fd;
+		c->next_stream_id = 1;
+		RTMP_Init(&c->rtmp);
+		c->rtmp.m_sb.sb_socket = fd;
+
+		connections.push_back(c);
+		hand_off(c);
+	}
+}
+
+/* Consumes whole chunks only. RTMP_ChunkBuffered says when m_sb holds the
+ * next one, until then the socket is read without blocking. A chunk that
+ * can't fit in m_sb at all goes to a helper. */
+bool RtmpIngestServer::read_connection(connection *c)
+{
+	RTMPSockBuf *sb = &c->rtmp.m_sb;
+	int reads = 0;
+
+	for (;;) {
+		int ready = RTMP_ChunkBuffered(&c->rtmp);
+
+		if (ready < 0) {
+			LOGW("ingest %d: chunk stream out of order", c->id);
+			return false;
+		}
+
+		if (!ready) {
+			if (sb->sb_start != sb->sb_buf) {
+				if (sb->sb_size)
+					memmove(sb->sb_buf, sb->sb_start, sb->sb_size);
+				sb->sb_start = sb->sb_buf;
+			}
+
+			if (sb->sb_size < (int)sizeof(sb->sb_buf) - 1) {
+				/* tls may hold records the socket no longer shows */
+				if (!sb->sb_ssl && reads == INGEST_READS_PER_EVENT)
+					return true;
+				reads++;
+
+				sb->sb_timedout = FALSE;
+				if (RTMPSockBuf_Fill(sb) <= 0)
+					return sb->sb_timedout != FALSE;
+				continue;
+			}
+
+			epoll_ctl(epoll_fd, EPOLL_CTL_DEL, sb->sb_socket, NULL);
+			hand_off(c);
+			return true;
+		}
+
+		if (!RTMP_ReadPacket(&c->rtmp, &c->packet))
+			return false;
+
+		if (RTMPPacket_IsReady(&c->packet)) {
+			bool ok = handle_packet(c, c->packet);
+			RTMP_RecyclePacket(&c->rtmp, &c->packet);
+			if (!ok)
+				return false;
+		}
+	}
+}
+
+void RtmpIngestServer::close_connection(connection *c)
+{
+	std::vector<connection *>::iterator it =
+		std::find(connections.begin(), connections.end(), c);
+	if (it != connections.end()) {
+		*it = connections.back();
+		connections.pop_back();
+	}
+
+	stop_publish(c);
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->rtmp.m_sb.sb_socket, NULL);
+	RTMPPacket_Free(&c->packet);
+	RTMP_Close(&c->rtmp);
+	::close(c->fd);
+	delete c;
+}
+
+bool RtmpIngestServer::handle_packet(connection *c, RTMPPacket &packet)
+{
+	switch (packet.m_packetType) {
+	case RTMP_PACKET_TYPE_CHUNK_SIZE:
+		if (packet.m_nBodySize < 4)
+			return false;
+		c->rtmp.m_inChunkSize = AMF_DecodeInt32(packet.m_body) & 0x7fffffff;
+		return c->rtmp.m_inChunkSize > 0;
+
+	case RTMP_PACKET_TYPE_SERVER_BW:
+		/* the publisher's window: acknowledge every tenth of it */
+		if (packet.m_nBodySize >= 4) {
+			c->rtmp.m_nClientBW = AMF_DecodeInt32(packet.m_body);
+			c->rtmp.m_bSendCounter = TRUE;
+		}
+		return true;
+
+	case RTMP_PACKET_TYPE_INVOKE:
+		return handle_invoke(c, packet);
+
+	case RTMP_PACKET_TYPE_AUDIO:
+	case RTMP_PACKET_TYPE_VIDEO:
+	case RTMP_PACKET_TYPE_INFO:
+		handle_media(c, packet);
+		return true;
+
+	case RTMP_PACKET_TYPE_FLASH_VIDEO:
+		handle_aggregate(c, packet);
+		return true;
+
+	default:
+		return true;
+	}
+}
+
+bool RtmpIngestServer::handle_invoke(connection *c, RTMPPacket &packet)
+{
+	AMFReader reader;
+	AMFObjectProperty prop;
+	AVal method;
+	double txn = 0;
+
+	AMFReader_Init(&reader, packet.m_body, (int)packet.m_nBodySize);
+	if (AMFReader_Next(&reader, &prop) != 1 || prop.p_type != AMF_STRING)
+		return false;
+	method = prop.p_vu.p_aval;
+	if (AMFReader_Next(&reader, &prop) == 1 && prop.p_type == AMF_NUMBER)
+		txn = prop.p_vu.p_number;
+
+	if (aval_is(method, "connect")) {
+		while (AMFReader_Next(&reader, &prop) == 1) {
+			if (prop.p_type == AMF_STRING && aval_is(prop.p_name, "app")) {
+				c->app.assign(prop.p_vu.p_aval.av_val,
+						prop.p_vu.p_aval.av_len);
+				break;
+			}
+		}
+		return send_connect_result(c, txn);
+
+	} else if (aval_is(method, "createStream")) {
+		return send_create_stream_result(c, txn, c->next_stream_id++);
+
+	} else if (aval_is(method, "publish")) {
+		/* null command object, then the stream name */
+		while (AMFReader_Next(&reader, &prop) == 1) {
+			if (prop.p_type == AMF_STRING) {
+				c->stream.assign(prop.p_vu.p_aval.av_val,
+						prop.p_vu.p_aval.av_len);
+				break;
+			}
+		}
+		stop_publish(c);
+		start_publish(c);
+		return send_publish_start(c, packet.m_nInfoField2);
+
+	} else if (aval_is(method, "FCUnpublish") ||
+	           aval_is(method, "deleteStream") ||
+	           aval_is(method, "closeStream")) {
+		stop_publish(c);
+	}
+
+	return true;
+}
+
+/* An aggregate is FLV tags with their back pointers. The first tag's time
+ * is the aggregate's, the others keep their distance to it. */
+void RtmpIngestServer::handle_aggregate(connection *c, RTMPPacket &packet)
+{
+	const uint8_t *body = (const uint8_t *)packet.m_body;
+	size_t size = packet.m_nBodySize;
+	size_t pos = 0;
+	uint32_t first_time = 0;
+	RTMPPacket sub = packet;
+
+	sub.m_nBodyCapacity = 0;
+
+	while (size - pos >= 11) {
+		const uint8_t *tag = body + pos;
+		uint32_t tag_size = read_uint24(tag + 1);
+		uint32_t tag_time = read_uint24(tag + 4) | ((uint32_t)tag[7] << 24);
+
+		if (size - pos - 11 < tag_size)
+			break;
+		if (pos == 0)
+			first_time = tag_time;
+
+		sub.m_packetType = tag[0];
+		sub.m_nTimeStamp = packet.m_nTimeStamp + (tag_time - first_time);
+		sub.m_body       = (char *)tag + 11;
+		sub.m_nBodySize  = tag_size;
+		if (sub.m_packetType == RTMP_PACKET_TYPE_AUDIO ||
+			sub.m_packetType == RTMP_PACKET_TYPE_VIDEO ||
+			sub.m_packetType == RTMP_PACKET_TYPE_INFO)
+			handle_media(c, sub);
+
+		pos += 11 + tag_size;
+		pos = size - pos < 4 ? size : pos + 4;
+	}
+}
+
+void RtmpIngestServer::handle_media(connection *c, RTMPPacket &packet)
+{
+	if (!c->publishing)
+		return;
+
+	c->bytes          += packet.m_nBodySize;
+	c->interval_bytes += packet.m_nBodySize;
+	c->messages++;
+
+	if (packet.m_packetType != RTMP_PACKET_TYPE_INFO) {
+		int64_t now_ms = (int64_t)(os_gettime_ns() / 1000000);
+		int64_t delay = now_ms - (int64_t)packet.m_nTimeStamp;
+
+		if (!c->have_delay || delay < c->min_delay_ms) {
+			c->min_delay_ms = delay;
+			c->have_delay = true;
+		}
+
+		double latency = (double)(delay - c->min_delay_ms);
+		c->latency_sum += latency;
+		c->latency_count++;
+		if (latency > c->max_latency_ms)
+			c->max_latency_ms = latency;
+	}
+
+	switch (sink) {
+	case SINK_RECORD:
+		if (c->recorder)
+			c->recorder->write_message(packet.m_packetType,
+					(int32_t)packet.m_nTimeStamp,
+					(const uint8_t *)packet.m_body, packet.m_nBodySize);
+		break;
+	case SINK_CALLBACK:
+		if (callback)
+			callback(callback_param, c->id, packet);
+		break;
+	case SINK_DISCARD:
+		break;
+	}
+}
+
+uint8_t *RtmpIngestServer::begin_reply(size_t size)
+{
+	if (!RTMPPacket_Reserve(&reply, (uint32_t)size))
+		return NULL;
+	return (uint8_t *)reply.m_body;
+}
+
+bool RtmpIngestServer::send_reply(connection *c, uint32_t stream_id,
+		size_t size)
+{
+	reply.m_headerType      = RTMP_PACKET_SIZE_LARGE;
+	reply.m_packetType      = RTMP_PACKET_TYPE_INVOKE;
+	reply.m_nChannel        = INGEST_REPLY_CHANNEL;
+	reply.m_nTimeStamp      = 0;
+	reply.m_nInfoField2     = (int32_t)stream_id;
+	reply.m_hasAbsTimestamp = 0;
+	reply.m_nBodySize       = (uint32_t)size;
+
+	return RTMP_SendPacket(&c->rtmp, &reply, FALSE) != 0;
+}
+
+bool RtmpIngestServer::send_connect_result(connection *c, double txn)
+{
+	amf_field<amf_str> version =
+		amf_string_field("fmsVer", AMF_LIT("FMS/3,5,7,7009"));
+	amf_field<double> capabilities = amf_number_field("capabilities", 31);
+	amf_field<amf_str> level = amf_string_field("level", AMF_LIT("status"));
+	amf_field<amf_str> code =
+		amf_string_field("code", AMF_LIT("NetConnection.Connect.Success"));
+	amf_field<amf_str> description =
+		amf_string_field("description", AMF_LIT("Connection succeeded."));
+	amf_field<double> encoding = amf_number_field("objectEncoding", 0);
+
+	size_t size = span_writer::amf_string_size(7) +
+	              span_writer::amf_number_size() +
+	              amf_object_size(version, capabilities) +
+	              amf_object_size(level, code, description, encoding);
+	uint8_t *body = begin_reply(size);
+	if (!body)
+		return false;
+
+	span_writer s(body, size);
+	s.write_amf_string(AMF_LIT("_result"));
+	s.write_amf_number(txn);
+	write_amf_object(s, version, capabilities);
+	write_amf_object(s, level, code, description, encoding);
+
+	return !s.overflow() && send_reply(c, 0, size);
+}
+
+bool RtmpIngestServer::send_create_stream_result(connection *c, double txn,
+		uint32_t stream_id)
+{
+	size_t size = span_writer::amf_string_size(7) +
+	              span_writer::amf_number_size() + 1 +
+	              span_writer::amf_number_size();
+	uint8_t *body = begin_reply(size);
+	if (!body)
+		return false;
+
+	span_writer s(body, size);
+	s.write_amf_string(AMF_LIT("_result"));
+	s.write_amf_number(txn);
+	s.write_uint8(AMF_NULL);
+	s.write_amf_number(stream_id);
+
+	return !s.overflow() && send_reply(c, 0, size);
+}
+
+bool RtmpIngestServer::send_publish_start(connection *c, uint32_t stream_id)
+{
+	amf_field<amf_str> level = amf_string_field("level", AMF_LIT("status"));
+	amf_field<amf_str> code =
+		amf_string_field("code", AMF_LIT("NetStream.Publish.Start"));
+	amf_field<amf_str> description =
+		amf_string_field("description", AMF_LIT("Publishing."));
+
+	size_t size = span_writer::amf_string_size(8) +
+	              span_writer::amf_number_size() + 1 +
+	              amf_object_size(level, code, description);
+	uint8_t *body = begin_reply(size);
+	if (!body)
+		return false;
+
+	span_writer s(body, size);
+	s.write_amf_string(AMF_LIT("onStatus"));
+	s.write_amf_number(0);
+	s.write_uint8(AMF_NULL);
+	write_amf_object(s, level, code, description);
+
+	return !s.overflow() && send_reply(c, stream_id, size);
+}
+
+void RtmpIngestServer::start_publish(connection *c)
+{
+	c->publishing = true;
+	LOGI("ingest %d: publishing %s/%s", c->id, c->app.c_str(),
+			c->stream.c_str());
+
+	if (sink != SINK_RECORD)
+		return;
+
+	std::string name = c->app + "_" + c->stream;
+	for (size_t i = 0; i < name.size(); i++) {
+		char ch = name[i];
+		if (!isalnum((unsigned char)ch) && ch != '-' && ch != '_')
+			name[i] = '_';
+	}
+
+	char id[16];
+	snprintf(id, sizeof(id), "-%d.flv", c->id);
+	std::string path = record_dir + "/" + name + id;
+
+	c->recorder = new FlvRecorder();
+	if (!c->recorder->open(path.c_str())) {
+		delete c->recorder;
+		c->recorder = NULL;
+		return;
+	}
+	c->recorder->write_file_header(true, true);
+}
+
+void RtmpIngestServer::stop_publish(connection *c)
+{
+	if (!c->publishing)
+		return;
+
+	c->publishing = false;
+	LOGI("ingest %d: %s/%s done, %llu bytes in %llu messages", c->id,
+			c->app.c_str(), c->stream.c_str(),
+			(unsigned long long)c->bytes, (unsigned long long)c->messages);
+
+	if (c->recorder) {
+		c->recorder->close();
+		delete c->recorder;
+		c->recorder = NULL;
+	}
+}
+
+void RtmpIngestServer::report()
+{
+	uint64_t now = os_gettime_ns();
+	double elapsed_ms = (double)(now - last_report_ns) / 1000000.0;
+	std::vector<ingest_conn_stats> list;
+	double total_kbps = 0.0;
+	double max_latency = 0.0;
+	int publishers = 0;
+
+	last_report_ns = now;
+	list.reserve(connections.size());
+
+	for (size_t i = 0; i < connections.size(); i++) {
+		connection *c = connections[i];
+		ingest_conn_stats st;
+
+		st.id             = c->id;
+		st.stream         = c->app + "/" + c->stream;
+		st.publishing     = c->publishing;
+		st.bytes          = c->bytes;
+		st.messages       = c->messages;
+		st.kbps           = elapsed_ms > 0.0 ?
+			(double)c->interval_bytes * 8.0 / elapsed_ms : 0.0;
+		st.latency_ms     = c->latency_count ?
+			c->latency_sum / c->latency_count : 0.0;
+		st.max_latency_ms = c->max_latency_ms;
+		list.push_back(st);
+
+		if (c->publishing)
+			publishers++;
+		total_kbps += st.kbps;
+		max_latency = std::max(max_latency, st.max_latency_ms);
+
+		c->interval_bytes = 0;
+		c->latency_sum    = 0.0;
+		c->latency_count  = 0;
+		c->max_latency_ms = 0.0;
+	}
+
+	pthread_mutex_lock(&stats_mutex);
+	stats.swap(list);
+	pthread_mutex_unlock(&stats_mutex);
+
+	if (log_reports)
+		LOGI("ingest server: %d connections, %d publishing, %.0f kbps, "
+		     "max latency %.1f ms", (int)connections.size(), publishers,
+		     total_kbps, max_latency);
+}
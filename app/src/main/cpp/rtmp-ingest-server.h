@@ -0,0 +1,137 @@
+#pragma once
+
+#include <stdint.h>
+#include <pthread.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "librtmp/rtmp.h"
+#include "util/threading.h"
+
+class FlvRecorder;
+
+/* An RTMP ingest server for loopback throughput and latency tests and as
+ * a local relay. One thread runs an epoll loop over every connection on
+ * top of librtmp's server side: RTMP_TLS_Accept and RTMP_Serve for the
+ * handshake, RTMP_ReadPacket for the chunks. A chunk is only read once
+ * all of it is buffered, so a slow publisher never holds up the others.
+ * What has to wait on one client, the handshake and chunks too big to
+ * buffer, runs on helper threads while the loop goes on with the rest.
+ * Any app and stream name may publish. Messages are dropped, recorded to
+ * one FLV file per publish, or handed to a callback on the loop thread. */
+typedef void (*ingest_packet_callback_t)(void *param, int conn_id,
+		const RTMPPacket &packet);
+
+struct ingest_conn_stats {
+	int         id;
+	std::string stream;		/* app/name once publishing */
+	bool        publishing;
+	uint64_t    bytes;		/* audio, video and data bodies */
+	uint64_t    messages;
+	double      kbps;		/* over the last report interval */
+	/* arrival time minus message timestamp, above the lowest seen on
+	 * the connection, so 0 is the publisher's best case. Average and
+	 * peak over the last report interval. */
+	double      latency_ms;
+	double      max_latency_ms;
+};
+
+class RtmpIngestServer {
+public:
+	enum sink_type {
+		SINK_DISCARD,
+		SINK_RECORD,
+		SINK_CALLBACK,
+	};
+
+	RtmpIngestServer();
+	virtual ~RtmpIngestServer();
+
+	/* set before start */
+	sink_type                 sink;
+	std::string               record_dir;
+	ingest_packet_callback_t  callback;
+	void                      *callback_param;
+	/* rtmps when both are set */
+	std::string               tls_cert;
+	std::string               tls_key;
+	int                       max_connections;
+	int                       report_interval_ms;
+	/* a totals line every report interval */
+	bool                      log_reports;
+
+	/* port 0 takes any free port, see get_port */
+	bool start(int port);
+	void stop();
+	bool active();
+	int get_port();
+
+	/* as of the last report interval */
+	std::vector<ingest_conn_stats> get_stats();
+	std::string get_report();
+
+private:
+	struct connection;
+
+	int                            listen_fd;
+	int                            epoll_fd;
+	int                            wake_fd;
+	int                            port;
+	void                           *tls_ctx;
+
+	pthread_t                      thread;
+	volatile bool                  running;
+	volatile bool                  stopping;
+
+	/* loop thread only */
+	std::vector<connection *>      connections;
+	int                            next_id;
+	RTMPPacket                     reply;
+	uint64_t                       last_report_ns;
+
+	pthread_mutex_t                stats_mutex;
+	std::vector<ingest_conn_stats> stats;
+
+	/* connections out on a helper come back in helper_done, with a write
+	 * to wake_fd */
+	std::vector<pthread_t>         helpers;
+	os_sem_t                       *helper_sem;
+	pthread_mutex_t                helper_mutex;
+	std::deque<connection *>       helper_jobs;
+	std::vector<connection *>      helper_done;
+	bool                           helpers_stopping;
+
+	static void *serve_thread_fun(void *data);
+	void serve();
+
+	static void *helper_thread_fun(void *data);
+	void run_helper();
+	bool start_helpers();
+	void stop_helpers();
+	void hand_off(connection *c);
+	void take_back();
+	bool read_blocking(connection *c);
+
+	void accept_connections();
+	bool read_connection(connection *c);
+	void close_connection(connection *c);
+
+	bool handle_packet(connection *c, RTMPPacket &packet);
+	bool handle_invoke(connection *c, RTMPPacket &packet);
+	void handle_aggregate(connection *c, RTMPPacket &packet);
+	void handle_media(connection *c, RTMPPacket &packet);
+
+	uint8_t *begin_reply(size_t size);
+	bool send_reply(connection *c, uint32_t stream_id, size_t size);
+	bool send_connect_result(connection *c, double txn);
+	bool send_create_stream_result(connection *c, double txn,
+			uint32_t stream_id);
+	bool send_publish_start(connection *c, uint32_t stream_id);
+
+	void start_publish(connection *c);
+	void stop_publish(connection *c);
+
+	void report();
+	void close_sockets();
+};
@@ -0,0 +1,862 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <atomic>
+#include <android/log.h>
+
+#include "rtmp-log.h"
+#include "util/platform.h"
+#include "util/threading.h"
+
+#define TAG "JNITEST"
+
+/* per thread, records go in whole and 8 byte aligned, power of two */
+#define LOG_RING_SIZE      (64 * 1024)
+#define LOG_HISTORY_SIZE   (256 * 1024)
+#define LOG_MAX_RINGS      32
+#define LOG_MAX_RECORD     (LOG_RING_SIZE / 4)
+#define LOG_DRAIN_MS       20
+#define LOG_LINE_SIZE      1024
+
+struct log_header {
+	uint16_t    size;      /* of the whole record, 0 wraps to the start */
+	uint8_t     level;
+	uint8_t     nargs;
+	uint32_t    tid;
+	const char  *fmt;
+	uint64_t    time_ns;
+};
+
+enum {
+	LOG_RING_FREE,
+	LOG_RING_USED,
+	LOG_RING_RELEASED,   /* its thread is gone, free once drained */
+};
+
+struct log_ring {
+	/* written by the owning thread */
+	alignas(64) std::atomic<uint32_t> head;
+	uint32_t                          pending;
+	bool                              wake;
+	std::atomic<uint32_t>             dropped;
+	uint32_t                          tid;
+
+	/* written by the drainer */
+	alignas(64) std::atomic<uint32_t> tail;
+	uint32_t                          dropped_seen;
+
+	std::atomic<int>                  state;
+	alignas(8) uint8_t                data[LOG_RING_SIZE];
+};
+
+/* the drainer's copy of recent records, oldest overwritten first */
+struct log_history {
+	uint32_t          head;
+	uint32_t          tail;
+	alignas(8) uint8_t data[LOG_HISTORY_SIZE];
+};
+
+volatile int rtmp_log_capture = RTMP_LOGDEBUG;
+static volatile int print_level = RTMP_LOGINFO;
+
+static std::atomic<log_ring *>  rings[LOG_MAX_RINGS];
+static std::atomic<uint32_t>    lost_records;
+static uint32_t                 lost_seen;
+static std::atomic<uint64_t>    dropped_total;
+static THREAD_LOCAL log_ring    *thread_ring;
+static pthread_once_t           init_once = PTHREAD_ONCE_INIT;
+static pthread_key_t            ring_key;
+static os_event_t               *wake_event;
+static log_history              *history;
+
+static pthread_mutex_t          request_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t           request_cond = PTHREAD_COND_INITIALIZER;
+static uint64_t                 flush_requested;
+static uint64_t                 flush_done;
+static bool                     dump_requested;
+static bool                     drainer_running;
+
+static inline uint32_t record_size(size_t arg_bytes)
+{
+	return (uint32_t)((sizeof(log_header) + arg_bytes + 7) & ~(size_t)7);
+}
+
+static void release_ring(void *data)
+{
+	log_ring *ring = (log_ring *)data;
+	ring->state.store(LOG_RING_RELEASED, std::memory_order_release);
+}
+
+static void *drain_thread_fun(void *data);
+
+static void log_init()
+{
+	pthread_t thread;
+	pthread_attr_t attr;
+
+	pthread_key_create(&ring_key, release_ring);
+	history = (log_history *)calloc(1, sizeof(log_history));
+	if (!history || os_event_init(&wake_event, OS_EVENT_TYPE_AUTO) != 0)
+		return;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	drainer_running = pthread_create(&thread, &attr, drain_thread_fun,
+			NULL) == 0;
+	pthread_attr_destroy(&attr);
+}
+
+/* takes a ring whose thread has exited and whose records are drained, or
+ * adds one while there is room */
+static log_ring *acquire_ring()
+{
+	pthread_once(&init_once, log_init);
+	if (!drainer_running)
+		return NULL;
+
+	for (int i = 0; i < LOG_MAX_RINGS; i++) {
+		log_ring *ring = rings[i].load(std::memory_order_acquire);
+		int expected = LOG_RING_FREE;
+
+		if (!ring) {
+			void *mem;
+			if (posix_memalign(&mem, 64, sizeof(log_ring)) != 0)
+				return NULL;
+			ring = (log_ring *)memset(mem, 0, sizeof(log_ring));
+			ring->state.store(LOG_RING_USED, std::memory_order_relaxed);
+
+			log_ring *empty = NULL;
+			if (!rings[i].compare_exchange_strong(empty, ring)) {
+				free(ring);
+				continue;
+			}
+		} else if (!ring->state.compare_exchange_strong(expected,
+					LOG_RING_USED)) {
+			continue;
+		}
+
+		ring->tid = (uint32_t)syscall(SYS_gettid);
+		pthread_setspecific(ring_key, ring);
+		thread_ring = ring;
+		return ring;
+	}
+
+	return NULL;
+}
+
+uint8_t *rtmp_log_begin(int level, const char *fmt, size_t nargs,
+		size_t arg_bytes)
+{
+	log_ring *ring = thread_ring;
+	if (!ring && !(ring = acquire_ring())) {
+		lost_records.fetch_add(1, std::memory_order_relaxed);
+		return NULL;
+	}
+
+	uint32_t size = record_size(nargs + arg_bytes);
+	uint32_t head = ring->head.load(std::memory_order_relaxed);
+	uint32_t tail = ring->tail.load(std::memory_order_acquire);
+	uint32_t offset = head & (LOG_RING_SIZE - 1);
+	uint32_t wrap = LOG_RING_SIZE - offset < size ? LOG_RING_SIZE - offset : 0;
+
+	if (size > LOG_MAX_RECORD ||
+	    LOG_RING_SIZE - (head - tail) < wrap + size) {
+		ring->dropped.store(ring->dropped.load(std::memory_order_relaxed) + 1,
+				std::memory_order_relaxed);
+		return NULL;
+	}
+
+	if (wrap) {
+		((log_header *)(ring->data + offset))->size = 0;
+		head += wrap;
+		offset = 0;
+	}
+
+	log_header *h = (log_header *)(ring->data + offset);
+	h->size = (uint16_t)size;
+	h->level = (uint8_t)level;
+	h->nargs = (uint8_t)nargs;
+	h->tid = ring->tid;
+	h->fmt = fmt;
+	h->time_ns = os_gettime_ns();
+
+	ring->pending = head + size;
+	ring->wake = head - tail < LOG_RING_SIZE / 2 &&
+	             ring->pending - tail >= LOG_RING_SIZE / 2;
+	return (uint8_t *)(h + 1);
+}
+
+void rtmp_log_commit()
+{
+	log_ring *ring = thread_ring;
+	ring->head.store(ring->pending, std::memory_order_release);
+
+	/* a burst filled half the ring, drain before the timer does */
+	if (ring->wake)
+		os_event_signal(wake_event);
+}
+
+/* ------------------------------------------------------------------------- */
+/* format specs, shared by the va_list capture and the formatter */
+
+enum log_length {
+	LOG_LEN_INT,
+	LOG_LEN_CHAR,
+	LOG_LEN_SHORT,
+	LOG_LEN_LONG,
+	LOG_LEN_LLONG,
+	LOG_LEN_SIZE,
+	LOG_LEN_MAX,
+	LOG_LEN_PTRDIFF,
+	LOG_LEN_LDOUBLE,
+};
+
+struct log_spec {
+	char        flags[8];
+	int         width;           /* -1 none */
+	int         precision;       /* -1 none */
+	bool        width_arg;
+	bool        precision_arg;
+	log_length  length;
+	char        conv;
+};
+
+/* f points past the '%', returns past the conversion, or NULL when the
+ * format ends inside the spec */
+static const char *parse_spec(const char *f, log_spec *spec)
+{
+	size_t nflags = 0;
+
+	spec->width = -1;
+	spec->precision = -1;
+	spec->width_arg = false;
+	spec->precision_arg = false;
+	spec->length = LOG_LEN_INT;
+
+	while (*f && strchr("-+ #0'", *f)) {
+		if (nflags < sizeof(spec->flags) - 1)
+			spec->flags[nflags++] = *f;
+		f++;
+	}
+	spec->flags[nflags] = 0;
+
+	if (*f == '*') {
+		spec->width_arg = true;
+		f++;
+	} else if (*f >= '0' && *f <= '9') {
+		spec->width = 0;
+		while (*f >= '0' && *f <= '9')
+			spec->width = spec->width * 10 + (*f++ - '0');
+	}
+
+	if (*f == '.') {
+		f++;
+		spec->precision = 0;
+		if (*f == '*') {
+			spec->precision_arg = true;
+			f++;
+		} else {
+			while (*f >= '0' && *f <= '9')
+				spec->precision = spec->precision * 10 + (*f++ - '0');
+		}
+	}
+
+	switch (*f) {
+	case 'h':
+		f++;
+		spec->length = LOG_LEN_SHORT;
+		if (*f == 'h') {
+			f++;
+			spec->length = LOG_LEN_CHAR;
+		}
+		break;
+	case 'l':
+		f++;
+		spec->length = LOG_LEN_LONG;
+		if (*f == 'l') {
+			f++;
+			spec->length = LOG_LEN_LLONG;
+		}
+		break;
+	case 'q': f++; spec->length = LOG_LEN_LLONG;   break;
+	case 'z': f++; spec->length = LOG_LEN_SIZE;    break;
+	case 'j': f++; spec->length = LOG_LEN_MAX;     break;
+	case 't': f++; spec->length = LOG_LEN_PTRDIFF; break;
+	case 'L': f++; spec->length = LOG_LEN_LDOUBLE; break;
+	}
+
+	if (!*f)
+		return NULL;
+	spec->conv = *f++;
+	return f;
+}
+
+static inline bool is_int_conv(char c)
+{
+	return c == 'd' || c == 'i' || c == 'u' || c == 'x' || c == 'X' ||
+	       c == 'o' || c == 'c';
+}
+
+static inline bool is_float_conv(char c)
+{
+	return c == 'f' || c == 'F' || c == 'e' || c == 'E' || c == 'g' ||
+	       c == 'G' || c == 'a' || c == 'A';
+}
+
+/* ------------------------------------------------------------------------- */
+/* librtmp callback, the arguments are only known from the format */
+
+struct log_capture {
+	uint8_t  tags[RTMP_LOG_MAX_ARGS];
+	uint8_t  values[RTMP_LOG_MAX_ARGS * (RTMP_LOG_MAX_STR + 1)];
+	size_t   nargs;
+	size_t   size;
+};
+
+static void capture_int(log_capture *c, bool is_signed, bool wide,
+		uint64_t value)
+{
+	if (wide && is_signed)
+		c->size = log_arg_write(&c->tags[c->nargs], c->values + c->size,
+				(int64_t)value) - c->values;
+	else if (wide)
+		c->size = log_arg_write(&c->tags[c->nargs], c->values + c->size,
+				value) - c->values;
+	else if (is_signed)
+		c->size = log_arg_write(&c->tags[c->nargs], c->values + c->size,
+				(int32_t)value) - c->values;
+	else
+		c->size = log_arg_write(&c->tags[c->nargs], c->values + c->size,
+				(uint32_t)value) - c->values;
+	c->nargs++;
+}
+
+static void capture_arg(log_capture *c, const log_spec *spec, va_list *args)
+{
+	char conv = spec->conv;
+
+	if (is_int_conv(conv)) {
+		bool is_signed = conv == 'd' || conv == 'i';
+		uint64_t value;
+		bool wide;
+
+		switch (spec->length) {
+		case LOG_LEN_LONG:
+			value = is_signed ? (uint64_t)va_arg(*args, long)
+			                  : va_arg(*args, unsigned long);
+			wide = sizeof(long) > 4;
+			break;
+		case LOG_LEN_LLONG:
+		case LOG_LEN_MAX:
+			value = is_signed ? (uint64_t)va_arg(*args, long long)
+			                  : va_arg(*args, unsigned long long);
+			wide = true;
+			break;
+		case LOG_LEN_SIZE:
+		case LOG_LEN_PTRDIFF:
+			value = is_signed ? (uint64_t)va_arg(*args, ptrdiff_t)
+			                  : va_arg(*args, size_t);
+			wide = sizeof(size_t) > 4;
+			break;
+		default:
+			value = is_signed ? (uint64_t)(int64_t)va_arg(*args, int)
+			                  : va_arg(*args, unsigned int);
+			wide = false;
+			break;
+		}
+		capture_int(c, is_signed, wide, value);
+
+	} else if (is_float_conv(conv)) {
+		double value = spec->length == LOG_LEN_LDOUBLE ?
+			(double)va_arg(*args, long double) : va_arg(*args, double);
+		c->size = log_arg_write(&c->tags[c->nargs], c->values + c->size,
+				value) - c->values;
+		c->nargs++;
+
+	} else if (conv == 's') {
+		const char *str = va_arg(*args, const char *);
+		size_t len;
+
+		/* %.*s on a buffer that is not terminated */
+		if (str && spec->precision >= 0)
+			len = strnlen(str, spec->precision < RTMP_LOG_MAX_STR ?
+					spec->precision : RTMP_LOG_MAX_STR);
+		else
+			len = log_str_len(str);
+		c->size = log_arg_write(&c->tags[c->nargs], c->values + c->size,
+				str, len) - c->values;
+		c->nargs++;
+
+	} else if (conv == 'p' || conv == 'n') {
+		c->size = log_arg_write(&c->tags[c->nargs], c->values + c->size,
+				va_arg(*args, const void *)) - c->values;
+		c->nargs++;
+	}
+}
+
+void rtmp_log_librtmp(int level, const char *fmt, va_list args)
+{
+	log_capture c;
+	va_list copy;
+	const char *f = fmt;
+
+	if (level > rtmp_log_capture)
+		return;
+
+	c.nargs = 0;
+	c.size = 0;
+	va_copy(copy, args);
+
+	while ((f = strchr(f, '%')) != NULL) {
+		log_spec spec;
+
+		if (f[1] == '%') {
+			f += 2;
+			continue;
+		}
+		f = parse_spec(f + 1, &spec);
+		if (!f)
+			break;
+
+		if (spec.width_arg && c.nargs < RTMP_LOG_MAX_ARGS)
+			capture_int(&c, true, false, (uint64_t)(int64_t)va_arg(copy, int));
+		if (spec.precision_arg && c.nargs < RTMP_LOG_MAX_ARGS) {
+			spec.precision = va_arg(copy, int);
+			capture_int(&c, true, false, (uint64_t)(int64_t)spec.precision);
+		}
+		if (c.nargs == RTMP_LOG_MAX_ARGS)
+			break;
+		capture_arg(&c, &spec, &copy);
+	}
+	va_end(copy);
+
+	uint8_t *tags = rtmp_log_begin(level, fmt, c.nargs, c.size);
+	if (!tags)
+		return;
+
+	memcpy(tags, c.tags, c.nargs);
+	memcpy(tags + c.nargs, c.values, c.size);
+	rtmp_log_commit();
+}
+
+/* ------------------------------------------------------------------------- */
+/* formatting, on the drainer thread only */
+
+struct log_arg {
+	uint8_t     type;
+	uint64_t    u;
+	double      f;
+	const char  *str;
+};
+
+static bool next_arg(const log_header *h, const uint8_t *&p, size_t &idx,
+		log_arg &arg)
+{
+	const uint8_t *tags = (const uint8_t *)(h + 1);
+	uint32_t u32;
+
+	if (idx >= h->nargs)
+		return false;
+
+	arg.type = tags[idx++];
+	switch (arg.type) {
+	case LOG_ARG_I32:
+		memcpy(&u32, p, 4);
+		arg.u = (uint64_t)(int64_t)(int32_t)u32;
+		p += 4;
+		break;
+	case LOG_ARG_U32:
+		memcpy(&u32, p, 4);
+		arg.u = u32;
+		p += 4;
+		break;
+	case LOG_ARG_F64:
+		memcpy(&arg.f, p, 8);
+		p += 8;
+		break;
+	case LOG_ARG_STR:
+		arg.str = (const char *)p;
+		p += strlen(arg.str) + 1;
+		break;
+	default:
+		memcpy(&arg.u, p, 8);
+		p += 8;
+		break;
+	}
+	return true;
+}
+
+static inline bool is_int_arg(uint8_t type)
+{
+	return type <= LOG_ARG_U64;
+}
+
+static size_t append(size_t len, size_t cap, int n)
+{
+	if (n < 0)
+		return len;
+	len += (size_t)n;
+	return len < cap ? len : cap - 1;
+}
+
+/* printf one spec with the value as it was stored, the length modifier is
+ * rebuilt from the stored type so a %d given an int64_t still prints */
+static size_t format_arg(char *out, size_t len, size_t cap,
+		const log_spec *spec, const log_arg &arg)
+{
+	char fmt[32];
+	char prec[16] = "";
+	char width[16] = "";
+	const char *mod = "";
+	char conv = spec->conv;
+
+	if (spec->width >= 0)
+		snprintf(width, sizeof(width), "%d", spec->width);
+	if (spec->precision >= 0)
+		snprintf(prec, sizeof(prec), ".%d", spec->precision);
+
+	if (is_int_conv(conv)) {
+		if (!is_int_arg(arg.type) && arg.type != LOG_ARG_F64)
+			return append(len, cap, snprintf(out + len, cap - len, "(?)"));
+
+		long long value = arg.type == LOG_ARG_F64 ? (long long)arg.f
+		                                          : (long long)arg.u;
+		bool wide = conv != 'c' && (arg.type == LOG_ARG_I64 ||
+				arg.type == LOG_ARG_U64 || arg.type == LOG_ARG_F64);
+		if (wide)
+			mod = "ll";
+		else if (spec->length == LOG_LEN_CHAR)
+			mod = "hh";
+		else if (spec->length == LOG_LEN_SHORT)
+			mod = "h";
+		snprintf(fmt, sizeof(fmt), "%%%s%s%s%s%c", spec->flags, width, prec,
+				mod, conv);
+		return append(len, cap, wide ?
+				snprintf(out + len, cap - len, fmt, value) :
+				snprintf(out + len, cap - len, fmt, (int)value));
+	}
+
+	snprintf(fmt, sizeof(fmt), "%%%s%s%s%c", spec->flags, width, prec, conv);
+
+	if (is_float_conv(conv)) {
+		double value = arg.type == LOG_ARG_F64 ? arg.f :
+			arg.type == LOG_ARG_I32 || arg.type == LOG_ARG_I64 ?
+				(double)(int64_t)arg.u : (double)arg.u;
+		if (arg.type == LOG_ARG_STR || arg.type == LOG_ARG_PTR)
+			return append(len, cap, snprintf(out + len, cap - len, "(?)"));
+		return append(len, cap, snprintf(out + len, cap - len, fmt, value));
+	}
+
+	if (conv == 's') {
+		if (arg.type != LOG_ARG_STR)
+			return append(len, cap, snprintf(out + len, cap - len, "(?)"));
+		return append(len, cap, snprintf(out + len, cap - len, fmt, arg.str));
+	}
+
+	if (conv == 'p') {
+		if (arg.type == LOG_ARG_STR || arg.type == LOG_ARG_F64)
+			return append(len, cap, snprintf(out + len, cap - len, "(?)"));
+		return append(len, cap, snprintf(out + len, cap - len, fmt,
+				(void *)(uintptr_t)arg.u));
+	}
+
+	return len;
+}
+
+static size_t format_record(const log_header *h, char *out, size_t cap)
+{
+	const uint8_t *p = (const uint8_t *)(h + 1) + h->nargs;
+	const char *f = h->fmt;
+	size_t idx = 0;
+	size_t len = 0;
+
+	out[0] = 0;
+	while (*f && len < cap - 1) {
+		const char *pct = strchr(f, '%');
+		size_t n = pct ? (size_t)(pct - f) : strlen(f);
+		log_spec spec;
+		log_arg arg;
+
+		if (n > cap - 1 - len)
+			n = cap - 1 - len;
+		memcpy(out + len, f, n);
+		len += n;
+		out[len] = 0;
+		if (!pct)
+			break;
+
+		if (pct[1] == '%') {
+			len = append(len, cap, snprintf(out + len, cap - len, "%%"));
+			f = pct + 2;
+			continue;
+		}
+
+		f = parse_spec(pct + 1, &spec);
+		if (!f)
+			break;
+
+		if (spec.width_arg) {
+			if (!next_arg(h, p, idx, arg))
+				break;
+			spec.width = (int)(int64_t)arg.u;
+			if (spec.width < 0) {
+				size_t n = strlen(spec.flags);
+				if (n < sizeof(spec.flags) - 1) {
+					spec.flags[n] = '-';
+					spec.flags[n + 1] = 0;
+				}
+				spec.width = -spec.width;
+			}
+		}
+		if (spec.precision_arg) {
+			if (!next_arg(h, p, idx, arg))
+				break;
+			spec.precision = (int)(int64_t)arg.u;
+		}
+
+		if (spec.conv == 'n') {
+			next_arg(h, p, idx, arg);
+			continue;
+		}
+		if (!next_arg(h, p, idx, arg)) {
+			len = append(len, cap, snprintf(out + len, cap - len,
+						"(missing)"));
+			continue;
+		}
+		len = format_arg(out, len, cap, &spec, arg);
+	}
+
+	return len;
+}
+
+static int android_priority(int level)
+{
+	if (level <= RTMP_LOGERROR)
+		return ANDROID_LOG_ERROR;
+	if (level == RTMP_LOGWARNING)
+		return ANDROID_LOG_WARN;
+	if (level == RTMP_LOGINFO)
+		return ANDROID_LOG_INFO;
+	return ANDROID_LOG_DEBUG;
+}
+
+/* ------------------------------------------------------------------------- */
+/* drainer */
+
+static void history_append(const log_header *h)
+{
+	uint32_t offset = history->head & (LOG_HISTORY_SIZE - 1);
+	uint32_t wrap = LOG_HISTORY_SIZE - offset < h->size ?
+		LOG_HISTORY_SIZE - offset : 0;
+
+	while (LOG_HISTORY_SIZE - (history->head - history->tail) < wrap + h->size) {
+		uint32_t tail = history->tail & (LOG_HISTORY_SIZE - 1);
+		uint16_t size = ((log_header *)(history->data + tail))->size;
+		history->tail += size ? size : LOG_HISTORY_SIZE - tail;
+	}
+
+	if (wrap) {
+		((log_header *)(history->data + offset))->size = 0;
+		history->head += wrap;
+		offset = 0;
+	}
+
+	memcpy(history->data + offset, h, h->size);
+	history->head += h->size;
+}
+
+static void dump_history()
+{
+	char line[LOG_LINE_SIZE];
+
+	__android_log_write(ANDROID_LOG_INFO, TAG, "log dump begin");
+
+	while (history->tail != history->head) {
+		uint32_t offset = history->tail & (LOG_HISTORY_SIZE - 1);
+		const log_header *h = (const log_header *)(history->data + offset);
+		int n;
+
+		if (!h->size) {
+			history->tail += LOG_HISTORY_SIZE - offset;
+			continue;
+		}
+
+		n = snprintf(line, sizeof(line), "%llu.%06llu %5u ",
+				(unsigned long long)(h->time_ns / 1000000000),
+				(unsigned long long)(h->time_ns / 1000 % 1000000),
+				h->tid);
+		format_record(h, line + n, sizeof(line) - n);
+		__android_log_write(android_priority(h->level), TAG, line);
+		history->tail += h->size;
+	}
+
+	__android_log_write(ANDROID_LOG_INFO, TAG, "log dump end");
+}
+
+static const log_header *ring_peek(log_ring *ring, uint32_t &tail,
+		uint32_t head)
+{
+	while (tail != head) {
+		uint32_t offset = tail & (LOG_RING_SIZE - 1);
+		const log_header *h = (const log_header *)(ring->data + offset);
+		if (h->size)
+			return h;
+		tail += LOG_RING_SIZE - offset;
+	}
+	return NULL;
+}
+
+/* merges what the rings hold so far by time, which keeps the order across
+ * threads in logcat and in the history */
+static void drain()
+{
+	log_ring  *active[LOG_MAX_RINGS];
+	uint32_t  tails[LOG_MAX_RINGS];
+	uint32_t  heads[LOG_MAX_RINGS];
+	int       count = 0;
+	uint64_t  dropped = 0;
+	char      line[LOG_LINE_SIZE];
+	int       level = print_level;
+
+	for (int i = 0; i < LOG_MAX_RINGS; i++) {
+		log_ring *ring = rings[i].load(std::memory_order_acquire);
+		if (!ring)
+			break;
+
+		int state = ring->state.load(std::memory_order_acquire);
+		uint32_t seen = ring->dropped.load(std::memory_order_relaxed);
+		dropped += seen - ring->dropped_seen;
+		ring->dropped_seen = seen;
+
+		active[count] = ring;
+		tails[count] = ring->tail.load(std::memory_order_relaxed);
+		heads[count] = ring->head.load(std::memory_order_acquire);
+
+		if (tails[count] != heads[count])
+			count++;
+		else if (state == LOG_RING_RELEASED)
+			ring->state.store(LOG_RING_FREE, std::memory_order_release);
+	}
+
+	for (;;) {
+		const log_header *next = NULL;
+		int next_idx = -1;
+
+		for (int i = 0; i < count; i++) {
+			const log_header *h = ring_peek(active[i], tails[i], heads[i]);
+			if (h && (!next || h->time_ns < next->time_ns)) {
+				next = h;
+				next_idx = i;
+			}
+		}
+		if (!next)
+			break;
+
+		if (next->level <= level) {
+			format_record(next, line, sizeof(line));
+			__android_log_write(android_priority(next->level), TAG, line);
+		}
+		history_append(next);
+
+		tails[next_idx] += next->size;
+		active[next_idx]->tail.store(tails[next_idx], std::memory_order_release);
+	}
+
+	for (int i = 0; i < count; i++)
+		active[i]->tail.store(tails[i], std::memory_order_release);
+
+	uint32_t lost = lost_records.load(std::memory_order_relaxed);
+	dropped += lost - lost_seen;
+	lost_seen = lost;
+
+	if (dropped) {
+		dropped_total.fetch_add(dropped, std::memory_order_relaxed);
+		snprintf(line, sizeof(line), "log: %llu records dropped",
+				(unsigned long long)dropped);
+		__android_log_write(ANDROID_LOG_WARN, TAG, line);
+	}
+}
+
+static void *drain_thread_fun(void *data)
+{
+	os_set_thread_name("rtmp-log");
+
+	for (;;) {
+		uint64_t requested;
+		bool dump;
+
+		os_event_timedwait(wake_event, LOG_DRAIN_MS);
+
+		pthread_mutex_lock(&request_mutex);
+		requested = flush_requested;
+		dump = dump_requested;
+		dump_requested = false;
+		pthread_mutex_unlock(&request_mutex);
+
+		drain();
+		if (dump)
+			dump_history();
+
+		pthread_mutex_lock(&request_mutex);
+		flush_done = requested;
+		pthread_cond_broadcast(&request_cond);
+		pthread_mutex_unlock(&request_mutex);
+	}
+
+	UNUSED_PARAMETER(data);
+	return NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+
+void rtmp_log_set_level(int level)
+{
+	print_level = level;
+	if (rtmp_log_capture < level)
+		rtmp_log_capture = level;
+}
+
+int rtmp_log_get_level()
+{
+	return print_level;
+}
+
+void rtmp_log_set_capture_level(int level)
+{
+	rtmp_log_capture = level > print_level ? level : print_level;
+}
+
+void rtmp_log_dump()
+{
+	pthread_once(&init_once, log_init);
+	if (!drainer_running)
+		return;
+
+	pthread_mutex_lock(&request_mutex);
+	dump_requested = true;
+	pthread_mutex_unlock(&request_mutex);
+	os_event_signal(wake_event);
+}
+
+void rtmp_log_flush()
+{
+	uint64_t request;
+
+	pthread_once(&init_once, log_init);
+	if (!drainer_running)
+		return;
+
+	pthread_mutex_lock(&request_mutex);
+	request = ++flush_requested;
+	os_event_signal(wake_event);
+	while (flush_done < request)
+		pthread_cond_wait(&request_cond, &request_mutex);
+	pthread_mutex_unlock(&request_mutex);
+}
+
+uint64_t rtmp_log_dropped()
+{
+	return dropped_total.load(std::memory_order_relaxed);
+}
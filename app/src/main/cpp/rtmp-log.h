@@ -0,0 +1,202 @@
+#pragma once
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+
+#include "librtmp/log.h"
+
+/* Asynchronous binary log. A log site formats nothing: it copies the format
+ * pointer, a timestamp and its arguments as tagged binary values into a
+ * ring owned by the calling thread, and a background thread formats the
+ * records later, only those at or under the print level. Everything down
+ * to the capture level is also kept in a history that rtmp_log_dump()
+ * writes out on request, so a debug line costs a copy and no snprintf
+ * unless someone asks for it. Levels are the librtmp ones, and librtmp's
+ * own RTMP_Log comes through the same rings via rtmp_log_librtmp. The
+ * format must be a literal, it is read after the call returns. */
+
+#define RTMP_LOG_MAX_ARGS  16
+#define RTMP_LOG_MAX_STR   255
+
+enum log_arg_type {
+	LOG_ARG_I32,
+	LOG_ARG_U32,
+	LOG_ARG_I64,
+	LOG_ARG_U64,
+	LOG_ARG_F64,
+	LOG_ARG_PTR,
+	LOG_ARG_STR,
+};
+
+extern volatile int rtmp_log_capture;
+
+/* reserves a record in the calling thread's ring and returns where its
+ * nargs type tags go, followed by arg_bytes of values, NULL when it is
+ * full; rtmp_log_commit() hands the record to the drainer */
+uint8_t *rtmp_log_begin(int level, const char *fmt, size_t nargs,
+		size_t arg_bytes);
+void rtmp_log_commit();
+
+void rtmp_log_set_level(int level);
+int rtmp_log_get_level();
+void rtmp_log_set_capture_level(int level);
+/* formats the history, all captured levels, on the drainer thread */
+void rtmp_log_dump();
+/* returns once everything logged before the call has been formatted */
+void rtmp_log_flush();
+uint64_t rtmp_log_dropped();
+
+/* for RTMP_LogSetCallback */
+extern "C" void rtmp_log_librtmp(int level, const char *fmt, va_list args);
+
+/* bytes a string takes without its terminator, "(null)" for NULL */
+inline size_t log_str_len(const char *str)
+{
+	size_t len = str ? strlen(str) : 6;
+	return len > RTMP_LOG_MAX_STR ? RTMP_LOG_MAX_STR : len;
+}
+
+/* the value's size in the record; a string's length goes to *len so the
+ * write doesn't measure it again */
+template<typename T>
+inline typename std::enable_if<std::is_integral<T>::value, size_t>::type
+log_arg_size(T, size_t *)
+{
+	return sizeof(T) > 4 ? 8 : 4;
+}
+
+template<typename T>
+inline typename std::enable_if<std::is_enum<T>::value, size_t>::type
+log_arg_size(T, size_t *)
+{
+	return 4;
+}
+
+inline size_t log_arg_size(double, size_t *)
+{
+	return 8;
+}
+
+inline size_t log_arg_size(const char *str, size_t *len)
+{
+	*len = log_str_len(str);
+	return *len + 1;
+}
+
+template<typename T>
+inline size_t log_arg_size(const T *, size_t *)
+{
+	return 8;
+}
+
+template<typename T>
+inline typename std::enable_if<std::is_integral<T>::value, uint8_t *>::type
+log_arg_write(uint8_t *tag, uint8_t *p, T value, size_t = 0)
+{
+	if (sizeof(T) > 4) {
+		uint64_t v = (uint64_t)value;
+		*tag = std::is_signed<T>::value ? LOG_ARG_I64 : LOG_ARG_U64;
+		memcpy(p, &v, 8);
+		return p + 8;
+	} else {
+		uint32_t v = std::is_signed<T>::value ? (uint32_t)(int32_t)value
+		                                      : (uint32_t)value;
+		*tag = std::is_signed<T>::value ? LOG_ARG_I32 : LOG_ARG_U32;
+		memcpy(p, &v, 4);
+		return p + 4;
+	}
+}
+
+template<typename T>
+inline typename std::enable_if<std::is_enum<T>::value, uint8_t *>::type
+log_arg_write(uint8_t *tag, uint8_t *p, T value, size_t = 0)
+{
+	return log_arg_write(tag, p, (int32_t)value);
+}
+
+inline uint8_t *log_arg_write(uint8_t *tag, uint8_t *p, double value,
+		size_t = 0)
+{
+	*tag = LOG_ARG_F64;
+	memcpy(p, &value, 8);
+	return p + 8;
+}
+
+/* len bytes of str, as log_str_len() measured them or fewer */
+inline uint8_t *log_arg_write(uint8_t *tag, uint8_t *p, const char *str,
+		size_t len)
+{
+	if (!str)
+		str = "(null)";
+
+	*tag = LOG_ARG_STR;
+	memcpy(p, str, len);
+	p[len] = 0;
+	return p + len + 1;
+}
+
+inline uint8_t *log_arg_write(uint8_t *tag, uint8_t *p, const char *str)
+{
+	return log_arg_write(tag, p, str, log_str_len(str));
+}
+
+template<typename T>
+inline uint8_t *log_arg_write(uint8_t *tag, uint8_t *p, const T *ptr, size_t = 0)
+{
+	uint64_t v = (uint64_t)(uintptr_t)ptr;
+	*tag = LOG_ARG_PTR;
+	memcpy(p, &v, 8);
+	return p + 8;
+}
+
+inline size_t log_args_size(size_t *)
+{
+	return 0;
+}
+
+template<typename T, typename... Args>
+inline size_t log_args_size(size_t *len, const T &value,
+		const Args&... rest)
+{
+	return log_arg_size(value, len) + log_args_size(len + 1, rest...);
+}
+
+inline void log_args_write(uint8_t *, uint8_t *, const size_t *)
+{
+}
+
+template<typename T, typename... Args>
+inline void log_args_write(uint8_t *tag, uint8_t *p, const size_t *len,
+		const T &value, const Args&... rest)
+{
+	p = log_arg_write(tag, p, value, *len);
+	log_args_write(tag + 1, p, len + 1, rest...);
+}
+
+template<typename... Args>
+inline void rtmp_log(int level, const char *fmt, const Args&... args)
+{
+	static_assert(sizeof...(Args) <= RTMP_LOG_MAX_ARGS,
+			"too many log arguments");
+
+	if (level > rtmp_log_capture)
+		return;
+
+	/* string lengths, measured once for the size and the copy */
+	size_t lens[sizeof...(Args) + 1];
+	uint8_t *tags = rtmp_log_begin(level, fmt, sizeof...(Args),
+			log_args_size(lens, args...));
+	if (!tags)
+		return;
+
+	log_args_write(tags, tags + sizeof...(Args), lens, args...);
+	rtmp_log_commit();
+}
+
+#define LOGE(...) rtmp_log(RTMP_LOGERROR, __VA_ARGS__)
+#define LOGW(...) rtmp_log(RTMP_LOGWARNING, __VA_ARGS__)
+#define LOGI(...) rtmp_log(RTMP_LOGINFO, __VA_ARGS__)
+#define LOGD(...) rtmp_log(RTMP_LOGDEBUG, __VA_ARGS__)
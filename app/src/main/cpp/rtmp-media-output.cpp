@@ -6,7 +6,8 @@
 media_output::media_output():
 update_semaphore(NULL),
 initialized(false),
-stop(false)
+stop(false),
+thread_active(false)
 {
     initialized = false;
     pthread_mutexattr_t attr;
@@ -63,16 +64,18 @@ bool media_output::output_open()
     stop = false;
 	if (pthread_create(&thread, NULL, media_thread, this) != 0)
 		return false;
+	thread_active = true;
 	return true;
 }
 
 void media_output::output_close()
 {
-    if (initialized) {
+    if (initialized && thread_active) {
         stop = true;
         os_sem_post(update_semaphore);
         void *thread_ret = NULL;
         pthread_join(thread, &thread_ret);
+        thread_active = false;
     }
 }
 
@@ -88,6 +91,16 @@ void media_output::update_input_frame(media_data &input_frame)
     output_unlock_frame();
 }
 
+void media_output::output_frame(media_data &frame)
+{
+    if(stop)
+        return;
+
+    pthread_mutex_lock(&input_mutex);
+    on_input_mutex(frame);
+    pthread_mutex_unlock(&input_mutex);
+}
+
 bool media_output::output_cur_frame()
 {
     media_data frame;
@@ -0,0 +1,910 @@
+#include <errno.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include <string>
+
+#include "rtmp-defs.h"
+#include "rtmp-mp4-recorder.h"
+#include "rtmp-span-writer.h"
+#include "rtmp-video-bitstream.h"
+
+#define MP4_QUEUE_SIZE           (8 * 1024 * 1024)
+#define MP4_MAX_FRAGMENT_SIZE    (16 * 1024 * 1024)
+#define MP4_VIDEO_TIMESCALE      90000
+
+#define MP4_SAMPLE_SYNC          0x02000000
+#define MP4_SAMPLE_NON_SYNC      0x01010000
+
+/* tfhd default-base-is-moof, trun data offset, duration, size, flags and
+ * composition offset for every sample */
+#define MP4_TFHD_FLAGS           0x020000
+#define MP4_TRUN_FLAGS           0x000f01
+
+#define MP4_MOOF_HEADER_SIZE     (8 + 16)
+#define MP4_TRAF_SIZE(n)         (8 + 16 + 20 + 20 + 16 * (n))
+
+/* sidecar index, a magic followed by one record per synced fragment */
+#define MP4_INDEX_MAGIC          "FMP4IDX1"
+#define MP4_INDEX_MAGIC_SIZE     8
+#define MP4_INDEX_RECORD_SIZE    16
+
+static const uint32_t unity_matrix[9] = {
+	0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000
+};
+
+static void put_uint32(uint8_t *p, uint32_t val)
+{
+	p[0] = (uint8_t)(val >> 24);
+	p[1] = (uint8_t)(val >> 16);
+	p[2] = (uint8_t)(val >> 8);
+	p[3] = (uint8_t)val;
+}
+
+static uint64_t get_uint64(const uint8_t *p)
+{
+	uint64_t val = 0;
+
+	for (int i = 0; i < 8; i++)
+		val = (val << 8) | p[i];
+	return val;
+}
+
+static size_t box_begin(span_writer &s, const char *type)
+{
+	size_t pos = s.pos();
+
+	s.write_uint32(0);
+	s.write(type, 4);
+	return pos;
+}
+
+static size_t full_box_begin(span_writer &s, const char *type, uint8_t version,
+		uint32_t flags)
+{
+	size_t pos = box_begin(s, type);
+
+	s.write_uint32(((uint32_t)version << 24) | flags);
+	return pos;
+}
+
+static void box_end(span_writer &s, size_t pos)
+{
+	if (!s.overflow())
+		put_uint32(s.data() + pos, (uint32_t)(s.pos() - pos));
+}
+
+static void write_matrix(span_writer &s)
+{
+	for (int i = 0; i < 9; i++)
+		s.write_uint32(unity_matrix[i]);
+}
+
+static void write_zeros(span_writer &s, size_t count)
+{
+	while (count--)
+		s.write_uint8(0);
+}
+
+/* sample rate and channel count from an AudioSpecificConfig */
+static bool parse_audio_config(const std::vector<uint8_t> &config,
+		uint32_t &sample_rate, uint32_t &channels)
+{
+	static const uint32_t rates[13] = {
+		96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050,
+		16000, 12000, 11025, 8000, 7350
+	};
+
+	bit_reader br(config.data(), config.size(), false);
+
+	if (br.u(5) == 31)
+		br.u(6);
+
+	uint32_t index = br.u(4);
+	if (index == 15)
+		sample_rate = br.u(24);
+	else if (index < 13)
+		sample_rate = rates[index];
+	else
+		return false;
+
+	channels = br.u(4);
+	if (!channels)
+		channels = 2;
+
+	return !br.overrun && sample_rate;
+}
+
+static void write_esds(span_writer &s, const std::vector<uint8_t> &config)
+{
+	size_t pos = full_box_begin(s, "esds", 0, 0);
+	uint8_t size = (uint8_t)config.size();
+
+	s.write_uint8(0x03);             /* ES_Descriptor */
+	s.write_uint8(23 + size);
+	s.write_uint16(0);
+	s.write_uint8(0);
+
+	s.write_uint8(0x04);             /* DecoderConfigDescriptor */
+	s.write_uint8(15 + size);
+	s.write_uint8(0x40);             /* MPEG-4 audio */
+	s.write_uint8(0x15);             /* audio stream */
+	s.write_uint24(0);
+	s.write_uint32(0);
+	s.write_uint32(0);
+
+	s.write_uint8(0x05);             /* DecoderSpecificInfo */
+	s.write_uint8(size);
+	s.write(config.data(), config.size());
+
+	s.write_uint8(0x06);             /* SLConfigDescriptor */
+	s.write_uint8(1);
+	s.write_uint8(0x02);
+
+	box_end(s, pos);
+}
+
+static void write_visual_entry(span_writer &s, uint32_t fourcc,
+		const std::vector<uint8_t> &config, uint32_t width, uint32_t height)
+{
+	const char *entry = "avc1";
+	const char *config_box = "avcC";
+
+	if (fourcc == VIDEO_FOURCC_HEVC) {
+		entry = "hvc1";
+		config_box = "hvcC";
+	} else if (fourcc == VIDEO_FOURCC_AV1) {
+		entry = "av01";
+		config_box = "av1C";
+	}
+
+	size_t pos = box_begin(s, entry);
+	write_zeros(s, 6);
+	s.write_uint16(1);               /* data reference index */
+	write_zeros(s, 16);
+	s.write_uint16((uint16_t)width);
+	s.write_uint16((uint16_t)height);
+	s.write_uint32(0x00480000);      /* 72 dpi */
+	s.write_uint32(0x00480000);
+	s.write_uint32(0);
+	s.write_uint16(1);               /* frame count */
+	write_zeros(s, 32);              /* compressor name */
+	s.write_uint16(0x0018);
+	s.write_uint16(0xffff);
+
+	size_t config_pos = box_begin(s, config_box);
+	s.write(config.data(), config.size());
+	box_end(s, config_pos);
+
+	box_end(s, pos);
+}
+
+static void write_audio_entry(span_writer &s, const std::vector<uint8_t> &config,
+		uint32_t sample_rate, uint32_t channels)
+{
+	size_t pos = box_begin(s, "mp4a");
+	write_zeros(s, 6);
+	s.write_uint16(1);               /* data reference index */
+	write_zeros(s, 8);
+	s.write_uint16((uint16_t)channels);
+	s.write_uint16(16);
+	write_zeros(s, 4);
+	s.write_uint32(sample_rate < 0x10000 ? sample_rate << 16 : 0);
+	write_esds(s, config);
+	box_end(s, pos);
+}
+
+static void write_trak(span_writer &s, uint32_t id, bool video,
+		uint32_t timescale, uint32_t width, uint32_t height,
+		const std::vector<uint8_t> &entry)
+{
+	size_t trak = box_begin(s, "trak");
+
+	size_t pos = full_box_begin(s, "tkhd", 0, 3);
+	s.write_uint32(0);
+	s.write_uint32(0);
+	s.write_uint32(id);
+	s.write_uint32(0);
+	s.write_uint32(0);               /* duration, fragments carry it */
+	write_zeros(s, 8);
+	s.write_uint16(0);
+	s.write_uint16(0);
+	s.write_uint16(video ? 0 : 0x0100);
+	s.write_uint16(0);
+	write_matrix(s);
+	s.write_uint32(width << 16);
+	s.write_uint32(height << 16);
+	box_end(s, pos);
+
+	size_t mdia = box_begin(s, "mdia");
+
+	pos = full_box_begin(s, "mdhd", 0, 0);
+	s.write_uint32(0);
+	s.write_uint32(0);
+	s.write_uint32(timescale);
+	s.write_uint32(0);
+	s.write_uint16(0x55c4);          /* und */
+	s.write_uint16(0);
+	box_end(s, pos);
+
+	static const char video_name[] = "VideoHandler";
+	static const char sound_name[] = "SoundHandler";
+	pos = full_box_begin(s, "hdlr", 0, 0);
+	s.write_uint32(0);
+	s.write(video ? "vide" : "soun", 4);
+	write_zeros(s, 12);
+	s.write(video ? video_name : sound_name, sizeof(video_name));
+	box_end(s, pos);
+
+	size_t minf = box_begin(s, "minf");
+
+	if (video) {
+		pos = full_box_begin(s, "vmhd", 0, 1);
+		write_zeros(s, 8);
+	} else {
+		pos = full_box_begin(s, "smhd", 0, 0);
+		write_zeros(s, 4);
+	}
+	box_end(s, pos);
+
+	size_t dinf = box_begin(s, "dinf");
+	size_t dref = full_box_begin(s, "dref", 0, 0);
+	s.write_uint32(1);
+	pos = full_box_begin(s, "url ", 0, 1);
+	box_end(s, pos);
+	box_end(s, dref);
+	box_end(s, dinf);
+
+	size_t stbl = box_begin(s, "stbl");
+	pos = full_box_begin(s, "stsd", 0, 0);
+	s.write_uint32(1);
+	s.write(entry.data(), entry.size());
+	box_end(s, pos);
+
+	/* sample tables stay empty, every sample lives in a fragment */
+	static const char *empty_tables[] = {"stts", "stsc", "stco"};
+	for (int i = 0; i < 3; i++) {
+		pos = full_box_begin(s, empty_tables[i], 0, 0);
+		s.write_uint32(0);
+		box_end(s, pos);
+	}
+	pos = full_box_begin(s, "stsz", 0, 0);
+	s.write_uint32(0);
+	s.write_uint32(0);
+	box_end(s, pos);
+	box_end(s, stbl);
+
+	box_end(s, minf);
+	box_end(s, mdia);
+	box_end(s, trak);
+}
+
+static void write_trex(span_writer &s, uint32_t id)
+{
+	size_t pos = full_box_begin(s, "trex", 0, 0);
+	s.write_uint32(id);
+	s.write_uint32(1);
+	s.write_uint32(0);
+	s.write_uint32(0);
+	s.write_uint32(0);
+	box_end(s, pos);
+}
+
+Mp4Recorder::Mp4Recorder():
+max_fragment_ms(5000),
+fd(-1),
+index_fd(-1),
+write_sem(NULL),
+queued_bytes(0),
+opened(false),
+stopping(false),
+dropped_packets(0),
+init_written(false),
+wait_keyframe(true),
+has_video(false),
+start_usec(INT64_MIN),
+sequence(0),
+file_size(0),
+failed(false)
+{
+	pthread_mutex_init(&mutex, NULL);
+	reset_track(video, 0, 0);
+	reset_track(audio, 0, 0);
+}
+
+Mp4Recorder::~Mp4Recorder()
+{
+	close();
+	pthread_mutex_destroy(&mutex);
+}
+
+bool Mp4Recorder::open(const char *path)
+{
+	std::string index_path = std::string(path) + ".idx";
+
+	close();
+
+	fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_LARGEFILE,
+			0644);
+	if (fd < 0) {
+		LOGI("mp4 recorder: failed to open %s: %s", path, strerror(errno));
+		return false;
+	}
+
+	index_fd = ::open(index_path.c_str(),
+			O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+	if (index_fd < 0 || write(index_fd, MP4_INDEX_MAGIC,
+				MP4_INDEX_MAGIC_SIZE) != MP4_INDEX_MAGIC_SIZE ||
+		os_sem_init(&write_sem, 0) != 0) {
+		LOGI("mp4 recorder: failed to open %s", index_path.c_str());
+		if (index_fd >= 0)
+			::close(index_fd);
+		::close(fd);
+		fd = index_fd = -1;
+		return false;
+	}
+
+	stopping        = false;
+	dropped_packets = 0;
+	init_written    = false;
+	wait_keyframe   = true;
+	has_video       = false;
+	start_usec      = INT64_MIN;
+	sequence        = 0;
+	file_size       = 0;
+	failed          = false;
+	init_segment.clear();
+	reset_track(video, 0, 0);
+	reset_track(audio, 0, 0);
+
+	if (pthread_create(&write_thread, NULL, write_thread_fun, this) != 0) {
+		os_sem_destroy(write_sem);
+		write_sem = NULL;
+		::close(index_fd);
+		::close(fd);
+		fd = index_fd = -1;
+		return false;
+	}
+
+	pthread_mutex_lock(&mutex);
+	opened = true;
+	pthread_mutex_unlock(&mutex);
+	return true;
+}
+
+void Mp4Recorder::close()
+{
+	pthread_mutex_lock(&mutex);
+	if (!opened) {
+		pthread_mutex_unlock(&mutex);
+		return;
+	}
+	opened   = false;
+	stopping = true;
+	pthread_mutex_unlock(&mutex);
+
+	os_sem_post(write_sem);
+	pthread_join(write_thread, NULL);
+
+	::close(index_fd);
+	::close(fd);
+	fd = index_fd = -1;
+
+	os_sem_destroy(write_sem);
+	write_sem = NULL;
+
+	pthread_mutex_lock(&mutex);
+	queue.clear();
+	queued_bytes = 0;
+	pthread_mutex_unlock(&mutex);
+
+	if (dropped_packets)
+		LOGI("mp4 recorder: dropped %d packets", dropped_packets);
+}
+
+bool Mp4Recorder::active()
+{
+	pthread_mutex_lock(&mutex);
+	bool ret = opened;
+	pthread_mutex_unlock(&mutex);
+	return ret;
+}
+
+bool Mp4Recorder::has_init()
+{
+	return init_written;
+}
+
+void Mp4Recorder::write_init(uint32_t video_fourcc,
+		const std::vector<uint8_t> &video_config, uint32_t width,
+		uint32_t height, const std::vector<uint8_t> &audio_config)
+{
+	uint32_t sample_rate = 0;
+	uint32_t channels = 0;
+	bool with_audio = !audio_config.empty() &&
+		audio_config.size() < 64 &&
+		parse_audio_config(audio_config, sample_rate, channels);
+	uint32_t next_id = 1;
+	std::vector<uint8_t> entry;
+
+	has_video = !video_config.empty();
+
+	/* a little under 1 KiB of boxes per track plus the codec configs */
+	span_writer s(init_segment, 2048 + 2 * (video_config.size() +
+			audio_config.size()));
+
+	size_t pos = box_begin(s, "ftyp");
+	s.write("iso5", 4);
+	s.write_uint32(0x200);
+	s.write("iso5iso6mp41", 12);
+	box_end(s, pos);
+
+	size_t moov = box_begin(s, "moov");
+
+	pos = full_box_begin(s, "mvhd", 0, 0);
+	s.write_uint32(0);
+	s.write_uint32(0);
+	s.write_uint32(1000);
+	s.write_uint32(0);
+	s.write_uint32(0x00010000);      /* rate */
+	s.write_uint16(0x0100);          /* volume */
+	write_zeros(s, 10);
+	write_matrix(s);
+	write_zeros(s, 24);
+	s.write_uint32((has_video ? 1 : 0) + (with_audio ? 1 : 0) + 1);
+	box_end(s, pos);
+
+	pthread_mutex_lock(&mutex);
+
+	if (has_video) {
+		span_writer e(entry, 256 + video_config.size());
+		write_visual_entry(e, video_fourcc, video_config, width, height);
+		entry.resize(e.pos());
+
+		reset_track(video, next_id++, MP4_VIDEO_TIMESCALE);
+		write_trak(s, video.id, true, video.timescale, width, height, entry);
+	}
+
+	if (with_audio) {
+		span_writer e(entry, 256 + audio_config.size());
+		write_audio_entry(e, audio_config, sample_rate, channels);
+		entry.resize(e.pos());
+
+		reset_track(audio, next_id++, sample_rate);
+		audio.last_duration = 1024;
+		write_trak(s, audio.id, false, audio.timescale, 0, 0, entry);
+	}
+
+	size_t mvex = box_begin(s, "mvex");
+	if (video.id)
+		write_trex(s, video.id);
+	if (audio.id)
+		write_trex(s, audio.id);
+	box_end(s, mvex);
+
+	box_end(s, moov);
+	init_segment.resize(s.overflow() ? 0 : s.pos());
+
+	pthread_mutex_unlock(&mutex);
+
+	init_written = !init_segment.empty();
+	os_sem_post(write_sem);
+}
+
+void Mp4Recorder::write_packet(encoder_packet &packet)
+{
+	bool video_packet = packet.type == OBS_ENCODER_VIDEO;
+
+	if (!init_written || packet.data.empty() || packet.timebase_den == 0)
+		return;
+
+	int64_t num = (int64_t)packet.timebase_num * MICROSECOND_DEN;
+	int64_t round = packet.timebase_den / 2;
+	int64_t dts_usec = (packet.dts * num + round) / packet.timebase_den;
+	int64_t pts_usec = (packet.pts * num + round) / packet.timebase_den;
+
+	if (wait_keyframe) {
+		if (has_video && (!video_packet || !packet.keyframe)) {
+			if (video_packet) {
+				pthread_mutex_lock(&mutex);
+				dropped_packets++;
+				pthread_mutex_unlock(&mutex);
+			}
+			return;
+		}
+		/* the first keyframe sets time zero */
+		if (start_usec == INT64_MIN)
+			start_usec = dts_usec;
+	}
+
+	/* audio from just before the first keyframe has nowhere to go */
+	if (dts_usec < start_usec)
+		return;
+
+	pthread_mutex_lock(&mutex);
+
+	if (!opened || queued_bytes + packet.data.size() > MP4_QUEUE_SIZE) {
+		if (opened)
+			dropped_packets++;
+		pthread_mutex_unlock(&mutex);
+		if (video_packet)
+			wait_keyframe = true;
+		return;
+	}
+
+	queue.push_back(mp4_packet());
+	mp4_packet &out = queue.back();
+	out.video    = video_packet;
+	out.keyframe = packet.keyframe;
+	out.dts_usec = dts_usec - start_usec;
+	out.pts_usec = pts_usec - start_usec;
+	out.data     = packet.data;
+	queued_bytes += packet.data.size();
+
+	pthread_mutex_unlock(&mutex);
+
+	if (video_packet || !has_video)
+		wait_keyframe = false;
+
+	os_sem_post(write_sem);
+}
+
+int Mp4Recorder::get_dropped_packets()
+{
+	return dropped_packets;
+}
+
+void *Mp4Recorder::write_thread_fun(void *data)
+{
+	Mp4Recorder *recorder = (Mp4Recorder *)data;
+	bool init_pending = true;
+	size_t last_size = 0;
+	mp4_packet packet;
+
+	os_set_thread_name("mp4-recorder: write_thread");
+
+	while (os_sem_wait(recorder->write_sem) == 0) {
+		pthread_mutex_lock(&recorder->mutex);
+		bool stop = recorder->stopping;
+
+		if (init_pending && !recorder->init_segment.empty()) {
+			pthread_mutex_unlock(&recorder->mutex);
+
+			struct iovec iov = {&recorder->init_segment[0],
+					recorder->init_segment.size()};
+			if (recorder->write_all(&iov, 1)) {
+				fdatasync(recorder->fd);
+				recorder->write_index(recorder->file_size);
+			}
+			init_pending = false;
+
+			pthread_mutex_lock(&recorder->mutex);
+		}
+
+		for (;;) {
+			recorder->queued_bytes -= last_size;
+			last_size = 0;
+
+			if (recorder->queue.empty())
+				break;
+
+			packet = std::move(recorder->queue.front());
+			recorder->queue.pop_front();
+			last_size = packet.data.size();
+			pthread_mutex_unlock(&recorder->mutex);
+
+			mp4_track &track = packet.video ? recorder->video :
+					recorder->audio;
+			if (track.id && !init_pending)
+				recorder->add_sample(track, packet);
+
+			pthread_mutex_lock(&recorder->mutex);
+		}
+
+		pthread_mutex_unlock(&recorder->mutex);
+
+		if (stop)
+			break;
+	}
+
+	/* the last samples have nothing after them, they get the duration of
+	 * the sample before */
+	mp4_track *tracks[2] = {&recorder->video, &recorder->audio};
+	for (int i = 0; i < 2; i++) {
+		mp4_track &track = *tracks[i];
+		if (track.has_pending)
+			recorder->commit_pending(track,
+					track.pending_dts + track.last_duration);
+	}
+	recorder->write_fragment();
+
+	return NULL;
+}
+
+/* A sample is held back until the next one on its track arrives, which
+ * gives its duration. Fragments are cut in front of each video keyframe
+ * and whenever one gets too long or too big. */
+void Mp4Recorder::add_sample(mp4_track &track, mp4_packet &packet)
+{
+	int64_t round = MICROSECOND_DEN / 2;
+	int64_t dts = (packet.dts_usec * track.timescale + round) / MICROSECOND_DEN;
+	int64_t pts = (packet.pts_usec * track.timescale + round) / MICROSECOND_DEN;
+
+	if (track.has_pending)
+		commit_pending(track, dts);
+
+	if ((packet.video && packet.keyframe) || fragment_full())
+		write_fragment();
+
+	track.has_pending = true;
+	track.pending_dts = dts;
+	track.pending_pts = pts;
+	track.pending_key = !packet.video || packet.keyframe;
+	track.pending_data.swap(packet.data);
+}
+
+void Mp4Recorder::commit_pending(mp4_track &track, int64_t next_dts)
+{
+	int64_t duration = next_dts - track.pending_dts;
+	mp4_sample sample;
+
+	if (duration <= 0)
+		duration = track.last_duration;
+	track.last_duration = (uint32_t)duration;
+
+	if (track.samples.empty())
+		track.base_dts = track.pending_dts;
+
+	sample.duration = (uint32_t)duration;
+	sample.size     = (uint32_t)track.pending_data.size();
+	sample.flags    = track.pending_key ? MP4_SAMPLE_SYNC : MP4_SAMPLE_NON_SYNC;
+	sample.cts      = (int32_t)(track.pending_pts - track.pending_dts);
+
+	track.samples.push_back(sample);
+	track.data.insert(track.data.end(), track.pending_data.begin(),
+			track.pending_data.end());
+	track.has_pending = false;
+}
+
+bool Mp4Recorder::fragment_full()
+{
+	mp4_track *tracks[2] = {&video, &audio};
+
+	if (video.data.size() + audio.data.size() >= MP4_MAX_FRAGMENT_SIZE)
+		return true;
+
+	for (int i = 0; i < 2; i++) {
+		mp4_track &track = *tracks[i];
+		uint64_t duration = 0;
+
+		for (size_t j = 0; j < track.samples.size(); j++)
+			duration += track.samples[j].duration;
+
+		if (track.timescale &&
+			duration * 1000 / track.timescale >= max_fragment_ms)
+			return true;
+	}
+
+	return false;
+}
+
+void Mp4Recorder::write_fragment()
+{
+	mp4_track *tracks[2] = {&video, &audio};
+	size_t moof_size = MP4_MOOF_HEADER_SIZE;
+	size_t data_size = 0;
+
+	for (int i = 0; i < 2; i++) {
+		if (!tracks[i]->samples.empty()) {
+			moof_size += MP4_TRAF_SIZE(tracks[i]->samples.size());
+			data_size += tracks[i]->data.size();
+		}
+	}
+
+	if (!data_size)
+		return;
+
+	span_writer s(moof, moof_size + 8);
+	size_t data_offset = moof_size + 8;
+
+	s.write_uint32((uint32_t)moof_size);
+	s.write("moof", 4);
+
+	s.write_uint32(16);
+	s.write("mfhd", 4);
+	s.write_uint32(0);
+	s.write_uint32(++sequence);
+
+	for (int i = 0; i < 2; i++) {
+		mp4_track &track = *tracks[i];
+		size_t count = track.samples.size();
+
+		if (!count)
+			continue;
+
+		s.write_uint32((uint32_t)MP4_TRAF_SIZE(count));
+		s.write("traf", 4);
+
+		s.write_uint32(16);
+		s.write("tfhd", 4);
+		s.write_uint32(MP4_TFHD_FLAGS);
+		s.write_uint32(track.id);
+
+		s.write_uint32(20);
+		s.write("tfdt", 4);
+		s.write_uint32(1 << 24);
+		s.write_uint64((uint64_t)track.base_dts);
+
+		s.write_uint32((uint32_t)(20 + 16 * count));
+		s.write("trun", 4);
+		s.write_uint32((1 << 24) | MP4_TRUN_FLAGS);
+		s.write_uint32((uint32_t)count);
+		s.write_uint32((uint32_t)data_offset);
+
+		for (size_t j = 0; j < count; j++) {
+			const mp4_sample &sample = track.samples[j];
+			s.write_uint32(sample.duration);
+			s.write_uint32(sample.size);
+			s.write_uint32(sample.flags);
+			s.write_uint32((uint32_t)sample.cts);
+		}
+
+		data_offset += track.data.size();
+	}
+
+	s.write_uint32((uint32_t)(8 + data_size));
+	s.write("mdat", 4);
+
+	struct iovec iov[3];
+	int count = 0;
+
+	iov[count].iov_base = &moof[0];
+	iov[count++].iov_len = moof.size();
+	for (int i = 0; i < 2; i++) {
+		if (!tracks[i]->data.empty()) {
+			iov[count].iov_base = &tracks[i]->data[0];
+			iov[count++].iov_len = tracks[i]->data.size();
+		}
+	}
+
+	if (write_all(iov, count)) {
+		fdatasync(fd);
+		write_index(file_size);
+	} else {
+		pthread_mutex_lock(&mutex);
+		dropped_packets += (int)(video.samples.size() + audio.samples.size());
+		pthread_mutex_unlock(&mutex);
+	}
+
+	for (int i = 0; i < 2; i++) {
+		tracks[i]->samples.clear();
+		tracks[i]->data.clear();
+	}
+}
+
+/* appended only once the fragment it covers is on disk */
+void Mp4Recorder::write_index(uint64_t end)
+{
+	uint8_t record[MP4_INDEX_RECORD_SIZE];
+	span_writer s(record, sizeof(record));
+
+	s.write_uint64(end);
+	s.write_uint32(sequence);
+	s.write_uint32(0);
+
+	if (write(index_fd, record, sizeof(record)) != (ssize_t)sizeof(record))
+		LOGI("mp4 recorder: index write failed: %s", strerror(errno));
+}
+
+bool Mp4Recorder::write_all(const struct iovec *iov, int count)
+{
+	struct iovec vec[3];
+	size_t left = 0;
+
+	if (failed || count > 3)
+		return false;
+
+	for (int i = 0; i < count; i++) {
+		vec[i] = iov[i];
+		left += iov[i].iov_len;
+	}
+
+	struct iovec *cur = vec;
+
+	while (left) {
+		ssize_t ret = writev(fd, cur, count);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			LOGI("mp4 recorder: write failed: %s", strerror(errno));
+			failed = true;
+			return false;
+		}
+
+		left      -= (size_t)ret;
+		file_size += (uint64_t)ret;
+
+		while (count && (size_t)ret >= cur->iov_len) {
+			ret -= cur->iov_len;
+			cur++;
+			count--;
+		}
+		if (count) {
+			cur->iov_base = (uint8_t *)cur->iov_base + ret;
+			cur->iov_len -= ret;
+		}
+	}
+
+	return true;
+}
+
+void Mp4Recorder::reset_track(mp4_track &track, uint32_t id,
+		uint32_t timescale)
+{
+	track.id            = id;
+	track.timescale     = timescale;
+	track.has_pending   = false;
+	track.pending_dts   = 0;
+	track.pending_pts   = 0;
+	track.pending_key   = false;
+	track.last_duration = timescale ? timescale / 30 : 0;
+	track.base_dts      = 0;
+	track.samples.clear();
+	track.data.clear();
+}
+
+bool Mp4Recorder::repair(const char *path)
+{
+	std::string index_path = std::string(path) + ".idx";
+	uint8_t buf[MP4_INDEX_RECORD_SIZE * 256];
+	uint8_t magic[MP4_INDEX_MAGIC_SIZE];
+	struct stat64 st;
+	uint64_t end = 0;
+	size_t have = 0;
+	ssize_t ret;
+
+	int index = ::open(index_path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (index < 0)
+		return false;
+
+	if (read(index, magic, sizeof(magic)) != (ssize_t)sizeof(magic) ||
+		memcmp(magic, MP4_INDEX_MAGIC, MP4_INDEX_MAGIC_SIZE) != 0) {
+		::close(index);
+		return false;
+	}
+
+	int file = ::open(path, O_WRONLY | O_CLOEXEC | O_LARGEFILE);
+	if (file < 0 || fstat64(file, &st) != 0) {
+		if (file >= 0)
+			::close(file);
+		::close(index);
+		return false;
+	}
+
+	while ((ret = read(index, buf + have, sizeof(buf) - have)) > 0) {
+		size_t size = have + (size_t)ret;
+		size_t i;
+
+		for (i = 0; i + MP4_INDEX_RECORD_SIZE <= size;
+				i += MP4_INDEX_RECORD_SIZE) {
+			uint64_t record_end = get_uint64(buf + i);
+			if (record_end > end && record_end <= (uint64_t)st.st_size)
+				end = record_end;
+		}
+
+		have = size - i;
+		memmove(buf, buf + i, have);
+	}
+
+	bool success = end != 0;
+	if (success && end < (uint64_t)st.st_size)
+		success = ftruncate64(file, (off64_t)end) == 0;
+
+	::close(file);
+	::close(index);
+	return success;
+}
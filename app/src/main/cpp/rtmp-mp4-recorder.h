@@ -0,0 +1,117 @@
+#pragma once
+
+#include <stdint.h>
+#include <pthread.h>
+#include <deque>
+#include <vector>
+
+#include "util/threading.h"
+#include "rtmp-struct.h"
+
+/* Writes the packets of a live stream to a fragmented MP4 file. The init
+ * segment goes first, then a moof/mdat pair per GOP, or per
+ * max_fragment_ms when there is no keyframe in time. The file is only
+ * ever appended to. After each fragment is synced its end offset is
+ * appended to a sidecar index at path + ".idx", which repair() uses to cut
+ * a file that was interrupted mid fragment back to the last whole one.
+ *
+ * Packets are copied into a bounded queue and muxed on a writer thread.
+ * When the queue is full the packet is dropped and counted, video then
+ * resumes at the next keyframe. */
+class Mp4Recorder {
+public:
+	Mp4Recorder();
+	virtual ~Mp4Recorder();
+
+	uint32_t max_fragment_ms;
+
+	bool open(const char *path);
+	/* flushes the last fragment and waits for the writer */
+	void close();
+
+	bool active();
+	bool has_init();
+
+	/* codec config is the avcC/hvcC/av1C record for video and the
+	 * AudioSpecificConfig for audio, an empty config leaves the track out.
+	 * Must come before the first packet, which must be a video keyframe
+	 * when there is a video track. */
+	void write_init(uint32_t video_fourcc, const std::vector<uint8_t> &video_config,
+			uint32_t width, uint32_t height,
+			const std::vector<uint8_t> &audio_config);
+	void write_packet(encoder_packet &packet);
+
+	int get_dropped_packets();
+
+	/* truncates path to the last fragment recorded in its index */
+	static bool repair(const char *path);
+
+private:
+	struct mp4_packet {
+		bool                 video;
+		bool                 keyframe;
+		int64_t              dts_usec;
+		int64_t              pts_usec;
+		std::vector<uint8_t> data;
+	};
+
+	struct mp4_sample {
+		uint32_t duration;
+		uint32_t size;
+		uint32_t flags;
+		int32_t  cts;
+	};
+
+	struct mp4_track {
+		uint32_t                id;
+		uint32_t                timescale;
+		bool                    has_pending;
+		int64_t                 pending_dts;
+		int64_t                 pending_pts;
+		bool                    pending_key;
+		std::vector<uint8_t>    pending_data;
+		uint32_t                last_duration;
+
+		int64_t                 base_dts;
+		std::vector<mp4_sample> samples;
+		std::vector<uint8_t>    data;
+	};
+
+	int                        fd;
+	int                        index_fd;
+	pthread_t                  write_thread;
+	os_sem_t                   *write_sem;
+	pthread_mutex_t            mutex;
+
+	/* guarded by mutex */
+	std::deque<mp4_packet>     queue;
+	size_t                     queued_bytes;
+	bool                       opened;
+	bool                       stopping;
+	int                        dropped_packets;
+
+	/* caller thread only */
+	bool                       init_written;
+	bool                       wait_keyframe;
+	bool                       has_video;
+	int64_t                    start_usec;
+
+	/* writer thread only */
+	std::vector<uint8_t>       init_segment;
+	mp4_track                  video;
+	mp4_track                  audio;
+	uint32_t                   sequence;
+	uint64_t                   file_size;
+	bool                       failed;
+	std::vector<uint8_t>       moof;
+
+	static void *write_thread_fun(void *data);
+
+	void add_sample(mp4_track &track, mp4_packet &packet);
+	void commit_pending(mp4_track &track, int64_t next_dts);
+	bool fragment_full();
+	void write_fragment();
+	void write_index(uint64_t end);
+	bool write_all(const struct iovec *iov, int count);
+	void reset_track(mp4_track &track, uint32_t id, uint32_t timescale);
+};
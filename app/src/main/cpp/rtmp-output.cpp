@@ -568,7 +568,7 @@ void RtmpOutput::on_interleave_packets(encoder_packet &packet)
 		!packet.keyframe) {
 		discard_unused_audio_packets(packet.dts_usec);
 		pthread_mutex_unlock(&interleaved_mutex);
-		LOGI("on_interleave_packets-------------------- discard_unused_audio_packets received_video %d, packet.type %d, packet.keyframe %d",received_video,packet.type,packet.keyframe );
+		LOGD("on_interleave_packets-------------------- discard_unused_audio_packets received_video %d, packet.type %d, packet.keyframe %d",received_video,packet.type,packet.keyframe );
 		return;
 	}
 
@@ -587,7 +587,7 @@ void RtmpOutput::on_interleave_packets(encoder_packet &packet)
     else{
 
         if (received_audio && received_video) {
-            LOGI("on_interleave_packets-------------------- was_started : %d ",was_started);
+            LOGD("on_interleave_packets-------------------- was_started : %d ",was_started);
             if (!was_started) {
                 if (prune_interleaved_packets()) {
                     if (initialize_interleaved_packets()) {
@@ -626,7 +626,7 @@ void RtmpOutput::send_interleaved()
 
 	if (out.type == OBS_ENCODER_VIDEO)
 		total_frames++;
-	LOGI("send_interleaved : ---------------------------------------------------- %d ", out.data.size());
+	LOGD("send_interleaved : ---------------------------------------------------- %d ", out.data.size());
 	encoded_packet(out);
 }
 
@@ -30,7 +30,13 @@ void RtmpPush::video_output_open()
 
 void RtmpPush::SetupOutputs()
 {
-    std::dynamic_pointer_cast<X264Encoder>(h264Streaming)->set_video(video);
+    std::shared_ptr<X264Encoder> h264 =
+            std::dynamic_pointer_cast<X264Encoder>(h264Streaming);
+
+    h264->codec = videoCodec;
+    h264->vfr = videoVfr;
+    h264->reorder_frames = videoReorderFrames;
+    h264->set_video(video);
     //std::dynamic_pointer_cast<aacEncoder>(aacStreaming)->set_audio(audio);
 }
 
@@ -62,6 +68,8 @@ bool RtmpPush::StartStreaming(const char *stream_url, const char *stream_name)
 
         output_stream->path = streamUrl;
         output_stream->key = streamName;
+        output_stream->record_path = recordPath;
+        output_stream->mp4_record_path = recordMp4Path;
 
         if (output_stream->output_start())
             return true;
@@ -117,4 +125,61 @@ void RtmpPush::Push_audio_data(media_data &input_frame)
     audio_output->UpdateCache(input_frame);
 }
 
+void RtmpPush::Push_audio_source_data(size_t source, media_data &input_frame)
+{
+    std::shared_ptr<AudioOutput> audio_output =
+            std::dynamic_pointer_cast<AudioOutput>(audio);
+    if(!audio_output)
+        return;
+
+    audio_output->push_source_data(source, input_frame);
+}
+
+void RtmpPush::Set_audio_source_gain(size_t source, float gain)
+{
+    std::shared_ptr<AudioOutput> audio_output =
+            std::dynamic_pointer_cast<AudioOutput>(audio);
+    if(!audio_output)
+        return;
+
+    audio_output->set_source_gain(source, gain);
+}
+
+int64_t RtmpPush::Get_clock_drift_usec(bool video)
+{
+    std::shared_ptr<media_encoder> encoder = video ? h264Streaming : aacStreaming;
+    if(!encoder)
+        return 0;
+
+    return encoder->get_clock_drift_usec();
+}
+
+uint32_t RtmpPush::Get_skipped_video_frames()
+{
+    std::shared_ptr<VideoOutput> video_output =
+            std::dynamic_pointer_cast<VideoOutput>(video);
+    if(!video_output)
+        return 0;
+
+    return video_output->get_skipped_frames();
+}
+
+int RtmpPush::Get_record_dropped_tags()
+{
+    std::shared_ptr<RtmpOutput> output_stream =
+            std::dynamic_pointer_cast<RtmpOutput>(streamOutput);
+    if(!output_stream)
+        return 0;
+
+    return output_stream->get_record_dropped_tags();
+}
+
+int RtmpPush::Get_mp4_record_dropped_packets()
+{
+    std::shared_ptr<RtmpOutput> output_stream =
+            std::dynamic_pointer_cast<RtmpOutput>(streamOutput);
+    if(!output_stream)
+        return 0;
 
+    return output_stream->get_mp4_record_dropped_packets();
+}
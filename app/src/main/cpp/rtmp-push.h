@@ -28,6 +28,13 @@ public:
     audio_output_info       audio_info;
 
     bool streamingActive = false;
+    bool videoVfr = false;
+    int  videoReorderFrames = -1;
+    std::string videoCodec = "h264";
+    /* local FLV copy of the stream, empty to not record */
+    std::string recordPath;
+    /* fragmented MP4 copy, empty to not record */
+    std::string recordMp4Path;
 
     RtmpPush();
 
@@ -40,6 +47,15 @@ public:
 
     void Push_video_data(media_data &input_frame);
     void Push_audio_data(media_data &input_frame);
+    void Push_audio_source_data(size_t source, media_data &input_frame);
+    void Set_audio_source_gain(size_t source, float gain);
+
+    /* how far the capture clock has drifted from the encoder's sample or
+     * frame clock */
+    int64_t Get_clock_drift_usec(bool video);
+    uint32_t Get_skipped_video_frames();
+    int Get_record_dropped_tags();
+    int Get_mp4_record_dropped_packets();
 
     inline bool Active()
     {
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <vector>
+
+#include "librtmp/amf.h"
+
+/* Big-endian writer over a span that is sized before writing starts. The
+ * span either comes from the caller or from a reusable buffer whose
+ * capacity carries over between packets, so the steady state allocates
+ * nothing and nothing is copied out afterwards. Writing past the end sets
+ * overflow and drops the write rather than growing. */
+class span_writer {
+public:
+	span_writer(uint8_t *data, size_t size):
+	begin(data), cur(data), end(data + size), overflowed(false)
+	{
+	}
+
+	/* resizes buf to exactly size and writes from its start */
+	span_writer(std::vector<uint8_t> &buf, size_t size):
+	overflowed(false)
+	{
+		buf.resize(size);
+		begin = cur = size ? &buf[0] : NULL;
+		end = begin + size;
+	}
+
+	void write_uint8(uint8_t val)
+	{
+		if (reserve(1))
+			*cur++ = val;
+	}
+
+	void write_uint16(uint16_t val)
+	{
+		if (!reserve(2))
+			return;
+		cur[0] = (uint8_t)(val >> 8);
+		cur[1] = (uint8_t)val;
+		cur += 2;
+	}
+
+	void write_uint24(uint32_t val)
+	{
+		if (!reserve(3))
+			return;
+		cur[0] = (uint8_t)(val >> 16);
+		cur[1] = (uint8_t)(val >> 8);
+		cur[2] = (uint8_t)val;
+		cur += 3;
+	}
+
+	void write_uint32(uint32_t val)
+	{
+		if (!reserve(4))
+			return;
+		cur[0] = (uint8_t)(val >> 24);
+		cur[1] = (uint8_t)(val >> 16);
+		cur[2] = (uint8_t)(val >> 8);
+		cur[3] = (uint8_t)val;
+		cur += 4;
+	}
+
+	void write_uint64(uint64_t val)
+	{
+		write_uint32((uint32_t)(val >> 32));
+		write_uint32((uint32_t)val);
+	}
+
+	void write_double(double val)
+	{
+		uint64_t bits;
+		memcpy(&bits, &val, sizeof(bits));
+		write_uint64(bits);
+	}
+
+	void write(const void *data, size_t size)
+	{
+		if (size && reserve(size)) {
+			memcpy(cur, data, size);
+			cur += size;
+		}
+	}
+
+	/* flv timestamps keep bits 24-30 in a trailing extension byte */
+	void write_flv_time(int32_t time_ms)
+	{
+		write_uint24((uint32_t)time_ms);
+		write_uint8((time_ms >> 24) & 0x7F);
+	}
+
+	/* AMF0, names are the key half of an object or ecma array member */
+	void write_amf_name(const char *name, size_t len)
+	{
+		write_uint16((uint16_t)len);
+		write(name, len);
+	}
+
+	void write_amf_string(const char *str, size_t len)
+	{
+		if (len > 0xffff) {
+			write_uint8(AMF_LONG_STRING);
+			write_uint32((uint32_t)len);
+		} else {
+			write_uint8(AMF_STRING);
+			write_uint16((uint16_t)len);
+		}
+		write(str, len);
+	}
+
+	void write_amf_number(double val)
+	{
+		write_uint8(AMF_NUMBER);
+		write_double(val);
+	}
+
+	void write_amf_bool(bool val)
+	{
+		write_uint8(AMF_BOOLEAN);
+		write_uint8(val ? 1 : 0);
+	}
+
+	void write_amf_object_end()
+	{
+		write_uint16(0);
+		write_uint8(AMF_OBJECT_END);
+	}
+
+	static constexpr size_t amf_name_size(size_t len)
+	{
+		return 2 + len;
+	}
+
+	static constexpr size_t amf_string_size(size_t len)
+	{
+		return (len > 0xffff ? 5 : 3) + len;
+	}
+
+	static constexpr size_t amf_number_size()
+	{
+		return 9;
+	}
+
+	static constexpr size_t amf_bool_size()
+	{
+		return 2;
+	}
+
+	static constexpr size_t amf_object_end_size()
+	{
+		return 3;
+	}
+
+	size_t pos() const {return (size_t)(cur - begin);}
+	size_t remaining() const {return (size_t)(end - cur);}
+	bool overflow() const {return overflowed;}
+	uint8_t *data() const {return begin;}
+
+private:
+	bool reserve(size_t size)
+	{
+		if ((size_t)(end - cur) >= size)
+			return true;
+		overflowed = true;
+		return false;
+	}
+
+	uint8_t *begin;
+	uint8_t *cur;
+	uint8_t *end;
+	bool     overflowed;
+};
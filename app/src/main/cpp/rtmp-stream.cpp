@@ -1,16 +1,40 @@
 
 #include <netdb.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <limits.h>
 
 #include "rtmp-stream.h"
-#include "util/dstr.h"
 #include "rtmp-output.h"
 #include "rtmp-flv-packager.h"
 # include "rtmp-video-output.h"
 
 #include "librtmp/log.h"
 
+#define MAX_AGGREGATE_SIZE (16 * 1024)
+#define INTERLEAVE_SLICE_SIZE (16 * 1024)
+
+/* most the librtmp batch holds at once: about SEND_BATCH_MAX_USEC of the
+ * stream's bitrate within these bounds. The rest of a backlog stays queued
+ * where check_to_drop_frames sees it. */
+#define SEND_BATCH_MAX_USEC   100000
+#define SEND_BATCH_MIN_BYTES  (2 * INTERLEAVE_SLICE_SIZE)
+#define SEND_BATCH_MAX_BYTES  (256 * 1024)
+
+#define PACING_HEADROOM_PCT   150
+#define PACING_INTERVAL_MS    10
+#define PACING_BURST_MS       20
+#define RATE_WINDOW_USEC      1000000
+#define BURST_BIN_NS          20000000ULL
+#define BURST_WINDOW_NS       1000000000ULL
+
 RtmpStream::RtmpStream():
+coalesce_delay_ms(0),
+aggregate_budget_ms(0),
+pacing_enabled(false),
+pacing_kbps(0),
+audio_priority_threshold_ms(500),
+tunnel_max_inflight(RTMPT_MAX_INFLIGHT),
 sent_headers(false),
 got_first_video(false),
 connecting(false),
@@ -19,13 +43,31 @@ disconnected(false),
 send_sem(NULL),
 stop_event(NULL),
 start_dts_offset(0),
+record_dts_offset(0),
 drop_threshold_usec(0),
 pframe_drop_threshold_usec(0),
 min_priority(0),
 congestion(0),
 last_dts_usec(0),
 total_bytes_sent(0),
-dropped_frames(0)
+dropped_frames(0),
+promoted_packets(0),
+estimated_bps(0),
+rate_window_bytes(0),
+rate_window_start_usec(-1),
+pacing_rate_bps(0),
+kernel_pacing(false),
+pacing_tokens(0),
+pacing_last_ns(0),
+queue_base_usec(INT64_MAX),
+batch_oldest_dts_usec(-1),
+queue_delay_ms(0),
+burst_bin_start_ns(0),
+burst_bin_bytes(0),
+burst_peak_bytes(0),
+burst_window_start_ns(0),
+burst_window_bytes(0),
+burstiness(1.0f)
 {
     id = "rtmp_output";
     encoded_video_codecs = "h264";
@@ -34,7 +76,7 @@ dropped_frames(0)
 
 	pthread_mutex_init_value(&packets_mutex);
 	RTMP_Init(&rtmp);
-	RTMP_LogSetCallback(log_rtmp);
+	RTMP_LogSetCallback(rtmp_log_librtmp);
 	RTMP_LogSetLevel(RTMP_LOGWARNING);
 
     if (pthread_mutex_init(&packets_mutex, NULL) != 0)
@@ -67,6 +109,7 @@ void RtmpStream::stream_destroy()
 		}
 	}
 
+	close_recorders();
 	free_packets();
 }
 
@@ -91,28 +134,39 @@ void RtmpStream::stop()
 	if (is_stream_active()) {
 		os_event_signal(stop_event);
 		os_sem_post(send_sem);
-	} else
+	} else {
+		close_recorders();
 		signal_stop(OBS_OUTPUT_SUCCESS);
+	}
 }
 
 void RtmpStream::encoded_packet(encoder_packet &packet)
 {
 	encoder_packet new_packet;
 	bool added_packet = false;
+	bool streaming = !isDisconnected() && is_stream_active();
 
-	if (isDisconnected() || !is_stream_active())
+	/* the recording outlives a dropped connection */
+	if (!streaming && !recorder.active() && !mp4_recorder.active())
 		return;
 
 	if (packet.type == OBS_ENCODER_VIDEO) {
-		if (!got_first_video) {
+		if (streaming && !got_first_video) {
 			start_dts_offset = packet.get_ms_time(packet.dts);
 			got_first_video = true;
 		}
-		new_packet = X264Encoder::parse_avc_packet(packet);
+		new_packet = X264Encoder::parse_packet(packet);
 	} else {
         new_packet = packet;
 	}
 
+	record_packet(new_packet);
+
+	if (!streaming) {
+		new_packet.packet_release();
+		return;
+	}
+
 	pthread_mutex_lock(&packets_mutex);
 
 	if (!isDisconnected()) {
@@ -149,6 +203,36 @@ int RtmpStream::get_dropped_frames()
 	return dropped_frames;
 }
 
+int RtmpStream::get_record_dropped_tags()
+{
+	return recorder.get_dropped_tags();
+}
+
+int RtmpStream::get_mp4_record_dropped_packets()
+{
+	return mp4_recorder.get_dropped_packets();
+}
+
+int RtmpStream::get_promoted_packets()
+{
+	return promoted_packets;
+}
+
+int RtmpStream::get_queue_delay_ms()
+{
+	return queue_delay_ms;
+}
+
+float RtmpStream::get_send_burstiness()
+{
+	return burstiness;
+}
+
+uint32_t RtmpStream::get_pacing_kbps()
+{
+	return (uint32_t)(pacing_rate_bps / 1000);
+}
+
 bool RtmpStream::stopping()
 {
 	return os_event_try(stop_event) != EAGAIN;
@@ -186,6 +270,14 @@ size_t RtmpStream::num_buffered_packets()
 	return packets.size / sizeof(encoder_packet_info);
 }
 
+size_t RtmpStream::queued_packets()
+{
+	pthread_mutex_lock(&packets_mutex);
+	size_t count = num_buffered_packets();
+	pthread_mutex_unlock(&packets_mutex);
+	return count;
+}
+
 void * RtmpStream::connect_thread_fun(void *data)
 {
 	RtmpStream *stream = (RtmpStream *)(data);
@@ -218,7 +310,7 @@ bool RtmpStream::add_packet(encoder_packet &packet)
 
 void RtmpStream::check_to_drop_frames(bool pframes)
 {
-	encoder_packet first;
+	encoder_packet_info first;
 	int64_t buffer_duration_usec;
 	size_t num_packets = num_buffered_packets();
 	const char *name = pframes ? "p-frames" : "b-frames";
@@ -288,14 +380,14 @@ void RtmpStream::set_output_error()
 	set_last_error( msg);
 }
 
-bool RtmpStream::find_first_video_packet(encoder_packet &first)
+bool RtmpStream::find_first_video_packet(encoder_packet_info &first)
 {
 	size_t count = packets.size / sizeof(encoder_packet_info);
 
 	for (size_t i = 0; i < count; i++) {
 		encoder_packet_info *cur = (encoder_packet_info *)packets.get_data(i * sizeof(first));
 		if (cur->type == OBS_ENCODER_VIDEO && !cur->keyframe) {
-			first = encoder_packet(*cur);
+			first = *cur;
 			return true;
 		}
 	}
@@ -324,29 +416,28 @@ void RtmpStream::drop_frames(const char *name, int highest_priority, bool pframe
 {
 	UNUSED_PARAMETER(pframes);
 
-	circlebuffer new_buf;
+	size_t count = num_buffered_packets();
 	int num_frames_dropped = 0;
 
 	UNUSED_PARAMETER(name);
 
-	new_buf.reserve(sizeof(encoder_packet_info) * 8);
-
-	while (packets.size) {
+	/* one pass around the ring, kept packets go back on the end. Copying
+	 * a circlebuffer shares its storage, so it is compacted in place. */
+	for (size_t i = 0; i < count; i++) {
 		encoder_packet_info packet_info;
 		packets.pop_front(&packet_info, sizeof(encoder_packet_info));
 
 		/* do not drop audio data or video keyframes */
 		if (packet_info.type == OBS_ENCODER_AUDIO ||
 			packet_info.drop_priority >= highest_priority) {
-			new_buf.push_back( &packet_info, sizeof(encoder_packet_info));
+			packets.push_back(&packet_info, sizeof(encoder_packet_info));
 
-		} else
+		} else {
+			encoder_packet auto_free(packet_info);
 			num_frames_dropped++;
+		}
 	}
 
-	packets.free();
-	packets = new_buf;
-
 	if (min_priority < highest_priority)
 		min_priority = highest_priority;
 	if (!num_frames_dropped)
@@ -368,6 +459,14 @@ int RtmpStream::init_send()
 
 	os_atomic_set_bool(&stream_active, true);
 
+	/* after a reconnect the recordings are still going */
+	if (!record_path.empty() && !recorder.active() &&
+		!recorder.open(record_path.c_str()))
+		LOGI("failed to start recording to %s", record_path.c_str());
+	if (!mp4_record_path.empty() && !mp4_recorder.active() &&
+		!mp4_recorder.open(mp4_record_path.c_str()))
+		LOGI("failed to start recording to %s", mp4_record_path.c_str());
+
 	if (!send_meta_data()) {
 		set_output_error();
 		return OBS_OUTPUT_DISCONNECTED;
@@ -383,31 +482,44 @@ bool RtmpStream::reset_semaphore()
 	return os_sem_init(&send_sem, 0) == 0;
 }
 
-bool RtmpStream::send_meta_data()
+void RtmpStream::set_meta_data(FLVPackager &packager)
 {
 	std::shared_ptr<X264Encoder> vencoder =
 			std::dynamic_pointer_cast<X264Encoder>(get_video_encoder());
 	std::shared_ptr<aacEncoder> aencoder =
 			std::dynamic_pointer_cast<aacEncoder>(get_audio_encoder());
 
-    std::shared_ptr<VideoOutput> video =
-            std::dynamic_pointer_cast<VideoOutput>(vencoder->media.lock());
+    std::shared_ptr<VideoOutput> video = vencoder ?
+            std::dynamic_pointer_cast<VideoOutput>(vencoder->media.lock()) :
+            std::shared_ptr<VideoOutput>();
 
-	FLVPackager packager;
 	if(vencoder){
-		packager.setProperty("width",(double)vencoder->get_width());
-		packager.setProperty("height",(double)vencoder->get_height());
+		uint32_t fourcc = vencoder->get_fourcc();
+
+		packager.has_video = true;
+		packager.width     = (double)vencoder->get_width();
+		packager.height    = (double)vencoder->get_height();
+
+		/* enhanced rtmp puts the FourCC where the codec id used to be */
+		packager.video_codec_id =
+				fourcc == VIDEO_FOURCC_AVC ? 7 : (double)fourcc;
 	}
-	packager.setProperty("videocodecid",7);
 
 	if(video)
-		packager.setProperty("framerate",video->get_frame_rate());
+		packager.frame_rate = video->get_frame_rate();
 
 	if(aencoder){
-        packager.setProperty("audiocodecid",10);
-        packager.setProperty("audiodatarate",0);
-        packager.setProperty("audiosamplerate",(double)aencoder->get_sample_rate());
+        packager.has_audio         = true;
+        packager.audio_codec_id    = 10;
+        packager.audio_data_rate   = 0;
+        packager.audio_sample_rate = (double)aencoder->get_sample_rate();
 	}
+}
+
+bool RtmpStream::send_meta_data()
+{
+	FLVPackager packager;
+	set_meta_data(packager);
 
 	std::vector<uint8_t> meta_data = packager.flv_meta_data(false);
     bool success = true;
@@ -434,6 +546,7 @@ int RtmpStream::try_connect()
 	set_rtmp_str(&rtmp.Link.pubUser,   username.c_str());
 	set_rtmp_str(&rtmp.Link.pubPasswd, password.c_str());
 	set_rtmp_str(&rtmp.Link.flashVer,  encoder_name.c_str());
+	set_fourcc_list();
 	rtmp.Link.swfUrl = rtmp.Link.tcUrl;
 	memset(&rtmp.m_bindIP, 0, sizeof(rtmp.m_bindIP));
 
@@ -442,6 +555,7 @@ int RtmpStream::try_connect()
 	rtmp.m_outChunkSize       = 4096;
 	rtmp.m_bSendChunkSizeInfo = true;
 	rtmp.m_bUseNagle          = true;
+	RTMP_SetTunnelInflight(&rtmp, (int)tunnel_max_inflight);
 
 	if (!RTMP_Connect(&rtmp, NULL)) {
 		set_output_error();
@@ -467,8 +581,10 @@ bool RtmpStream::init_connect()
 	os_atomic_set_bool(&disconnected, false);
 	total_bytes_sent = 0;
 	dropped_frames   = 0;
+	promoted_packets = 0;
 	min_priority     = 0;
 	got_first_video  = false;
+	reset_pacing();
 
 	drop_b = 700;
 	drop_p = 900;
@@ -487,6 +603,7 @@ bool RtmpStream::init_connect()
 void * RtmpStream::send_thread_fun(void *data)
 {
 	RtmpStream *stream = (RtmpStream *)data;
+	std::vector<encoder_packet_info> batch;
 
 	os_set_thread_name("rtmp-stream: send_thread");
 
@@ -495,34 +612,33 @@ void * RtmpStream::send_thread_fun(void *data)
 		if (stream->stopping())
 			break;
 
-		encoder_packet_info packet_info;
-		if (!stream->get_next_packet(packet_info))
+		/* trade a little latency for fewer, larger writes, but only for
+		 * a lone packet: a batch takes everything queued, and the posts
+		 * left over from it must not each wait again */
+		if (stream->coalesce_delay_ms && stream->queued_packets() == 1)
+			os_event_timedwait(stream->stop_event,
+					stream->coalesce_delay_ms);
+
+		if (!stream->get_next_packets(batch, stream->batch_room()))
 			continue;
 
-		encoder_packet packet(packet_info);
-		if (stream->stopping()) {
-			if (stream->can_shutdown_stream(packet)) {
-                packet.packet_release();
-				break;
-			}
+		if (stream->stopping() && stream->can_shutdown_stream()) {
+			stream->free_batch(batch);
+			break;
 		}
 
-		if (!stream->sent_headers) {
-			if (!stream->send_headers()) {
-				os_atomic_set_bool(&stream->disconnected, true);
-				break;
-			}
-		}
-        LOGI("send_packet ------- pts : %lld --------- dts : %lld,----------- dts_usec : %lld ---------- sys_dts_usec :%lld  ----------- tid %lu",
-            packet.pts,packet.dts,packet.dts_usec,packet.sys_dts_usec, pthread_self());
-		if (stream->send_packet(packet, false, packet.track_idx) < 0) {
-            LOGI("send_packet failed------- ");
+		if (stream->send_packets(batch) < 0) {
+			LOGI("send_packet failed------- ");
 			os_atomic_set_bool(&stream->disconnected, true);
 			break;
 		}
-
 	}
 
+	/* tags already taken off the queue still belong to the stream */
+	if (stream->stopping() && !stream->isDisconnected())
+		stream->flush_aggregates(false);
+	stream->clear_aggregates();
+
 	stream->set_output_error();
 	RTMP_Close(&stream->rtmp);
 
@@ -532,6 +648,9 @@ void * RtmpStream::send_thread_fun(void *data)
 	} else
 		stream->end_data_capture();
 
+	/* a dropped connection leaves the recordings running until stop */
+	if (stream->stopping())
+		stream->close_recorders();
 	stream->free_packets();
 	os_event_reset(stream->stop_event);
 	os_atomic_set_bool(&stream->stream_active, false);
@@ -539,21 +658,188 @@ void * RtmpStream::send_thread_fun(void *data)
 	return NULL;
 }
 
-bool RtmpStream::get_next_packet(encoder_packet_info &packet)
+/* takes packets for up to max_bytes, but always at least one */
+bool RtmpStream::get_next_packets(std::vector<encoder_packet_info> &batch,
+		int64_t max_bytes)
 {
-	bool new_packet = false;
+	batch.clear();
 
 	pthread_mutex_lock(&packets_mutex);
-	if (packets.size) {
-		packets.pop_front(&packet, sizeof(encoder_packet_info));
-		new_packet = true;
-	}
+	if (send_queue_congested())
+		take_promoted_packets(batch, max_bytes);
+	else
+		take_packets(batch, max_bytes);
 	pthread_mutex_unlock(&packets_mutex);
 
-	return new_packet;
+	return !batch.empty();
+}
+
+bool RtmpStream::send_queue_congested()
+{
+	size_t count = num_buffered_packets();
+
+	if (!audio_priority_threshold_ms || count < 2)
+		return false;
+
+	encoder_packet_info *first = (encoder_packet_info *)packets.get_data(0);
+	encoder_packet_info *last  = (encoder_packet_info *)packets.get_data(
+			(count - 1) * sizeof(encoder_packet_info));
+
+	return last->dts_usec - first->dts_usec >
+		   (int64_t)audio_priority_threshold_ms * 1000;
+}
+
+void RtmpStream::take_packets(std::vector<encoder_packet_info> &batch,
+		int64_t max_bytes)
+{
+	int64_t bytes = 0;
+
+	while (packets.size && batch.size() < RTMP_BATCH_MAX_MSGS) {
+		encoder_packet_info packet_info;
+		packets.peek_front(&packet_info, sizeof(encoder_packet_info));
+
+		if (!batch.empty() &&
+			(bytes + packet_info.data_size > max_bytes ||
+			 packet_info.dts_usec - batch.front().dts_usec >
+			 SEND_BATCH_MAX_USEC))
+			break;
+
+		packets.pop_front(sizeof(encoder_packet_info));
+		bytes += packet_info.data_size;
+		batch.push_back(packet_info);
+	}
+}
+
+/* One pass around the queue: packets are taken in order until video no
+ * longer fits, after that only audio is, ahead of the video left queued.
+ * Keyframes are not overtaken and each track keeps its own order, so dts
+ * stays monotonic per track and a stalled video track cannot starve
+ * audio. */
+void RtmpStream::take_promoted_packets(std::vector<encoder_packet_info> &batch,
+		int64_t max_bytes)
+{
+	size_t count = num_buffered_packets();
+	int64_t bytes = 0;
+	bool skipped = false;
+	bool blocked = false;
+
+	for (size_t i = 0; i < count; i++) {
+		encoder_packet_info packet_info;
+		packets.pop_front(&packet_info, sizeof(encoder_packet_info));
+
+		bool take = !blocked && batch.size() < RTMP_BATCH_MAX_MSGS;
+		if (take && packet_info.type != OBS_ENCODER_AUDIO)
+			take = !skipped && (batch.empty() ||
+					bytes + packet_info.data_size <= max_bytes);
+
+		if (take) {
+			if (skipped)
+				promoted_packets++;
+			bytes += packet_info.data_size;
+			batch.push_back(packet_info);
+			continue;
+		}
+
+		if (packet_info.type != OBS_ENCODER_AUDIO) {
+			skipped = true;
+			if (packet_info.keyframe)
+				blocked = true;
+		}
+		packets.push_back(&packet_info, sizeof(encoder_packet_info));
+	}
 }
 
-bool RtmpStream::can_shutdown_stream(encoder_packet &packet)
+int RtmpStream::send_packets(std::vector<encoder_packet_info> &batch)
+{
+	int ret = 0;
+
+	if (!discard_pending_recv_data())
+		ret = -1;
+
+	RTMP_BeginBatch(&rtmp);
+
+	if (ret >= 0 && !sent_headers && !send_headers())
+		ret = -1;
+
+	batch_oldest_dts_usec = -1;
+
+	if (ret >= 0)
+		ret = queue_packets(batch);
+
+	update_pacing_rate();
+
+	/* write big messages a slice at a time and pick up whatever arrived
+	 * meanwhile, so new audio chunks go out between the video chunks */
+	while (ret >= 0 && RTMP_BatchPending(&rtmp)) {
+		int pending;
+
+		wait_for_tokens();
+
+		pending = RTMP_BatchPending(&rtmp);
+		if (!RTMP_WriteBatchSlice(&rtmp, (int)pacing_slice_size())) {
+			ret = -1;
+			break;
+		}
+		on_bytes_written(pending - RTMP_BatchPending(&rtmp));
+
+		int64_t room = batch_room();
+		if (RTMP_BatchPending(&rtmp) && room > 0 &&
+			get_next_packets(batch, room))
+			ret = queue_packets(batch);
+	}
+
+	free_batch(batch);
+
+	if (ret >= 0 && aggregate_budget_ms)
+		ret = flush_aggregates(true);
+
+	if (!RTMP_FlushBatch(&rtmp))
+		ret = -1;
+
+	if (ret >= 0)
+		update_queue_delay();
+
+	return ret;
+}
+
+int RtmpStream::queue_packets(std::vector<encoder_packet_info> &batch)
+{
+	int ret = 0;
+	size_t i = 0;
+
+	for (; ret >= 0 && i < batch.size(); i++) {
+		encoder_packet packet(batch[i]);
+		update_bitrate_estimate(packet);
+		ret = send_packet(packet, false, packet.track_idx);
+	}
+
+	/* packets not reached after a failure still own their data */
+	batch.erase(batch.begin(), batch.begin() + i);
+	free_batch(batch);
+
+	return ret;
+}
+
+int64_t RtmpStream::batch_room()
+{
+	int64_t cap = (int64_t)(estimated_bps / 8) * SEND_BATCH_MAX_USEC / 1000000;
+
+	if (cap < SEND_BATCH_MIN_BYTES)
+		cap = SEND_BATCH_MIN_BYTES;
+	if (cap > SEND_BATCH_MAX_BYTES)
+		cap = SEND_BATCH_MAX_BYTES;
+
+	return cap - RTMP_BatchPending(&rtmp);
+}
+
+void RtmpStream::free_batch(std::vector<encoder_packet_info> &batch)
+{
+	for (size_t i = 0; i < batch.size(); i++)
+		encoder_packet auto_free(batch[i]);
+	batch.clear();
+}
+
+bool RtmpStream::can_shutdown_stream()
 {
 	return true;
 }
@@ -570,39 +856,112 @@ bool RtmpStream::send_headers()
 	return true;
 }
 
-bool RtmpStream::send_audio_header()
+bool RtmpStream::get_audio_header(encoder_packet &packet)
 {
 	std::shared_ptr<aacEncoder> aencoder =
 			std::dynamic_pointer_cast<aacEncoder>(get_audio_encoder());
 
 	if (!aencoder)
-		return true;
+		return false;
 
-	encoder_packet packet;
 	packet.type = OBS_ENCODER_AUDIO;
 	packet.timebase_den = 1;
     packet.data = aencoder->get_encode_header();
-
-	return send_packet(packet, true, 0) >= 0;
+	return true;
 }
 
-bool RtmpStream::send_video_header()
+bool RtmpStream::get_video_header(encoder_packet &packet)
 {
     std::shared_ptr<X264Encoder> vencoder =
             std::dynamic_pointer_cast<X264Encoder>(get_video_encoder());
 
     if (!vencoder)
-        return true;
+        return false;
 
-	encoder_packet packet;
 	packet.type = OBS_ENCODER_VIDEO;
 	packet.timebase_den = 1;
 	packet.keyframe = true;
+	packet.fourcc = vencoder->get_fourcc();
     packet.data = vencoder->get_encode_header();
+	return true;
+}
+
+bool RtmpStream::send_audio_header()
+{
+	encoder_packet packet;
+
+	if (!get_audio_header(packet))
+		return true;
+
+	return send_packet(packet, true, 0) >= 0;
+}
+
+bool RtmpStream::send_video_header()
+{
+	encoder_packet packet;
+
+	if (!get_video_header(packet))
+		return true;
 
 	return send_packet(packet, true, 0) >= 0;
 }
 
+/* Recordings start at the first keyframe the stream sees, with the same
+ * onMetaData and sequence headers that went out on the wire. */
+void RtmpStream::record_packet(encoder_packet &packet)
+{
+	bool keyframe = packet.type == OBS_ENCODER_VIDEO && packet.keyframe;
+
+	if (recorder.active() && (recorder.has_header() || keyframe)) {
+		if (!recorder.has_header()) {
+			encoder_packet video_header;
+			encoder_packet audio_header;
+			FLVPackager packager;
+
+			/* the file's clock starts at its first keyframe, whatever
+			 * the connection is doing */
+			record_dts_offset = packet.get_ms_time(packet.dts);
+
+			set_meta_data(packager);
+			recorder.write_header(packager);
+
+			if (get_video_header(video_header))
+				recorder.write_packet(video_header, 0, true);
+			if (get_audio_header(audio_header))
+				recorder.write_packet(audio_header, 0, true);
+		}
+
+		recorder.write_packet(packet, record_dts_offset, false);
+	}
+
+	if (mp4_recorder.active() && (mp4_recorder.has_init() || keyframe)) {
+		if (!mp4_recorder.has_init()) {
+			std::shared_ptr<X264Encoder> vencoder =
+					std::dynamic_pointer_cast<X264Encoder>(get_video_encoder());
+			std::shared_ptr<media_encoder> aencoder = get_audio_encoder();
+			std::vector<uint8_t> video_config;
+			std::vector<uint8_t> audio_config;
+
+			if (!vencoder || !vencoder->get_extra_data(video_config))
+				return;
+			if (aencoder)
+				aencoder->get_extra_data(audio_config);
+
+			mp4_recorder.write_init(vencoder->get_fourcc(), video_config,
+					vencoder->get_width(), vencoder->get_height(),
+					audio_config);
+		}
+
+		mp4_recorder.write_packet(packet);
+	}
+}
+
+void RtmpStream::close_recorders()
+{
+	recorder.close();
+	mp4_recorder.close();
+}
+
 bool RtmpStream::discard_recv_data(size_t size)
 {
 	uint8_t buf[512];
@@ -622,37 +981,312 @@ bool RtmpStream::discard_recv_data(size_t size)
 	return true;
 }
 
-int RtmpStream::send_packet(encoder_packet &packet, bool is_header, size_t idx)
+bool RtmpStream::discard_pending_recv_data()
 {
+	/* tunnel replies are framed in HTTP, librtmp has to take them apart */
+	if (rtmp.Link.protocol & RTMP_FEATURE_HTTP)
+		return RTMP_TunnelCollect(&rtmp, false) != 0;
+
 	int recv_size = 0;
 	int ret = ioctl(rtmp.m_sb.sb_socket, FIONREAD, &recv_size);
-	if (ret >= 0 && recv_size > 0) {
-		if (!discard_recv_data((size_t)recv_size))
-            return -1;
-	}
+	if (ret >= 0 && recv_size > 0)
+		return discard_recv_data((size_t)recv_size);
 
-	std::vector<uint8_t> send_data =
-			FLVPackager::flv_packet_mux(packet, is_header ? 0 : start_dts_offset,is_header);
+	return true;
+}
 
-	int data_size = send_data.size();
-	if(data_size > 0)
-        ret = RTMP_Write(&rtmp, (char*)&send_data[0], data_size, (int)idx);
+int RtmpStream::send_packet(encoder_packet &packet, bool is_header, size_t idx)
+{
+	FLVPackager::flv_packet_mux(tag_buffer, packet,
+			is_header ? 0 : start_dts_offset, is_header);
+
+	if (tag_buffer.empty())
+		return 0;
+
+	if (aggregate_budget_ms && !is_header)
+		return aggregate_tag(tag_buffer, idx);
+
+	int ret = flush_aggregates(false);
+	if (ret < 0)
+		return ret;
+
+	return write_tag(tag_buffer, idx);
+}
+
+int RtmpStream::write_tag(std::vector<uint8_t> &tag, size_t idx)
+{
+	int data_size = tag.size();
+	int ret = RTMP_Write(&rtmp, (char*)&tag[0], data_size, (int)idx);
 	total_bytes_sent += data_size;
 	return ret;
 }
 
-void RtmpStream::set_rtmp_str(AVal *val, const char *str)
+int RtmpStream::aggregate_tag(std::vector<uint8_t> &tag, size_t idx)
 {
-	bool valid  = (str && *str);
-	val->av_val = valid ? (char*)str       : NULL;
-	val->av_len = valid ? (int)strlen(str) : 0;
+	tag_aggregate &agg = aggregates[tag[0] == RTMP_PACKET_TYPE_AUDIO ? 0 : 1];
+	int32_t time_ms = FLVPackager::flv_tag_time_ms(&tag[0]);
+	int ret = 0;
+
+	/* big tags gain nothing from sharing a message header */
+	if (tag.size() > MAX_AGGREGATE_SIZE) {
+		ret = flush_aggregate(agg);
+		return ret < 0 ? ret : write_tag(tag, idx);
+	}
+
+	if (agg.tags.size() + tag.size() > MAX_AGGREGATE_SIZE ||
+		idx != agg.track_idx) {
+		ret = flush_aggregate(agg);
+		if (ret < 0)
+			return ret;
+	}
+
+	if (agg.tags.empty()) {
+		agg.start_ms  = time_ms;
+		agg.start_ns  = os_gettime_ns();
+		agg.track_idx = idx;
+	}
+
+	agg.tags.insert(agg.tags.end(), tag.begin(), tag.end());
+
+	if (time_ms - agg.start_ms >= (int32_t)aggregate_budget_ms)
+		ret = flush_aggregate(agg);
+
+	return ret;
 }
 
-void RtmpStream::log_rtmp(int level, const char *format, va_list args)
+int RtmpStream::flush_aggregate(tag_aggregate &agg)
 {
-	struct dstr encoder_name = {0};
-    dstr_vprintf(&encoder_name, format, args);
-	LOGI("%s",encoder_name.array);
-	dstr_free(&encoder_name);
+	if (agg.tags.empty())
+		return 0;
 
+	int32_t tag_size = (int32_t)agg.tags.size();
+	int ret;
+
+	/* a lone tag goes out as itself */
+	if (tag_size == 15 + ((agg.tags[1] << 16) |
+						  (agg.tags[2] << 8) | agg.tags[3])) {
+		ret = write_tag(agg.tags, agg.track_idx);
+	} else {
+		FLVPackager::flv_aggregate_mux(aggregate_buffer, agg.tags,
+				agg.start_ms);
+		ret = write_tag(aggregate_buffer, agg.track_idx);
+	}
+
+	agg.tags.clear();
+	return ret;
+}
+
+/* also bounds the wait in wall time, so a track that goes quiet doesn't
+ * hold its last tags until more media arrives */
+int RtmpStream::flush_aggregates(bool expired_only)
+{
+	uint64_t now = os_gettime_ns();
+	int ret = 0;
+
+	for (size_t i = 0; ret >= 0 && i < 2; i++) {
+		tag_aggregate &agg = aggregates[i];
+
+		if (!expired_only || (!agg.tags.empty() &&
+			now - agg.start_ns >= (uint64_t)aggregate_budget_ms * 1000000))
+			ret = flush_aggregate(agg);
+	}
+
+	return ret;
+}
+
+void RtmpStream::clear_aggregates()
+{
+	aggregates[0].tags.clear();
+	aggregates[1].tags.clear();
+}
+
+void RtmpStream::reset_pacing()
+{
+	estimated_bps          = 0;
+	rate_window_bytes      = 0;
+	rate_window_start_usec = -1;
+	pacing_rate_bps        = 0;
+	kernel_pacing          = false;
+	pacing_tokens          = 0;
+	queue_base_usec        = INT64_MAX;
+	batch_oldest_dts_usec  = -1;
+	queue_delay_ms         = 0;
+	burst_bin_start_ns     = 0;
+	burst_bin_bytes        = 0;
+	burst_peak_bytes       = 0;
+	burst_window_start_ns  = 0;
+	burst_window_bytes     = 0;
+	burstiness             = 1.0f;
+}
+
+void RtmpStream::update_bitrate_estimate(encoder_packet &packet)
+{
+	int64_t now_usec = (int64_t)(os_gettime_ns() / 1000);
+	int64_t span;
+
+	/* the smallest gap between wall clock and media clock seen so far is
+	 * taken as "no queueing", see update_queue_delay */
+	if (now_usec - packet.dts_usec < queue_base_usec)
+		queue_base_usec = now_usec - packet.dts_usec;
+	if (batch_oldest_dts_usec < 0 || packet.dts_usec < batch_oldest_dts_usec)
+		batch_oldest_dts_usec = packet.dts_usec;
+
+	if (rate_window_start_usec < 0)
+		rate_window_start_usec = packet.dts_usec;
+
+	rate_window_bytes += packet.data.size();
+
+	span = packet.dts_usec - rate_window_start_usec;
+	if (span < RATE_WINDOW_USEC)
+		return;
+
+	uint64_t bps = rate_window_bytes * 8 * 1000000 / span;
+	estimated_bps = estimated_bps ? (estimated_bps * 3 + bps) / 4 : bps;
+
+	rate_window_start_usec = packet.dts_usec;
+	rate_window_bytes      = 0;
+}
+
+void RtmpStream::update_pacing_rate()
+{
+	uint64_t rate = 0;
+
+	if (pacing_enabled)
+		rate = pacing_kbps ? (uint64_t)pacing_kbps * 1000 :
+			   estimated_bps * PACING_HEADROOM_PCT / 100;
+
+	if (rate == pacing_rate_bps)
+		return;
+
+	if (!pacing_rate_bps) {
+		pacing_tokens  = 0;
+		pacing_last_ns = os_gettime_ns();
+	}
+	pacing_rate_bps = rate;
+
+#ifdef SO_MAX_PACING_RATE
+	/* let the kernel space out the segments if it can, the user space
+	 * bucket below is only the fallback */
+	unsigned int bytes_per_sec = (rate && rate / 8 < UINT_MAX) ?
+								 (unsigned int)(rate / 8) : UINT_MAX;
+	int err = setsockopt(rtmp.m_sb.sb_socket, SOL_SOCKET,
+			SO_MAX_PACING_RATE, &bytes_per_sec, sizeof(bytes_per_sec));
+	kernel_pacing = rate && err == 0;
+#endif
+}
+
+size_t RtmpStream::pacing_slice_size()
+{
+	if (!pacing_rate_bps)
+		return INTERLEAVE_SLICE_SIZE;
+
+	size_t size = (size_t)(pacing_rate_bps / 8 * PACING_INTERVAL_MS / 1000);
+	if (size > INTERLEAVE_SLICE_SIZE)
+		size = INTERLEAVE_SLICE_SIZE;
+	if (size < (size_t)rtmp.m_outChunkSize)
+		size = (size_t)rtmp.m_outChunkSize;
+	return size;
+}
+
+void RtmpStream::refill_tokens()
+{
+	uint64_t now = os_gettime_ns();
+	double burst = (double)pacing_rate_bps / 8 * PACING_BURST_MS / 1000;
+
+	pacing_tokens += (double)(now - pacing_last_ns) * pacing_rate_bps / 8e9;
+	if (pacing_tokens > burst)
+		pacing_tokens = burst;
+	pacing_last_ns = now;
+}
+
+void RtmpStream::wait_for_tokens()
+{
+	if (!pacing_rate_bps || kernel_pacing)
+		return;
+
+	refill_tokens();
+	if (pacing_tokens >= 0)
+		return;
+
+	/* the bucket is allowed to go into debt by one slice, wait until it
+	 * is paid back; a stop request cuts the wait short */
+	unsigned long wait_ms = (unsigned long)(-pacing_tokens * 8000 /
+			pacing_rate_bps) + 1;
+	os_event_timedwait(stop_event, wait_ms);
+	refill_tokens();
+}
+
+void RtmpStream::on_bytes_written(size_t bytes)
+{
+	uint64_t now = os_gettime_ns();
+
+	if (pacing_rate_bps && !kernel_pacing)
+		pacing_tokens -= (double)bytes;
+
+	if (!burst_window_start_ns) {
+		burst_window_start_ns = now;
+		burst_bin_start_ns    = now;
+	}
+
+	if (now - burst_bin_start_ns >= BURST_BIN_NS) {
+		if (burst_bin_bytes > burst_peak_bytes)
+			burst_peak_bytes = burst_bin_bytes;
+		burst_bin_start_ns = now;
+		burst_bin_bytes    = 0;
+	}
+
+	/* peak rate over a short bin against the mean rate over the window,
+	 * 1.0 is perfectly smooth */
+	if (now - burst_window_start_ns >= BURST_WINDOW_NS) {
+		if (burst_bin_bytes > burst_peak_bytes)
+			burst_peak_bytes = burst_bin_bytes;
+		if (burst_window_bytes) {
+			uint64_t bins = (now - burst_window_start_ns) / BURST_BIN_NS;
+			burstiness = (float)(burst_peak_bytes * bins) /
+						 (float)burst_window_bytes;
+		}
+		burst_window_start_ns = now;
+		burst_window_bytes    = 0;
+		burst_peak_bytes      = 0;
+	}
+
+	burst_bin_bytes    += bytes;
+	burst_window_bytes += bytes;
+}
+
+void RtmpStream::update_queue_delay()
+{
+	if (batch_oldest_dts_usec < 0 || queue_base_usec == INT64_MAX)
+		return;
+
+	/* how much later than the best case the oldest packet of this batch
+	 * made it out of the socket writes */
+	int64_t now_usec = (int64_t)(os_gettime_ns() / 1000);
+	int64_t delay = now_usec - batch_oldest_dts_usec - queue_base_usec;
+	queue_delay_ms = delay > 0 ? (int)(delay / 1000) : 0;
+}
+
+/* enhanced rtmp servers learn from connect which FourCCs to expect, plain
+ * h264 keeps the legacy connect */
+void RtmpStream::set_fourcc_list()
+{
+	std::shared_ptr<X264Encoder> vencoder =
+			std::dynamic_pointer_cast<X264Encoder>(get_video_encoder());
+
+	fourcc_list.clear();
+	if (vencoder && vencoder->get_fourcc() != VIDEO_FOURCC_AVC) {
+		uint32_t fourcc = vencoder->get_fourcc();
+
+		for (int shift = 24; shift >= 0; shift -= 8)
+			fourcc_list += (char)(fourcc >> shift);
+	}
+
+	set_rtmp_str(&rtmp.Link.fourCcList, fourcc_list.c_str());
+}
+
+void RtmpStream::set_rtmp_str(AVal *val, const char *str)
+{
+	bool valid  = (str && *str);
+	val->av_val = valid ? (char*)str       : NULL;
+	val->av_len = valid ? (int)strlen(str) : 0;
 }
@@ -7,11 +7,16 @@
 #include "librtmp/rtmp.h"
 #include "rtmp-defs.h"
 #include <string>
+#include <vector>
 
 #include "rtmp-circle-buffer.h"
+#include "rtmp-flv-recorder.h"
+#include "rtmp-mp4-recorder.h"
 #include "rtmp-output-base.h"
 #include "rtmp-struct.h"
 
+class FLVPackager;
+
 class RtmpStream : public rtmp_output_base
 {
 public:
@@ -25,6 +30,12 @@ public:
 	float get_congestion();
 	int get_connect_time_ms();
 	int get_dropped_frames();
+	int get_record_dropped_tags();
+	int get_mp4_record_dropped_packets();
+	int get_promoted_packets();
+	int get_queue_delay_ms();
+	float get_send_burstiness();
+	uint32_t get_pacing_kbps();
 
 	bool stopping();
 	bool isConnecting();
@@ -35,6 +46,34 @@ public:
 	std::string		  username;
 	std::string		  password;
 
+	/* how long the send thread may hold a wakeup to gather more packets
+	 * into the same write, 0 sends as soon as anything is queued */
+	uint32_t		  coalesce_delay_ms;
+
+	/* when non-zero, consecutive small tags are packed into RTMP aggregate
+	 * messages spanning at most this much media time */
+	uint32_t		  aggregate_budget_ms;
+
+	/* spread writes over time instead of bursting whole keyframes into
+	 * the socket, at pacing_kbps or, when 0, at the measured stream
+	 * bitrate plus some headroom */
+	bool			  pacing_enabled;
+	uint32_t		  pacing_kbps;
+
+	/* once this much media time is queued, audio is sent ahead of the
+	 * non-keyframe video queued before it, 0 keeps plain FIFO order */
+	uint32_t		  audio_priority_threshold_ms;
+
+	/* over rtmpt, how many /send posts may be on the connection before
+	 * their responses are read, 0 never waits. Raise it for servers that
+	 * answer slowly but take pipelined requests */
+	uint32_t		  tunnel_max_inflight;
+
+	/* when set, the stream is also recorded to this FLV file */
+	std::string		  record_path;
+	/* the same for a fragmented MP4 file, see Mp4Recorder */
+	std::string		  mp4_record_path;
+
 protected:
 
 	pthread_mutex_t  packets_mutex;
@@ -43,6 +82,8 @@ protected:
 
 	bool             got_first_video;
 	int64_t          start_dts_offset;
+	/* the FLV recording's own, set at its first keyframe */
+	int64_t          record_dts_offset;
 
 	volatile bool    connecting;
 	pthread_t        connect_thread;
@@ -54,6 +95,7 @@ protected:
 	os_event_t       *stop_event;
 
 	std::string		  encoder_name;
+	std::string		  fourcc_list;
 	std::string		  bind_ip;
 
 	int64_t          drop_threshold_usec;
@@ -63,10 +105,49 @@ protected:
 
 	int64_t          last_dts_usec;
 
+	/* small tags waiting to go out as one aggregate message. Audio and
+	 * video gather apart so audio keeps its own chunk stream. */
+	struct tag_aggregate {
+		tag_aggregate() : start_ms(0), start_ns(0), track_idx(0) {}
+
+		std::vector<uint8_t> tags;
+		int32_t              start_ms;
+		uint64_t             start_ns;
+		size_t               track_idx;
+	};
+
+	/* reused between packets so muxing a tag doesn't allocate */
+	std::vector<uint8_t> tag_buffer;
+	tag_aggregate    aggregates[2];
+	std::vector<uint8_t> aggregate_buffer;
+
 	uint64_t         total_bytes_sent;
 	int              dropped_frames;
+	int              promoted_packets;
+
+	uint64_t         estimated_bps;
+	uint64_t         rate_window_bytes;
+	int64_t          rate_window_start_usec;
+
+	uint64_t         pacing_rate_bps;
+	bool             kernel_pacing;
+	double           pacing_tokens;
+	uint64_t         pacing_last_ns;
+
+	int64_t          queue_base_usec;
+	int64_t          batch_oldest_dts_usec;
+	int              queue_delay_ms;
+
+	uint64_t         burst_bin_start_ns;
+	uint64_t         burst_bin_bytes;
+	uint64_t         burst_peak_bytes;
+	uint64_t         burst_window_start_ns;
+	uint64_t         burst_window_bytes;
+	float            burstiness;
 
 	RTMP             rtmp;
+	FlvRecorder      recorder;
+	Mp4Recorder      mp4_recorder;
 
 	os_event_t       *buffer_space_available_event;
 	os_event_t       *buffer_has_data_event;
@@ -76,6 +157,7 @@ protected:
 
 protected:
 	size_t num_buffered_packets();
+	size_t queued_packets();
 
 	bool init_connect();
 	int try_connect();
@@ -83,30 +165,59 @@ protected:
 	bool add_video_packet(encoder_packet &packet);
 	bool add_packet(encoder_packet &packet);
 	void check_to_drop_frames(bool pframes);
-	bool find_first_video_packet(encoder_packet &irst);
+	bool find_first_video_packet(encoder_packet_info &first);
 	void drop_frames(const char *name, int highest_priority, bool pframes);
 	int init_send();
 	bool reset_semaphore();
+	static void * send_thread_fun(void *data);
+	void set_meta_data(FLVPackager &packager);
 	bool send_meta_data();
-	bool get_next_packet(encoder_packet_info &packet);
-	bool can_shutdown_stream(encoder_packet &packet);
+	bool get_next_packets(std::vector<encoder_packet_info> &batch,
+			int64_t max_bytes);
+	int64_t batch_room();
+	bool send_queue_congested();
+	void take_packets(std::vector<encoder_packet_info> &batch,
+			int64_t max_bytes);
+	void take_promoted_packets(std::vector<encoder_packet_info> &batch,
+			int64_t max_bytes);
+	int send_packets(std::vector<encoder_packet_info> &batch);
+	int queue_packets(std::vector<encoder_packet_info> &batch);
+	void free_batch(std::vector<encoder_packet_info> &batch);
+	bool can_shutdown_stream();
 	bool send_headers();
 	bool send_audio_header();
 	bool send_video_header();
+	bool get_audio_header(encoder_packet &packet);
+	bool get_video_header(encoder_packet &packet);
+	void record_packet(encoder_packet &packet);
+	void close_recorders();
 	int send_packet(encoder_packet &packet, bool is_header, size_t idx);
+	int write_tag(std::vector<uint8_t> &tag, size_t idx);
+	int aggregate_tag(std::vector<uint8_t> &tag, size_t idx);
+	int flush_aggregate(tag_aggregate &agg);
+	int flush_aggregates(bool expired_only);
+	void clear_aggregates();
+	void reset_pacing();
+	void update_bitrate_estimate(encoder_packet &packet);
+	void update_pacing_rate();
+	size_t pacing_slice_size();
+	void refill_tokens();
+	void wait_for_tokens();
+	void on_bytes_written(size_t bytes);
+	void update_queue_delay();
 	bool discard_recv_data(size_t size);
+	bool discard_pending_recv_data();
 
 	 void stream_destroy();
 
 private:
 	static void * connect_thread_fun(void *data);
-	static void * send_thread_fun(void *data);
-	static void log_rtmp(int level, const char *format, va_list args);
 
 	void free_packets();
 	bool is_stream_active();
 
 	void set_rtmp_str(AVal *val, const char *str);
+	void set_fourcc_list();
 
 	volatile bool    stream_active;
 };
@@ -9,6 +9,7 @@
 #include "callback/signal.h"
 #include "util/circlebuf.h"
 #include "util/threading.h"
+#include "rtmp-circle-buffer.h"
 
 
 #define MAJOR_VER  1
@@ -17,6 +18,7 @@
 
 
 #define AUDIO_OUTPUT_FRAMES 1024
+#define MAX_AUDIO_CHANNELS  8
 #define MAX_CONVERT_BUFFERS 3
 
 /** Specifies the encoder type */
@@ -128,6 +130,9 @@ public:
     void output_close();
 
     void update_input_frame(media_data &input_frame);
+    /* hands the frame to the inputs on the caller's thread, for producers
+     * that push faster than the single frame cache can take */
+    void output_frame(media_data &frame);
 
 protected:
     pthread_t thread;
@@ -136,6 +141,8 @@ protected:
     pthread_mutex_t input_mutex;
     bool  stop;
     bool  initialized;
+    /* thread is joinable: started by output_open, not yet joined */
+    bool  thread_active;
     media_data cache;
 
     virtual void on_media_thread_create(){};
@@ -173,6 +180,8 @@ struct encoder_packet_info
     int                   drop_priority;
 
     size_t                track_idx ;
+
+    uint32_t              fourcc;       /**< Video codec, see VIDEO_FOURCC */
 };
 /** Encoder output packet */
 class encoder_packet : public  encoder_packet_info{
@@ -225,6 +234,27 @@ struct encoder_frame {
     std::vector<uint8_t>  data;
     uint32_t              frames = 0;
     int64_t               pts = 0;
+
+    /* audio frames point into the encoder's input ring instead of
+     * filling data; the second span is the part that wrapped around */
+    const uint8_t         *span[2] = {NULL, NULL};
+    size_t                span_size[2] = {0, 0};
+
+    bool is_view() const {return span[0] != NULL;}
+    size_t size() const
+    {
+        return is_view() ? span_size[0] + span_size[1] : data.size();
+    }
+    void copy_to(uint8_t *dst) const
+    {
+        if (!is_view()) {
+            memcpy(dst, data.data(), data.size());
+            return;
+        }
+        memcpy(dst, span[0], span_size[0]);
+        if (span_size[1])
+            memcpy(dst + span_size[0], span[1], span_size[1]);
+    }
 };
 
 struct video_output_info {
@@ -251,11 +281,18 @@ struct video_output_info {
     uint64_t          samples_per_sec;
 };
 
+struct video_scaler;
+typedef struct video_scaler video_scaler_t;
+
 struct video_input {
     video_scale_info   conversion;
+    video_scaler_t     *scaler = NULL;
+    media_data         frame;
     void (*callback)(void *param, struct media_data *frame) = NULL;
     void *param = NULL;
     uint64_t last_output_timestamp = 0;
+    /* capture time the pacer expects the next frame at, 0 until the first */
+    uint64_t next_frame_ts = 0;
 };
 
 struct audio_resampler;
@@ -268,9 +305,43 @@ struct audio_input {
     void *param = NULL;
 };
 
+/* one converted copy of the current frame per distinct target format */
+struct audio_convert_cache {
+    struct audio_convert_info conversion;
+    audio_resampler_t         *resampler = NULL;
+    media_data                data;
+    bool                      ready = false;
+};
+
+/* pcm source mixed into the output, kept as float planes in the output
+ * rate and layout; start_ts is the time of the first buffered frame.
+ * The planes share their storage when copied, so sources are held by
+ * pointer. */
+struct audio_mix_source {
+    size_t                          id = 0;
+    struct audio_convert_info       conversion;
+    float                           gain = 1.0f;
+    uint64_t                        jitter_ns = 0;
+    audio_resampler_t               *resampler = NULL;
+    size_t                          channels = 0;
+    circlebuffer                    planes[MAX_AUDIO_CHANNELS];
+    uint64_t                        start_ts = 0;
+    bool                            started = false;
+};
+
 struct audio_mix {
     std::vector<audio_input> inputs;
-    float buffer[AUDIO_OUTPUT_FRAMES];
+    std::vector<audio_convert_cache> converters;
+
+    std::vector<audio_mix_source *> sources;
+    audio_resampler_t         *encoder = NULL;
+    uint64_t                  mix_start_ts = 0;
+    uint64_t                  mix_ticks = 0;
+    uint64_t                  newest_ts = 0;
+    bool                      mix_started = false;
+    std::vector<float>        buffer;
+    std::vector<uint8_t>      scratch;
+    media_data                frame;
 };
 
 
@@ -0,0 +1,952 @@
+#include <string.h>
+
+#include "rtmp-defs.h"
+#include "rtmp-span-writer.h"
+#include "rtmp-video-bitstream.h"
+
+#define HEVC_NAL_IRAP_FIRST 16
+#define HEVC_NAL_IRAP_LAST  23
+#define HEVC_NAL_VPS        32
+#define HEVC_NAL_SPS        33
+#define HEVC_NAL_PPS        34
+
+#define AV1_OBU_SEQUENCE_HEADER    1
+#define AV1_OBU_TEMPORAL_DELIMITER 2
+#define AV1_OBU_FRAME_HEADER       3
+#define AV1_OBU_FRAME              6
+#define AV1_OBU_PADDING            15
+
+#define AV1C_MARKER_VERSION        0x81
+
+enum video_codec video_codec_from_name(const std::string &name)
+{
+	if (name == "hevc" || name == "h265")
+		return VIDEO_CODEC_HEVC;
+	if (name == "av1")
+		return VIDEO_CODEC_AV1;
+	return VIDEO_CODEC_AVC;
+}
+
+enum video_codec video_codec_from_fourcc(uint32_t fourcc)
+{
+	if (fourcc == VIDEO_FOURCC_HEVC)
+		return VIDEO_CODEC_HEVC;
+	if (fourcc == VIDEO_FOURCC_AV1)
+		return VIDEO_CODEC_AV1;
+	return VIDEO_CODEC_AVC;
+}
+
+uint32_t video_codec_fourcc(enum video_codec codec)
+{
+	switch (codec) {
+	case VIDEO_CODEC_HEVC: return VIDEO_FOURCC_HEVC;
+	case VIDEO_CODEC_AV1:  return VIDEO_FOURCC_AV1;
+	default:               return VIDEO_FOURCC_AVC;
+	}
+}
+
+bool video_codec_is_enhanced(enum video_codec codec)
+{
+	return codec != VIDEO_CODEC_AVC;
+}
+
+/* ------------------------------------------------------------------------- */
+
+bit_reader::bit_reader(const uint8_t *src, size_t size, bool rbsp):
+bit(0),
+overrun(false)
+{
+	int zeros = 0;
+
+	if (!rbsp) {
+		data.assign(src, src + size);
+		return;
+	}
+
+	/* drop emulation prevention bytes, 00 00 03 -> 00 00 */
+	data.reserve(size);
+	for (size_t i = 0; i < size; i++) {
+		if (zeros >= 2 && src[i] == 3) {
+			zeros = 0;
+			continue;
+		}
+		data.push_back(src[i]);
+		zeros = src[i] ? 0 : zeros + 1;
+	}
+}
+
+uint32_t bit_reader::u(int n)
+{
+	uint32_t val = 0;
+
+	while (n--) {
+		if (bit >= data.size() * 8) {
+			overrun = true;
+			return 0;
+		}
+		val = (val << 1) | ((data[bit >> 3] >> (7 - (bit & 7))) & 1);
+		bit++;
+	}
+	return val;
+}
+
+uint32_t bit_reader::ue()
+{
+	int zeros = 0;
+
+	while (!u(1)) {
+		if (overrun || ++zeros > 31) {
+			overrun = true;
+			return 0;
+		}
+	}
+	return ((1u << zeros) - 1) + u(zeros);
+}
+
+int32_t bit_reader::se()
+{
+	uint32_t val = ue();
+	return (val & 1) ? (int32_t)((val + 1) / 2) : -(int32_t)(val / 2);
+}
+
+uint32_t bit_reader::uvlc()
+{
+	int zeros = 0;
+
+	while (!u(1)) {
+		if (overrun)
+			return 0;
+		if (++zeros >= 32)
+			return UINT32_MAX;
+	}
+	return u(zeros) + ((1u << zeros) - 1);
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* 00 00 01 at or after p, else end. Checks a word at a time for a zero
+ * byte before looking closer, as ffmpeg does. */
+static const uint8_t *find_startcode(const uint8_t *p, const uint8_t *end)
+{
+	const uint8_t *a = p + 4 - ((intptr_t)p & 3);
+
+	if (end - p < 3)
+		return end;
+
+	for (end -= 3; p < a && p < end; p++) {
+		if (p[0] == 0 && p[1] == 0 && p[2] == 1)
+			return p;
+	}
+
+	for (end -= 3; p < end; p += 4) {
+		uint32_t x;
+		memcpy(&x, p, sizeof(x));
+
+		if ((x - 0x01010101) & (~x) & 0x80808080) {
+			if (p[1] == 0) {
+				if (p[0] == 0 && p[2] == 1)
+					return p;
+				if (p[2] == 0 && p[3] == 1)
+					return p+1;
+			}
+
+			if (p[3] == 0) {
+				if (p[2] == 0 && p[4] == 1)
+					return p+2;
+				if (p[4] == 0 && p[5] == 1)
+					return p+3;
+			}
+		}
+	}
+
+	for (end += 3; p < end; p++) {
+		if (p[0] == 0 && p[1] == 0 && p[2] == 1)
+			return p;
+	}
+
+	return end + 3;
+}
+
+static bool has_startcode(const uint8_t *data, size_t size)
+{
+	if (size < 4 || data[0] || data[1])
+		return false;
+	return data[2] == 1 || (!data[2] && data[3] == 1);
+}
+
+/* Steps to the next nal of an annex B stream. The zeros in front of the
+ * following start code belong to it, not to this nal. */
+static bool next_nal(const uint8_t **p, const uint8_t *end,
+		const uint8_t **nal, size_t *size)
+{
+	for (;;) {
+		const uint8_t *start = find_startcode(*p, end);
+		if (start == end)
+			return false;
+
+		start += 3;
+		const uint8_t *next = find_startcode(start, end);
+		const uint8_t *last = next;
+
+		while (last > start && !last[-1])
+			last--;
+
+		*p = next;
+		if (last > start) {
+			*nal = start;
+			*size = last - start;
+			return true;
+		}
+	}
+}
+
+static inline int nal_type(enum video_codec codec, const uint8_t *nal)
+{
+	return codec == VIDEO_CODEC_HEVC ? (nal[0] >> 1) & 0x3f : nal[0] & 0x1f;
+}
+
+static void nal_frame_info(enum video_codec codec, const uint8_t *nal,
+		bool *keyframe, int *priority)
+{
+	int type = nal_type(codec, nal);
+
+	if (codec == VIDEO_CODEC_AVC) {
+		if (type != OBS_NAL_SLICE_IDR && type != OBS_NAL_SLICE)
+			return;
+		if (keyframe)
+			*keyframe = (type == OBS_NAL_SLICE_IDR);
+		if (priority)
+			*priority = nal[0] >> 5;
+		return;
+	}
+
+	/* hevc has no nal_ref_idc, the even types below the reserved range are
+	 * the sub-layer non-reference pictures */
+	if (type >= 32)
+		return;
+
+	bool irap = type >= HEVC_NAL_IRAP_FIRST && type <= HEVC_NAL_IRAP_LAST;
+	if (keyframe)
+		*keyframe = irap;
+	if (priority) {
+		if (irap)
+			*priority = OBS_NAL_PRIORITY_HIGHEST;
+		else if (type <= 14 && !(type & 1))
+			*priority = OBS_NAL_PRIORITY_DISPOSABLE;
+		else
+			*priority = OBS_NAL_PRIORITY_HIGH;
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+
+struct av1_obu {
+	int            type;
+	const uint8_t *header;
+	size_t         header_size;
+	const uint8_t *payload;
+	size_t         size;
+};
+
+static bool read_leb128(const uint8_t *p, const uint8_t *end, uint64_t *val,
+		size_t *len)
+{
+	*val = 0;
+	for (size_t i = 0; i < 8 && p + i < end; i++) {
+		*val |= (uint64_t)(p[i] & 0x7f) << (i * 7);
+		if (!(p[i] & 0x80)) {
+			*len = i + 1;
+			return true;
+		}
+	}
+	return false;
+}
+
+static void write_leb128(span_writer &s, uint64_t val)
+{
+	do {
+		uint8_t byte = val & 0x7f;
+		val >>= 7;
+		s.write_uint8(val ? byte | 0x80 : byte);
+	} while (val);
+}
+
+/* low overhead obu stream, the last obu may leave out its size field */
+static bool next_obu(const uint8_t **p, const uint8_t *end, av1_obu *obu)
+{
+	const uint8_t *cur = *p;
+
+	if (cur >= end)
+		return false;
+
+	obu->type        = (cur[0] >> 3) & 0xf;
+	obu->header      = cur;
+	obu->header_size = (cur[0] & 0x04) ? 2 : 1;
+
+	const uint8_t *payload = cur + obu->header_size;
+	uint64_t size;
+	size_t len = 0;
+
+	if (payload > end)
+		return false;
+	if (cur[0] & 0x02) {
+		if (!read_leb128(payload, end, &size, &len))
+			return false;
+		payload += len;
+		if (size > (uint64_t)(end - payload))
+			return false;
+	} else {
+		size = end - payload;
+	}
+
+	obu->payload = payload;
+	obu->size    = (size_t)size;
+	*p = payload + size;
+	return true;
+}
+
+static constexpr size_t leb128_size(uint64_t val)
+{
+	return val < 0x80 ? 1 : 1 + leb128_size(val >> 7);
+}
+
+static size_t obu_written_size(const av1_obu &obu)
+{
+	return obu.header_size + leb128_size(obu.size) + obu.size;
+}
+
+static void write_obu(span_writer &s, const av1_obu &obu)
+{
+	s.write_uint8(obu.header[0] | 0x02);
+	if (obu.header_size > 1)
+		s.write_uint8(obu.header[1]);
+	write_leb128(s, obu.size);
+	s.write(obu.payload, obu.size);
+}
+
+/* only the start of the uncompressed header, which assumes the sequence
+ * isn't a reduced still picture */
+static bool av1_is_key_frame(const av1_obu &obu)
+{
+	if (!obu.size)
+		return false;
+
+	bool show_existing_frame = (obu.payload[0] & 0x80) != 0;
+	int frame_type = (obu.payload[0] >> 5) & 0x3;
+	return !show_existing_frame && frame_type == 0;
+}
+
+/* ------------------------------------------------------------------------- */
+
+void video_bitstream_packetize(enum video_codec codec, const uint8_t *data,
+		size_t size, std::vector<uint8_t> &out, bool *keyframe,
+		int *priority)
+{
+	const uint8_t *p = data;
+	const uint8_t *end = data + size;
+
+	if (codec == VIDEO_CODEC_AV1) {
+		/* only a trailing obu can lack a size field, and the ones that have
+		 * one never get longer */
+		span_writer s(out, size + 8);
+		bool seen_frame = false;
+		av1_obu obu;
+
+		while (next_obu(&p, end, &obu)) {
+			if (obu.type == AV1_OBU_TEMPORAL_DELIMITER ||
+				obu.type == AV1_OBU_PADDING)
+				continue;
+
+			if (!seen_frame && (obu.type == AV1_OBU_FRAME ||
+					obu.type == AV1_OBU_FRAME_HEADER)) {
+				bool key = av1_is_key_frame(obu);
+
+				if (keyframe)
+					*keyframe = key;
+				if (priority)
+					*priority = key ? OBS_NAL_PRIORITY_HIGHEST :
+							OBS_NAL_PRIORITY_HIGH;
+				seen_frame = true;
+			}
+
+			write_obu(s, obu);
+		}
+
+		out.resize(s.pos());
+		return;
+	}
+
+	/* every nal costs at least a 3 byte start code and gets a 4 byte length
+	 * instead, so one extra byte per three bounds the output */
+	span_writer s(out, size + size / 3 + 1);
+	const uint8_t *nal;
+	size_t nal_size;
+
+	while (next_nal(&p, end, &nal, &nal_size)) {
+		nal_frame_info(codec, nal, keyframe, priority);
+		s.write_uint32((uint32_t)nal_size);
+		s.write(nal, nal_size);
+	}
+
+	out.resize(s.pos());
+}
+
+bool video_bitstream_is_keyframe(enum video_codec codec, const uint8_t *data,
+		size_t size)
+{
+	const uint8_t *p = data;
+	const uint8_t *end = data + size;
+	bool keyframe = false;
+
+	if (codec == VIDEO_CODEC_AV1) {
+		av1_obu obu;
+
+		while (next_obu(&p, end, &obu)) {
+			if (obu.type == AV1_OBU_FRAME ||
+				obu.type == AV1_OBU_FRAME_HEADER)
+				return av1_is_key_frame(obu);
+		}
+		return false;
+	}
+
+	const uint8_t *nal;
+	size_t nal_size;
+
+	while (next_nal(&p, end, &nal, &nal_size))
+		nal_frame_info(codec, nal, &keyframe, NULL);
+	return keyframe;
+}
+
+/* ------------------------------------------------------------------------- */
+
+struct nal_unit {
+	const uint8_t *data;
+	size_t         size;
+};
+
+static void collect_nals(enum video_codec codec, const uint8_t *data,
+		size_t size, int type, std::vector<nal_unit> &nals)
+{
+	const uint8_t *p = data;
+	const uint8_t *end = data + size;
+	nal_unit nal;
+
+	while (next_nal(&p, end, &nal.data, &nal.size)) {
+		if (nal.size > 1 && nal_type(codec, nal.data) == type)
+			nals.push_back(nal);
+	}
+}
+
+static size_t nal_list_size(const std::vector<nal_unit> &nals)
+{
+	size_t size = 0;
+
+	for (size_t i = 0; i < nals.size(); i++)
+		size += 2 + nals[i].size;
+	return size;
+}
+
+static void write_nal_list(span_writer &s, const std::vector<nal_unit> &nals)
+{
+	for (size_t i = 0; i < nals.size(); i++) {
+		s.write_uint16((uint16_t)nals[i].size);
+		s.write(nals[i].data, nals[i].size);
+	}
+}
+
+static bool make_avc_config(const uint8_t *data, size_t size,
+		std::vector<uint8_t> &config)
+{
+	std::vector<nal_unit> sps, pps;
+
+	collect_nals(VIDEO_CODEC_AVC, data, size, OBS_NAL_SPS, sps);
+	collect_nals(VIDEO_CODEC_AVC, data, size, OBS_NAL_PPS, pps);
+	if (sps.empty() || pps.empty() || sps[0].size < 4)
+		return false;
+
+	span_writer s(config, 7 + nal_list_size(sps) + nal_list_size(pps));
+
+	s.write_uint8(0x01);
+	s.write(sps[0].data + 1, 3);
+	s.write_uint8(0xff);
+	s.write_uint8(0xe0 | (uint8_t)sps.size());
+	write_nal_list(s, sps);
+	s.write_uint8((uint8_t)pps.size());
+	write_nal_list(s, pps);
+	return true;
+}
+
+struct hevc_sps_info {
+	uint32_t max_sub_layers;
+	uint32_t temporal_id_nested;
+	uint32_t profile_space;
+	uint32_t tier;
+	uint32_t profile_idc;
+	uint32_t compatibility;
+	uint32_t constraints_hi;
+	uint32_t constraints_lo;
+	uint32_t level_idc;
+	uint32_t chroma_format_idc;
+	uint32_t bit_depth_luma;
+	uint32_t bit_depth_chroma;
+	uint32_t num_reorder_pics;
+};
+
+static bool parse_hevc_sps(const uint8_t *sps, size_t size,
+		hevc_sps_info &info)
+{
+	bit_reader r(sps, size, true);
+
+	r.u(16);
+	r.u(4);
+	info.max_sub_layers     = r.u(3) + 1;
+	info.temporal_id_nested = r.u(1);
+
+	/* general profile_tier_level */
+	info.profile_space  = r.u(2);
+	info.tier           = r.u(1);
+	info.profile_idc    = r.u(5);
+	info.compatibility  = r.u(32);
+	info.constraints_hi = r.u(32);
+	info.constraints_lo = r.u(16);
+	info.level_idc      = r.u(8);
+
+	uint32_t sub_layers = info.max_sub_layers - 1;
+	bool profile_present[8], level_present[8];
+
+	for (uint32_t i = 0; i < sub_layers; i++) {
+		profile_present[i] = r.u(1) != 0;
+		level_present[i]   = r.u(1) != 0;
+	}
+	if (sub_layers) {
+		for (uint32_t i = sub_layers; i < 8; i++)
+			r.u(2);
+	}
+	for (uint32_t i = 0; i < sub_layers; i++) {
+		if (profile_present[i]) {
+			r.u(32);
+			r.u(32);
+			r.u(24);
+		}
+		if (level_present[i])
+			r.u(8);
+	}
+
+	r.ue();
+	info.chroma_format_idc = r.ue();
+	if (info.chroma_format_idc == 3)
+		r.u(1);
+	r.ue();
+	r.ue();
+	if (r.u(1)) {
+		r.ue();
+		r.ue();
+		r.ue();
+		r.ue();
+	}
+	info.bit_depth_luma   = r.ue();
+	info.bit_depth_chroma = r.ue();
+	r.ue();
+
+	/* only the highest sub-layer matters, it holds the largest values */
+	bool ordering_info = r.u(1) != 0;
+	for (uint32_t i = ordering_info ? 0 : sub_layers; i <= sub_layers; i++) {
+		r.ue();
+		info.num_reorder_pics = r.ue();
+		r.ue();
+	}
+
+	return !r.overrun && info.chroma_format_idc <= 3 &&
+			info.bit_depth_luma <= 8 && info.bit_depth_chroma <= 8;
+}
+
+static bool make_hevc_config(const uint8_t *data, size_t size,
+		std::vector<uint8_t> &config)
+{
+	std::vector<nal_unit> arrays[3];
+	static const int types[3] = {HEVC_NAL_VPS, HEVC_NAL_SPS, HEVC_NAL_PPS};
+	hevc_sps_info info;
+	size_t size_out = 23;
+
+	for (int i = 0; i < 3; i++) {
+		collect_nals(VIDEO_CODEC_HEVC, data, size, types[i], arrays[i]);
+		if (arrays[i].empty())
+			return false;
+	}
+
+	if (!parse_hevc_sps(arrays[1][0].data, arrays[1][0].size, info))
+		return false;
+
+	for (int i = 0; i < 3; i++)
+		size_out += 3 + nal_list_size(arrays[i]);
+
+	span_writer s(config, size_out);
+
+	s.write_uint8(0x01);
+	s.write_uint8((uint8_t)((info.profile_space << 6) | (info.tier << 5) |
+			info.profile_idc));
+	s.write_uint32(info.compatibility);
+	s.write_uint32(info.constraints_hi);
+	s.write_uint16((uint16_t)info.constraints_lo);
+	s.write_uint8((uint8_t)info.level_idc);
+	s.write_uint16(0xf000);	/* min_spatial_segmentation_idc */
+	s.write_uint8(0xfc);	/* parallelismType */
+	s.write_uint8((uint8_t)(0xfc | info.chroma_format_idc));
+	s.write_uint8((uint8_t)(0xf8 | info.bit_depth_luma));
+	s.write_uint8((uint8_t)(0xf8 | info.bit_depth_chroma));
+	s.write_uint16(0);	/* avgFrameRate */
+	s.write_uint8((uint8_t)((info.max_sub_layers << 3) |
+			(info.temporal_id_nested << 2) | 3));
+	s.write_uint8(3);
+
+	for (int i = 0; i < 3; i++) {
+		s.write_uint8((uint8_t)(0x80 | types[i]));
+		s.write_uint16((uint16_t)arrays[i].size());
+		write_nal_list(s, arrays[i]);
+	}
+	return true;
+}
+
+struct av1_seq_info {
+	uint32_t profile;
+	uint32_t level_idx;
+	uint32_t tier;
+	uint32_t high_bitdepth;
+	uint32_t twelve_bit;
+	uint32_t monochrome;
+	uint32_t subsampling_x;
+	uint32_t subsampling_y;
+	uint32_t sample_position;
+};
+
+static bool parse_av1_sequence_header(const uint8_t *data, size_t size,
+		av1_seq_info &info)
+{
+	bit_reader r(data, size, false);
+
+	memset(&info, 0, sizeof(info));
+	info.profile = r.u(3);
+	r.u(1);
+	bool reduced = r.u(1) != 0;
+
+	if (reduced) {
+		info.level_idx = r.u(5);
+	} else {
+		bool decoder_model_info = false;
+		uint32_t delay_length = 0;
+
+		if (r.u(1)) {
+			r.u(32);
+			r.u(32);
+			if (r.u(1))
+				r.uvlc();
+			decoder_model_info = r.u(1) != 0;
+			if (decoder_model_info) {
+				delay_length = r.u(5) + 1;
+				r.u(32);
+				r.u(10);
+			}
+		}
+
+		bool initial_display_delay = r.u(1) != 0;
+		uint32_t points = r.u(5) + 1;
+
+		for (uint32_t i = 0; i < points && !r.overrun; i++) {
+			r.u(12);
+			uint32_t level = r.u(5);
+			uint32_t tier = level > 7 ? r.u(1) : 0;
+
+			if (!i) {
+				info.level_idx = level;
+				info.tier      = tier;
+			}
+			if (decoder_model_info && r.u(1)) {
+				r.u(delay_length);
+				r.u(delay_length);
+				r.u(1);
+			}
+			if (initial_display_delay && r.u(1))
+				r.u(4);
+		}
+	}
+
+	uint32_t width_bits  = r.u(4) + 1;
+	uint32_t height_bits = r.u(4) + 1;
+	r.u(width_bits);
+	r.u(height_bits);
+	if (!reduced && r.u(1)) {
+		r.u(4);
+		r.u(3);
+	}
+	r.u(3);
+
+	if (!reduced) {
+		r.u(4);
+		bool order_hint = r.u(1) != 0;
+		if (order_hint)
+			r.u(2);
+
+		uint32_t screen_content = r.u(1) ? 2 : r.u(1);
+		if (screen_content && !r.u(1))
+			r.u(1);
+		if (order_hint)
+			r.u(3);
+	}
+	r.u(3);
+
+	/* color_config */
+	info.high_bitdepth = r.u(1);
+	if (info.profile == 2 && info.high_bitdepth)
+		info.twelve_bit = r.u(1);
+	info.monochrome = info.profile == 1 ? 0 : r.u(1);
+
+	uint32_t primaries = 2, transfer = 2, matrix = 2;
+	if (r.u(1)) {
+		primaries = r.u(8);
+		transfer  = r.u(8);
+		matrix    = r.u(8);
+	}
+
+	if (info.monochrome) {
+		info.subsampling_x = 1;
+		info.subsampling_y = 1;
+	} else if (primaries == 1 && transfer == 13 && matrix == 0) {
+		/* srgb */
+	} else {
+		r.u(1);
+		if (info.profile == 0) {
+			info.subsampling_x = 1;
+			info.subsampling_y = 1;
+		} else if (info.profile == 2 && info.twelve_bit) {
+			info.subsampling_x = r.u(1);
+			info.subsampling_y = info.subsampling_x ? r.u(1) : 0;
+		} else if (info.profile == 2) {
+			info.subsampling_x = 1;
+		}
+		if (info.subsampling_x && info.subsampling_y)
+			info.sample_position = r.u(2);
+	}
+
+	return !r.overrun;
+}
+
+static bool make_av1_config(const uint8_t *data, size_t size,
+		std::vector<uint8_t> &config)
+{
+	const uint8_t *p = data;
+	const uint8_t *end = data + size;
+	av1_seq_info info;
+	av1_obu obu;
+
+	/* the encoder may already hand out a complete av1C */
+	if (size >= 4 && data[0] == AV1C_MARKER_VERSION) {
+		config.assign(data, data + size);
+		return true;
+	}
+
+	while (next_obu(&p, end, &obu)) {
+		if (obu.type != AV1_OBU_SEQUENCE_HEADER)
+			continue;
+		if (!parse_av1_sequence_header(obu.payload, obu.size, info))
+			return false;
+
+		span_writer s(config, 4 + obu_written_size(obu));
+
+		s.write_uint8(AV1C_MARKER_VERSION);
+		s.write_uint8((uint8_t)((info.profile << 5) | info.level_idx));
+		s.write_uint8((uint8_t)((info.tier << 7) |
+				(info.high_bitdepth << 6) | (info.twelve_bit << 5) |
+				(info.monochrome << 4) | (info.subsampling_x << 3) |
+				(info.subsampling_y << 2) | info.sample_position));
+		s.write_uint8(0);
+		write_obu(s, obu);
+		return true;
+	}
+
+	return false;
+}
+
+bool video_bitstream_make_config(enum video_codec codec, const uint8_t *data,
+		size_t size, std::vector<uint8_t> &config)
+{
+	if (!data || !size)
+		return false;
+
+	if (codec == VIDEO_CODEC_AV1)
+		return make_av1_config(data, size, config);
+
+	/* already a decoder configuration record */
+	if (!has_startcode(data, size)) {
+		config.assign(data, data + size);
+		return true;
+	}
+
+	return codec == VIDEO_CODEC_HEVC ?
+			make_hevc_config(data, size, config) :
+			make_avc_config(data, size, config);
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void skip_scaling_list(bit_reader &r, int size)
+{
+	int last = 8, next = 8;
+
+	for (int i = 0; i < size && !r.overrun; i++) {
+		if (next)
+			next = (last + r.se() + 256) % 256;
+		last = next ? next : last;
+	}
+}
+
+static void skip_hrd(bit_reader &r)
+{
+	uint32_t count = r.ue() + 1;
+
+	r.u(8);
+	for (uint32_t i = 0; i < count && !r.overrun; i++) {
+		r.ue();
+		r.ue();
+		r.u(1);
+	}
+	r.u(20);
+}
+
+/* max_num_reorder_frames from the vui, -1 when there is none */
+static int parse_avc_sps_reorder(const uint8_t *sps, size_t size)
+{
+	bit_reader r(sps, size, true);
+
+	r.u(8);
+	uint32_t profile_idc = r.u(8);
+	r.u(16);
+	r.ue();
+
+	if (profile_idc == 100 || profile_idc == 110 || profile_idc == 122 ||
+		profile_idc == 244 || profile_idc == 44 || profile_idc == 83 ||
+		profile_idc == 86 || profile_idc == 118 || profile_idc == 128 ||
+		profile_idc == 138 || profile_idc == 139 || profile_idc == 134 ||
+		profile_idc == 135) {
+		uint32_t chroma_format_idc = r.ue();
+
+		if (chroma_format_idc == 3)
+			r.u(1);
+		r.ue();
+		r.ue();
+		r.u(1);
+		if (r.u(1)) {
+			int lists = chroma_format_idc == 3 ? 12 : 8;
+
+			for (int i = 0; i < lists; i++) {
+				if (r.u(1))
+					skip_scaling_list(r, i < 6 ? 16 : 64);
+			}
+		}
+	}
+
+	r.ue();
+	uint32_t poc_type = r.ue();
+	if (poc_type == 0) {
+		r.ue();
+	} else if (poc_type == 1) {
+		r.u(1);
+		r.se();
+		r.se();
+		uint32_t cycle = r.ue();
+		for (uint32_t i = 0; i < cycle && !r.overrun; i++)
+			r.se();
+	}
+
+	r.ue();
+	r.u(1);
+	r.ue();
+	r.ue();
+	if (!r.u(1))
+		r.u(1);
+	r.u(1);
+	if (r.u(1)) {
+		r.ue();
+		r.ue();
+		r.ue();
+		r.ue();
+	}
+
+	if (!r.u(1) || r.overrun)
+		return -1;
+
+	/* vui */
+	if (r.u(1) && r.u(8) == 255)
+		r.u(32);
+	if (r.u(1))
+		r.u(1);
+	if (r.u(1)) {
+		r.u(4);
+		if (r.u(1))
+			r.u(24);
+	}
+	if (r.u(1)) {
+		r.ue();
+		r.ue();
+	}
+	if (r.u(1)) {
+		r.u(32);
+		r.u(32);
+		r.u(1);
+	}
+
+	bool nal_hrd = r.u(1) != 0;
+	if (nal_hrd)
+		skip_hrd(r);
+	bool vcl_hrd = r.u(1) != 0;
+	if (vcl_hrd)
+		skip_hrd(r);
+	if (nal_hrd || vcl_hrd)
+		r.u(1);
+	r.u(1);
+
+	if (!r.u(1) || r.overrun)
+		return -1;
+
+	r.u(1);
+	r.ue();
+	r.ue();
+	r.ue();
+	r.ue();
+	uint32_t reorder = r.ue();
+
+	if (r.overrun || reorder > 16)
+		return -1;
+	return (int)reorder;
+}
+
+int video_bitstream_reorder_frames(enum video_codec codec, const uint8_t *data,
+		size_t size)
+{
+	std::vector<nal_unit> sps;
+
+	if (codec == VIDEO_CODEC_AV1)
+		return 0;
+	if (!data || !has_startcode(data, size))
+		return -1;
+
+	if (codec == VIDEO_CODEC_HEVC) {
+		hevc_sps_info info;
+
+		collect_nals(codec, data, size, HEVC_NAL_SPS, sps);
+		if (sps.empty() || !parse_hevc_sps(sps[0].data, sps[0].size, info))
+			return -1;
+		return info.num_reorder_pics > 16 ? -1 : (int)info.num_reorder_pics;
+	}
+
+	collect_nals(codec, data, size, OBS_NAL_SPS, sps);
+	if (sps.empty() || sps[0].size < 4)
+		return -1;
+
+	int reorder = parse_avc_sps_reorder(sps[0].data, sps[0].size);
+	if (reorder >= 0)
+		return reorder;
+
+	/* no bitstream restriction in the vui. Baseline can't carry b-frames,
+	 * for anything else assume the usual two */
+	return sps[0].data[1] == 66 ? 0 : 2;
+}
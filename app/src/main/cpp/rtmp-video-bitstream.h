@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+enum video_codec {
+	VIDEO_CODEC_AVC,
+	VIDEO_CODEC_HEVC,
+	VIDEO_CODEC_AV1,
+};
+
+#define VIDEO_FOURCC(a, b, c, d) \
+	(((uint32_t)(a) << 24) | ((uint32_t)(b) << 16) | \
+	 ((uint32_t)(c) << 8) | (uint32_t)(d))
+
+#define VIDEO_FOURCC_AVC  VIDEO_FOURCC('a', 'v', 'c', '1')
+#define VIDEO_FOURCC_HEVC VIDEO_FOURCC('h', 'v', 'c', '1')
+#define VIDEO_FOURCC_AV1  VIDEO_FOURCC('a', 'v', '0', '1')
+
+/* "h264", "hevc" or "av1", anything else is taken as h264 */
+enum video_codec video_codec_from_name(const std::string &name);
+enum video_codec video_codec_from_fourcc(uint32_t fourcc);
+uint32_t video_codec_fourcc(enum video_codec codec);
+
+/* codecs that only go out with the enhanced rtmp video header */
+bool video_codec_is_enhanced(enum video_codec codec);
+
+/* Reads an sps/vps/sequence header bit by bit. Emulation prevention bytes
+ * are dropped when rbsp is set, reading past the end sets overrun and
+ * returns zeros. */
+class bit_reader {
+public:
+	bit_reader(const uint8_t *data, size_t size, bool rbsp);
+
+	uint32_t u(int n);
+	uint32_t ue();
+	int32_t  se();
+	uint32_t uvlc();
+
+	std::vector<uint8_t> data;
+	size_t               bit;
+	bool                 overrun;
+};
+
+/* Turns one encoder output buffer into flv frame data. Annex B h264/hevc
+ * becomes 4 byte length prefixed nals, av1 keeps its obus minus temporal
+ * delimiters, each with a size field. */
+void video_bitstream_packetize(enum video_codec codec, const uint8_t *data,
+		size_t size, std::vector<uint8_t> &out, bool *keyframe,
+		int *priority);
+bool video_bitstream_is_keyframe(enum video_codec codec, const uint8_t *data,
+		size_t size);
+
+/* Builds the avcC, hvcC or av1C record from the codec config the encoder
+ * hands out, parameter sets for h264/hevc, a sequence header or an av1C
+ * for av1 */
+bool video_bitstream_make_config(enum video_codec codec, const uint8_t *data,
+		size_t size, std::vector<uint8_t> &config);
+
+/* How many frames the stream may be reordered by, from the sps vui for
+ * h264 (falling back to 0 for baseline and 2 otherwise) and the sps for
+ * hevc. av1 is sent in display order. -1 without parameter sets. */
+int video_bitstream_reorder_frames(enum video_codec codec, const uint8_t *data,
+		size_t size);
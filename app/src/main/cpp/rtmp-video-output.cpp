@@ -1,11 +1,13 @@
 
 #include "rtmp-video-output.h"
+#include "rtmp-video-scaler.h"
 #include "rtmp-defs.h"
 #include "util/dstr.h"
 #include "util/threading.h"
 
 VideoOutput::VideoOutput(video_output_info &video_info):
-frame_time(0)
+frame_time(0),
+skipped_frames(0)
 {
 	info 		= video_info;
 	frame_time  = (uint64_t)(1000000000.0 * (double)video_info.fps_den /
@@ -14,6 +16,7 @@ frame_time(0)
 
 VideoOutput::~VideoOutput()
 {
+	video_scaler_destroy(input.scaler);
 }
 
 void VideoOutput::on_media_thread_create()
@@ -23,16 +26,80 @@ void VideoOutput::on_media_thread_create()
 
 void VideoOutput::on_input_mutex(media_data &frame)
 {
-	if (scale_video_output(input, frame))
-		input.callback(input.param, &frame);
+	media_data *out = &frame;
+
+	if (input.callback == NULL)
+		return;
+
+	if (!pace_video_output(input, frame))
+		return;
+
+	if (scale_video_output(input, frame, &out))
+		input.callback(input.param, out);
 
 	input.last_output_timestamp = frame.timestamp;
 }
 
-bool VideoOutput::scale_video_output(video_input &input, media_data &data)
+/* Lets one frame through per frame_time of capture time. The expected time
+ * advances on a fixed grid rather than from the last frame let through, so
+ * timing error doesn't accumulate, and a frame is taken once it is within
+ * half an interval of its slot. Encoded frames can't be skipped without
+ * breaking the frames that reference them, those are capped to the frame
+ * rate at the encoder input instead. */
+bool VideoOutput::pace_video_output(video_input &input, media_data &data)
+{
+	if (info.format == VIDEO_FORMAT_NONE || !frame_time)
+		return true;
+
+	if (input.last_output_timestamp >= data.timestamp) {
+		os_atomic_inc_long(&skipped_frames);
+		return false;
+	}
+
+	if (!input.next_frame_ts) {
+		input.next_frame_ts = data.timestamp + frame_time;
+		return true;
+	}
+
+	if (data.timestamp + frame_time / 2 < input.next_frame_ts) {
+		os_atomic_inc_long(&skipped_frames);
+		return false;
+	}
+
+	input.next_frame_ts += frame_time;
+
+	/* a stall or a jump in capture time starts a new grid */
+	if (input.next_frame_ts + frame_time < data.timestamp)
+		input.next_frame_ts = data.timestamp + frame_time;
+
+	return true;
+}
+
+uint32_t VideoOutput::get_skipped_frames()
+{
+	return (uint32_t)os_atomic_load_long(&skipped_frames);
+}
+
+bool VideoOutput::scale_video_output(video_input &input, media_data &data,
+									 media_data **out)
 {
-	if(input.last_output_timestamp >= data.timestamp)
+	/* encoded frames come in decode order, with b-frames their timestamps
+	 * go backwards, so only a repeat of the last frame is dropped */
+	if (info.format == VIDEO_FORMAT_NONE ?
+			input.last_output_timestamp == data.timestamp :
+			input.last_output_timestamp >= data.timestamp)
 		return  false;
+
+	if (!input.scaler)
+		return true;
+
+	if (data.data.empty() ||
+		!video_scaler_scale(input.scaler, input.frame.data, &data.data[0],
+							data.data.size()))
+		return false;
+
+	input.frame.timestamp = data.timestamp;
+	*out = &input.frame;
 	return true;
 }
 
@@ -97,8 +164,10 @@ bool VideoOutput::video_output_connect(const struct video_scale_info *conversion
 			vInput.conversion.height = info.height;
 
 		success = input_init(vInput);
-		if (success)
+		if (success) {
+			video_scaler_destroy(input.scaler);
 			input = vInput;
+		}
 	}
 
 	pthread_mutex_unlock(&input_mutex);
@@ -125,8 +194,40 @@ bool VideoOutput::get_input_valid(void (*callback)(void *param, struct media_dat
 	return false;
 }
 
+/* encoded frames pass through untouched, raw ones get a scaler when the
+ * input asks for another format or size */
 bool VideoOutput::input_init(video_input &input)
 {
+	video_scale_info &conv = input.conversion;
+
+	if (info.format == VIDEO_FORMAT_NONE || conv.format == VIDEO_FORMAT_NONE)
+		return true;
+
+	if (conv.colorspace == VIDEO_CS_DEFAULT)
+		conv.colorspace = info.colorspace;
+	if (conv.range == VIDEO_RANGE_DEFAULT)
+		conv.range = info.range;
+
+	if (conv.format == info.format && conv.width == info.width &&
+		conv.height == info.height && conv.colorspace == info.colorspace &&
+		conv.range == info.range)
+		return true;
+
+	video_scale_info src;
+	src.format     = info.format;
+	src.width      = info.width;
+	src.height     = info.height;
+	src.range      = info.range;
+	src.colorspace = info.colorspace;
+
+	input.scaler = video_scaler_create(&conv, &src, VIDEO_SCALE_DEFAULT);
+	if (!input.scaler) {
+		LOGI("VideoOutput: can't convert %dx%d (%d) to %dx%d (%d)",
+			 info.width, info.height, (int)info.format,
+			 conv.width, conv.height, (int)conv.format);
+		return false;
+	}
+
 	return true;
 }
 
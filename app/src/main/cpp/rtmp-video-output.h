@@ -30,6 +30,9 @@ public:
 									 void *param);
 	video_output_info * get_info();
 
+	/* raw frames the pacer held back to stay at the configured fps */
+	uint32_t get_skipped_frames();
+
 protected:
 	video_output_info            		info;
 
@@ -38,7 +41,11 @@ protected:
 
 private:
 
-	bool scale_video_output(video_input &input, media_data &data);
+	bool pace_video_output(video_input &input, media_data &data);
+	bool scale_video_output(video_input &input, media_data &data,
+							media_data **out);
+
+	volatile long                       skipped_frames;
 	bool video_output_connect(const struct video_scale_info *conversion,
 										   void (*callback)(void *param, struct media_data *frame),
 										   void *param);
@@ -0,0 +1,874 @@
+#include <math.h>
+#include <string.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define VIDEO_USE_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define VIDEO_USE_SSE2
+#endif
+
+#include "rtmp-video-scaler.h"
+#include "util/platform.h"
+#include "util/threading.h"
+
+#define FILTER_SHIFT  8
+#define FILTER_ONE    (1 << FILTER_SHIFT)
+#define COEF_SHIFT    14
+#define COEF_HALF     (1 << (COEF_SHIFT - 1))
+
+/* frames with at least this many pixels on either side get split across
+ * threads */
+#define SCALER_THREAD_MIN_PIXELS (1280 * 720)
+#define SCALER_MAX_THREADS       4
+
+#define SCALER_MAX_RATIO 8
+#define SCALER_MAX_TAPS  (SCALER_MAX_RATIO + 2)
+
+/* per output sample: taps source samples starting at offset, weights sum
+ * to FILTER_ONE */
+struct scale_filter {
+	int                   taps;
+	bool                  identity;
+	std::vector<int32_t>  offset;
+	std::vector<uint16_t> weights;
+};
+
+/* scratch rows for one band of output rows */
+struct scaler_band {
+	uint32_t             y0;
+	uint32_t             y1;
+	std::vector<uint8_t> vtmp;
+	std::vector<uint8_t> rows[2];
+	std::vector<uint8_t> chroma[2];
+};
+
+struct scaler_worker {
+	struct video_scaler *scaler;
+	pthread_t           thread;
+	os_sem_t            *start;
+	scaler_band         band;
+};
+
+enum scale_path {
+	PATH_YUV,
+	PATH_RGB,
+	PATH_RGB_TO_YUV,
+	PATH_YUV_TO_RGB,
+};
+
+struct video_scaler {
+	struct video_scale_info src;
+	struct video_scale_info dst;
+	enum scale_path         path;
+
+	uint32_t src_cw, src_ch;
+	uint32_t dst_cw, dst_ch;
+
+	scale_filter luma_h, luma_v;
+	scale_filter chroma_h, chroma_v;
+
+	/* rgb to yuv, indexed by source byte order */
+	int16_t y_coefs[3];
+	int32_t u_coefs[3];
+	int32_t v_coefs[3];
+	int32_t y_offset;
+
+	/* yuv to rgb */
+	int32_t y_min;
+	int32_t ry, rv, gu, gv, bu;
+
+	bool swap_rb;
+
+	const uint8_t *input;
+	uint8_t       *output;
+
+	scaler_band                 main_band;
+	std::vector<scaler_worker*> workers;
+	os_sem_t                    *done;
+	volatile bool               exit;
+};
+
+/* ------------------------------------------------------------------------- */
+
+bool video_format_is_yuv420(enum video_format format)
+{
+	return format == VIDEO_FORMAT_I420 || format == VIDEO_FORMAT_NV12;
+}
+
+bool video_format_is_rgb(enum video_format format)
+{
+	return format == VIDEO_FORMAT_RGBA || format == VIDEO_FORMAT_BGRA ||
+		format == VIDEO_FORMAT_BGRX;
+}
+
+size_t video_get_frame_size(enum video_format format, uint32_t width,
+		uint32_t height)
+{
+	size_t luma   = (size_t)width * height;
+	size_t chroma = (size_t)((width + 1) / 2) * ((height + 1) / 2);
+
+	if (video_format_is_yuv420(format))
+		return luma + chroma * 2;
+	if (video_format_is_rgb(format))
+		return luma * 4;
+	return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+
+void video_filter_rows(uint8_t *dst, const uint8_t *const *rows,
+		const uint16_t *weights, int taps, size_t count)
+{
+	size_t i = 0;
+
+#if defined(VIDEO_USE_NEON)
+	for (; i + 16 <= count; i += 16) {
+		uint16x8_t lo = vdupq_n_u16(FILTER_ONE / 2);
+		uint16x8_t hi = lo;
+
+		for (int k = 0; k < taps; k++) {
+			uint8x16_t px = vld1q_u8(rows[k] + i);
+			lo = vmlaq_n_u16(lo, vmovl_u8(vget_low_u8(px)), weights[k]);
+			hi = vmlaq_n_u16(hi, vmovl_u8(vget_high_u8(px)), weights[k]);
+		}
+
+		vst1q_u8(dst + i, vcombine_u8(vshrn_n_u16(lo, FILTER_SHIFT),
+				vshrn_n_u16(hi, FILTER_SHIFT)));
+	}
+#elif defined(VIDEO_USE_SSE2)
+	const __m128i zero = _mm_setzero_si128();
+
+	for (; i + 16 <= count; i += 16) {
+		__m128i lo = _mm_set1_epi16(FILTER_ONE / 2);
+		__m128i hi = lo;
+
+		for (int k = 0; k < taps; k++) {
+			__m128i px = _mm_loadu_si128((const __m128i *)(rows[k] + i));
+			__m128i w  = _mm_set1_epi16((short)weights[k]);
+			lo = _mm_add_epi16(lo,
+					_mm_mullo_epi16(_mm_unpacklo_epi8(px, zero), w));
+			hi = _mm_add_epi16(hi,
+					_mm_mullo_epi16(_mm_unpackhi_epi8(px, zero), w));
+		}
+
+		lo = _mm_srli_epi16(lo, FILTER_SHIFT);
+		hi = _mm_srli_epi16(hi, FILTER_SHIFT);
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+	}
+#endif
+
+	for (; i < count; i++) {
+		uint32_t acc = FILTER_ONE / 2;
+		for (int k = 0; k < taps; k++)
+			acc += (uint32_t)weights[k] * rows[k][i];
+		dst[i] = (uint8_t)(acc >> FILTER_SHIFT);
+	}
+}
+
+static inline uint8_t clamp_byte(int32_t v)
+{
+	return (uint8_t)(v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+void video_rgb_to_luma(uint8_t *dst, const uint8_t *src, const int16_t *coefs,
+		int32_t offset, size_t count)
+{
+	size_t i = 0;
+
+#if defined(VIDEO_USE_NEON)
+	const int32x4_t voff = vdupq_n_s32(offset);
+
+	for (; i + 8 <= count; i += 8) {
+		uint8x8x4_t px = vld4_u8(src + i * 4);
+		int16x8_t c0 = vreinterpretq_s16_u16(vmovl_u8(px.val[0]));
+		int16x8_t c1 = vreinterpretq_s16_u16(vmovl_u8(px.val[1]));
+		int16x8_t c2 = vreinterpretq_s16_u16(vmovl_u8(px.val[2]));
+
+		int32x4_t lo = vmlal_n_s16(voff, vget_low_s16(c0), coefs[0]);
+		lo = vmlal_n_s16(lo, vget_low_s16(c1), coefs[1]);
+		lo = vmlal_n_s16(lo, vget_low_s16(c2), coefs[2]);
+		int32x4_t hi = vmlal_n_s16(voff, vget_high_s16(c0), coefs[0]);
+		hi = vmlal_n_s16(hi, vget_high_s16(c1), coefs[1]);
+		hi = vmlal_n_s16(hi, vget_high_s16(c2), coefs[2]);
+
+		int16x8_t y = vcombine_s16(vshrn_n_s32(lo, COEF_SHIFT),
+				vshrn_n_s32(hi, COEF_SHIFT));
+		vst1_u8(dst + i, vqmovun_s16(y));
+	}
+#elif defined(VIDEO_USE_SSE2)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i vcoef = _mm_setr_epi16(coefs[0], coefs[1], coefs[2], 0,
+			coefs[0], coefs[1], coefs[2], 0);
+	const __m128i voff = _mm_set1_epi32(offset);
+
+	for (; i + 8 <= count; i += 8) {
+		__m128i y[2];
+
+		for (int h = 0; h < 2; h++) {
+			__m128i px = _mm_loadu_si128(
+					(const __m128i *)(src + (i + h * 4) * 4));
+			/* pairs of (c0*k0 + c1*k1, c2*k2) per pixel */
+			__m128i a = _mm_madd_epi16(_mm_unpacklo_epi8(px, zero), vcoef);
+			__m128i b = _mm_madd_epi16(_mm_unpackhi_epi8(px, zero), vcoef);
+			__m128 even = _mm_shuffle_ps(_mm_castsi128_ps(a),
+					_mm_castsi128_ps(b), _MM_SHUFFLE(2, 0, 2, 0));
+			__m128 odd  = _mm_shuffle_ps(_mm_castsi128_ps(a),
+					_mm_castsi128_ps(b), _MM_SHUFFLE(3, 1, 3, 1));
+			__m128i sum = _mm_add_epi32(_mm_castps_si128(even),
+					_mm_castps_si128(odd));
+			y[h] = _mm_srai_epi32(_mm_add_epi32(sum, voff), COEF_SHIFT);
+		}
+
+		__m128i s16 = _mm_packs_epi32(y[0], y[1]);
+		_mm_storel_epi64((__m128i *)(dst + i), _mm_packus_epi16(s16, s16));
+	}
+#endif
+
+	for (; i < count; i++) {
+		const uint8_t *p = src + i * 4;
+		dst[i] = clamp_byte((coefs[0] * p[0] + coefs[1] * p[1] +
+				coefs[2] * p[2] + offset) >> COEF_SHIFT);
+	}
+}
+
+void video_interleave_uv(uint8_t *uv, const uint8_t *u, const uint8_t *v,
+		size_t count)
+{
+	size_t i = 0;
+
+#if defined(VIDEO_USE_NEON)
+	for (; i + 16 <= count; i += 16) {
+		uint8x16x2_t px;
+		px.val[0] = vld1q_u8(u + i);
+		px.val[1] = vld1q_u8(v + i);
+		vst2q_u8(uv + i * 2, px);
+	}
+#elif defined(VIDEO_USE_SSE2)
+	for (; i + 16 <= count; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(u + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(v + i));
+		_mm_storeu_si128((__m128i *)(uv + i * 2), _mm_unpacklo_epi8(a, b));
+		_mm_storeu_si128((__m128i *)(uv + i * 2 + 16),
+				_mm_unpackhi_epi8(a, b));
+	}
+#endif
+
+	for (; i < count; i++) {
+		uv[i * 2]     = u[i];
+		uv[i * 2 + 1] = v[i];
+	}
+}
+
+void video_deinterleave_uv(uint8_t *u, uint8_t *v, const uint8_t *uv,
+		size_t count)
+{
+	size_t i = 0;
+
+#if defined(VIDEO_USE_NEON)
+	for (; i + 16 <= count; i += 16) {
+		uint8x16x2_t px = vld2q_u8(uv + i * 2);
+		vst1q_u8(u + i, px.val[0]);
+		vst1q_u8(v + i, px.val[1]);
+	}
+#elif defined(VIDEO_USE_SSE2)
+	const __m128i mask = _mm_set1_epi16(0x00ff);
+
+	for (; i + 16 <= count; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(uv + i * 2));
+		__m128i b = _mm_loadu_si128((const __m128i *)(uv + i * 2 + 16));
+		_mm_storeu_si128((__m128i *)(u + i), _mm_packus_epi16(
+				_mm_and_si128(a, mask), _mm_and_si128(b, mask)));
+		_mm_storeu_si128((__m128i *)(v + i), _mm_packus_epi16(
+				_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+	}
+#endif
+
+	for (; i < count; i++) {
+		u[i] = uv[i * 2];
+		v[i] = uv[i * 2 + 1];
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void build_filter(scale_filter &f, uint32_t src_len, uint32_t dst_len,
+		bool area)
+{
+	f.offset.resize(dst_len);
+
+	if (src_len == dst_len) {
+		f.taps     = 1;
+		f.identity = true;
+		f.weights.assign(dst_len, FILTER_ONE);
+		for (uint32_t i = 0; i < dst_len; i++)
+			f.offset[i] = (int32_t)i;
+		return;
+	}
+
+	double scale = (double)src_len / (double)dst_len;
+	area = area && scale > 1.0;
+
+	f.identity = false;
+	f.taps     = area ? (int)ceil(scale) + 1 : 2;
+	if (f.taps > (int)src_len)
+		f.taps = (int)src_len;
+	f.weights.assign((size_t)dst_len * f.taps, 0);
+
+	std::vector<double> w(f.taps + 1);
+
+	for (uint32_t i = 0; i < dst_len; i++) {
+		int start;
+		int count;
+
+		if (area) {
+			double lo = i * scale;
+			double hi = lo + scale;
+			start = (int)floor(lo);
+			count = f.taps;
+			for (int k = 0; k < count; k++) {
+				double a = lo > start + k ? lo : start + k;
+				double b = hi < start + k + 1 ? hi : start + k + 1;
+				w[k] = b > a ? (b - a) / scale : 0.0;
+			}
+		} else {
+			double s = (i + 0.5) * scale - 0.5;
+			start = (int)floor(s);
+			count = 2;
+			w[0]  = 1.0 - (s - start);
+			w[1]  = s - start;
+		}
+
+		/* taps past either edge fold onto the edge sample */
+		int base = start;
+		if (base > (int)src_len - f.taps)
+			base = (int)src_len - f.taps;
+		if (base < 0)
+			base = 0;
+
+		uint16_t *out = &f.weights[(size_t)i * f.taps];
+		int sum = 0;
+		int largest = 0;
+
+		for (int k = 0; k < count; k++) {
+			int j = start + k;
+			if (j < 0)
+				j = 0;
+			if (j > (int)src_len - 1)
+				j = (int)src_len - 1;
+
+			out[j - base] += (uint16_t)lrint(w[k] * FILTER_ONE);
+		}
+		for (int k = 0; k < f.taps; k++) {
+			sum += out[k];
+			if (out[k] > out[largest])
+				largest = k;
+		}
+		out[largest] += FILTER_ONE - sum;
+
+		f.offset[i] = base;
+	}
+}
+
+static void get_color_coefs(enum video_colorspace cs, double *kr, double *kb)
+{
+	if (cs == VIDEO_CS_709) {
+		*kr = 0.2126;
+		*kb = 0.0722;
+	} else {
+		*kr = 0.299;
+		*kb = 0.114;
+	}
+}
+
+static inline int32_t to_fixed(double v)
+{
+	return (int32_t)lrint(v * (1 << COEF_SHIFT));
+}
+
+static void build_rgb_to_yuv(struct video_scaler *s)
+{
+	double kr, kb;
+	get_color_coefs(s->dst.colorspace, &kr, &kb);
+	double kg = 1.0 - kr - kb;
+
+	bool full = s->dst.range == VIDEO_RANGE_FULL;
+	double ys = full ? 1.0 : 219.0 / 255.0;
+	double cs = full ? 1.0 : 224.0 / 255.0;
+
+	double y[3] = {kr * ys, kg * ys, kb * ys};
+	double u[3] = {-kr / (2.0 * (1.0 - kb)) * cs,
+			-kg / (2.0 * (1.0 - kb)) * cs, 0.5 * cs};
+	double v[3] = {0.5 * cs, -kg / (2.0 * (1.0 - kr)) * cs,
+			-kb / (2.0 * (1.0 - kr)) * cs};
+
+	/* source byte order is r, g, b unless the source is bgr */
+	bool bgr = s->src.format != VIDEO_FORMAT_RGBA;
+	for (int c = 0; c < 3; c++) {
+		int from = bgr ? 2 - c : c;
+		s->y_coefs[c] = (int16_t)to_fixed(y[from]);
+		s->u_coefs[c] = to_fixed(u[from]);
+		s->v_coefs[c] = to_fixed(v[from]);
+	}
+
+	s->y_offset = ((full ? 0 : 16) << COEF_SHIFT) + COEF_HALF;
+}
+
+static void build_yuv_to_rgb(struct video_scaler *s)
+{
+	double kr, kb;
+	get_color_coefs(s->src.colorspace, &kr, &kb);
+	double kg = 1.0 - kr - kb;
+
+	bool full = s->src.range == VIDEO_RANGE_FULL;
+	double ys = full ? 1.0 : 255.0 / 219.0;
+	double cs = full ? 1.0 : 255.0 / 224.0;
+
+	s->y_min = full ? 0 : 16;
+	s->ry    = to_fixed(ys);
+	s->rv    = to_fixed(2.0 * (1.0 - kr) * cs);
+	s->gu    = to_fixed(-2.0 * kb * (1.0 - kb) / kg * cs);
+	s->gv    = to_fixed(-2.0 * kr * (1.0 - kr) / kg * cs);
+	s->bu    = to_fixed(2.0 * (1.0 - kb) * cs);
+}
+
+/* ------------------------------------------------------------------------- */
+
+template <int C, int T>
+static void filter_columns(uint8_t *dst, const uint8_t *src,
+		const scale_filter &f, uint32_t width)
+{
+	const int taps = T ? T : f.taps;
+
+	for (uint32_t x = 0; x < width; x++) {
+		const uint8_t  *s = src + (size_t)f.offset[x] * C;
+		const uint16_t *w = &f.weights[(size_t)x * taps];
+		uint32_t acc[C];
+
+		for (int c = 0; c < C; c++)
+			acc[c] = FILTER_ONE / 2;
+		for (int k = 0; k < taps; k++)
+			for (int c = 0; c < C; c++)
+				acc[c] += (uint32_t)w[k] * s[k * C + c];
+		for (int c = 0; c < C; c++)
+			dst[x * C + c] = (uint8_t)(acc[c] >> FILTER_SHIFT);
+	}
+}
+
+/* the common tap counts get unrolled loops */
+template <int C>
+static void filter_columns(uint8_t *dst, const uint8_t *src,
+		const scale_filter &f, uint32_t width)
+{
+	switch (f.taps) {
+	case 2:  filter_columns<C, 2>(dst, src, f, width); break;
+	case 3:  filter_columns<C, 3>(dst, src, f, width); break;
+	default: filter_columns<C, 0>(dst, src, f, width); break;
+	}
+}
+
+/* one output row of a plane: vertical pass at source width into vtmp, then
+ * the horizontal pass into dst */
+static void scale_row(scaler_band &band, const scale_filter &fv,
+		const scale_filter &fh, const uint8_t *plane, uint32_t src_width,
+		int channels, uint8_t *dst, uint32_t dst_width, uint32_t y)
+{
+	size_t stride = (size_t)src_width * channels;
+	const uint8_t *rows[SCALER_MAX_TAPS];
+	const uint8_t *line;
+	int taps = fv.taps;
+
+	if (fv.identity) {
+		line = plane + (size_t)y * stride;
+	} else {
+		for (int k = 0; k < taps; k++)
+			rows[k] = plane + (size_t)(fv.offset[y] + k) * stride;
+		video_filter_rows(&band.vtmp[0], rows,
+				&fv.weights[(size_t)y * fv.taps], taps, stride);
+		line = &band.vtmp[0];
+	}
+
+	if (fh.identity) {
+		memcpy(dst, line, (size_t)dst_width * channels);
+		return;
+	}
+
+	switch (channels) {
+	case 1: filter_columns<1>(dst, line, fh, dst_width); break;
+	case 2: filter_columns<2>(dst, line, fh, dst_width); break;
+	case 4: filter_columns<4>(dst, line, fh, dst_width); break;
+	}
+}
+
+static inline void get_planes(const struct video_scale_info *info,
+		uint8_t *frame, uint8_t **y, uint8_t **u, uint8_t **v)
+{
+	size_t luma   = (size_t)info->width * info->height;
+	size_t chroma = (size_t)((info->width + 1) / 2) *
+			((info->height + 1) / 2);
+
+	*y = frame;
+	*u = frame + luma;
+	*v = info->format == VIDEO_FORMAT_I420 ? frame + luma + chroma : NULL;
+}
+
+static void scale_yuv(struct video_scaler *s, scaler_band &band)
+{
+	uint8_t *sy, *su, *sv, *dy, *du, *dv;
+	get_planes(&s->src, (uint8_t *)s->input, &sy, &su, &sv);
+	get_planes(&s->dst, s->output, &dy, &du, &dv);
+
+	for (uint32_t y = band.y0; y < band.y1; y++)
+		scale_row(band, s->luma_v, s->luma_h, sy, s->src.width, 1,
+				dy + (size_t)y * s->dst.width, s->dst.width, y);
+
+	uint32_t c0 = band.y0 / 2;
+	uint32_t c1 = (band.y1 + 1) / 2;
+	uint32_t cw = s->dst_cw;
+
+	for (uint32_t y = c0; y < c1 && y < s->dst_ch; y++) {
+		size_t row = (size_t)y * cw;
+
+		if (!sv) {
+			/* nv12 source, chroma stays interleaved while scaling */
+			if (!dv) {
+				scale_row(band, s->chroma_v, s->chroma_h, su, s->src_cw, 2,
+						du + row * 2, cw, y);
+			} else {
+				uint8_t *tmp = &band.chroma[0][0];
+				scale_row(band, s->chroma_v, s->chroma_h, su, s->src_cw, 2,
+						tmp, cw, y);
+				video_deinterleave_uv(du + row, dv + row, tmp, cw);
+			}
+		} else {
+			uint8_t *u = dv ? du + row : &band.chroma[0][0];
+			uint8_t *v = dv ? dv + row : &band.chroma[1][0];
+
+			scale_row(band, s->chroma_v, s->chroma_h, su, s->src_cw, 1,
+					u, cw, y);
+			scale_row(band, s->chroma_v, s->chroma_h, sv, s->src_cw, 1,
+					v, cw, y);
+			if (!dv)
+				video_interleave_uv(du + row * 2, u, v, cw);
+		}
+	}
+}
+
+static void scale_rgb(struct video_scaler *s, scaler_band &band)
+{
+	for (uint32_t y = band.y0; y < band.y1; y++) {
+		uint8_t *dst = s->output + (size_t)y * s->dst.width * 4;
+
+		scale_row(band, s->luma_v, s->luma_h, s->input, s->src.width, 4,
+				dst, s->dst.width, y);
+
+		if (s->swap_rb) {
+			for (uint32_t x = 0; x < s->dst.width; x++) {
+				uint8_t t      = dst[x * 4];
+				dst[x * 4]     = dst[x * 4 + 2];
+				dst[x * 4 + 2] = t;
+			}
+		}
+	}
+}
+
+static inline uint8_t rgb_to_chroma(const int32_t *coefs, const uint8_t *a,
+		const uint8_t *b, const uint8_t *c, const uint8_t *d)
+{
+	int32_t sum = 0;
+	for (int k = 0; k < 3; k++)
+		sum += coefs[k] * ((a[k] + b[k] + c[k] + d[k] + 2) >> 2);
+	return clamp_byte((sum + (128 << COEF_SHIFT) + COEF_HALF) >> COEF_SHIFT);
+}
+
+static void scale_rgb_to_yuv(struct video_scaler *s, scaler_band &band)
+{
+	uint8_t *dy, *du, *dv;
+	get_planes(&s->dst, s->output, &dy, &du, &dv);
+
+	uint32_t width = s->dst.width;
+
+	for (uint32_t y = band.y0; y < band.y1; y += 2) {
+		uint8_t *r0 = &band.rows[0][0];
+		uint8_t *r1 = &band.rows[1][0];
+		bool pair = y + 1 < s->dst.height;
+
+		scale_row(band, s->luma_v, s->luma_h, s->input, s->src.width, 4,
+				r0, width, y);
+		video_rgb_to_luma(dy + (size_t)y * width, r0, s->y_coefs,
+				s->y_offset, width);
+
+		if (pair) {
+			scale_row(band, s->luma_v, s->luma_h, s->input, s->src.width,
+					4, r1, width, y + 1);
+			video_rgb_to_luma(dy + (size_t)(y + 1) * width, r1,
+					s->y_coefs, s->y_offset, width);
+		} else {
+			r1 = r0;
+		}
+
+		size_t row = (size_t)(y / 2) * s->dst_cw;
+
+		for (uint32_t x = 0; x < s->dst_cw; x++) {
+			uint32_t x0 = x * 2;
+			uint32_t x1 = x0 + 1 < width ? x0 + 1 : x0;
+			const uint8_t *a = r0 + x0 * 4, *b = r0 + x1 * 4;
+			const uint8_t *c = r1 + x0 * 4, *d = r1 + x1 * 4;
+			uint8_t u = rgb_to_chroma(s->u_coefs, a, b, c, d);
+			uint8_t v = rgb_to_chroma(s->v_coefs, a, b, c, d);
+
+			if (dv) {
+				du[row + x] = u;
+				dv[row + x] = v;
+			} else {
+				du[(row + x) * 2]     = u;
+				du[(row + x) * 2 + 1] = v;
+			}
+		}
+	}
+}
+
+static void scale_yuv_to_rgb(struct video_scaler *s, scaler_band &band)
+{
+	uint8_t *sy, *su, *sv;
+	get_planes(&s->src, (uint8_t *)s->input, &sy, &su, &sv);
+
+	bool bgr = s->dst.format != VIDEO_FORMAT_RGBA;
+	uint32_t width = s->dst.width;
+	uint32_t cw = s->dst_cw;
+	uint8_t *yrow = &band.rows[0][0];
+	uint8_t *urow = &band.chroma[0][0];
+	uint8_t *vrow = &band.chroma[1][0];
+	uint8_t *uvrow = &band.rows[1][0];
+
+	for (uint32_t y = band.y0; y < band.y1; y++) {
+		if (y == band.y0 || !(y & 1)) {
+			if (sv) {
+				scale_row(band, s->chroma_v, s->chroma_h, su, s->src_cw, 1,
+						urow, cw, y / 2);
+				scale_row(band, s->chroma_v, s->chroma_h, sv, s->src_cw, 1,
+						vrow, cw, y / 2);
+			} else {
+				scale_row(band, s->chroma_v, s->chroma_h, su, s->src_cw, 2,
+						uvrow, cw, y / 2);
+				video_deinterleave_uv(urow, vrow, uvrow, cw);
+			}
+		}
+
+		scale_row(band, s->luma_v, s->luma_h, sy, s->src.width, 1, yrow,
+				width, y);
+
+		uint8_t *dst = s->output + (size_t)y * width * 4;
+
+		for (uint32_t x = 0; x < width; x++) {
+			int32_t l = (yrow[x] - s->y_min) * s->ry + COEF_HALF;
+			int32_t u = urow[x / 2] - 128;
+			int32_t v = vrow[x / 2] - 128;
+			uint8_t r = clamp_byte((l + s->rv * v) >> COEF_SHIFT);
+			uint8_t g = clamp_byte((l + s->gu * u + s->gv * v) >> COEF_SHIFT);
+			uint8_t b = clamp_byte((l + s->bu * u) >> COEF_SHIFT);
+
+			dst[x * 4]     = bgr ? b : r;
+			dst[x * 4 + 1] = g;
+			dst[x * 4 + 2] = bgr ? r : b;
+			dst[x * 4 + 3] = 255;
+		}
+	}
+}
+
+static void scale_band(struct video_scaler *s, scaler_band &band)
+{
+	switch (s->path) {
+	case PATH_YUV:        scale_yuv(s, band); break;
+	case PATH_RGB:        scale_rgb(s, band); break;
+	case PATH_RGB_TO_YUV: scale_rgb_to_yuv(s, band); break;
+	case PATH_YUV_TO_RGB: scale_yuv_to_rgb(s, band); break;
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void *scaler_thread(void *param)
+{
+	scaler_worker *w = (scaler_worker *)param;
+	struct video_scaler *s = w->scaler;
+
+	os_set_thread_name("video-io: scaler thread");
+
+	for (;;) {
+		os_sem_wait(w->start);
+		if (s->exit)
+			break;
+
+		scale_band(s, w->band);
+		os_sem_post(s->done);
+	}
+
+	return NULL;
+}
+
+static void init_band(struct video_scaler *s, scaler_band &band)
+{
+	uint32_t src_w = s->src.width > s->dst.width ? s->src.width : s->dst.width;
+
+	band.vtmp.resize((size_t)src_w * 4);
+	band.rows[0].resize((size_t)s->dst.width * 4);
+	band.rows[1].resize((size_t)s->dst.width * 4);
+	band.chroma[0].resize((size_t)s->dst_cw * 2);
+	band.chroma[1].resize((size_t)s->dst_cw * 2);
+}
+
+static void stop_workers(struct video_scaler *s)
+{
+	s->exit = true;
+
+	for (size_t i = 0; i < s->workers.size(); i++) {
+		scaler_worker *w = s->workers[i];
+		os_sem_post(w->start);
+		pthread_join(w->thread, NULL);
+		os_sem_destroy(w->start);
+		delete w;
+	}
+
+	s->workers.clear();
+	if (s->done)
+		os_sem_destroy(s->done);
+	s->done = NULL;
+}
+
+static void start_workers(struct video_scaler *s)
+{
+	size_t src_pixels = (size_t)s->src.width * s->src.height;
+	size_t dst_pixels = (size_t)s->dst.width * s->dst.height;
+	int threads = os_get_logical_cores();
+
+	if (threads > SCALER_MAX_THREADS)
+		threads = SCALER_MAX_THREADS;
+	if (s->dst.height < (uint32_t)threads * 16)
+		threads = 1;
+	if (src_pixels < SCALER_THREAD_MIN_PIXELS &&
+		dst_pixels < SCALER_THREAD_MIN_PIXELS)
+		threads = 1;
+	if (threads < 2 || os_sem_init(&s->done, 0) != 0)
+		return;
+
+	for (int i = 1; i < threads; i++) {
+		scaler_worker *w = new scaler_worker();
+		w->scaler = s;
+		init_band(s, w->band);
+
+		if (os_sem_init(&w->start, 0) != 0) {
+			delete w;
+			break;
+		}
+		if (pthread_create(&w->thread, NULL, scaler_thread, w) != 0) {
+			os_sem_destroy(w->start);
+			delete w;
+			break;
+		}
+		s->workers.push_back(w);
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+
+video_scaler_t *video_scaler_create(const struct video_scale_info *dst,
+		const struct video_scale_info *src, enum video_scale_type type)
+{
+	bool src_yuv = video_format_is_yuv420(src->format);
+	bool dst_yuv = video_format_is_yuv420(dst->format);
+
+	if (!video_get_frame_size(src->format, src->width, src->height) ||
+		!video_get_frame_size(dst->format, dst->width, dst->height))
+		return NULL;
+
+	/* keeps the area filter within the row pointers scale_row has room for */
+	if (src->width > dst->width * SCALER_MAX_RATIO ||
+		src->height > dst->height * SCALER_MAX_RATIO)
+		return NULL;
+
+	struct video_scaler *s = new video_scaler();
+	s->src    = *src;
+	s->dst    = *dst;
+	s->src_cw = (src->width + 1) / 2;
+	s->src_ch = (src->height + 1) / 2;
+	s->dst_cw = (dst->width + 1) / 2;
+	s->dst_ch = (dst->height + 1) / 2;
+	s->done   = NULL;
+	s->exit   = false;
+
+	if (src_yuv && dst_yuv)
+		s->path = PATH_YUV;
+	else if (!src_yuv && !dst_yuv)
+		s->path = PATH_RGB;
+	else if (dst_yuv)
+		s->path = PATH_RGB_TO_YUV;
+	else
+		s->path = PATH_YUV_TO_RGB;
+
+	s->swap_rb = s->path == PATH_RGB &&
+			(src->format == VIDEO_FORMAT_RGBA) !=
+			(dst->format == VIDEO_FORMAT_RGBA);
+
+	bool area = type == VIDEO_SCALE_AREA || type == VIDEO_SCALE_DEFAULT;
+	build_filter(s->luma_h, src->width, dst->width, area);
+	build_filter(s->luma_v, src->height, dst->height, area);
+	build_filter(s->chroma_h, s->src_cw, s->dst_cw, area);
+	build_filter(s->chroma_v, s->src_ch, s->dst_ch, area);
+
+	if (s->path == PATH_RGB_TO_YUV)
+		build_rgb_to_yuv(s);
+	else if (s->path == PATH_YUV_TO_RGB)
+		build_yuv_to_rgb(s);
+
+	init_band(s, s->main_band);
+	start_workers(s);
+	return s;
+}
+
+void video_scaler_destroy(video_scaler_t *scaler)
+{
+	if (!scaler)
+		return;
+
+	stop_workers(scaler);
+	delete scaler;
+}
+
+bool video_scaler_scale(video_scaler_t *s, std::vector<uint8_t> &output,
+		const uint8_t *input, size_t input_size)
+{
+	if (!s || !input ||
+		input_size < video_get_frame_size(s->src.format, s->src.width,
+				s->src.height))
+		return false;
+
+	output.resize(video_get_frame_size(s->dst.format, s->dst.width,
+			s->dst.height));
+
+	s->input  = input;
+	s->output = &output[0];
+
+	/* bands start on even rows so each owns whole chroma rows */
+	uint32_t bands = (uint32_t)s->workers.size() + 1;
+	uint32_t rows  = ((s->dst.height + bands - 1) / bands + 1) & ~1u;
+	uint32_t y     = rows;
+
+	for (size_t i = 0; i < s->workers.size(); i++) {
+		scaler_band &band = s->workers[i]->band;
+		band.y0 = y < s->dst.height ? y : s->dst.height;
+		band.y1 = y + rows < s->dst.height ? y + rows : s->dst.height;
+		y += rows;
+		os_sem_post(s->workers[i]->start);
+	}
+
+	s->main_band.y0 = 0;
+	s->main_band.y1 = rows < s->dst.height ? rows : s->dst.height;
+	scale_band(s, s->main_band);
+
+	for (size_t i = 0; i < s->workers.size(); i++)
+		os_sem_wait(s->done);
+
+	return true;
+}
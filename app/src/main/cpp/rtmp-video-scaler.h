@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#include "rtmp-struct.h"
+
+enum video_scale_type {
+	VIDEO_SCALE_DEFAULT,  /* area when shrinking, bilinear otherwise */
+	VIDEO_SCALE_BILINEAR,
+	VIDEO_SCALE_AREA,
+};
+
+/* Converts between NV12, I420, RGBA and BGRA/BGRX and resizes in the same
+ * pass. Frames are tightly packed with their planes stored back to back.
+ * Large frames are split by rows across worker threads. */
+video_scaler_t *video_scaler_create(const struct video_scale_info *dst,
+		const struct video_scale_info *src, enum video_scale_type type);
+void video_scaler_destroy(video_scaler_t *scaler);
+
+bool video_scaler_scale(video_scaler_t *scaler, std::vector<uint8_t> &output,
+		const uint8_t *input, size_t input_size);
+
+size_t video_get_frame_size(enum video_format format, uint32_t width,
+		uint32_t height);
+bool video_format_is_yuv420(enum video_format format);
+bool video_format_is_rgb(enum video_format format);
+
+/* SIMD kernels shared by the scaler. filter_rows weights sum to 256. */
+void video_filter_rows(uint8_t *dst, const uint8_t *const *rows,
+		const uint16_t *weights, int taps, size_t count);
+void video_rgb_to_luma(uint8_t *dst, const uint8_t *src, const int16_t *coefs,
+		int32_t offset, size_t count);
+void video_interleave_uv(uint8_t *uv, const uint8_t *u, const uint8_t *v,
+		size_t count);
+void video_deinterleave_uv(uint8_t *u, uint8_t *v, const uint8_t *uv,
+		size_t count);
@@ -2,12 +2,13 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <algorithm>
 #include "util/platform.h"
 #include "util/serializer.h"
 #include "util/array-serializer.h"
 # include "rtmp-encoder.h"
-#include "rtmp-serialize-byte.h"
 #include "rtmp-video-output.h"
+#include "rtmp-video-bitstream.h"
 
 #ifndef _STDINT_H_INCLUDED
 #define _STDINT_H_INCLUDED
@@ -22,9 +23,30 @@
 
 //#define ENABLE_VFR
 
+/* how far vfr timestamps may run ahead of the time that has really passed
+ * since the first frame, which catches steps in the capture clock without
+ * squeezing the long gaps a static screen legitimately produces */
+#define VFR_MAX_LEAD_MS 500
+
+/* pts units per frame, so frame times can be slewed by a fraction of a
+ * frame when correcting drift */
+#define VIDEO_TIMEBASE_SCALE 100
+
 static void receive_video(void *param, struct media_data *frame);
 
 X264Encoder::X264Encoder():
+vfr(false),
+reorder_frames(-1),
+active_reorder(0),
+sent_frames(0),
+vfr_start_wall(0),
+drift_start_ts(0),
+drift_frames(0),
+last_frame_ts(0),
+decoded_frames(0),
+first_pts(0),
+last_dts(0),
+reorder_warned(false),
 preferred_format(VIDEO_FORMAT_NONE),
 scaled_width(0),
 scaled_height(0)
@@ -56,8 +78,14 @@ void X264Encoder::set_video(std::shared_ptr<media_output> &video)
 	        std::dynamic_pointer_cast<VideoOutput>(video)->get_info();
 
 	media        = video;
-	timebase_num = voi->fps_den;
-	timebase_den = voi->fps_num;
+
+	if (vfr) {
+		timebase_num = 1;
+		timebase_den = MILLISECOND_DEN;
+	} else {
+		timebase_num = voi->fps_den * VIDEO_TIMEBASE_SCALE;
+		timebase_den = voi->fps_num * VIDEO_TIMEBASE_SCALE;
+	}
 }
 
 uint32_t X264Encoder::get_width()
@@ -98,14 +126,14 @@ bool X264Encoder::encode(encoder_frame &frame,
 	received_packet = (frame.frames != 0);
 	if (frame.frames){
 
-		int frameType = frame.data[4] & 0x1F;
-
 		packet.data		     = frame.data;
 		packet.type          = OBS_ENCODER_VIDEO;
 		packet.pts           = frame.pts;
-		packet.dts           = frame.pts;
-		packet.keyframe      = frameType == OBS_NAL_SLICE_IDR;
-		LOGI("X264Encoder------------------- packet size : %d",packet.data.size());
+		packet.dts           = active_reorder ? get_dts(frame.pts) : frame.pts;
+		packet.keyframe      = video_bitstream_is_keyframe(get_codec_id(),
+				&frame.data[0], frame.data.size());
+		packet.fourcc        = get_fourcc();
+		LOGD("X264Encoder------------------- packet size : %d",packet.data.size());
 	}
 
 	return true;
@@ -124,10 +152,17 @@ std::vector<uint8_t> X264Encoder::get_encode_header()
 {
     std::vector<uint8_t> data;
     get_extra_data(data);
+    return data;
+}
 
-    std::vector<uint8_t> header;
-    header = parse_header(data);
-    return header;
+enum video_codec X264Encoder::get_codec_id()
+{
+	return video_codec_from_name(codec);
+}
+
+uint32_t X264Encoder::get_fourcc()
+{
+	return video_codec_fourcc(get_codec_id());
 }
 
 bool X264Encoder::get_sei_data(std::vector<uint8_t> &sei_data)
@@ -150,34 +185,35 @@ void X264Encoder::get_info(video_scale_info &info)
 	info.format = pref_format;
 }
 
-void X264Encoder::load_headers()
+/* csd-0 and csd-1 back to back, h264 splits sps and pps over the two,
+ * hevc puts all parameter sets in csd-0 and av1 its av1C */
+void X264Encoder::get_codec_config(std::vector<uint8_t> &config)
 {
     std::shared_ptr<VideoOutput> video =
             std::dynamic_pointer_cast<VideoOutput>(media.lock());
+
+	config.clear();
 	if(!video)
 		return;
 
-	int	csdsize0 = video->format_csd0.size()-4;
-	int	csdsize1 = video->format_csd1.size()-4;
-
-	extra_data.resize(11 + csdsize0 + csdsize1,0);
-	memcpy(&extra_data[8], (void*)&video->format_csd0[4], csdsize0);
-	memcpy(&extra_data[11+csdsize0], (void*)&video->format_csd1[4], csdsize1);
+	config.insert(config.end(), video->format_csd0.begin(),
+			video->format_csd0.end());
+	config.insert(config.end(), video->format_csd1.begin(),
+			video->format_csd1.end());
+}
 
-	extra_data[0] = 0x01;
-	extra_data[1] = extra_data[9];
-	extra_data[2] = extra_data[10];
-	extra_data[3] = extra_data[11];
-	extra_data[4] =  0xFF;
+void X264Encoder::load_headers()
+{
+	std::vector<uint8_t> config;
 
-	extra_data[5] = 0xE1;
-	extra_data[6] = ((csdsize0 >> 8) & 0xFF);
-	extra_data[7] = ((csdsize0) & 0xFF);
+	get_codec_config(config);
+	if (config.empty())
+		return;
 
-	int pos = 8 + csdsize0;
-	extra_data[pos] = 0x01;
-	extra_data[pos+1] = ((csdsize1 >> 8) & 0xFF);
-	extra_data[pos+2] = ((csdsize1) & 0xFF);
+	if (!video_bitstream_make_config(get_codec_id(), &config[0],
+			config.size(), extra_data))
+		LOGI("X264Encoder: no usable %s decoder configuration in csd",
+				codec.c_str());
 }
 
 bool X264Encoder::valid_format(enum video_format format)
@@ -257,190 +293,219 @@ static void receive_video(void *param, struct media_data *frame)
 
 	enc_frame.data    = frame->data;
 
-	if (!encoder->start_ts)
+	if (!encoder->start_ts) {
 		encoder->start_ts = frame->timestamp;
+		encoder->drift.reset();
+		encoder->drift_corrected_ns = 0;
+		encoder->sent_frames = 0;
+		encoder->last_frame_ts = 0;
+		encoder->vfr_start_wall = os_gettime_ns();
+		encoder->reset_reorder();
+	}
 
 	enc_frame.frames = 1;
-	enc_frame.pts    = encoder->cur_pts;
+	if (encoder->active_reorder)
+		enc_frame.pts = encoder->get_capture_pts(frame->timestamp);
+	else if (encoder->vfr)
+		enc_frame.pts = encoder->get_vfr_pts(frame->timestamp);
+	else
+		enc_frame.pts = encoder->cur_pts;
 
 	encoder->do_encode(enc_frame);
 
-	encoder->cur_pts += encoder->timebase_num;
+	if (encoder->active_reorder)
+		encoder->cur_pts = std::max(encoder->cur_pts, enc_frame.pts + 1);
+	else if (encoder->vfr)
+		encoder->cur_pts = enc_frame.pts + 1;
+	else
+		encoder->advance_pts(frame->timestamp);
 }
 
-void X264Encoder::on_initialize_internal()
+/* With b-frames, frames arrive in decode order and their capture times are
+ * the only record of display order, so pts is taken from them as is. No
+ * monotonic clamp or drift slewing, both would scramble the order. */
+int64_t X264Encoder::get_capture_pts(uint64_t timestamp)
 {
+	int64_t elapsed = (int64_t)timestamp - (int64_t)start_ts;
+	int64_t units = elapsed * (int64_t)timebase_den;
 
+	/* round to the nearest pts unit either side of zero */
+	units += elapsed < 0 ? -500000000LL : 500000000LL;
+	sent_frames++;
+	return units / 1000000000LL;
 }
 
-enum video_format X264Encoder::get_preferred_video_format()
+void X264Encoder::reset_reorder()
 {
-	if (type != OBS_ENCODER_VIDEO)
-		return VIDEO_FORMAT_NONE;
-
-	return preferred_format;
+	while (!reorder_pts.empty())
+		reorder_pts.pop();
+
+	decoded_frames = 0;
+	first_pts      = 0;
+	last_dts       = 0;
+	reorder_warned = false;
+	active_reorder = detect_reorder_frames();
+
+	if (active_reorder)
+		LOGI("X264Encoder: reordering %d frame(s), rebuilding dts",
+				active_reorder);
 }
 
-std::vector<uint8_t> X264Encoder::parse_header(const std::vector<uint8_t> &data)
+int X264Encoder::detect_reorder_frames()
 {
-    SerializeByte serialize_byte;
-	const uint8_t *sps = NULL, *pps = NULL;
-	size_t sps_size = 0, pps_size = 0;
-
-    std::vector<uint8_t> header;
-    do{
-        if (data.size() <= 6)
-            break;
+	std::vector<uint8_t> config;
 
-        if (!has_start_code(&data[0])) {
-            header = data;
-            break;
-        }
+	if (reorder_frames >= 0)
+		return reorder_frames;
 
-        get_sps_pps(&data[0], data.size(), &sps, &sps_size, &pps, &pps_size);
-        if (!sps || !pps || sps_size < 4)
-            break;
+	get_codec_config(config);
+	if (config.empty())
+		return 0;
 
-        serialize_byte.write_uint8(0x01);
-        serialize_byte.write(sps+1, 3);
-        serialize_byte.write_uint8(0xff);
-        serialize_byte.write_uint8(0xe1);
+	int reorder = video_bitstream_reorder_frames(get_codec_id(), &config[0],
+			config.size());
+	return reorder > 0 ? reorder : 0;
+}
 
-        serialize_byte.write_uint16((uint16_t)sps_size);
-        serialize_byte.write(sps, sps_size);
-        serialize_byte.write_uint8(0x01);
-        serialize_byte.write_uint16((uint16_t)pps_size);
-        serialize_byte.write(pps, pps_size);
-        header = serialize_byte.GetDataByte();
+int64_t X264Encoder::get_frame_duration()
+{
+	if (!vfr)
+		return timebase_num;
 
-    }while(false);
+	std::shared_ptr<VideoOutput> video =
+			std::dynamic_pointer_cast<VideoOutput>(media.lock());
+	const video_output_info *voi = video ? video->get_info() : NULL;
 
-    return header;
+	if (!voi || !voi->fps_num)
+		return 1;
+	return std::max<int64_t>(1, (int64_t)voi->fps_den * MILLISECOND_DEN /
+			voi->fps_num);
 }
 
-void X264Encoder::get_sps_pps(const uint8_t *data, size_t size,
-						const uint8_t **sps, size_t *sps_size,
-						const uint8_t **pps, size_t *pps_size)
+/* Rebuilds dts from pts for a stream with active_reorder frames of delay.
+ * The first frames get dts stepped back from the first pts, after that each
+ * frame takes the smallest pts still waiting, which is the next frame in
+ * display order. dts then never passes pts and is strictly increasing. */
+int64_t X264Encoder::get_dts(int64_t pts)
 {
-	const uint8_t *nal_start, *nal_end;
-	const uint8_t *end = data+size;
-	int type;
-
-	nal_start = find_startcode(data, end);
-	while (true) {
-		while (nal_start < end && !*(nal_start++));
-
-		if (nal_start == end)
-			break;
-
-		nal_end = find_startcode(nal_start, end);
-
-		type = nal_start[0] & 0x1F;
-		if (type == OBS_NAL_SPS) {
-			*sps = nal_start;
-			*sps_size = nal_end - nal_start;
-		} else if (type == OBS_NAL_PPS) {
-			*pps = nal_start;
-			*pps_size = nal_end - nal_start;
-		}
+	int64_t dts;
+
+	reorder_pts.push(pts);
+
+	if (decoded_frames < active_reorder) {
+		if (!decoded_frames)
+			first_pts = pts;
+		dts = first_pts - (active_reorder - decoded_frames) *
+				get_frame_duration();
+	} else {
+		dts = reorder_pts.top();
+		reorder_pts.pop();
+	}
+
+	if (decoded_frames && dts <= last_dts)
+		dts = last_dts + 1;
 
-		nal_start = nal_end;
+	if (dts > pts && !reorder_warned) {
+		LOGI("X264Encoder: dts passed pts, stream reorders more than %d "
+				"frame(s)", active_reorder);
+		reorder_warned = true;
 	}
+
+	decoded_frames++;
+	last_dts = dts;
+	return dts;
 }
 
-const uint8_t * X264Encoder::find_startcode(const uint8_t *p, const uint8_t *end)
+/* pts in ms straight from capture time, kept strictly increasing. Audio is
+ * trimmed to the same start_ts, so the two stay aligned however unevenly
+ * frames arrive. */
+int64_t X264Encoder::get_vfr_pts(uint64_t timestamp)
 {
-	const uint8_t *out= ff_avc_find_startcode_internal(p, end);
-	if (p < out && out < end && !out[-1]) out--;
-	return out;
+	int64_t pts = timestamp > start_ts ?
+			(int64_t)((timestamp - start_ts) / 1000000) : 0;
+	int64_t limit = (int64_t)((os_gettime_ns() - vfr_start_wall) / 1000000) +
+			VFR_MAX_LEAD_MS;
+
+	if (pts > limit)
+		pts = limit;
+	if (pts < cur_pts)
+		pts = cur_pts;
+
+	sent_frames++;
+	return pts;
 }
 
-const uint8_t * X264Encoder::ff_avc_find_startcode_internal(const uint8_t *p,
-													 const uint8_t *end)
+/* frames keep their nominal duration unless the capture clock has drifted
+ * more than half the bound away, in which case each frame is stretched or
+ * shortened by one pts unit until it is back. Only frames arriving at the
+ * frame rate say anything about the clock: a screen that sends frames on
+ * change falls behind the frame count when it is static, so a gap or a
+ * burst restarts the estimate instead of being slewed towards. */
+void X264Encoder::advance_pts(uint64_t timestamp)
 {
-	const uint8_t *a = p + 4 - ((intptr_t)p & 3);
-
-	for (end -= 3; p < a && p < end; p++) {
-		if (p[0] == 0 && p[1] == 0 && p[2] == 1)
-			return p;
+	int64_t step = timebase_num;
+	uint64_t frame_ns = (uint64_t)timebase_num * 1000000000ULL / timebase_den;
+	uint64_t interval = timestamp - last_frame_ts;
+	bool steady = last_frame_ts && timestamp > last_frame_ts &&
+			interval >= frame_ns / 2 && interval <= frame_ns * 3 / 2;
+
+	if (!steady) {
+		drift.reset();
+		drift_corrected_ns = 0;
+		drift_start_ts = timestamp;
+		drift_frames = 0;
 	}
 
-	for (end -= 3; p < end; p += 4) {
-		uint32_t x = *(const uint32_t*)p;
-
-		if ((x - 0x01010101) & (~x) & 0x80808080) {
-			if (p[1] == 0) {
-				if (p[0] == 0 && p[2] == 1)
-					return p;
-				if (p[2] == 0 && p[3] == 1)
-					return p+1;
-			}
-
-			if (p[3] == 0) {
-				if (p[2] == 0 && p[4] == 1)
-					return p+2;
-				if (p[4] == 0 && p[5] == 1)
-					return p+3;
-			}
-		}
-	}
+	drift.update(timestamp - drift_start_ts, drift_frames * frame_ns);
+	drift_frames++;
+	last_frame_ts = timestamp;
+	sent_frames++;
+
+	if (drift.settled()) {
+		int64_t residual = drift.get_drift_ns() - drift_corrected_ns;
+		int64_t unit = timebase_num / VIDEO_TIMEBASE_SCALE;
+
+		if (residual > DRIFT_BOUND_NS / 2)
+			step += unit;
+		else if (residual < -DRIFT_BOUND_NS / 2)
+			step -= unit;
 
-	for (end += 3; p < end; p++) {
-		if (p[0] == 0 && p[1] == 0 && p[2] == 1)
-			return p;
+		drift_corrected_ns += (step - (int64_t)timebase_num) *
+				1000000000LL / timebase_den;
 	}
 
-	return end + 3;
+	cur_pts += step;
 }
 
-bool  X264Encoder::has_start_code(const uint8_t *data)
+void X264Encoder::on_initialize_internal()
 {
-	if (data[0] != 0 || data[1] != 0)
-		return false;
 
-	return data[2] == 1 || (data[2] == 0 && data[3] == 1);
 }
 
-encoder_packet X264Encoder::parse_avc_packet(encoder_packet &src)
+enum video_format X264Encoder::get_preferred_video_format()
 {
-    SerializeByte serialize_byte;
-	encoder_packet avc_packet = src;
+	if (type != OBS_ENCODER_VIDEO)
+		return VIDEO_FORMAT_NONE;
 
-	serialize_avc_data(serialize_byte,&src.data[0], src.data.size(),
-	        &avc_packet.keyframe, &avc_packet.priority);
-    avc_packet.drop_priority = avc_packet.priority;
-    avc_packet.data = serialize_byte.GetDataByte();
-    return avc_packet;
+	return preferred_format;
 }
 
-void X264Encoder::serialize_avc_data(SerializeByte &s, const uint8_t *data,
-							   size_t size, bool *is_keyframe, int *priority)
+encoder_packet X264Encoder::parse_packet(encoder_packet &src)
 {
-	const uint8_t *nal_start, *nal_end;
-	const uint8_t *end = data+size;
-	int type;
-
-	nal_start = find_startcode(data, end);
-	while (true) {
-		while (nal_start < end && !*(nal_start++));
+	encoder_packet out;
+	std::vector<uint8_t> data;
 
-		if (nal_start == end)
-			break;
+	/* copy everything but the payload, which gets rewritten anyway */
+	data.swap(src.data);
+	out = src;
+	src.data.swap(data);
 
-		type = nal_start[0] & 0x1F;
+	if (src.data.empty())
+		return out;
 
-		if (type == OBS_NAL_SLICE_IDR || type == OBS_NAL_SLICE) {
-			if (is_keyframe)
-				*is_keyframe = (type == OBS_NAL_SLICE_IDR);
-			if (priority)
-				*priority = nal_start[0] >> 5;
-		}
-
-		nal_end = find_startcode(nal_start, end);
-        s.write_uint32((uint32_t)(nal_end - nal_start));
-        s.write(nal_start, nal_end - nal_start);
-		nal_start = nal_end;
-	}
+	video_bitstream_packetize(video_codec_from_fourcc(src.fourcc),
+			&src.data[0], src.data.size(), out.data, &out.keyframe,
+			&out.priority);
+	out.drop_priority = out.priority;
+	return out;
 }
-
-
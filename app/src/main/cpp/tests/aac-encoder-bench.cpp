@@ -0,0 +1,82 @@
+/*
+ * Realtime factor of AacLcEncoder per sample rate and channel count on
+ * music-like input, i.e. seconds of audio coded per second of cpu.
+ *
+ *   aac-encoder-bench [seconds of audio]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+
+#include "rtmp-aac-encoder.h"
+
+static double now_sec()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv)
+{
+	static const uint32_t rates[] = {16000, 22050, 24000, 32000, 44100, 48000};
+	double seconds = argc > 1 ? atof(argv[1]) : 10.0;
+
+	printf("%8s %3s %6s %10s\n", "rate", "ch", "kbps", "realtime");
+
+	for (size_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+		for (uint32_t ch = 1; ch <= 2; ch++) {
+			uint32_t rate = rates[r];
+			uint32_t bitrate = 64000 * ch;
+
+			AacLcEncoder enc;
+			if (!enc.open(rate, ch, bitrate)) {
+				printf("%8u %3u failed to open\n", rate, ch);
+				return 1;
+			}
+
+			/* a few partials with vibrato and noise, so block switching
+			 * and the rate control both have work to do */
+			size_t frames = (size_t)(rate * seconds);
+			frames -= frames % AAC_FRAME_SAMPLES;
+			std::vector<float> pcm(frames * ch);
+			unsigned seed = 1;
+			for (size_t i = 0; i < frames; i++) {
+				double t = (double)i / rate;
+				double v = 0.0;
+				for (int k = 1; k <= 6; k++)
+					v += 0.08 / k * sin(2 * M_PI * 196.0 * k * t *
+							(1.0 + 0.003 * sin(2 * M_PI * 5 * t)));
+				if (fmod(t, 0.5) < 0.01)
+					v *= 3.0;
+				for (uint32_t c = 0; c < ch; c++) {
+					seed = seed * 1103515245 + 12345;
+					float noise = ((seed >> 9) & 0xFFFF) / 65536.0f - 0.5f;
+					pcm[i * ch + c] = (float)v + 0.02f * noise;
+				}
+			}
+
+			std::vector<uint8_t> packet;
+			size_t bytes = 0, packets = 0;
+			double start = now_sec();
+			for (size_t k = 0; k < frames; k += AAC_FRAME_SAMPLES) {
+				if (enc.encode(&pcm[k * ch], AAC_FRAME_SAMPLES * ch, NULL, 0,
+						packet)) {
+					bytes += packet.size();
+					packets++;
+				}
+			}
+			double elapsed = now_sec() - start;
+
+			double audio = (double)frames / rate;
+			double kbps = packets ? bytes * 8.0 /
+					(packets * (double)AAC_FRAME_SAMPLES / rate) / 1000.0 : 0;
+			printf("%8u %3u %6.1f %9.1fx\n", rate, ch, kbps, audio / elapsed);
+		}
+	}
+
+	return 0;
+}
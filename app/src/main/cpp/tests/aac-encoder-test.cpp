@@ -0,0 +1,249 @@
+/*
+ * Encodes synthetic signals with AacLcEncoder, decodes them with ffmpeg and
+ * checks the decoder accepts every frame, the delay is the documented one
+ * and the signal to noise ratio is sane for the bitrate.
+ *
+ *   aac-encoder-test <ffmpeg>
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "rtmp-aac-encoder.h"
+
+#define TEST_SECONDS 3
+
+enum signal_kind {
+	SIGNAL_TONE,
+	SIGNAL_MULTITONE,
+	SIGNAL_CHIRP,
+	SIGNAL_CLICKS,
+};
+
+static const char *signal_names[] = {"tone", "multitone", "chirp", "clicks"};
+
+struct test_case {
+	enum signal_kind kind;
+	uint32_t         sample_rate;
+	uint32_t         channels;
+	uint32_t         bitrate;
+	double           min_snr_db;
+};
+
+static const test_case cases[] = {
+	{SIGNAL_TONE,      48000, 1,  64000, 22.0},
+	{SIGNAL_TONE,      44100, 2, 128000, 24.0},
+	{SIGNAL_MULTITONE, 48000, 2, 128000, 28.0},
+	{SIGNAL_MULTITONE, 32000, 1,  48000, 28.0},
+	{SIGNAL_CHIRP,     44100, 2, 128000, 35.0},
+	{SIGNAL_CHIRP,     22050, 1,  32000, 30.0},
+	{SIGNAL_CLICKS,    48000, 2, 128000, 28.0},
+	{SIGNAL_MULTITONE, 16000, 1,  24000, 30.0},
+	{SIGNAL_TONE,      24000, 2,  64000, 30.0},
+};
+
+static float synth(enum signal_kind kind, uint32_t rate, uint32_t ch,
+		size_t i)
+{
+	double t = (double)i / rate;
+	double nyq = rate * 0.5;
+
+	switch (kind) {
+	case SIGNAL_TONE:
+		return (float)(0.5 * sin(2 * M_PI * (440.0 + 110.0 * ch) * t));
+
+	case SIGNAL_MULTITONE: {
+		static const double freqs[] = {220, 587, 1250, 2900, 5100};
+		double v = 0.0;
+		for (size_t k = 0; k < sizeof(freqs) / sizeof(freqs[0]); k++)
+			if (freqs[k] < nyq * 0.6)
+				v += 0.12 * sin(2 * M_PI * freqs[k] * (1.0 + 0.01 * ch) * t
+						+ k);
+		return (float)v;
+	}
+
+	case SIGNAL_CHIRP: {
+		/* 100 Hz up to half the band over the test */
+		double f1 = nyq * 0.5;
+		double k = (f1 - 100.0) / TEST_SECONDS;
+		return (float)(0.4 * sin(2 * M_PI * (100.0 * t + 0.5 * k * t * t)
+				+ ch));
+	}
+
+	case SIGNAL_CLICKS: {
+		/* quiet tone with a decaying burst every quarter second */
+		double v = 0.05 * sin(2 * M_PI * 330.0 * t);
+		double since = fmod(t, 0.25);
+		if (since < 0.02)
+			v += 0.6 * exp(-since * 300.0) * sin(2 * M_PI * 1800.0 * t);
+		return (float)v;
+	}
+	}
+
+	return 0.0f;
+}
+
+static void write_adts(FILE *f, const std::vector<uint8_t> &frame,
+		int rate_idx, uint32_t channels)
+{
+	size_t len = frame.size() + 7;
+	uint8_t hdr[7];
+
+	hdr[0] = 0xFF;
+	hdr[1] = 0xF1;
+	hdr[2] = (uint8_t)((1 << 6) | (rate_idx << 2) | (channels >> 2));
+	hdr[3] = (uint8_t)(((channels & 3) << 6) | (len >> 11));
+	hdr[4] = (uint8_t)((len >> 3) & 0xFF);
+	hdr[5] = (uint8_t)(((len & 7) << 5) | 0x1F);
+	hdr[6] = 0xFC;
+
+	fwrite(hdr, 1, sizeof(hdr), f);
+	fwrite(frame.data(), 1, frame.size(), f);
+}
+
+static bool decode(const char *ffmpeg, const char *path,
+		std::vector<float> &out)
+{
+	std::string cmd = std::string(ffmpeg) +
+			" -v error -xerror -i " + path + " -f f32le -";
+
+	FILE *p = popen(cmd.c_str(), "r");
+	if (!p)
+		return false;
+
+	float buf[4096];
+	size_t n;
+	while ((n = fread(buf, sizeof(float), 4096, p)) > 0)
+		out.insert(out.end(), buf, buf + n);
+
+	return pclose(p) == 0;
+}
+
+/* SNR of the decoded signal against the input at a given delay, per
+ * channel, skipping the first and last half second */
+static double snr_at(const std::vector<float> &ref,
+		const std::vector<float> &dec, uint32_t channels, size_t frames,
+		size_t margin, long delay)
+{
+	double sig = 0.0, err = 0.0;
+
+	for (size_t i = margin; i + margin < frames; i++) {
+		long j = (long)i + delay;
+		if (j < 0 || (size_t)(j + 1) * channels > dec.size())
+			return -100.0;
+
+		for (uint32_t c = 0; c < channels; c++) {
+			double a = ref[i * channels + c];
+			double d = a - dec[(size_t)j * channels + c];
+			sig += a * a;
+			err += d * d;
+		}
+	}
+
+	return 10.0 * log10(sig / (err + 1e-20));
+}
+
+static bool run_case(const char *ffmpeg, const test_case &tc)
+{
+	AacLcEncoder enc;
+	if (!enc.open(tc.sample_rate, tc.channels, tc.bitrate)) {
+		printf("FAIL open %u Hz %u ch\n", tc.sample_rate, tc.channels);
+		return false;
+	}
+
+	const std::vector<uint8_t> &asc = enc.get_config();
+	int rate_idx = ((asc[0] & 7) << 1) | (asc[1] >> 7);
+
+	size_t frames = (size_t)tc.sample_rate * TEST_SECONDS;
+	frames -= frames % AAC_FRAME_SAMPLES;
+
+	std::vector<float> pcm(frames * tc.channels);
+	for (size_t i = 0; i < frames; i++)
+		for (uint32_t c = 0; c < tc.channels; c++)
+			pcm[i * tc.channels + c] = synth(tc.kind, tc.sample_rate, c, i);
+
+	char path[] = "/tmp/aac-encoder-test-XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0)
+		return false;
+	FILE *f = fdopen(fd, "wb");
+
+	/* flush the encoder delay with silence so the whole input comes out */
+	std::vector<float> silence(AAC_FRAME_SAMPLES * tc.channels, 0.0f);
+	std::vector<uint8_t> packet;
+	size_t packets = 0, bytes = 0;
+	size_t in_frames = frames / AAC_FRAME_SAMPLES + 2;
+
+	for (size_t k = 0; k < in_frames; k++) {
+		const float *src = k * AAC_FRAME_SAMPLES < frames ?
+				&pcm[k * AAC_FRAME_SAMPLES * tc.channels] : &silence[0];
+
+		/* split every other frame the way a wrapped ring hands it over */
+		size_t count = AAC_FRAME_SAMPLES * tc.channels;
+		size_t head = (k & 1) ? (count / 3) / tc.channels * tc.channels :
+				count;
+		if (!enc.encode(src, head, src + head, count - head, packet))
+			continue;
+
+		write_adts(f, packet, rate_idx, tc.channels);
+		packets++;
+		bytes += packet.size();
+	}
+	fclose(f);
+
+	std::vector<float> dec;
+	bool ok = decode(ffmpeg, path, dec);
+	unlink(path);
+
+	if (!ok) {
+		printf("FAIL %s %u Hz %u ch: decoder rejected the stream\n",
+				signal_names[tc.kind], tc.sample_rate, tc.channels);
+		return false;
+	}
+
+	/* the decoder drops nothing, so the first input sample shows up one
+	 * frame in: the first packet is the priming frame */
+	size_t margin = tc.sample_rate / 2;
+	long best_delay = 0;
+	double best = -1e9;
+	for (long d = 0; d <= 3 * AAC_FRAME_SAMPLES; d++) {
+		double snr = snr_at(pcm, dec, tc.channels, frames, margin, d);
+		if (snr > best) {
+			best = snr;
+			best_delay = d;
+		}
+	}
+
+	double kbps = bytes * 8.0 / (packets * (double)AAC_FRAME_SAMPLES /
+			tc.sample_rate) / 1000.0;
+	long expected = AAC_ENCODER_DELAY - AAC_FRAME_SAMPLES;
+	bool pass = best >= tc.min_snr_db && best_delay == expected &&
+			kbps < tc.bitrate / 1000.0 * 1.2;
+
+	printf("%s %-9s %5u Hz %u ch %3u kbps: snr %5.1f dB (min %4.1f) "
+			"delay %ld rate %.1f kbps\n", pass ? "ok  " : "FAIL",
+			signal_names[tc.kind], tc.sample_rate, tc.channels,
+			tc.bitrate / 1000, best, tc.min_snr_db, best_delay, kbps);
+
+	return pass;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s <ffmpeg>\n", argv[0]);
+		return 2;
+	}
+
+	int failed = 0;
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+		if (!run_case(argv[1], cases[i]))
+			failed++;
+
+	return failed ? 1 : 0;
+}
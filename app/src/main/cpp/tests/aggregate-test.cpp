@@ -0,0 +1,329 @@
+/*
+ * Sends a second of audio and video through RtmpStream with aggregation on
+ * into a socketpair, reads it back with librtmp and takes the aggregates
+ * apart again. Checks every tag arrives intact and in order per track,
+ * back pointers are 11 + DataSize, audio aggregates stay on the audio
+ * chunk stream, a quiet track is flushed by the wall clock budget and
+ * stopping sends what is still gathered.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <vector>
+
+#include "loopback-stream.h"
+
+#define BUDGET_MS     100
+#define CHANNEL_AUDIO 0x04
+#define CHANNEL_VIDEO 0x06
+
+struct sent_tag {
+	uint8_t              type;
+	int32_t              time_ms;
+	std::vector<uint8_t> body;
+};
+
+struct received_msg {
+	int                  channel;
+	uint8_t              type;
+	int32_t              time_ms;
+	std::vector<uint8_t> body;
+};
+
+static pthread_mutex_t received_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<received_msg> received;
+
+static void *receive_thread(void *data)
+{
+	RTMP *r = (RTMP *)data;
+	RTMPPacket packet;
+
+	memset(&packet, 0, sizeof(packet));
+	while (RTMP_ReadPacket(r, &packet)) {
+		if (!RTMPPacket_IsReady(&packet))
+			continue;
+
+		received_msg msg;
+		msg.channel = packet.m_nChannel;
+		msg.type    = packet.m_packetType;
+		msg.time_ms = (int32_t)packet.m_nTimeStamp;
+		msg.body.assign(packet.m_body, packet.m_body + packet.m_nBodySize);
+
+		pthread_mutex_lock(&received_mutex);
+		received.push_back(msg);
+		pthread_mutex_unlock(&received_mutex);
+
+		RTMPPacket_Free(&packet);
+	}
+
+	RTMPPacket_Free(&packet);
+	return NULL;
+}
+
+static uint32_t read_be24(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+}
+
+static uint32_t read_be32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | read_be24(p + 1);
+}
+
+static int failures;
+
+#define CHECK(cond, ...) \
+	do { \
+		if (!(cond)) { \
+			printf("FAIL: " __VA_ARGS__); \
+			printf("\n"); \
+			failures++; \
+		} \
+	} while (0)
+
+/* flattens the received messages into tags per type */
+static void unpack(std::vector<sent_tag> &audio, std::vector<sent_tag> &video,
+		int &audio_aggregates, int &video_aggregates)
+{
+	std::vector<received_msg> msgs;
+
+	pthread_mutex_lock(&received_mutex);
+	msgs = received;
+	pthread_mutex_unlock(&received_mutex);
+
+	audio.clear();
+	video.clear();
+	audio_aggregates = video_aggregates = 0;
+
+	for (size_t i = 0; i < msgs.size(); i++) {
+		const received_msg &msg = msgs[i];
+
+		if (msg.type != RTMP_PACKET_TYPE_FLASH_VIDEO) {
+			sent_tag tag;
+			tag.type    = msg.type;
+			tag.time_ms = msg.time_ms;
+			tag.body    = msg.body;
+
+			CHECK(msg.channel == (msg.type == RTMP_PACKET_TYPE_AUDIO ?
+					CHANNEL_AUDIO : CHANNEL_VIDEO),
+					"type %d message on chunk stream %d", msg.type,
+					msg.channel);
+			(msg.type == RTMP_PACKET_TYPE_AUDIO ? audio : video).push_back(tag);
+			continue;
+		}
+
+		const uint8_t *p = &msg.body[0];
+		size_t size = msg.body.size(), pos = 0;
+		int32_t first_ms = -1;
+		uint8_t agg_type = size ? p[0] : 0;
+
+		(agg_type == RTMP_PACKET_TYPE_AUDIO ? audio_aggregates :
+				video_aggregates)++;
+		CHECK(msg.channel == (agg_type == RTMP_PACKET_TYPE_AUDIO ?
+				CHANNEL_AUDIO : CHANNEL_VIDEO),
+				"aggregate of type %d on chunk stream %d", agg_type,
+				msg.channel);
+
+		while (pos + 11 <= size) {
+			sent_tag tag;
+			uint32_t data_size = read_be24(p + pos + 1);
+			int32_t ts = (int32_t)(read_be24(p + pos + 4) |
+					((uint32_t)p[pos + 7] << 24));
+
+			if (pos + 11 + data_size + 4 > size) {
+				CHECK(false, "sub tag overruns its aggregate");
+				break;
+			}
+
+			if (first_ms < 0)
+				first_ms = ts;
+
+			CHECK(p[pos] == agg_type, "aggregate mixes tag types");
+			CHECK(read_be24(p + pos + 8) == 0, "sub tag stream id");
+			CHECK(read_be32(p + pos + 11 + data_size) == 11 + data_size,
+					"back pointer %u for a %u byte tag",
+					read_be32(p + pos + 11 + data_size), data_size);
+
+			tag.type    = p[pos];
+			tag.time_ms = msg.time_ms + (ts - first_ms);
+			tag.body.assign(p + pos + 11, p + pos + 11 + data_size);
+			(tag.type == RTMP_PACKET_TYPE_AUDIO ? audio : video).push_back(tag);
+
+			pos += 11 + data_size + 4;
+		}
+
+		CHECK(pos == size, "aggregate has %d trailing bytes",
+				(int)(size - pos));
+	}
+}
+
+static void compare(const char *name, const std::vector<sent_tag> &sent,
+		const std::vector<sent_tag> &got)
+{
+	CHECK(sent.size() == got.size(), "%s: sent %d tags, got %d", name,
+			(int)sent.size(), (int)got.size());
+
+	for (size_t i = 0; i < sent.size() && i < got.size(); i++) {
+		CHECK(sent[i].time_ms == got[i].time_ms, "%s tag %d: time %d, got %d",
+				name, (int)i, sent[i].time_ms, got[i].time_ms);
+		CHECK(sent[i].body == got[i].body, "%s tag %d: body differs", name,
+				(int)i);
+	}
+}
+
+static size_t count_type(uint8_t type)
+{
+	std::vector<sent_tag> audio, video;
+	int a, v;
+
+	unpack(audio, video, a, v);
+	return type == RTMP_PACKET_TYPE_AUDIO ? audio.size() : video.size();
+}
+
+static bool wait_for(uint8_t type, size_t count)
+{
+	for (int i = 0; i < 200; i++) {
+		if (count_type(type) >= count)
+			return true;
+		usleep(5000);
+	}
+	return false;
+}
+
+static void make_packet(encoder_packet &packet, sent_tag &tag,
+		enum obs_encoder_type type, int64_t time_ms, size_t size,
+		bool keyframe)
+{
+	packet.type         = type;
+	packet.timebase_num = 1;
+	packet.timebase_den = 1000;
+	packet.pts          = time_ms;
+	packet.dts          = time_ms;
+	packet.dts_usec     = time_ms * 1000;
+	packet.keyframe     = keyframe;
+	packet.data.resize(size);
+	for (size_t i = 0; i < size; i++)
+		packet.data[i] = (uint8_t)(i * 7 + time_ms);
+
+	/* the FLV body the stream builds around it */
+	tag.time_ms = (int32_t)time_ms;
+	if (type == OBS_ENCODER_AUDIO) {
+		static const uint8_t prefix[] = {0xaf, 0x01};
+		tag.type = RTMP_PACKET_TYPE_AUDIO;
+		tag.body.assign(prefix, prefix + sizeof(prefix));
+	} else {
+		uint8_t prefix[] = {(uint8_t)(keyframe ? 0x17 : 0x27), 0x01, 0, 0, 0};
+		tag.type = RTMP_PACKET_TYPE_VIDEO;
+		tag.body.assign(prefix, prefix + sizeof(prefix));
+	}
+	tag.body.insert(tag.body.end(), packet.data.begin(), packet.data.end());
+}
+
+int main()
+{
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+		return 2;
+
+	RTMP *reader = RTMP_Alloc();
+	RTMP_Init(reader);
+	reader->m_sb.sb_socket = fds[1];
+	reader->m_inChunkSize  = LOOPBACK_CHUNK_SIZE;
+
+	pthread_t thread;
+	pthread_create(&thread, NULL, receive_thread, reader);
+
+	LoopbackStream stream;
+	stream.attach(fds[0]);
+	stream.aggregate_budget_ms = BUDGET_MS;
+
+	std::vector<sent_tag> sent_audio, sent_video;
+	int64_t a = 0, v = 0;
+
+	/* a second of media, one wakeup per 20 ms; the keyframes are over
+	 * the aggregate size and go out alone */
+	for (int64_t now = 20; now <= 1000; now += 20) {
+		while (a * 1024 * 1000 / 48000 < now || v * 1000 / 30 < now) {
+			int64_t ats = 1 + a * 1024 * 1000 / 48000;
+			int64_t vts = 1 + v * 1000 / 30;
+			encoder_packet packet;
+			sent_tag tag;
+
+			if (ats <= vts) {
+				make_packet(packet, tag, OBS_ENCODER_AUDIO, ats, 300, false);
+				sent_audio.push_back(tag);
+				a++;
+			} else {
+				bool keyframe = v % 15 == 0;
+				make_packet(packet, tag, OBS_ENCODER_VIDEO, vts,
+						keyframe ? 20000 : 1500, keyframe);
+				sent_video.push_back(tag);
+				v++;
+			}
+			stream.queue(packet);
+		}
+
+		CHECK(stream.drain() >= 0, "send failed at %d ms", (int)now);
+	}
+
+	/* video goes quiet: one more audio wakeup after the budget has passed
+	 * in wall time must push the gathered video out */
+	usleep((BUDGET_MS + 50) * 1000);
+	{
+		encoder_packet packet;
+		sent_tag tag;
+		make_packet(packet, tag, OBS_ENCODER_AUDIO,
+				1 + a * 1024 * 1000 / 48000, 300, false);
+		sent_audio.push_back(tag);
+		stream.queue(packet);
+	}
+	CHECK(stream.drain() >= 0, "send failed after the pause");
+	CHECK(wait_for(RTMP_PACKET_TYPE_VIDEO, sent_video.size()),
+			"video still held %d ms after its last tag", BUDGET_MS + 50);
+
+	/* stopping sends the audio still being gathered */
+	{
+		encoder_packet packet;
+		sent_tag tag;
+		make_packet(packet, tag, OBS_ENCODER_AUDIO,
+				1 + (a + 1) * 1024 * 1000 / 48000, 300, false);
+		sent_audio.push_back(tag);
+		stream.queue(packet);
+	}
+	CHECK(stream.drain() >= 0, "send failed before stopping");
+	usleep(20000);
+	CHECK(count_type(RTMP_PACKET_TYPE_AUDIO) < sent_audio.size(),
+			"the last audio tag was not gathered");
+	CHECK(stream.stop_flush() >= 0, "stop flush failed");
+	CHECK(wait_for(RTMP_PACKET_TYPE_AUDIO, sent_audio.size()),
+			"audio gathered at stop was not sent");
+
+	shutdown(fds[0], SHUT_WR);
+	pthread_join(thread, NULL);
+	stream.detach();
+	close(fds[0]);
+	close(fds[1]);
+	reader->m_sb.sb_socket = -1;
+	RTMP_Free(reader);
+
+	std::vector<sent_tag> got_audio, got_video;
+	int audio_aggregates, video_aggregates;
+	unpack(got_audio, got_video, audio_aggregates, video_aggregates);
+
+	compare("audio", sent_audio, got_audio);
+	compare("video", sent_video, got_video);
+	CHECK(audio_aggregates > 0, "no audio aggregates");
+	CHECK(video_aggregates > 0, "no video aggregates");
+
+	printf("%d audio and %d video tags in %d audio and %d video aggregates, "
+			"%d messages\n", (int)got_audio.size(), (int)got_video.size(),
+			audio_aggregates, video_aggregates, (int)received.size());
+
+	if (failures)
+		printf("%d checks failed\n", failures);
+	return failures ? 1 : 0;
+}
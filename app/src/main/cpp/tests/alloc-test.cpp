@@ -0,0 +1,273 @@
+/*
+ * Heap allocations on the librtmp message paths once they are warm:
+ * RTMP_Write one tag at a time, in batches, and in batches through a
+ * custom send function that needs each batch in one piece, and
+ * RTMP_ReadPacket with the bodies recycled. Mixed 2-20 KB and 150 KB video
+ * with small audio; none of the four may allocate per message.
+ *
+ * malloc, calloc and realloc are interposed and forwarded to glibc's own,
+ * counting only on the thread under test, so this needs glibc and is
+ * built with RTMP_COUNT_ALLOCS.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <vector>
+
+#include "librtmp/rtmp.h"
+#include "librtmp/log.h"
+
+#define MESSAGES    4000
+#define WARM_UP     500
+#define CHUNK_SIZE  4096
+
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+
+static __thread bool counting;
+static long allocations;
+
+extern "C" void *malloc(size_t size)
+{
+	if (counting)
+		allocations++;
+	return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size)
+{
+	if (counting)
+		allocations++;
+	return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+	if (counting)
+		allocations++;
+	return __libc_realloc(ptr, size);
+}
+
+static int failures;
+
+#define CHECK(cond, ...) \
+	do { \
+		if (!(cond)) { \
+			printf("FAIL: " __VA_ARGS__); \
+			printf("\n"); \
+			failures++; \
+		} \
+	} while (0)
+
+static void *drain_thread(void *data)
+{
+	int fd = *(int *)data;
+	char buf[65536];
+
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+	return NULL;
+}
+
+static int custom_send(RTMPSockBuf *sb, const char *buf, int len, void *param)
+{
+	(void)param;
+	return (int)send(sb->sb_socket, buf, len, 0);
+}
+
+static size_t video_size(int i)
+{
+	return i % 30 == 0 ? 150000 + (i % 7) * 1000 : 2000 + (i * 37) % 20000;
+}
+
+static int make_tag(std::vector<char> &tag, uint8_t type, size_t size,
+		uint32_t ts)
+{
+	uint32_t prev = (uint32_t)(11 + size);
+	uint8_t header[11] = {type, (uint8_t)(size >> 16), (uint8_t)(size >> 8),
+			(uint8_t)size, (uint8_t)(ts >> 16), (uint8_t)(ts >> 8),
+			(uint8_t)ts, (uint8_t)(ts >> 24), 0, 0, 0};
+
+	memcpy(&tag[0], header, sizeof(header));
+	memset(&tag[11], 0x55, size);
+	tag[11 + size]     = (char)(prev >> 24);
+	tag[11 + size + 1] = (char)(prev >> 16);
+	tag[11 + size + 2] = (char)(prev >> 8);
+	tag[11 + size + 3] = (char)prev;
+	return (int)(size + 15);
+}
+
+enum write_mode {
+	WRITE_DIRECT,
+	WRITE_BATCH,
+	WRITE_BATCH_FLAT,
+};
+
+static const char *mode_names[] = {"direct", "batched", "batched, flattened"};
+
+static void write_path(write_mode mode)
+{
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+		CHECK(false, "socketpair");
+		return;
+	}
+
+	pthread_t drain;
+	pthread_create(&drain, NULL, drain_thread, &fds[1]);
+
+	RTMP *rtmp = RTMP_Alloc();
+	RTMP_Init(rtmp);
+	rtmp->m_sb.sb_socket     = fds[0];
+	rtmp->m_outChunkSize     = CHUNK_SIZE;
+	rtmp->Link.streams[0].id = 1;
+	rtmp->Link.nStreams      = 1;
+	if (mode == WRITE_BATCH_FLAT) {
+		rtmp->m_bCustomSend    = 1;
+		rtmp->m_customSendFunc = custom_send;
+	}
+
+	std::vector<char> tag(200000);
+	uint32_t ts = 1;
+	bool ok = true;
+
+	for (int i = 0; i < MESSAGES && ok; i++) {
+		if (i == WARM_UP) {
+			allocations = 0;
+			counting = true;
+		}
+
+		if (mode != WRITE_DIRECT)
+			RTMP_BeginBatch(rtmp);
+
+		int size = make_tag(tag, RTMP_PACKET_TYPE_VIDEO, video_size(i), ts++);
+		ok = RTMP_Write(rtmp, &tag[0], size, 0) > 0;
+		size = make_tag(tag, RTMP_PACKET_TYPE_AUDIO, 300 + i % 50, ts++);
+		ok = ok && RTMP_Write(rtmp, &tag[0], size, 0) > 0;
+
+		if (mode != WRITE_DIRECT)
+			ok = ok && RTMP_FlushBatch(rtmp);
+	}
+
+	counting = false;
+	long counted = allocations;
+
+	printf("write, %s: %ld allocations over %d messages after warm-up\n",
+			mode_names[mode], counted, 2 * (MESSAGES - WARM_UP));
+	CHECK(ok, "write failed");
+	CHECK(counted == 0, "%s writes allocated %ld times", mode_names[mode],
+			counted);
+
+	RTMP_Close(rtmp);
+	RTMP_Free(rtmp);
+	close(fds[0]);
+	pthread_join(drain, NULL);
+	close(fds[1]);
+}
+
+struct sender {
+	RTMP *rtmp;
+	int  messages;
+};
+
+static size_t read_size(int i)
+{
+	return i % 20 == 0 ? 60000 + (i % 5) * 100 : 500 + (i * 13) % 3000;
+}
+
+static void *send_thread(void *data)
+{
+	sender *tx = (sender *)data;
+	std::vector<char> body(RTMP_MAX_HEADER_SIZE + 70000, 0x33);
+
+	for (int i = 0; i < tx->messages; i++) {
+		RTMPPacket packet;
+		memset(&packet, 0, sizeof(packet));
+		packet.m_nChannel    = (i & 1) ? 0x05 : 0x06;
+		packet.m_headerType  = RTMP_PACKET_SIZE_LARGE;
+		packet.m_packetType  = (i & 1) ? RTMP_PACKET_TYPE_AUDIO :
+				RTMP_PACKET_TYPE_VIDEO;
+		packet.m_nTimeStamp  = i;
+		packet.m_nInfoField2 = 1;
+		packet.m_body        = &body[RTMP_MAX_HEADER_SIZE];
+		packet.m_nBodySize   = (uint32_t)read_size(i);
+
+		if (!RTMP_SendPacket(tx->rtmp, &packet, FALSE))
+			break;
+	}
+	return NULL;
+}
+
+static void read_path()
+{
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+		CHECK(false, "socketpair");
+		return;
+	}
+
+	RTMP *writer = RTMP_Alloc();
+	RTMP *reader = RTMP_Alloc();
+	RTMP_Init(writer);
+	RTMP_Init(reader);
+	writer->m_sb.sb_socket = fds[0];
+	reader->m_sb.sb_socket = fds[1];
+
+	sender tx = {writer, 3000};
+	pthread_t thread;
+	pthread_create(&thread, NULL, send_thread, &tx);
+
+	RTMPPacket packet;
+	memset(&packet, 0, sizeof(packet));
+	int received = 0, wrong = 0;
+
+	while (received < tx.messages && RTMP_ReadPacket(reader, &packet)) {
+		if (!RTMPPacket_IsReady(&packet))
+			continue;
+
+		if (received == WARM_UP) {
+			allocations = 0;
+			counting = true;
+		}
+
+		if (packet.m_nBodySize != read_size(received))
+			wrong++;
+		received++;
+		RTMP_RecyclePacket(reader, &packet);
+	}
+
+	counting = false;
+	long counted = allocations;
+
+	printf("read: %ld allocations over %d messages after warm-up\n", counted,
+			received - WARM_UP);
+	CHECK(received == tx.messages && wrong == 0,
+			"%d of %d messages read, %d of the wrong size", received,
+			tx.messages, wrong);
+	CHECK(counted == 0, "reads allocated %ld times", counted);
+
+	pthread_join(thread, NULL);
+	RTMP_Close(writer);
+	RTMP_Close(reader);
+	RTMP_Free(writer);
+	RTMP_Free(reader);
+}
+
+int main()
+{
+	RTMP_LogSetLevel(RTMP_LOGERROR);
+
+	write_path(WRITE_DIRECT);
+	write_path(WRITE_BATCH);
+	write_path(WRITE_BATCH_FLAT);
+	read_path();
+
+	if (failures)
+		printf("%d checks failed\n", failures);
+	return failures ? 1 : 0;
+}
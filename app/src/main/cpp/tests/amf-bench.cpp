@@ -0,0 +1,202 @@
+/*
+ * Nanoseconds per message for the AMF paths on the control channel:
+ * reading the code out of an onStatus with AMF_Decode and AMF_GetProp
+ * against AMFReader, and building the onMetaData tag field by field with
+ * the amf.c encoders against FLVPackager's sized schema. Both have to
+ * come out byte for byte the same.
+ *
+ *   amf-bench [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include "librtmp/amf.h"
+#include "librtmp/log.h"
+#include "librtmp/rtmp.h"
+#include "rtmp-defs.h"
+#include "rtmp-flv-packager.h"
+
+#define SAVC(x) static const AVal av_##x = {(char *)#x, sizeof(#x) - 1}
+
+SAVC(onStatus);
+SAVC(onMetaData);
+SAVC(level);
+SAVC(code);
+SAVC(description);
+SAVC(details);
+SAVC(width);
+SAVC(height);
+SAVC(videocodecid);
+SAVC(framerate);
+SAVC(audiocodecid);
+SAVC(audiodatarate);
+SAVC(audiosamplerate);
+SAVC(encoder);
+
+static const AVal av_status      = {(char *)"status", 6};
+static const AVal av_publish     = {(char *)"NetStream.Publish.Start", 23};
+static const AVal av_start       = {(char *)"Start publishing", 16};
+static const AVal av_stream      = {(char *)"live/stream", 11};
+
+static double now_sec()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int make_status(char *buf, char *end)
+{
+	char *p = buf;
+
+	p = AMF_EncodeString(p, end, &av_onStatus);
+	p = AMF_EncodeNumber(p, end, 0);
+	*p++ = AMF_NULL;
+	*p++ = AMF_OBJECT;
+	p = AMF_EncodeNamedString(p, end, &av_level, &av_status);
+	p = AMF_EncodeNamedString(p, end, &av_code, &av_publish);
+	p = AMF_EncodeNamedString(p, end, &av_description, &av_start);
+	p = AMF_EncodeNamedString(p, end, &av_details, &av_stream);
+	*p++ = 0;
+	*p++ = 0;
+	*p++ = AMF_OBJECT_END;
+	return (int)(p - buf);
+}
+
+static int decode_status(const char *buf, int size)
+{
+	AMFObject obj, info;
+	AVal code = {0, 0};
+
+	if (AMF_Decode(&obj, buf, size, FALSE) < 0)
+		return 0;
+	AMFProp_GetObject(AMF_GetProp(&obj, NULL, 3), &info);
+	AMFProp_GetString(AMF_GetProp(&info, &av_code, -1), &code);
+	AMF_Reset(&obj);
+	return code.av_len;
+}
+
+static int read_status(const char *buf, int size)
+{
+	AMFReader reader;
+	AMFObjectProperty prop;
+
+	AMFReader_Init(&reader, buf, size);
+	if (AMFReader_Next(&reader, &prop) != 1 ||
+		AMFReader_Next(&reader, &prop) != 1 ||
+		AMFReader_Next(&reader, &prop) != 1 ||
+		AMFReader_Skip(&reader, &prop) != 1 ||
+		AMFReader_Next(&reader, &prop) != 1)
+		return 0;
+
+	while (AMFReader_Next(&reader, &prop) == 1 &&
+		AMFReader_Depth(&reader) >= 1) {
+		if (prop.p_type == AMF_STRING && AVMATCH(&prop.p_name, &av_code))
+			return prop.p_vu.p_aval.av_len;
+		AMFReader_Skip(&reader, &prop);
+	}
+	return 0;
+}
+
+/* the tag the packager writes, with the amf.c encoders into a buffer
+ * sized for the worst case */
+static std::vector<uint8_t> encode_meta_data()
+{
+	char name[64];
+	AVal module_name;
+	module_name.av_val = name;
+	module_name.av_len = snprintf(name, sizeof(name), "%s ( version %d.%d.%d )",
+			"rtmp-output module", MAJOR_VER, MINOR_VER, PATCH_VER);
+
+	std::vector<uint8_t> out(512);
+	char *buf = (char *)&out[0];
+	char *end = buf + out.size() - 4;
+	char *p = buf + 11;
+
+	p = AMF_EncodeString(p, end, &av_onMetaData);
+	*p++ = AMF_ECMA_ARRAY;
+	p = AMF_EncodeInt32(p, end, 8);
+	p = AMF_EncodeNamedNumber(p, end, &av_width, 1280);
+	p = AMF_EncodeNamedNumber(p, end, &av_height, 720);
+	p = AMF_EncodeNamedNumber(p, end, &av_videocodecid, 7);
+	p = AMF_EncodeNamedNumber(p, end, &av_framerate, 30);
+	p = AMF_EncodeNamedNumber(p, end, &av_audiocodecid, 10);
+	p = AMF_EncodeNamedNumber(p, end, &av_audiodatarate, 128);
+	p = AMF_EncodeNamedNumber(p, end, &av_audiosamplerate, 48000);
+	p = AMF_EncodeNamedString(p, end, &av_encoder, &module_name);
+	p = AMF_EncodeInt24(p, end, AMF_OBJECT_END);
+
+	int data_size = (int)(p - buf) - 11;
+	buf[0] = RTMP_PACKET_TYPE_INFO;
+	AMF_EncodeInt24(buf + 1, end, data_size);
+	memset(buf + 4, 0, 7);
+	p = AMF_EncodeInt32(p, end + 4, data_size + 11);
+
+	out.resize(p - buf);
+	return out;
+}
+
+int main(int argc, char **argv)
+{
+	int iterations = argc > 1 ? atoi(argv[1]) : 1000000;
+	volatile int sink = 0;
+	char status[256];
+
+	if (iterations < 1)
+		iterations = 1;
+	RTMP_LogSetLevel(RTMP_LOGCRIT);
+
+	int status_size = make_status(status, status + sizeof(status));
+
+	double start = now_sec();
+	for (int i = 0; i < iterations; i++)
+		sink += decode_status(status, status_size);
+	double decode_ns = (now_sec() - start) * 1e9 / iterations;
+
+	start = now_sec();
+	for (int i = 0; i < iterations; i++)
+		sink += read_status(status, status_size);
+	double read_ns = (now_sec() - start) * 1e9 / iterations;
+
+	bool same_code = decode_status(status, status_size) == av_publish.av_len &&
+			read_status(status, status_size) == av_publish.av_len;
+
+	printf("onStatus code: AMF_Decode %.0f ns, AMFReader %.0f ns\n",
+			decode_ns, read_ns);
+
+	FLVPackager packager;
+	packager.has_video         = true;
+	packager.width             = 1280;
+	packager.height            = 720;
+	packager.video_codec_id    = 7;
+	packager.frame_rate        = 30;
+	packager.has_audio         = true;
+	packager.audio_codec_id    = 10;
+	packager.audio_data_rate   = 128;
+	packager.audio_sample_rate = 48000;
+
+	start = now_sec();
+	for (int i = 0; i < iterations; i++)
+		sink += (int)encode_meta_data().size();
+	double encode_ns = (now_sec() - start) * 1e9 / iterations;
+
+	start = now_sec();
+	for (int i = 0; i < iterations; i++)
+		sink += (int)packager.flv_meta_data(false).size();
+	double schema_ns = (now_sec() - start) * 1e9 / iterations;
+
+	bool same_meta = encode_meta_data() == packager.flv_meta_data(false);
+
+	printf("onMetaData tag: amf.c encoders %.0f ns, packager schema %.0f ns\n",
+			encode_ns, schema_ns);
+
+	if (!same_code)
+		printf("FAIL: the decoders read different codes\n");
+	if (!same_meta)
+		printf("FAIL: the packager's onMetaData differs from amf.c's\n");
+	return same_code && same_meta ? 0 : 1;
+}
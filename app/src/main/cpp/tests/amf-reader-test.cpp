@@ -0,0 +1,503 @@
+/*
+ * AMFReader against amf.c: random AMF0 buffers with AMF3 values behind
+ * AMF_AVMPLUS are decoded by both and must give the same values in the
+ * same order. amf.c mis-decodes negative AMF3 integers, fails on nested
+ * AMF3 objects and double-frees dynamic members, so those are checked
+ * against known values instead. Every prefix of a value must fail
+ * cleanly rather than read past the end.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "librtmp/amf.h"
+#include "librtmp/log.h"
+
+#define CASES 20000
+
+static int failures;
+
+#define CHECK(cond, ...) \
+	do { \
+		if (!(cond)) { \
+			printf("FAIL: " __VA_ARGS__); \
+			printf("\n"); \
+			failures++; \
+		} \
+	} while (0)
+
+typedef std::vector<uint8_t> buffer;
+
+static unsigned seed = 12345;
+
+static unsigned rnd()
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+static void put_u16(buffer &b, unsigned v)
+{
+	b.push_back((uint8_t)(v >> 8));
+	b.push_back((uint8_t)v);
+}
+
+static void put_u32(buffer &b, uint32_t v)
+{
+	for (int i = 3; i >= 0; i--)
+		b.push_back((uint8_t)(v >> (8 * i)));
+}
+
+static void put_double(buffer &b, double d)
+{
+	uint64_t bits;
+	memcpy(&bits, &d, sizeof(bits));
+	for (int i = 7; i >= 0; i--)
+		b.push_back((uint8_t)(bits >> (8 * i)));
+}
+
+static void put_u29(buffer &b, uint32_t v)
+{
+	if (v < 0x80) {
+		b.push_back((uint8_t)v);
+	} else if (v < 0x4000) {
+		b.push_back((uint8_t)(0x80 | (v >> 7)));
+		b.push_back(v & 0x7f);
+	} else if (v < 0x200000) {
+		b.push_back((uint8_t)(0x80 | (v >> 14)));
+		b.push_back((uint8_t)(0x80 | ((v >> 7) & 0x7f)));
+		b.push_back(v & 0x7f);
+	} else {
+		b.push_back((uint8_t)(0x80 | (v >> 22)));
+		b.push_back((uint8_t)(0x80 | ((v >> 15) & 0x7f)));
+		b.push_back((uint8_t)(0x80 | ((v >> 8) & 0x7f)));
+		b.push_back(v & 0xff);
+	}
+}
+
+static std::string random_name()
+{
+	std::string s;
+	int n = 1 + rnd() % 8;
+	for (int i = 0; i < n; i++)
+		s += (char)('a' + rnd() % 26);
+	return s;
+}
+
+static void put_amf0_name(buffer &b, const std::string &s)
+{
+	put_u16(b, (unsigned)s.size());
+	b.insert(b.end(), s.begin(), s.end());
+}
+
+static void put_amf3_string(buffer &b, const std::string &s)
+{
+	put_u29(b, (uint32_t)(s.size() << 1) | 1);
+	b.insert(b.end(), s.begin(), s.end());
+}
+
+/* what amf.c decodes correctly: small integers, one level of objects */
+static void put_amf3_value(buffer &b, int depth)
+{
+	switch (rnd() % (depth < 1 ? 8 : 7)) {
+	case 0: b.push_back(AMF3_NULL); break;
+	case 1: b.push_back(AMF3_TRUE); break;
+	case 2: b.push_back(AMF3_FALSE); break;
+	case 3:
+		b.push_back(AMF3_INTEGER);
+		put_u29(b, rnd() % (1 << 21));
+		break;
+	case 4:
+		b.push_back(AMF3_DOUBLE);
+		put_double(b, (double)(rnd() % 100000) / 7);
+		break;
+	case 5:
+		b.push_back(AMF3_STRING);
+		put_amf3_string(b, random_name());
+		break;
+	case 6:
+		b.push_back(AMF3_DATE);
+		put_u29(b, 1);
+		put_double(b, 1e12);
+		break;
+	case 7: {
+		int n = rnd() % 4;
+
+		b.push_back(AMF3_OBJECT);
+		put_u29(b, (uint32_t)(n << 4) | 3);
+		put_amf3_string(b, "");
+		/* sealed names are unique so no string reference is needed */
+		for (int i = 0; i < n; i++)
+			put_amf3_string(b, random_name() + "s" + std::to_string(i));
+		for (int i = 0; i < n; i++)
+			put_amf3_value(b, depth + 1);
+		break;
+	}
+	}
+}
+
+static void put_amf0_value(buffer &b, int depth)
+{
+	unsigned type = rnd() % (depth < 4 ? 11 : 7);
+
+	switch (type) {
+	case 0:
+		b.push_back(AMF_NUMBER);
+		put_double(b, (double)(int)rnd() / 3);
+		break;
+	case 1:
+		b.push_back(AMF_BOOLEAN);
+		b.push_back(rnd() % 2);
+		break;
+	case 2:
+		b.push_back(AMF_STRING);
+		put_amf0_name(b, random_name());
+		break;
+	case 3: b.push_back(AMF_NULL); break;
+	case 4: b.push_back(AMF_UNDEFINED); break;
+	case 5: {
+		std::string s = random_name();
+		b.push_back(AMF_LONG_STRING);
+		put_u32(b, (uint32_t)s.size());
+		b.insert(b.end(), s.begin(), s.end());
+		break;
+	}
+	case 6:
+		b.push_back(AMF_DATE);
+		put_double(b, 1.5e12);
+		put_u16(b, 0);
+		break;
+	case 7:
+	case 8: {
+		int n = rnd() % 5;
+
+		b.push_back(type == 7 ? AMF_OBJECT : AMF_ECMA_ARRAY);
+		if (type == 8)
+			put_u32(b, rnd() % 5);
+		for (int i = 0; i < n; i++) {
+			put_amf0_name(b, random_name());
+			put_amf0_value(b, depth + 1);
+		}
+		put_u16(b, 0);
+		b.push_back(AMF_OBJECT_END);
+		break;
+	}
+	case 9: {
+		int n = rnd() % 4;
+
+		b.push_back(AMF_STRICT_ARRAY);
+		put_u32(b, n);
+		for (int i = 0; i < n; i++)
+			put_amf0_value(b, depth + 1);
+		break;
+	}
+	case 10: {
+		/* amf.c only takes objects behind AMF_AVMPLUS */
+		b.push_back(AMF_AVMPLUS);
+		size_t at = b.size();
+		put_amf3_value(b, 0);
+		if (b[at] != AMF3_OBJECT) {
+			b.resize(at);
+			b.push_back(AMF3_OBJECT);
+			put_u29(b, 3);
+			put_amf3_string(b, "");
+		}
+		break;
+	}
+	}
+}
+
+/* one value as both decoders see it, objects closed by AMF_OBJECT_END */
+struct amf_event {
+	std::string name;
+	int         type;
+	int         depth;
+	double      number;
+	std::string str;
+
+	bool operator==(const amf_event &e) const
+	{
+		return name == e.name && type == e.type && depth == e.depth &&
+			number == e.number && str == e.str;
+	}
+};
+
+static amf_event make_event(const AMFObjectProperty &p, int depth)
+{
+	amf_event e;
+
+	if (p.p_name.av_val)
+		e.name.assign(p.p_name.av_val, p.p_name.av_len);
+	e.type   = p.p_type;
+	e.depth  = depth;
+	e.number = 0;
+	if (p.p_type == AMF_NUMBER || p.p_type == AMF_BOOLEAN ||
+			p.p_type == AMF_DATE || p.p_type == AMF_REFERENCE)
+		e.number = p.p_vu.p_number;
+	if (p.p_type == AMF_STRING)
+		e.str.assign(p.p_vu.p_aval.av_val, p.p_vu.p_aval.av_len);
+	return e;
+}
+
+static void print_event(const amf_event &e)
+{
+	printf("  %d %s type %d %g '%s'\n", e.depth, e.name.c_str(), e.type,
+			e.number, e.str.c_str());
+}
+
+static void flatten(AMFObject *obj, int depth, bool named,
+		std::vector<amf_event> &out)
+{
+	for (int i = 0; i < obj->o_num; i++) {
+		AMFObjectProperty *p = &obj->o_props[i];
+
+		/* amf.c keeps the empty name ending dynamic members */
+		if (named && p->p_name.av_len == 0)
+			continue;
+
+		out.push_back(make_event(*p, depth));
+		if (p->p_type == AMF_OBJECT || p->p_type == AMF_ECMA_ARRAY ||
+				p->p_type == AMF_STRICT_ARRAY) {
+			flatten(&p->p_vu.p_object, depth + 1,
+					p->p_type != AMF_STRICT_ARRAY, out);
+
+			amf_event end;
+			end.type   = AMF_OBJECT_END;
+			end.depth  = depth;
+			end.number = 0;
+			out.push_back(end);
+		}
+	}
+}
+
+/* the buffer is copied to the heap at its exact size so a sanitizer
+ * build catches any read past the end */
+static int read_events(const buffer &b, std::vector<amf_event> &out)
+{
+	char *data = (char *)malloc(b.size() ? b.size() : 1);
+	memcpy(data, b.data(), b.size());
+
+	AMFReader reader;
+	AMFObjectProperty prop;
+	int ret;
+
+	AMFReader_Init(&reader, data, (int)b.size());
+	while ((ret = AMFReader_Next(&reader, &prop)) == 1) {
+		int depth = AMFReader_Depth(&reader);
+		if (prop.p_type == AMF_OBJECT || prop.p_type == AMF_ECMA_ARRAY ||
+				prop.p_type == AMF_STRICT_ARRAY)
+			depth--;
+		out.push_back(make_event(prop, depth));
+	}
+
+	free(data);
+	return ret;
+}
+
+static void differential()
+{
+	int mismatches = 0;
+
+	for (int c = 0; c < CASES; c++) {
+		buffer b;
+		int n = 1 + rnd() % 6;
+		for (int i = 0; i < n; i++)
+			put_amf0_value(b, 0);
+
+		AMFObject obj;
+		std::vector<amf_event> expected, events;
+		int decoded = AMF_Decode(&obj, (const char *)&b[0], (int)b.size(),
+				FALSE);
+		if (decoded >= 0)
+			flatten(&obj, 0, false, expected);
+		AMF_Reset(&obj);
+
+		int ret = read_events(b, events);
+		if (decoded >= 0 && ret == 0 && expected == events)
+			continue;
+
+		if (++mismatches <= 3) {
+			printf("case %d: AMF_Decode %d, AMFReader %d\n", c, decoded, ret);
+			for (size_t i = 0; i < events.size(); i++)
+				print_event(events[i]);
+		}
+	}
+
+	printf("%d random buffers, %d decoded differently from amf.c\n", CASES,
+			mismatches);
+	CHECK(mismatches == 0, "%d mismatches", mismatches);
+}
+
+/* all 29 bits, sign extended, where amf.c gets the last byte wrong */
+static void amf3_integers()
+{
+	static const int32_t values[] = {0, 1, 127, 128, 16383, 16384, 2097151,
+			2097152, 268435455, -1, -128, -268435456};
+	int wrong = 0;
+
+	for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+		buffer b;
+		b.push_back(AMF_AVMPLUS);
+		b.push_back(AMF3_INTEGER);
+		put_u29(b, (uint32_t)values[i] & 0x1fffffff);
+
+		std::vector<amf_event> events;
+		int ret = read_events(b, events);
+		if (ret != 0 || events.size() != 1 || events[0].type != AMF_NUMBER ||
+				events[0].number != values[i]) {
+			CHECK(false, "AMF3 integer %d read as %g", values[i],
+					events.empty() ? 0.0 : events[0].number);
+			wrong++;
+		}
+	}
+
+	for (int c = 0; c < CASES; c++) {
+		int32_t value = (int32_t)(rnd() << 8) >> 3;
+		buffer b;
+		b.push_back(AMF_AVMPLUS);
+		b.push_back(AMF3_INTEGER);
+		put_u29(b, (uint32_t)value & 0x1fffffff);
+
+		std::vector<amf_event> events;
+		if (read_events(b, events) != 0 || events.size() != 1 ||
+				events[0].number != value)
+			wrong++;
+	}
+
+	CHECK(wrong == 0, "%d AMF3 integers read wrong", wrong);
+}
+
+/* a proper prefix of one value is always truncated */
+static void truncation()
+{
+	int prefixes = 0, failed = 0;
+
+	for (int c = 0; c < 3000; c++) {
+		buffer b;
+		put_amf0_value(b, 0);
+
+		for (size_t len = 1; len < b.size(); len++) {
+			buffer prefix(b.begin(), b.begin() + len);
+			std::vector<amf_event> events;
+
+			prefixes++;
+			if (read_events(prefix, events) == -1)
+				failed++;
+		}
+	}
+
+	printf("%d truncated buffers, %d failed cleanly\n", prefixes, failed);
+	CHECK(failed == prefixes, "%d truncated buffers read as complete",
+			prefixes - failed);
+}
+
+static void check_events(const char *what, const buffer &b,
+		const amf_event *expected, size_t count)
+{
+	std::vector<amf_event> events;
+	int ret = read_events(b, events);
+	bool same = ret == 0 && events.size() == count;
+
+	for (size_t i = 0; same && i < count; i++)
+		same = events[i] == expected[i];
+
+	if (!same) {
+		CHECK(false, "%s: read %d, %d values", what, ret, (int)events.size());
+		for (size_t i = 0; i < events.size(); i++)
+			print_event(events[i]);
+	}
+}
+
+/* traits and strings referenced by index from a second object */
+static void amf3_references()
+{
+	buffer b;
+	b.push_back(AMF_AVMPLUS);
+	b.push_back(AMF3_OBJECT);
+	put_u29(b, (2 << 4) | 3);
+	put_amf3_string(b, "C");
+	put_amf3_string(b, "code");
+	put_amf3_string(b, "level");
+	b.push_back(AMF3_STRING);
+	put_amf3_string(b, "NetStream.Play.Start");
+	b.push_back(AMF3_STRING);
+	put_u29(b, 3 << 1);
+
+	b.push_back(AMF_AVMPLUS);
+	b.push_back(AMF3_OBJECT);
+	put_u29(b, 1);
+	b.push_back(AMF3_INTEGER);
+	put_u29(b, 5);
+	b.push_back(AMF3_STRING);
+	put_u29(b, 1 << 1);
+
+	static const amf_event expected[] = {
+		{"",      AMF_OBJECT,     0, 0, ""},
+		{"code",  AMF_STRING,     1, 0, "NetStream.Play.Start"},
+		{"level", AMF_STRING,     1, 0, "NetStream.Play.Start"},
+		{"",      AMF_OBJECT_END, 0, 0, ""},
+		{"",      AMF_OBJECT,     0, 0, ""},
+		{"code",  AMF_NUMBER,     1, 5, ""},
+		{"level", AMF_STRING,     1, 0, "code"},
+		{"",      AMF_OBJECT_END, 0, 0, ""},
+	};
+	check_events("AMF3 references", b, expected,
+			sizeof(expected) / sizeof(expected[0]));
+}
+
+/* dynamic members and an AMF3 array nested in an object */
+static void amf3_dynamic()
+{
+	buffer b;
+	b.push_back(AMF_AVMPLUS);
+	b.push_back(AMF3_OBJECT);
+	put_u29(b, (1 << 4) | 8 | 3);
+	put_amf3_string(b, "");
+	put_amf3_string(b, "sealed");
+	b.push_back(AMF3_INTEGER);
+	put_u29(b, 0x1fffffff);
+	put_amf3_string(b, "dyn");
+	b.push_back(AMF3_ARRAY);
+	put_u29(b, (2 << 1) | 1);
+	put_amf3_string(b, "k");
+	b.push_back(AMF3_TRUE);
+	put_amf3_string(b, "");
+	b.push_back(AMF3_INTEGER);
+	put_u29(b, 1);
+	b.push_back(AMF3_NULL);
+	put_amf3_string(b, "");
+	b.push_back(AMF_NUMBER);
+	put_double(b, 3);
+
+	static const amf_event expected[] = {
+		{"",       AMF_OBJECT,     0,  0, ""},
+		{"sealed", AMF_NUMBER,     1, -1, ""},
+		{"dyn",    AMF_ECMA_ARRAY, 1,  0, ""},
+		{"k",      AMF_BOOLEAN,    2,  1, ""},
+		{"",       AMF_NUMBER,     2,  1, ""},
+		{"",       AMF_NULL,       2,  0, ""},
+		{"",       AMF_OBJECT_END, 1,  0, ""},
+		{"",       AMF_OBJECT_END, 0,  0, ""},
+		{"",       AMF_NUMBER,     0,  3, ""},
+	};
+	check_events("AMF3 dynamic members", b, expected,
+			sizeof(expected) / sizeof(expected[0]));
+}
+
+int main()
+{
+	RTMP_LogSetLevel(RTMP_LOGCRIT);
+
+	differential();
+	amf3_integers();
+	truncation();
+	amf3_references();
+	amf3_dynamic();
+
+	if (failures)
+		printf("%d checks failed\n", failures);
+	return failures ? 1 : 0;
+}
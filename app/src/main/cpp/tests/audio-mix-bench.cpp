@@ -0,0 +1,154 @@
+/*
+ * Cost of mixing 8 pcm sources at 48 kHz stereo in AudioOutput, i.e.
+ * microseconds of cpu per second of audio. Every source pushes chunks of
+ * its own size with its own capture latency and a millisecond of
+ * timestamp jitter, the way mic, app and file sources arrive. Each source
+ * is a constant level, so every mixed sample is checked against their sum.
+ *
+ *   audio-mix-bench [seconds of audio]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include "rtmp-audio-output.h"
+
+#define SOURCES      8
+#define SAMPLE_RATE  48000
+#define CHANNELS     2
+#define BASE_TS      1000000000ULL
+
+struct mix_check {
+	size_t ticks;
+	size_t bad_ticks;
+	float  expected;
+};
+
+static void on_tick(void *param, media_data &frame)
+{
+	mix_check *check = (mix_check *)param;
+	const float *samples = (const float *)&frame.data[0];
+	size_t count = frame.data.size() / sizeof(float);
+
+	/* the first ticks are partly before some sources started */
+	if (check->ticks++ < 2)
+		return;
+
+	for (size_t i = 0; i < count; i++) {
+		if (fabsf(samples[i] - check->expected) > 1e-5f) {
+			check->bad_ticks++;
+			break;
+		}
+	}
+}
+
+struct bench_source {
+	size_t             chunk;
+	uint64_t           latency_ns;
+	uint64_t           next_ns;
+	uint64_t           frames;
+	std::vector<float> pcm;
+};
+
+static double now_sec()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv)
+{
+	double seconds = argc > 1 ? atof(argv[1]) : 10.0;
+	if (seconds < 1.0)
+		seconds = 1.0;
+
+	audio_output_info info;
+	info.name            = "mix";
+	info.samples_per_sec = SAMPLE_RATE;
+	info.format          = AUDIO_FORMAT_FLOAT_PLANAR;
+	info.speakers        = SPEAKERS_STEREO;
+
+	AudioOutput output(info);
+	output.output_open();
+
+	mix_check check;
+	memset(&check, 0, sizeof(check));
+
+	audio_convert_info conversion;
+	conversion.format          = AUDIO_FORMAT_FLOAT;
+	conversion.speakers        = SPEAKERS_STEREO;
+	conversion.samples_per_sec = SAMPLE_RATE;
+
+	bench_source sources[SOURCES];
+	for (size_t i = 0; i < SOURCES; i++) {
+		float level = 0.02f * (i + 1);
+
+		sources[i].chunk      = 480 + 32 * i;
+		sources[i].latency_ns = i * 2000000ULL;
+		sources[i].next_ns    = 0;
+		sources[i].frames     = 0;
+		sources[i].pcm.assign(sources[i].chunk * CHANNELS, level);
+		check.expected += level;
+
+		output.add_source(i, &conversion, 1.0f, 40);
+	}
+	output.connect(NULL, on_tick, &check);
+
+	uint64_t total = (uint64_t)(seconds * SAMPLE_RATE);
+	unsigned seed = 1;
+	double cpu = 0.0;
+	bool pending = true;
+
+	/* a millisecond of wall time per step, each source pushes the chunks
+	 * it has captured by then */
+	for (uint64_t now = 0; pending; now += 1000000ULL) {
+		pending = false;
+
+		for (size_t i = 0; i < SOURCES; i++) {
+			bench_source &src = sources[i];
+
+			while (src.frames < total) {
+				uint64_t captured = (src.frames + src.chunk) * 1000000000ULL /
+						SAMPLE_RATE + src.latency_ns;
+				if (captured > now)
+					break;
+
+				seed = seed * 1103515245 + 12345;
+				int64_t jitter = (int64_t)((seed >> 8) % 2000000) - 1000000;
+
+				media_data frame;
+				frame.timestamp = BASE_TS + src.frames * 1000000000ULL /
+						SAMPLE_RATE + jitter;
+				frame.data.assign((const uint8_t *)&src.pcm[0],
+						(const uint8_t *)&src.pcm[0] +
+						src.pcm.size() * sizeof(float));
+
+				double start = now_sec();
+				output.push_source_data(i, frame);
+				cpu += now_sec() - start;
+
+				src.frames += src.chunk;
+			}
+
+			if (src.frames < total)
+				pending = true;
+		}
+	}
+
+	output.disconnect(on_tick, &check);
+
+	size_t expected_ticks = (size_t)(total / AUDIO_OUTPUT_FRAMES);
+	printf("%d sources %d Hz %d ch: %.1f usec per second of audio, "
+			"%.0fx realtime, %d ticks (%d expected), %d wrong\n",
+			SOURCES, SAMPLE_RATE, CHANNELS, cpu * 1e6 / seconds,
+			seconds / cpu, (int)check.ticks, (int)expected_ticks,
+			(int)check.bad_ticks);
+
+	bool ok = check.bad_ticks == 0 && check.ticks + 2 >= expected_ticks;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,273 @@
+/*
+ * Runs the real send thread with coalesce_delay_ms set while audio and
+ * video are handed over in real time, and reads the socketpair as fast as
+ * it can. The stream has to arrive complete and no later than a few
+ * delays behind its media time. A batch takes every packet queued, so the
+ * posts of the semaphore it already served must not each wait out the
+ * delay again: once the stream is through, the thread has to sleep in the
+ * semaphore instead of waking every delay for posts with nothing behind
+ * them, which its voluntary context switches in /proc show.
+ *
+ * Then the reader goes away with a batch still to write. No SIGPIPE
+ * handler is installed, so the write has to come back as an error
+ * instead of killing the process.
+ */
+
+#include <dirent.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "loopback-stream.h"
+
+#define MEDIA_SECONDS   3
+#define FPS             30
+#define VIDEO_BYTES     8000
+#define AUDIO_BYTES     400
+#define COALESCE_MS     20
+#define MAX_DELAY_MS    (5 * COALESCE_MS)
+#define IDLE_MS         500
+#define MAX_IDLE_WAKES  2
+
+static int failures;
+
+#define CHECK(cond, ...) \
+	do { \
+		if (!(cond)) { \
+			printf("FAIL: " __VA_ARGS__); \
+			printf("\n"); \
+			failures++; \
+		} \
+	} while (0)
+
+static uint64_t now_us()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+struct receiver {
+	RTMP            *rtmp;
+	uint64_t        start_us;
+	volatile int    audio;
+	volatile int    video;
+	int64_t         max_delay_ms;
+	int64_t         total_delay_ms;
+};
+
+static void *receive_thread(void *data)
+{
+	receiver *rx = (receiver *)data;
+	RTMPPacket packet;
+
+	memset(&packet, 0, sizeof(packet));
+	while (RTMP_ReadPacket(rx->rtmp, &packet)) {
+		if (!RTMPPacket_IsReady(&packet))
+			continue;
+
+		/* RTMP_Close sends commands of its own on the way out */
+		if (packet.m_packetType == RTMP_PACKET_TYPE_AUDIO)
+			rx->audio++;
+		else if (packet.m_packetType == RTMP_PACKET_TYPE_VIDEO)
+			rx->video++;
+		else {
+			RTMPPacket_Free(&packet);
+			continue;
+		}
+
+		int64_t delay = ((int64_t)(now_us() - rx->start_us) -
+				(int64_t)packet.m_nTimeStamp * 1000) / 1000;
+		rx->total_delay_ms += delay;
+		if (delay > rx->max_delay_ms)
+			rx->max_delay_ms = delay;
+		RTMPPacket_Free(&packet);
+	}
+
+	RTMPPacket_Free(&packet);
+	return NULL;
+}
+
+/* the send thread's voluntary context switches, -1 when it is not found */
+static long send_thread_switches()
+{
+	DIR *dir = opendir("/proc/self/task");
+	struct dirent *entry;
+	long switches = -1;
+
+	while (dir && switches < 0 && (entry = readdir(dir))) {
+		char path[64], line[64];
+		if (entry->d_name[0] == '.')
+			continue;
+
+		/* thread names are cut to 15 characters */
+		snprintf(path, sizeof(path), "/proc/self/task/%s/comm",
+				entry->d_name);
+		FILE *f = fopen(path, "r");
+		bool found = f && fgets(line, sizeof(line), f) &&
+				!strncmp(line, "rtmp-stream: se", 15);
+		if (f)
+			fclose(f);
+		if (!found)
+			continue;
+
+		snprintf(path, sizeof(path), "/proc/self/task/%s/status",
+				entry->d_name);
+		f = fopen(path, "r");
+		while (f && fgets(line, sizeof(line), f))
+			sscanf(line, "voluntary_ctxt_switches: %ld", &switches);
+		if (f)
+			fclose(f);
+	}
+
+	if (dir)
+		closedir(dir);
+	return switches;
+}
+
+static void make_packet(encoder_packet &packet, enum obs_encoder_type type,
+		int64_t time_ms, size_t size, bool keyframe)
+{
+	packet.type          = type;
+	packet.timebase_num  = 1;
+	packet.timebase_den  = 1000;
+	packet.pts           = time_ms;
+	packet.dts           = time_ms;
+	packet.dts_usec      = time_ms * 1000;
+	packet.keyframe      = keyframe;
+	packet.priority      = keyframe ? OBS_NAL_PRIORITY_HIGHEST :
+			OBS_NAL_PRIORITY_HIGH;
+	packet.drop_priority = packet.priority;
+	packet.data.assign(size, (uint8_t)time_ms);
+}
+
+static void coalesce()
+{
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+		CHECK(false, "socketpair");
+		return;
+	}
+
+	receiver rx;
+	memset(&rx, 0, sizeof(rx));
+	rx.rtmp = RTMP_Alloc();
+	RTMP_Init(rx.rtmp);
+	rx.rtmp->m_sb.sb_socket = fds[1];
+	rx.rtmp->m_inChunkSize  = LOOPBACK_CHUNK_SIZE;
+
+	LoopbackStream stream;
+	stream.attach(fds[0]);
+	stream.coalesce_delay_ms = COALESCE_MS;
+
+	bool started = stream.start_send_thread();
+	CHECK(started, "no send thread");
+	if (!started) {
+		close(fds[0]);
+		close(fds[1]);
+		RTMP_Free(rx.rtmp);
+		return;
+	}
+
+	rx.start_us = now_us();
+	pthread_t rx_thread;
+	pthread_create(&rx_thread, NULL, receive_thread, &rx);
+
+	int64_t a = 0, v = 0;
+	while (a * 1024 * 1000 / 48000 < MEDIA_SECONDS * 1000 ||
+			v * 1000 / FPS < MEDIA_SECONDS * 1000) {
+		int64_t ats = 1 + a * 1024 * 1000 / 48000;
+		int64_t vts = 1 + v * 1000 / FPS;
+		int64_t ts = ats <= vts ? ats : vts;
+
+		uint64_t due = rx.start_us + (uint64_t)ts * 1000;
+		uint64_t now = now_us();
+		if (due > now)
+			usleep((useconds_t)(due - now));
+
+		encoder_packet packet;
+		if (ats <= vts) {
+			make_packet(packet, OBS_ENCODER_AUDIO, ats, AUDIO_BYTES, false);
+			a++;
+		} else {
+			make_packet(packet, OBS_ENCODER_VIDEO, vts, VIDEO_BYTES,
+					v % FPS == 0);
+			v++;
+		}
+		stream.post(packet);
+	}
+
+	for (int waited = 0; waited < 5000 &&
+			(rx.audio < a || rx.video < v); waited++)
+		usleep(1000);
+
+	usleep(COALESCE_MS * 2 * 1000);
+	long idle_start = send_thread_switches();
+	usleep(IDLE_MS * 1000);
+	long idle_wakes = send_thread_switches() - idle_start;
+
+	/* the thread closes its end, which ends the reader */
+	stream.stop_send_thread();
+	pthread_join(rx_thread, NULL);
+	close(fds[1]);
+	rx.rtmp->m_sb.sb_socket = -1;
+	RTMP_Free(rx.rtmp);
+
+	int received = rx.audio + rx.video;
+	int average  = received ? (int)(rx.total_delay_ms / received) : 0;
+
+	printf("coalescing %d ms: sent %d audio / %d video, received %d / %d, "
+			"delay %d ms (max %d), %ld wakeups idle\n", COALESCE_MS, (int)a,
+			(int)v, rx.audio, rx.video, average, (int)rx.max_delay_ms,
+			idle_wakes);
+
+	CHECK(rx.audio == a && rx.video == v, "%d of %d packets arrived",
+			received, (int)(a + v));
+	CHECK(rx.max_delay_ms < MAX_DELAY_MS, "packets arrived up to %d ms late",
+			(int)rx.max_delay_ms);
+	CHECK(idle_start >= 0, "send thread not found in /proc");
+	CHECK(idle_wakes <= MAX_IDLE_WAKES, "%ld wakeups in %d ms with nothing "
+			"queued", idle_wakes, IDLE_MS);
+}
+
+static void peer_reset()
+{
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+		CHECK(false, "socketpair");
+		return;
+	}
+
+	LoopbackStream stream;
+	stream.attach(fds[0]);
+	close(fds[1]);
+
+	for (int i = 0; i < 20; i++) {
+		encoder_packet packet;
+		make_packet(packet, i & 1 ? OBS_ENCODER_AUDIO : OBS_ENCODER_VIDEO,
+				1 + i * 10, i & 1 ? AUDIO_BYTES : VIDEO_BYTES, i == 0);
+		stream.queue(packet);
+	}
+
+	int ret = stream.drain();
+	printf("peer gone: batched write returned %d\n", ret);
+	CHECK(ret < 0, "writing to a closed peer did not fail");
+
+	stream.detach();
+	close(fds[0]);
+}
+
+int main()
+{
+	RTMP_LogSetLevel(RTMP_LOGCRIT);
+
+	coalesce();
+	peer_reset();
+
+	if (failures)
+		printf("%d checks failed\n", failures);
+	return failures ? 1 : 0;
+}
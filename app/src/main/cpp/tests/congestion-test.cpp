@@ -0,0 +1,298 @@
+/*
+ * Streams audio and video in real time through RtmpStream into a
+ * socketpair whose reader is throttled to a link rate, and prints a trace
+ * of the send queue every half second.
+ *
+ * On a link slower than the stream the backlog has to stay in the packet
+ * queue where check_to_drop_frames sees it: congestion must rise,
+ * p-frames must be dropped, audio must be promoted past them and arrive
+ * complete and ahead of the video. On a link faster than the stream
+ * nothing may be dropped or promoted.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "loopback-stream.h"
+
+#define MEDIA_SECONDS   4
+#define FPS             30
+#define VIDEO_KBPS      2500
+#define AUDIO_KBPS      128
+#define KEYFRAME_SEC    2
+#define TRACE_MS        500
+
+static uint64_t now_us()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+struct receiver {
+	RTMP            *rtmp;
+	uint64_t        start_us;
+	uint32_t        link_kbps;
+	pthread_mutex_t mutex;
+	int             audio;
+	int             video;
+	uint64_t        bytes;
+	/* how late each track arrives against its media time */
+	int64_t         audio_delay_ms;
+	int64_t         video_delay_ms;
+	int64_t         max_audio_delay_ms;
+	int64_t         max_video_delay_ms;
+	int64_t         total_audio_delay_ms;
+	int64_t         total_video_delay_ms;
+};
+
+/* reads at link_kbps by sleeping off each message's size */
+static void *receive_thread(void *data)
+{
+	receiver *rx = (receiver *)data;
+	RTMPPacket packet;
+
+	memset(&packet, 0, sizeof(packet));
+	while (RTMP_ReadPacket(rx->rtmp, &packet)) {
+		if (!RTMPPacket_IsReady(&packet))
+			continue;
+
+		uint64_t now = now_us();
+		int64_t delay = ((int64_t)(now - rx->start_us) -
+				(int64_t)packet.m_nTimeStamp * 1000) / 1000;
+
+		pthread_mutex_lock(&rx->mutex);
+		if (packet.m_packetType == RTMP_PACKET_TYPE_AUDIO) {
+			rx->audio++;
+			rx->audio_delay_ms = delay;
+			rx->total_audio_delay_ms += delay;
+			if (delay > rx->max_audio_delay_ms)
+				rx->max_audio_delay_ms = delay;
+		} else if (packet.m_packetType == RTMP_PACKET_TYPE_VIDEO) {
+			rx->video++;
+			rx->video_delay_ms = delay;
+			rx->total_video_delay_ms += delay;
+			if (delay > rx->max_video_delay_ms)
+				rx->max_video_delay_ms = delay;
+		}
+		rx->bytes += packet.m_nBodySize;
+		uint64_t due = rx->start_us + rx->bytes * 8 * 1000 / rx->link_kbps;
+		pthread_mutex_unlock(&rx->mutex);
+
+		if (due > now)
+			usleep((useconds_t)(due - now));
+
+		RTMPPacket_Free(&packet);
+	}
+
+	RTMPPacket_Free(&packet);
+	return NULL;
+}
+
+struct producer {
+	LoopbackStream  *stream;
+	receiver        *rx;
+	uint64_t        start_us;
+	bool            trace;
+	volatile bool   done;
+	int             audio;
+	int             video;
+	float           max_congestion;
+};
+
+static void make_packet(encoder_packet &packet, enum obs_encoder_type type,
+		int64_t time_ms, size_t size, bool keyframe)
+{
+	packet.type          = type;
+	packet.timebase_num  = 1;
+	packet.timebase_den  = 1000;
+	packet.pts           = time_ms;
+	packet.dts           = time_ms;
+	packet.dts_usec      = time_ms * 1000;
+	packet.keyframe      = keyframe;
+	packet.priority      = keyframe ? OBS_NAL_PRIORITY_HIGHEST :
+			OBS_NAL_PRIORITY_HIGH;
+	packet.drop_priority = packet.priority;
+	packet.data.assign(size, (uint8_t)time_ms);
+}
+
+static void trace_line(producer *pr, int64_t ts)
+{
+	receiver *rx = pr->rx;
+
+	pthread_mutex_lock(&rx->mutex);
+	printf("  %5d ms  queued %3d  congestion %4.2f  dropped %3d  "
+			"promoted %3d  audio delay %4d ms  video delay %4d ms\n",
+			(int)ts, (int)pr->stream->queued(),
+			pr->stream->get_congestion(),
+			pr->stream->get_dropped_frames(),
+			pr->stream->get_promoted_packets(),
+			(int)rx->audio_delay_ms, (int)rx->video_delay_ms);
+	pthread_mutex_unlock(&rx->mutex);
+}
+
+/* the encoders: packets handed over at their media time */
+static void *produce_thread(void *data)
+{
+	producer *pr = (producer *)data;
+	int64_t a = 0, v = 0, next_trace = TRACE_MS;
+	size_t audio_bytes = AUDIO_KBPS * 1000 / 8 * 1024 / 48000;
+	size_t video_bytes = VIDEO_KBPS * 1000 / 8 / FPS;
+
+	while (a * 1024 * 1000 / 48000 < MEDIA_SECONDS * 1000 ||
+			v * 1000 / FPS < MEDIA_SECONDS * 1000) {
+		int64_t ats = 1 + a * 1024 * 1000 / 48000;
+		int64_t vts = 1 + v * 1000 / FPS;
+		int64_t ts = ats <= vts ? ats : vts;
+
+		uint64_t due = pr->start_us + (uint64_t)ts * 1000;
+		uint64_t now = now_us();
+		if (due > now)
+			usleep((useconds_t)(due - now));
+
+		encoder_packet packet;
+		if (ats <= vts) {
+			make_packet(packet, OBS_ENCODER_AUDIO, ats, audio_bytes, false);
+			pr->stream->queue(packet);
+			pr->audio++;
+			a++;
+		} else {
+			bool keyframe = v % (FPS * KEYFRAME_SEC) == 0;
+			make_packet(packet, OBS_ENCODER_VIDEO, vts,
+					keyframe ? video_bytes * 6 : video_bytes * 9 / 10,
+					keyframe);
+			pr->stream->queue(packet);
+			pr->video++;
+			v++;
+		}
+
+		float congestion = pr->stream->get_congestion();
+		if (congestion > pr->max_congestion)
+			pr->max_congestion = congestion;
+
+		if (pr->trace && ts >= next_trace) {
+			trace_line(pr, ts);
+			next_trace += TRACE_MS;
+		}
+	}
+
+	pr->done = true;
+	return NULL;
+}
+
+static int failures;
+
+#define CHECK(cond, ...) \
+	do { \
+		if (!(cond)) { \
+			printf("FAIL: " __VA_ARGS__); \
+			printf("\n"); \
+			failures++; \
+		} \
+	} while (0)
+
+static void run(uint32_t link_kbps, bool congested)
+{
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+		CHECK(false, "socketpair");
+		return;
+	}
+
+	/* keep the kernel from soaking up the backlog */
+	int buf_size = 16 * 1024;
+	setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &buf_size, sizeof(buf_size));
+	setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &buf_size, sizeof(buf_size));
+
+	printf("%u kbps link, %u kbps stream:\n", link_kbps,
+			VIDEO_KBPS + AUDIO_KBPS);
+
+	receiver rx;
+	memset(&rx, 0, sizeof(rx));
+	pthread_mutex_init(&rx.mutex, NULL);
+	rx.rtmp = RTMP_Alloc();
+	RTMP_Init(rx.rtmp);
+	rx.rtmp->m_sb.sb_socket = fds[1];
+	rx.rtmp->m_inChunkSize  = LOOPBACK_CHUNK_SIZE;
+	rx.link_kbps = link_kbps;
+
+	LoopbackStream stream;
+	stream.attach(fds[0]);
+
+	producer pr;
+	memset(&pr, 0, sizeof(pr));
+	pr.stream = &stream;
+	pr.rx     = &rx;
+	pr.trace  = true;
+
+	rx.start_us = pr.start_us = now_us();
+
+	pthread_t rx_thread, pr_thread;
+	pthread_create(&rx_thread, NULL, receive_thread, &rx);
+	pthread_create(&pr_thread, NULL, produce_thread, &pr);
+
+	int ret = 0;
+	while (ret >= 0 && !pr.done) {
+		ret = stream.wakeup();
+		if (ret == 0)
+			usleep(1000);
+	}
+	pthread_join(pr_thread, NULL);
+	if (ret >= 0)
+		ret = stream.drain();
+
+	shutdown(fds[0], SHUT_WR);
+	pthread_join(rx_thread, NULL);
+	stream.detach();
+	close(fds[0]);
+	close(fds[1]);
+	rx.rtmp->m_sb.sb_socket = -1;
+	RTMP_Free(rx.rtmp);
+
+	int dropped  = stream.get_dropped_frames();
+	int promoted = stream.get_promoted_packets();
+	int lost     = pr.video - rx.video;
+	int audio_ms = rx.audio ? (int)(rx.total_audio_delay_ms / rx.audio) : 0;
+	int video_ms = rx.video ? (int)(rx.total_video_delay_ms / rx.video) : 0;
+
+	printf("  sent %d audio / %d video, received %d / %d, %d dropped, "
+			"%d promoted, max congestion %.2f\n  delay audio %d ms "
+			"(max %d), video %d ms (max %d)\n", pr.audio, pr.video,
+			rx.audio, rx.video, dropped, promoted, pr.max_congestion,
+			audio_ms, (int)rx.max_audio_delay_ms, video_ms,
+			(int)rx.max_video_delay_ms);
+
+	CHECK(ret >= 0, "send failed");
+	CHECK(rx.audio == pr.audio, "%d audio packets lost", pr.audio - rx.audio);
+	CHECK(lost == dropped, "%d video frames lost but %d counted as dropped",
+			lost, dropped);
+
+	if (congested) {
+		CHECK(pr.max_congestion >= 0.5f,
+				"congestion never rose above %.2f", pr.max_congestion);
+		CHECK(dropped > 0, "no video dropped on a link slower than the stream");
+		CHECK(promoted > 0, "no audio promoted past the backlog");
+		CHECK(rx.max_audio_delay_ms < rx.max_video_delay_ms,
+				"audio delay peaked at %d ms, video at %d ms",
+				(int)rx.max_audio_delay_ms, (int)rx.max_video_delay_ms);
+		CHECK(audio_ms < video_ms, "audio %d ms behind on average, video %d ms",
+				audio_ms, video_ms);
+	} else {
+		CHECK(dropped == 0, "%d frames dropped on a fast link", dropped);
+		CHECK(promoted == 0, "%d packets promoted on a fast link", promoted);
+	}
+}
+
+int main()
+{
+	run(1000, true);
+	run(8000, false);
+
+	if (failures)
+		printf("%d checks failed\n", failures);
+	return failures ? 1 : 0;
+}
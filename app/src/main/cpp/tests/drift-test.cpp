@@ -0,0 +1,154 @@
+/*
+ * Feeds X264Encoder's frame clock with synthetic capture timestamps:
+ * a steady 30 fps source whose clock runs 300 ppm fast has to be slewed
+ * back to within the drift bound, while a screen that only sends frames
+ * on change, with long static gaps between bursts, must not be slewed at
+ * all. Also checks clock_drift never reports more than DRIFT_MAX_PPM of
+ * the time measured.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "rtmp-encoder.h"
+
+#define FPS          30
+#define SCALE        100
+#define FRAME_NS     (1000000000LL / FPS)
+#define START_NS     5000000000ULL
+#define JITTER_NS    2000000
+
+static int failures;
+
+#define CHECK(cond, ...) \
+	do { \
+		if (!(cond)) { \
+			printf("FAIL: " __VA_ARGS__); \
+			printf("\n"); \
+			failures++; \
+		} \
+	} while (0)
+
+static unsigned seed = 1;
+
+static int64_t jitter()
+{
+	seed = seed * 1103515245 + 12345;
+	return (int64_t)((seed >> 8) % (2 * JITTER_NS)) - JITTER_NS;
+}
+
+static void init_encoder(X264Encoder &encoder)
+{
+	encoder.timebase_num = 1 * SCALE;
+	encoder.timebase_den = FPS * SCALE;
+	encoder.cur_pts = 0;
+	encoder.drift.reset();
+	encoder.drift_corrected_ns = 0;
+}
+
+static int64_t pts_ns(X264Encoder &encoder)
+{
+	return encoder.cur_pts * 1000000000LL * encoder.timebase_num /
+			encoder.timebase_num / encoder.timebase_den;
+}
+
+/* 20 minutes at 30 fps from a capture clock running 300 ppm fast */
+static void steady_source()
+{
+	X264Encoder encoder;
+	init_encoder(encoder);
+
+	int64_t frames = 20 * 60 * FPS;
+	int64_t worst = 0;
+
+	for (int64_t k = 0; k < frames; k++) {
+		int64_t capture = k * FRAME_NS + k * FRAME_NS / 1000000 * 300;
+
+		/* pts are where this frame is shown, capture time where it was
+		 * taken: the gap between them is what the player sees drift by */
+		int64_t lag = capture - pts_ns(encoder);
+		if (k > 60 * FPS && llabs(lag) > worst)
+			worst = llabs(lag);
+
+		encoder.advance_pts(START_NS + capture + jitter());
+	}
+
+	printf("steady source: drift %lld us, corrected %lld us, worst lag "
+			"after the first minute %lld us\n",
+			(long long)encoder.get_clock_drift_usec(),
+			(long long)encoder.get_drift_corrected_usec(),
+			(long long)(worst / 1000));
+
+	CHECK(encoder.get_drift_corrected_usec() > 300000,
+			"only %lld us of 360 ms drift corrected",
+			(long long)encoder.get_drift_corrected_usec());
+	CHECK(worst < DRIFT_BOUND_NS + JITTER_NS, "lag reached %lld us",
+			(long long)(worst / 1000));
+}
+
+/* bursts of 2 to 8 s at 30 fps separated by static gaps of 0.2 to 3 s */
+static void change_only_source()
+{
+	X264Encoder encoder;
+	init_encoder(encoder);
+
+	int64_t now = 0, sent = 0, worst = 0;
+
+	while (now < 20LL * 60 * 1000000000LL) {
+		seed = seed * 1103515245 + 12345;
+		int64_t burst = (2 + (seed >> 8) % 7) * FPS;
+
+		for (int64_t i = 0; i < burst; i++) {
+			encoder.advance_pts(START_NS + now + jitter());
+			now += FRAME_NS;
+			sent++;
+
+			int64_t corrected = encoder.drift_corrected_ns;
+			if (llabs(corrected) > worst)
+				worst = llabs(corrected);
+		}
+
+		seed = seed * 1103515245 + 12345;
+		now += 200000000LL + (int64_t)((seed >> 8) % 2800) * 1000000LL;
+	}
+
+	int64_t slewed = encoder.cur_pts - sent * encoder.timebase_num;
+
+	printf("change-only source: %lld frames, %lld pts units slewed, "
+			"largest correction %lld us\n", (long long)sent,
+			(long long)slewed, (long long)(worst / 1000));
+
+	CHECK(slewed == 0 && worst == 0,
+			"static gaps were slewed towards: %lld units", (long long)slewed);
+}
+
+/* an offset growing at 5% is a stepping clock, not drift */
+static void drift_bound()
+{
+	clock_drift drift;
+	int64_t worst = 0;
+
+	for (uint64_t k = 0; k < 20000; k++) {
+		uint64_t media = k * FRAME_NS;
+		uint64_t capture = media + media / 20;
+		drift.update(capture, media);
+
+		int64_t bound = (int64_t)(capture / 1000000 * DRIFT_MAX_PPM);
+		if (llabs(drift.get_drift_ns()) - bound > worst)
+			worst = llabs(drift.get_drift_ns()) - bound;
+	}
+
+	CHECK(worst <= 0, "drift exceeded %d ppm by %lld ns", DRIFT_MAX_PPM,
+			(long long)worst);
+}
+
+int main()
+{
+	steady_source();
+	change_only_source();
+	drift_bound();
+
+	if (failures)
+		printf("%d checks failed\n", failures);
+	return failures ? 1 : 0;
+}
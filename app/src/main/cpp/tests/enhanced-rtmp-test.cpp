@@ -0,0 +1,557 @@
+/*
+ * Enhanced RTMP for HEVC and AV1, the way RtmpStream sends it: the encoder's
+ * parameter sets or sequence header out as hvcC and av1C, frames through
+ * X264Encoder::parse_packet and FLVPackager::flv_packet_mux, written into a
+ * socketpair and read back as RTMP messages.
+ *
+ * Every video message has to carry the ExVideoTagHeader with the frame
+ * type and packet type, the codec's FourCC and a payload that is the frame
+ * in length prefixed NALs or sized OBUs. HEVC sent IBBP with b-frame dts
+ * rebuilt has to carry the signed composition time on CodedFrames and
+ * leave it out as CodedFramesX where it is zero; AV1 never carries one.
+ *
+ * try_connect against a stub server has to announce the FourCC in the
+ * connect command's fourCcList, and leave the list out for H.264.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "librtmp/rtmp.h"
+#include "librtmp/log.h"
+#include "loopback-stream.h"
+#include "rtmp-encoder.h"
+#include "rtmp-video-bitstream.h"
+#include "rtmp-video-output.h"
+
+#define FPS           30
+#define FRAME_UNITS   100
+#define GOPS          3
+
+/* ExVideoTagHeader */
+#define EX_HEADER           0x80
+#define EX_FRAME_KEY        0x10
+#define EX_FRAME_INTER      0x20
+#define EX_SEQUENCE_START   0
+#define EX_CODED_FRAMES     1
+#define EX_CODED_FRAMES_X   3
+
+static int failures;
+
+#define CHECK(cond, ...) \
+	do { \
+		if (!(cond)) { \
+			printf("FAIL: " __VA_ARGS__); \
+			printf("\n"); \
+			failures++; \
+		} \
+	} while (0)
+
+/* VPS, SPS and PPS of a 64x64 8 bit stream, annex B */
+static const uint8_t hevc_csd[] = {
+	0x00, 0x00, 0x00, 0x01, 0x40, 0x01, 0x0c, 0x01, 0xff, 0xff, 0x04, 0x08,
+	0x00, 0x00, 0x03, 0x00, 0x9e, 0x08, 0x00, 0x00, 0x03, 0x00, 0x00, 0x1e,
+	0x91, 0x10, 0x09, 0x00, 0x00, 0x00, 0x01, 0x42, 0x01, 0x01, 0x04, 0x08,
+	0x00, 0x00, 0x03, 0x00, 0x9e, 0x08, 0x00, 0x00, 0x03, 0x00, 0x00, 0x1e,
+	0x90, 0x04, 0x10, 0x20, 0xb2, 0xc8, 0x89, 0x24, 0x99, 0x5e, 0x02, 0xdc,
+	0x08, 0x08, 0x00, 0x10, 0x00, 0x00, 0x03, 0x00, 0x10, 0x00, 0x00, 0x03,
+	0x01, 0xe0, 0x80, 0x00, 0x00, 0x00, 0x01, 0x44, 0x01, 0xc1, 0x72, 0x86,
+	0x0c, 0x42, 0x24,
+};
+
+/* the sequence header OBU of a 64x64 main profile stream, with its size */
+static const uint8_t av1_csd[] = {
+	0x0a, 0x0d, 0x20, 0x00, 0x00, 0x02, 0xaf, 0xff, 0x9b, 0x5f, 0x24, 0x04,
+	0x34, 0x00, 0x80,
+};
+
+struct codec_case {
+	const char    *codec;
+	uint32_t      fourcc;
+	const uint8_t *csd;
+	size_t        csd_size;
+	/* display order of one gop after its keyframe, in decode order */
+	int           length;
+	int           order[4];
+	int           depth;
+};
+
+/* RtmpStream with the encoder it would get from its output */
+class EnhancedStream : public LoopbackStream {
+public:
+	std::shared_ptr<X264Encoder> encoder;
+
+	std::shared_ptr<media_encoder> get_video_encoder() override
+	{
+		return encoder;
+	}
+
+	int connect()
+	{
+		return try_connect();
+	}
+
+	bool send_header()
+	{
+		return send_video_header();
+	}
+
+	/* what encoded_packet does with the first video packet */
+	void set_start(encoder_packet &packet)
+	{
+		start_dts_offset = packet.get_ms_time(packet.dts);
+		got_first_video  = true;
+	}
+};
+
+static uint32_t be16(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 8 | p[1];
+}
+
+static uint32_t be24(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2];
+}
+
+static uint32_t be32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | be24(p + 1);
+}
+
+static int32_t ms(int64_t units)
+{
+	return (int32_t)(units * 1000 / (FPS * FRAME_UNITS));
+}
+
+/* the NALs of an annex B buffer, start codes stripped */
+static void split_nals(const uint8_t *data, size_t size,
+		std::vector<std::vector<uint8_t> > &nals)
+{
+	std::vector<size_t> starts;
+
+	for (size_t i = 0; i + 3 <= size; i++)
+		if (!data[i] && !data[i + 1] && data[i + 2] == 1)
+			starts.push_back(i + 3);
+
+	nals.clear();
+	for (size_t i = 0; i < starts.size(); i++) {
+		size_t end = i + 1 < starts.size() ? starts[i + 1] - 3 : size;
+
+		/* the leading zero of a 4 byte start code */
+		if (i + 1 < starts.size() && end > starts[i] && !data[end - 1])
+			end--;
+		nals.push_back(std::vector<uint8_t>(data + starts[i], data + end));
+	}
+}
+
+/* one frame as the encoder hands it out: an IDR or trailing slice for
+ * HEVC, a temporal delimiter and a frame OBU for AV1 */
+static void make_frame(const codec_case &cc, std::vector<uint8_t> &data,
+		bool keyframe, int index)
+{
+	static const uint8_t start[4] = {0, 0, 0, 1};
+
+	if (cc.fourcc == VIDEO_FOURCC_HEVC) {
+		data.assign(start, start + 4);
+		data.push_back(keyframe ? 0x26 : 0x02);
+		data.push_back(0x01);
+	} else {
+		data.clear();
+		data.push_back(0x12);
+		data.push_back(0x00);
+		data.push_back(0x32);
+		data.push_back(17);
+		/* show_existing_frame 0, frame_type KEY or INTER, show_frame */
+		data.push_back(keyframe ? 0x10 : 0x30);
+	}
+	for (int i = 0; i < 16; i++)
+		data.push_back((uint8_t)(index + i + 1));
+}
+
+static bool read_video(RTMP *rtmp, RTMPPacket &packet)
+{
+	RTMPPacket_Free(&packet);
+	while (RTMP_ReadPacket(rtmp, &packet)) {
+		if (!RTMPPacket_IsReady(&packet))
+			continue;
+		if (packet.m_packetType == RTMP_PACKET_TYPE_VIDEO)
+			return true;
+		RTMPPacket_Free(&packet);
+	}
+	return false;
+}
+
+static void check_hvcc(const uint8_t *p, size_t size)
+{
+	std::vector<std::vector<uint8_t> > nals;
+	split_nals(hevc_csd, sizeof(hevc_csd), nals);
+
+	if (size < 23 || p[0] != 1 || p[22] != 3) {
+		CHECK(false, "hevc: hvcC of %zu bytes, version %d, %d arrays", size,
+				size ? p[0] : 0, size >= 23 ? p[22] : 0);
+		return;
+	}
+
+	/* profile space, tier and profile, the sps's first byte past its nal
+	 * header and ids */
+	CHECK(nals.size() == 3 && nals[1].size() > 3 && p[1] == nals[1][3],
+			"hevc: hvcC profile %02x differs from the sps", p[1]);
+
+	size_t pos = 23;
+	for (int i = 0; i < 3; i++) {
+		if (pos + 5 > size) {
+			CHECK(false, "hevc: hvcC ends in array %d", i);
+			return;
+		}
+
+		int type = p[pos] & 0x3f;
+		uint32_t count = be16(p + pos + 1);
+		uint32_t nal_size = be16(p + pos + 3);
+		pos += 5;
+
+		CHECK(type == 32 + i && count == 1, "hevc: hvcC array %d has %u "
+				"of nal type %d", i, count, type);
+		if (pos + nal_size > size || nals.size() != 3) {
+			CHECK(false, "hevc: hvcC nal %d runs past the record", i);
+			return;
+		}
+		CHECK(nal_size == nals[i].size() &&
+				!memcmp(p + pos, &nals[i][0], nal_size), "hevc: hvcC nal "
+				"type %d differs from the parameter set", type);
+		pos += nal_size;
+	}
+	CHECK(pos == size, "hevc: %zu bytes after the hvcC arrays", size - pos);
+}
+
+static void check_av1c(const uint8_t *p, size_t size)
+{
+	CHECK(size == 4 + sizeof(av1_csd) && p[0] == 0x81 &&
+			!memcmp(p + 4, av1_csd, sizeof(av1_csd)), "av1: av1C of %zu "
+			"bytes, marker %02x, without the sequence header OBU", size,
+			size ? p[0] : 0);
+}
+
+/* the frame as the tag should carry it: one length prefixed NAL, or the
+ * frame OBU without its temporal delimiter */
+static void expected_payload(const codec_case &cc,
+		const std::vector<uint8_t> &frame, std::vector<uint8_t> &payload)
+{
+	if (cc.fourcc == VIDEO_FOURCC_HEVC) {
+		uint32_t size = (uint32_t)frame.size() - 4;
+		payload.clear();
+		payload.push_back((uint8_t)(size >> 24));
+		payload.push_back((uint8_t)(size >> 16));
+		payload.push_back((uint8_t)(size >> 8));
+		payload.push_back((uint8_t)size);
+		payload.insert(payload.end(), frame.begin() + 4, frame.end());
+	} else {
+		payload.assign(frame.begin() + 2, frame.end());
+	}
+}
+
+static void loopback(const codec_case &cc)
+{
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+		CHECK(false, "socketpair");
+		return;
+	}
+
+	RTMP *rx = RTMP_Alloc();
+	RTMP_Init(rx);
+	rx->m_sb.sb_socket = fds[1];
+	rx->m_inChunkSize  = LOOPBACK_CHUNK_SIZE;
+
+	video_output_info info;
+	info.name    = "video";
+	info.format  = VIDEO_FORMAT_NONE;
+	info.fps_num = FPS;
+	info.fps_den = 1;
+	info.width   = 64;
+	info.height  = 64;
+
+	std::shared_ptr<VideoOutput> video(new VideoOutput(info));
+	std::shared_ptr<media_output> media = video;
+	video->format_csd0.assign(cc.csd, cc.csd + cc.csd_size);
+
+	EnhancedStream stream;
+	stream.aggregate_budget_ms = 0;
+	stream.encoder = std::make_shared<X264Encoder>();
+	stream.encoder->codec = cc.codec;
+	stream.encoder->set_video(media);
+	stream.encoder->reorder_frames = cc.depth;
+	stream.encoder->reset_reorder();
+	stream.attach(fds[0]);
+
+	RTMPPacket packet;
+	memset(&packet, 0, sizeof(packet));
+
+	CHECK(stream.send_header(), "%s: sending the sequence header", cc.codec);
+	if (!read_video(rx, packet)) {
+		CHECK(false, "%s: no sequence header", cc.codec);
+	} else {
+		const uint8_t *body = (const uint8_t *)packet.m_body;
+		uint32_t size = packet.m_nBodySize;
+
+		CHECK(size > 5 && body[0] == (EX_HEADER | EX_FRAME_KEY |
+				EX_SEQUENCE_START) && be32(body + 1) == cc.fourcc,
+				"%s: sequence header %02x, fourcc %08x", cc.codec,
+				size ? body[0] : 0, size > 5 ? be32(body + 1) : 0);
+		if (size > 5) {
+			if (cc.fourcc == VIDEO_FOURCC_HEVC)
+				check_hvcc(body + 5, size - 5);
+			else
+				check_av1c(body + 5, size - 5);
+		}
+	}
+
+	int frames = 1 + GOPS * cc.length;
+	int32_t dts_offset = 0;
+	int with_cts = 0, without_cts = 0;
+
+	for (int k = 0; k < frames; k++) {
+		int display = k ? 1 + (k - 1) / cc.length * cc.length +
+				cc.order[(k - 1) % cc.length] : 0;
+		bool key = !k;
+
+		encoder_frame frame;
+		make_frame(cc, frame.data, key, k);
+		frame.frames = 1;
+		frame.pts    = (int64_t)display * FRAME_UNITS;
+
+		encoder_packet encoded;
+		bool received = false;
+		encoded.timebase_num = stream.encoder->timebase_num;
+		encoded.timebase_den = stream.encoder->timebase_den;
+		stream.encoder->encode(frame, encoded, received);
+		CHECK(received && encoded.keyframe == key, "%s: frame %d received "
+				"%d, keyframe %d", cc.codec, k, received, encoded.keyframe);
+
+		if (!k) {
+			stream.set_start(encoded);
+			dts_offset = encoded.get_ms_time(encoded.dts);
+		}
+
+		encoder_packet flv = X264Encoder::parse_packet(encoded);
+		stream.queue(flv);
+		CHECK(stream.drain() == 0, "%s: frame %d not sent", cc.codec, k);
+
+		if (!read_video(rx, packet)) {
+			CHECK(false, "%s: frame %d did not arrive", cc.codec, k);
+			break;
+		}
+
+		const uint8_t *body = (const uint8_t *)packet.m_body;
+		uint32_t size = packet.m_nBodySize;
+		int32_t cts = ms(encoded.pts) - ms(encoded.dts);
+		bool hevc = cc.fourcc == VIDEO_FOURCC_HEVC;
+		int type = hevc && !cts ? EX_CODED_FRAMES_X : EX_CODED_FRAMES;
+		size_t header = 5 + (hevc && cts ? 3 : 0);
+
+		if (size < header) {
+			CHECK(false, "%s: frame %d of %u bytes", cc.codec, k, size);
+			continue;
+		}
+
+		CHECK(body[0] == (EX_HEADER | type | (key ? EX_FRAME_KEY :
+				EX_FRAME_INTER)), "%s: frame %d header %02x, expected "
+				"packet type %d", cc.codec, k, body[0], type);
+		CHECK(be32(body + 1) == cc.fourcc, "%s: frame %d fourcc %08x",
+				cc.codec, k, be32(body + 1));
+		CHECK((int32_t)packet.m_nTimeStamp == ms(encoded.dts) - dts_offset,
+				"%s: frame %d time %u, dts %d ms", cc.codec, k,
+				packet.m_nTimeStamp, ms(encoded.dts) - dts_offset);
+
+		if (header == 8) {
+			int32_t tag_cts = (int32_t)(be24(body + 5) << 8) >> 8;
+			CHECK(tag_cts == cts, "%s: frame %d composition time %d, "
+					"expected %d", cc.codec, k, tag_cts, cts);
+			with_cts++;
+		} else {
+			without_cts++;
+		}
+
+		std::vector<uint8_t> payload;
+		expected_payload(cc, frame.data, payload);
+		CHECK(size - header == payload.size() &&
+				!memcmp(body + header, &payload[0], payload.size()),
+				"%s: frame %d payload of %zu bytes, expected %zu", cc.codec,
+				k, (size_t)(size - header), payload.size());
+	}
+
+	printf("%s: %d frames, %d with a composition time, %d without\n",
+			cc.codec, frames, with_cts, without_cts);
+	if (cc.depth)
+		CHECK(with_cts && without_cts, "%s: b-frames sent no CodedFrames "
+				"and CodedFramesX mix", cc.codec);
+	else
+		CHECK(!with_cts, "%s: composition time without b-frames",
+				cc.codec);
+
+	RTMPPacket_Free(&packet);
+	stream.detach();
+	close(fds[0]);
+	close(fds[1]);
+	rx->m_sb.sb_socket = -1;
+	RTMP_Free(rx);
+}
+
+struct stub_server {
+	int         listen_fd;
+	int         port;
+	bool        got_connect;
+	bool        has_list;
+	std::string list;
+};
+
+/* handshakes, reads up to the connect command and hangs up */
+static void *server_thread(void *data)
+{
+	stub_server *srv = (stub_server *)data;
+	int fd = accept(srv->listen_fd, NULL, NULL);
+	if (fd < 0)
+		return NULL;
+
+	RTMP *rtmp = RTMP_Alloc();
+	RTMP_Init(rtmp);
+	rtmp->m_sb.sb_socket = fd;
+
+	RTMPPacket packet;
+	memset(&packet, 0, sizeof(packet));
+
+	bool served = RTMP_Serve(rtmp) != 0;
+
+	while (served && RTMP_ReadPacket(rtmp, &packet)) {
+		if (!RTMPPacket_IsReady(&packet))
+			continue;
+
+		if (packet.m_packetType == RTMP_PACKET_TYPE_CHUNK_SIZE) {
+			rtmp->m_inChunkSize = AMF_DecodeInt32(packet.m_body);
+			RTMPPacket_Free(&packet);
+			continue;
+		}
+		if (packet.m_packetType != RTMP_PACKET_TYPE_INVOKE) {
+			RTMPPacket_Free(&packet);
+			continue;
+		}
+
+		AMFObject obj, command;
+		if (AMF_Decode(&obj, packet.m_body, packet.m_nBodySize, FALSE) >= 0) {
+			AMFProp_GetObject(AMF_GetProp(&obj, NULL, 2), &command);
+
+			AVal name = {(char *)"fourCcList", 10};
+			AMFObjectProperty *list = AMF_GetProp(&command, &name, -1);
+
+			srv->got_connect = true;
+			srv->has_list = list && list->p_type == AMF_STRICT_ARRAY;
+			for (int i = 0; srv->has_list &&
+					i < AMF_CountProp(&list->p_vu.p_object); i++) {
+				AVal item;
+				AMFProp_GetString(AMF_GetProp(&list->p_vu.p_object, NULL, i),
+						&item);
+				if (i)
+					srv->list += ',';
+				srv->list.append(item.av_val, item.av_len);
+			}
+			AMF_Reset(&obj);
+		}
+		break;
+	}
+
+	RTMPPacket_Free(&packet);
+	close(fd);
+	rtmp->m_sb.sb_socket = -1;
+	RTMP_Free(rtmp);
+	return NULL;
+}
+
+static bool server_start(stub_server *srv, pthread_t *thread)
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	int one = 1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family      = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	srv->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	setsockopt(srv->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(srv->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+			listen(srv->listen_fd, 1) != 0 ||
+			getsockname(srv->listen_fd, (struct sockaddr *)&addr, &len) != 0) {
+		close(srv->listen_fd);
+		return false;
+	}
+	srv->port = ntohs(addr.sin_port);
+	return pthread_create(thread, NULL, server_thread, srv) == 0;
+}
+
+static void connect_list(const char *codec, const char *expect)
+{
+	stub_server srv;
+	srv.got_connect = false;
+	srv.has_list    = false;
+
+	pthread_t thread;
+	if (!server_start(&srv, &thread)) {
+		CHECK(false, "%s: stub server", codec);
+		return;
+	}
+
+	char url[64];
+	snprintf(url, sizeof(url), "rtmp://127.0.0.1:%d/live", srv.port);
+
+	EnhancedStream stream;
+	stream.encoder = std::make_shared<X264Encoder>();
+	stream.encoder->codec = codec;
+	stream.path = url;
+	stream.key  = "stream";
+
+	/* the server hangs up after connect, so this fails on purpose */
+	stream.connect();
+	pthread_join(thread, NULL);
+	close(srv.listen_fd);
+
+	printf("%s: connect %s fourCcList [%s]\n", codec,
+			srv.has_list ? "with" : "without", srv.list.c_str());
+
+	CHECK(srv.got_connect, "%s: no connect command", codec);
+	if (expect)
+		CHECK(srv.has_list && srv.list == expect, "%s: fourCcList [%s], "
+				"expected [%s]", codec, srv.list.c_str(), expect);
+	else
+		CHECK(!srv.has_list, "%s: fourCcList sent for a legacy codec",
+				codec);
+}
+
+int main()
+{
+	static const codec_case cases[] = {
+		{"hevc", VIDEO_FOURCC_HEVC, hevc_csd, sizeof(hevc_csd),
+				3, {2, 0, 1}, 1},
+		{"av1",  VIDEO_FOURCC_AV1,  av1_csd,  sizeof(av1_csd),
+				1, {0},       0},
+	};
+
+	RTMP_LogSetLevel(RTMP_LOGCRIT);
+
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+		loopback(cases[i]);
+
+	connect_list("hevc", "hvc1");
+	connect_list("av1", "av01");
+	connect_list("h264", NULL);
+
+	if (failures)
+		printf("%d checks failed\n", failures);
+	return failures ? 1 : 0;
+}
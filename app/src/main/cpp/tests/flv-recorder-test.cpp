@@ -0,0 +1,432 @@
+/*
+ * Records a stream with FlvRecorder, once from encoder packets behind
+ * the packager's onMetaData and once from FLV bodies as an RTMP publisher
+ * sends them, then walks the file: every PreviousTagSize must be 11 plus
+ * the DataSize of the tag before it, the chain has to end exactly at the
+ * end of the file, every tag written must be there with its body intact,
+ * and duration and filesize must be patched into the onMetaData. Keyframes
+ * are large enough to span the recorder's write buffers.
+ *
+ * Then RtmpStream records with its connection down: encoded_packet still
+ * has to hand every packet to the recording, timed from the recording's
+ * own first keyframe, and stop has to close the file.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#include "librtmp/rtmp.h"
+#include "rtmp-flv-packager.h"
+#include "rtmp-flv-recorder.h"
+#include "rtmp-stream.h"
+#include "rtmp-video-bitstream.h"
+
+#define SECONDS 10
+#define FPS     30
+
+static int failures;
+
+#define CHECK(cond, ...) \
+	do { \
+		if (!(cond)) { \
+			printf("FAIL: " __VA_ARGS__); \
+			printf("\n"); \
+			failures++; \
+		} \
+	} while (0)
+
+struct file_tag {
+	uint8_t              type;
+	int32_t              time_ms;
+	std::vector<uint8_t> body;
+};
+
+static uint32_t read_be24(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+}
+
+static uint32_t read_be32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | read_be24(p + 1);
+}
+
+static double read_double(const uint8_t *p)
+{
+	uint64_t bits = 0;
+	double value;
+
+	for (int i = 0; i < 8; i++)
+		bits = (bits << 8) | p[i];
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+static bool read_file(const char *path, std::vector<uint8_t> &data)
+{
+	FILE *f = fopen(path, "rb");
+	if (!f)
+		return false;
+
+	uint8_t buf[65536];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+		data.insert(data.end(), buf, buf + n);
+	fclose(f);
+	return true;
+}
+
+/* walks the back pointer chain, false where it breaks */
+static bool parse_flv(const std::vector<uint8_t> &file,
+		std::vector<file_tag> &tags)
+{
+	if (file.size() < 13 || memcmp(&file[0], "FLV", 3) != 0) {
+		CHECK(false, "no flv header");
+		return false;
+	}
+
+	size_t pos = read_be32(&file[5]);
+	CHECK(pos == 9, "header size %u", (unsigned)pos);
+	CHECK(read_be32(&file[pos]) == 0, "PreviousTagSize0 is %u",
+			read_be32(&file[pos]));
+	pos += 4;
+
+	while (pos < file.size()) {
+		if (pos + 11 > file.size()) {
+			CHECK(false, "truncated tag header at %u", (unsigned)pos);
+			return false;
+		}
+
+		const uint8_t *p = &file[pos];
+		uint32_t data_size = read_be24(p + 1);
+
+		if (pos + 11 + data_size + 4 > file.size()) {
+			CHECK(false, "tag at %u overruns the file", (unsigned)pos);
+			return false;
+		}
+
+		uint32_t back = read_be32(p + 11 + data_size);
+		if (back != 11 + data_size) {
+			CHECK(false, "tag %d at %u: PreviousTagSize %u for DataSize %u",
+					(int)tags.size(), (unsigned)pos, back, data_size);
+			return false;
+		}
+
+		file_tag tag;
+		tag.type    = p[0];
+		tag.time_ms = (int32_t)(read_be24(p + 4) | ((uint32_t)p[7] << 24));
+		tag.body.assign(p + 11, p + 11 + data_size);
+		tags.push_back(tag);
+
+		pos += 11 + data_size + 4;
+	}
+
+	return pos == file.size();
+}
+
+static double meta_number(const file_tag &meta, const char *name)
+{
+	size_t len = strlen(name);
+	const std::vector<uint8_t> &b = meta.body;
+
+	for (size_t i = 0; i + 2 + len + 9 <= b.size(); i++)
+		if (b[i] == 0 && b[i + 1] == len && memcmp(&b[i + 2], name, len) == 0 &&
+				b[i + 2 + len] == 0)
+			return read_double(&b[i + 3 + len]);
+	return -1.0;
+}
+
+static void fill(std::vector<uint8_t> &data, size_t size, unsigned seed)
+{
+	data.resize(size);
+	for (size_t i = 0; i < size; i++) {
+		seed = seed * 1103515245 + 12345;
+		data[i] = (uint8_t)(seed >> 16);
+	}
+}
+
+static void make_packet(encoder_packet &packet, enum obs_encoder_type type,
+		int64_t time_ms, size_t size, bool keyframe, uint32_t fourcc)
+{
+	packet.type         = type;
+	packet.timebase_num = 1;
+	packet.timebase_den = 1000;
+	packet.pts          = time_ms;
+	packet.dts          = time_ms;
+	packet.keyframe     = keyframe;
+	packet.fourcc       = fourcc;
+	fill(packet.data, size, (unsigned)time_ms * 31 + (unsigned)type);
+}
+
+/* a second of 30 fps video has a keyframe bigger than a write buffer */
+static size_t video_size(int64_t v)
+{
+	return v % FPS == 0 ? 700 * 1024 : 9000 + (size_t)(v % 7) * 1000;
+}
+
+static void record_packets(const char *path, uint32_t fourcc)
+{
+	FLVPackager packager;
+	packager.has_video         = true;
+	packager.width             = 1280;
+	packager.height            = 720;
+	packager.video_codec_id    = 7;
+	packager.frame_rate        = FPS;
+	packager.has_audio         = true;
+	packager.audio_codec_id    = 10;
+	packager.audio_data_rate   = 128;
+	packager.audio_sample_rate = 48000;
+
+	FlvRecorder recorder;
+	CHECK(recorder.open(path), "open %s", path);
+	recorder.write_header(packager);
+
+	std::vector<std::vector<uint8_t> > sent;
+	encoder_packet header;
+
+	make_packet(header, OBS_ENCODER_VIDEO, 0, 40, true, fourcc);
+	recorder.write_packet(header, 0, true);
+	make_packet(header, OBS_ENCODER_AUDIO, 0, 2, false, 0);
+	recorder.write_packet(header, 0, true);
+
+	int64_t a = 0, v = 0, last_ms = 0;
+	int written = 2;
+
+	while (a * 1024 * 1000 / 48000 < SECONDS * 1000 ||
+			v * 1000 / FPS < SECONDS * 1000) {
+		int64_t ats = 100 + a * 1024 * 1000 / 48000;
+		int64_t vts = 100 + v * 1000 / FPS;
+		encoder_packet packet;
+
+		if (ats <= vts) {
+			make_packet(packet, OBS_ENCODER_AUDIO, ats, 371, false, 0);
+			last_ms = ats;
+			a++;
+		} else {
+			make_packet(packet, OBS_ENCODER_VIDEO, vts, video_size(v),
+					v % FPS == 0, fourcc);
+			last_ms = vts;
+			v++;
+		}
+
+		recorder.write_packet(packet, 100, false);
+		sent.push_back(packet.data);
+		written++;
+	}
+
+	int dropped = recorder.get_dropped_tags();
+	recorder.close();
+
+	std::vector<uint8_t> file;
+	std::vector<file_tag> tags;
+	CHECK(read_file(path, file), "read %s", path);
+	bool chain = parse_flv(file, tags);
+
+	printf("packets, fourcc %08x: %d tags written, %d in %u bytes, "
+			"%d dropped\n", fourcc, written + 1, (int)tags.size(),
+			(unsigned)file.size(), dropped);
+
+	CHECK(chain, "back pointer chain does not end at the end of the file");
+	CHECK(dropped == 0, "%d tags dropped", dropped);
+	CHECK((int)tags.size() == written + 1, "%d tags in the file, %d written",
+			(int)tags.size(), written + 1);
+	if (tags.empty())
+		return;
+
+	CHECK(tags[0].type == RTMP_PACKET_TYPE_INFO, "onMetaData is not first");
+	CHECK(meta_number(tags[0], "duration") == (last_ms - 100) / 1000.0,
+			"duration %.3f, last tag at %.3f", meta_number(tags[0], "duration"),
+			(last_ms - 100) / 1000.0);
+	CHECK(meta_number(tags[0], "filesize") == (double)file.size(),
+			"filesize %.0f of %u", meta_number(tags[0], "filesize"),
+			(unsigned)file.size());
+
+	/* the payload is the tail of each body, after the codec prefix */
+	for (size_t i = 0; i < sent.size() && i + 3 < tags.size(); i++) {
+		const std::vector<uint8_t> &body = tags[i + 3].body;
+		const std::vector<uint8_t> &data = sent[i];
+
+		if (body.size() < data.size() ||
+				memcmp(&body[body.size() - data.size()], &data[0],
+						data.size()) != 0) {
+			CHECK(false, "tag %d: payload differs", (int)i + 3);
+			break;
+		}
+	}
+}
+
+/* the ingest path: FLV bodies, onMetaData behind @setDataFrame */
+static void record_messages(const char *path)
+{
+	FlvRecorder recorder;
+	CHECK(recorder.open(path), "open %s", path);
+	recorder.write_file_header(true, true);
+
+	FLVPackager packager;
+	packager.has_video     = true;
+	packager.width         = 640;
+	packager.height        = 360;
+	packager.has_file_info = true;
+	packager.duration      = 0;
+	packager.file_size     = 0;
+	std::vector<uint8_t> meta_tag = packager.flv_meta_data(false);
+
+	static const char set_data_frame[] = "\x02\x00\x0d@setDataFrame";
+	std::vector<uint8_t> meta(set_data_frame,
+			set_data_frame + sizeof(set_data_frame) - 1);
+	uint32_t meta_size = read_be24(&meta_tag[1]);
+	meta.insert(meta.end(), meta_tag.begin() + 11,
+			meta_tag.begin() + 11 + meta_size);
+	recorder.write_message(RTMP_PACKET_TYPE_INFO, 0, &meta[0], meta.size());
+
+	static const uint8_t avc_header[] = {0x17, 0x00, 0, 0, 0, 1, 0x64, 0, 0x1f};
+	recorder.write_message(RTMP_PACKET_TYPE_VIDEO, 0, avc_header,
+			sizeof(avc_header));
+
+	int written = 2;
+	int32_t last_ms = 0;
+	std::vector<uint8_t> body;
+
+	for (int64_t v = 0; v < SECONDS * FPS; v++) {
+		int32_t time_ms = (int32_t)(v * 1000 / FPS);
+
+		fill(body, video_size(v) + 5, (unsigned)v);
+		body[0] = v % FPS == 0 ? 0x17 : 0x27;
+		body[1] = 1;
+		recorder.write_message(RTMP_PACKET_TYPE_VIDEO, time_ms, &body[0],
+				body.size());
+
+		fill(body, 300, (unsigned)v + 7);
+		body[0] = 0xaf;
+		body[1] = 1;
+		recorder.write_message(RTMP_PACKET_TYPE_AUDIO, time_ms, &body[0],
+				body.size());
+
+		written += 2;
+		last_ms = time_ms;
+	}
+
+	recorder.close();
+
+	std::vector<uint8_t> file;
+	std::vector<file_tag> tags;
+	CHECK(read_file(path, file), "read %s", path);
+	bool chain = parse_flv(file, tags);
+
+	printf("messages: %d tags written, %d in %u bytes\n", written,
+			(int)tags.size(), (unsigned)file.size());
+
+	CHECK(chain, "back pointer chain does not end at the end of the file");
+	CHECK((int)tags.size() == written, "%d tags in the file, %d written",
+			(int)tags.size(), written);
+	if (tags.empty())
+		return;
+
+	CHECK(tags[0].type == RTMP_PACKET_TYPE_INFO &&
+			tags[0].body.size() == meta_size,
+			"@setDataFrame was not stripped from onMetaData");
+	CHECK(meta_number(tags[0], "duration") == last_ms / 1000.0,
+			"duration %.3f, last tag at %.3f", meta_number(tags[0], "duration"),
+			last_ms / 1000.0);
+	CHECK(meta_number(tags[0], "filesize") == (double)file.size(),
+			"filesize %.0f of %u", meta_number(tags[0], "filesize"),
+			(unsigned)file.size());
+}
+
+/* RtmpStream whose recording was started by an earlier connection */
+class RecordingStream : public RtmpStream {
+public:
+	bool open_recording(const char *path)
+	{
+		return recorder.open(path);
+	}
+};
+
+static void record_disconnected(const char *path)
+{
+	static const uint8_t start_code[4] = {0, 0, 0, 1};
+	const int64_t start_ms = 5000;
+
+	RecordingStream stream;
+	CHECK(stream.open_recording(path), "open %s", path);
+
+	int64_t a = 0, v = 0, last_ms = 0;
+	int recorded = 0;
+	bool seen_keyframe = false;
+
+	/* audio ahead of the first keyframe has no file to go in yet */
+	while (a * 1024 * 1000 / 48000 < SECONDS * 1000 ||
+			v * 1000 / FPS < SECONDS * 1000) {
+		int64_t ats = start_ms - 50 + a * 1024 * 1000 / 48000;
+		int64_t vts = start_ms + v * 1000 / FPS;
+		encoder_packet packet;
+
+		if (ats <= vts) {
+			make_packet(packet, OBS_ENCODER_AUDIO, ats, 371, false, 0);
+			last_ms = ats;
+			a++;
+		} else {
+			bool key = v % FPS == 0;
+			make_packet(packet, OBS_ENCODER_VIDEO, vts, 9000, key,
+					VIDEO_FOURCC_AVC);
+			packet.data.insert(packet.data.begin(), key ? 0x65 : 0x41);
+			packet.data.insert(packet.data.begin(), start_code,
+					start_code + 4);
+			seen_keyframe = seen_keyframe || key;
+			last_ms = vts;
+			v++;
+		}
+
+		if (seen_keyframe)
+			recorded++;
+		stream.encoded_packet(packet);
+	}
+
+	int dropped = stream.get_record_dropped_tags();
+	stream.stop();
+
+	std::vector<uint8_t> file;
+	std::vector<file_tag> tags;
+	CHECK(read_file(path, file), "read %s", path);
+	bool chain = parse_flv(file, tags);
+
+	printf("disconnected stream: %d packets recorded, %d tags in %u bytes, "
+			"%d dropped\n", recorded, (int)tags.size(),
+			(unsigned)file.size(), dropped);
+
+	CHECK(chain, "back pointer chain does not end at the end of the file");
+	CHECK((int)tags.size() == recorded + 1, "%d tags in the file, %d "
+			"packets recorded", (int)tags.size(), recorded + 1);
+	if (tags.size() < 2)
+		return;
+
+	CHECK(tags[0].type == RTMP_PACKET_TYPE_INFO, "onMetaData is not first");
+	CHECK(tags[1].type == RTMP_PACKET_TYPE_VIDEO && tags[1].time_ms == 0 &&
+			tags[1].body[0] == 0x17, "the file starts at %d ms with a "
+			"%s tag", tags[1].time_ms, tags[1].type == RTMP_PACKET_TYPE_VIDEO ?
+			"video" : "non-video");
+	CHECK(tags.back().time_ms == last_ms - start_ms, "last tag at %d ms, "
+			"sent at %d", tags.back().time_ms, (int)(last_ms - start_ms));
+}
+
+int main()
+{
+	char path[] = "/tmp/flv-recorder-test-XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0)
+		return 2;
+	close(fd);
+
+	record_packets(path, 0);
+	record_packets(path, VIDEO_FOURCC_HEVC);
+	record_messages(path);
+	record_disconnected(path);
+	unlink(path);
+
+	if (failures)
+		printf("%d checks failed\n", failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,247 @@
+/*
+ * Writes an AVC + AAC file with FlvRecorder and replays it through
+ * FlvReplaySource into an encoded VideoOutput and AudioOutput: onMetaData
+ * has to give width, height and framerate, the avcC has to come out as
+ * Annex B parameter sets, every frame has to arrive with start codes in
+ * place of its length prefixes, and timestamps must keep rising across
+ * loops.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#include "librtmp/rtmp.h"
+#include "rtmp-audio-output.h"
+#include "rtmp-flv-packager.h"
+#include "rtmp-flv-recorder.h"
+#include "rtmp-flv-replay.h"
+#include "rtmp-video-output.h"
+
+#define FRAMES 90
+#define FPS    30
+
+static int failures;
+
+#define CHECK(cond, ...) \
+	do { \
+		if (!(cond)) { \
+			printf("FAIL: " __VA_ARGS__); \
+			printf("\n"); \
+			failures++; \
+		} \
+	} while (0)
+
+static const uint8_t sps[] = {0x67, 0x64, 0x00, 0x1f, 0xac, 0xd9, 0x40};
+static const uint8_t pps[] = {0x68, 0xeb, 0xe3, 0xcb};
+static const uint8_t asc[] = {0x11, 0x90};
+
+struct received {
+	int                  frames;
+	bool                 ordered;
+	uint64_t             last_ts;
+	std::vector<uint8_t> first;
+	std::vector<uint8_t> last;
+};
+
+static void on_frame(received *rx, media_data &frame)
+{
+	if (rx->frames && frame.timestamp <= rx->last_ts)
+		rx->ordered = false;
+	if (!rx->frames)
+		rx->first = frame.data;
+	rx->last    = frame.data;
+	rx->last_ts = frame.timestamp;
+	rx->frames++;
+}
+
+static void on_video(void *param, struct media_data *frame)
+{
+	on_frame((received *)param, *frame);
+}
+
+static void on_audio(void *param, media_data &frame)
+{
+	on_frame((received *)param, frame);
+}
+
+/* two NALs per frame, each behind a 4 byte length */
+static void frame_nals(int v, std::vector<uint8_t> &annexb,
+		std::vector<uint8_t> &flv)
+{
+	static const uint8_t start_code[4] = {0, 0, 0, 1};
+	size_t sizes[2] = {6, 200 + (size_t)v * 13};
+
+	annexb.clear();
+	flv.clear();
+	for (int n = 0; n < 2; n++) {
+		std::vector<uint8_t> nal(sizes[n], (uint8_t)(v + n));
+		nal[0] = n == 0 ? 0x09 : (v % FPS == 0 ? 0x65 : 0x41);
+
+		annexb.insert(annexb.end(), start_code, start_code + 4);
+		annexb.insert(annexb.end(), nal.begin(), nal.end());
+
+		uint8_t len[4] = {0, 0, (uint8_t)(nal.size() >> 8),
+				(uint8_t)nal.size()};
+		flv.insert(flv.end(), len, len + 4);
+		flv.insert(flv.end(), nal.begin(), nal.end());
+	}
+}
+
+static void write_file(const char *path, std::vector<uint8_t> &last_frame)
+{
+	FlvRecorder recorder;
+	CHECK(recorder.open(path), "open %s", path);
+	recorder.write_file_header(true, true);
+
+	FLVPackager packager;
+	packager.has_video  = true;
+	packager.width      = 1280;
+	packager.height     = 720;
+	packager.frame_rate = FPS;
+	std::vector<uint8_t> meta = packager.flv_meta_data(false);
+	uint32_t meta_size = ((uint32_t)meta[1] << 16) | (meta[2] << 8) | meta[3];
+	recorder.write_message(RTMP_PACKET_TYPE_INFO, 0, &meta[11], meta_size);
+
+	std::vector<uint8_t> body;
+	static const uint8_t avc_header[] = {0x17, 0, 0, 0, 0, 1, 0x64, 0x00,
+			0x1f, 0xff, 0xe1};
+	body.assign(avc_header, avc_header + sizeof(avc_header));
+	body.push_back(0);
+	body.push_back(sizeof(sps));
+	body.insert(body.end(), sps, sps + sizeof(sps));
+	body.push_back(1);
+	body.push_back(0);
+	body.push_back(sizeof(pps));
+	body.insert(body.end(), pps, pps + sizeof(pps));
+	recorder.write_message(RTMP_PACKET_TYPE_VIDEO, 0, &body[0], body.size());
+
+	uint8_t aac_header[] = {0xaf, 0, asc[0], asc[1]};
+	recorder.write_message(RTMP_PACKET_TYPE_AUDIO, 0, aac_header,
+			sizeof(aac_header));
+
+	std::vector<uint8_t> flv;
+	for (int v = 0; v < FRAMES; v++) {
+		int32_t time_ms = v * 1000 / FPS;
+
+		frame_nals(v, last_frame, flv);
+		uint8_t video[5] = {(uint8_t)(v % FPS == 0 ? 0x17 : 0x27), 1, 0, 0, 0};
+		body.assign(video, video + 5);
+		body.insert(body.end(), flv.begin(), flv.end());
+		recorder.write_message(RTMP_PACKET_TYPE_VIDEO, time_ms, &body[0],
+				body.size());
+
+		uint8_t audio[2] = {0xaf, 1};
+		body.assign(audio, audio + 2);
+		body.insert(body.end(), 300, (uint8_t)v);
+		recorder.write_message(RTMP_PACKET_TYPE_AUDIO, time_ms, &body[0],
+				body.size());
+	}
+
+	recorder.close();
+}
+
+static void replay(const char *path, bool loop,
+		const std::vector<uint8_t> &last_frame)
+{
+	FlvReplaySource source;
+	source.realtime = false;
+	source.loop     = loop;
+
+	CHECK(source.open(path), "replay open %s", path);
+	CHECK(source.video_codec == "h264", "codec %s",
+			source.video_codec.c_str());
+	CHECK(source.width == 1280 && source.height == 720 &&
+			source.frame_rate == FPS, "onMetaData gave %ux%u at %.2f fps",
+			source.width, source.height, source.frame_rate);
+
+	video_output_info vinfo;
+	vinfo.name    = "video";
+	vinfo.format  = VIDEO_FORMAT_NONE;
+	vinfo.fps_num = FPS;
+	vinfo.fps_den = 1;
+	vinfo.width   = source.width;
+	vinfo.height  = source.height;
+
+	audio_output_info ainfo;
+	ainfo.name            = "audio";
+	ainfo.samples_per_sec = 48000;
+	ainfo.format          = AUDIO_FORMAT_FLOAT;
+	ainfo.speakers        = SPEAKERS_STEREO;
+
+	std::shared_ptr<VideoOutput> video(new VideoOutput(vinfo));
+	std::shared_ptr<AudioOutput> audio(new AudioOutput(ainfo));
+	video->output_open();
+	audio->output_open();
+
+	received vrx, arx;
+	vrx.frames = arx.frames = 0;
+	vrx.ordered = arx.ordered = true;
+	video->start_raw_video(NULL, on_video, &vrx);
+	audio->connect(NULL, on_audio, &arx);
+
+	CHECK(source.start(video, audio), "start");
+	if (loop) {
+		while (source.get_loops() < 3)
+			usleep(1000);
+	} else {
+		while (source.active())
+			usleep(1000);
+	}
+	source.stop();
+
+	audio->disconnect(on_audio, &arx);
+	video->stop_raw_video(on_video, &vrx);
+
+	printf("%s: %d video, %d audio frames, %u loops\n",
+			loop ? "loop" : "once", vrx.frames, arx.frames, source.get_loops());
+
+	std::vector<uint8_t> csd;
+	static const uint8_t start_code[4] = {0, 0, 0, 1};
+	csd.insert(csd.end(), start_code, start_code + 4);
+	csd.insert(csd.end(), sps, sps + sizeof(sps));
+	csd.insert(csd.end(), start_code, start_code + 4);
+	csd.insert(csd.end(), pps, pps + sizeof(pps));
+
+	CHECK(video->format_csd0 == csd, "avcC not converted to Annex B");
+	CHECK(audio->format.size() == 2 && memcmp(&audio->format[0], asc, 2) == 0,
+			"AudioSpecificConfig not handed over");
+	CHECK(vrx.ordered && arx.ordered, "timestamps went backwards");
+
+	if (!loop) {
+		std::vector<uint8_t> first, flv;
+		frame_nals(0, first, flv);
+
+		CHECK(vrx.frames == FRAMES && arx.frames == FRAMES,
+				"%d video and %d audio frames of %d", vrx.frames, arx.frames,
+				FRAMES);
+		CHECK(vrx.first == first && vrx.last == last_frame,
+				"frames not rewritten to Annex B");
+		CHECK(arx.last.size() == 300, "audio frame of %u bytes",
+				(unsigned)arx.last.size());
+	} else {
+		CHECK(vrx.frames >= 3 * FRAMES, "%d video frames in 3 loops",
+				vrx.frames);
+	}
+}
+
+int main()
+{
+	char path[] = "/tmp/flv-replay-test-XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0)
+		return 2;
+	close(fd);
+
+	std::vector<uint8_t> last_frame;
+	write_file(path, last_frame);
+	replay(path, false, last_frame);
+	replay(path, true, last_frame);
+	unlink(path);
+
+	if (failures)
+		printf("%d checks failed\n", failures);
+	return failures ? 1 : 0;
+}
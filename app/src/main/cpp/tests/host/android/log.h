@@ -0,0 +1,40 @@
+#pragma once
+
+/* Host stand-in for the NDK log, for the tests and benchmarks. Lines go
+ * to stderr. */
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#define ANDROID_LOG_VERBOSE 2
+#define ANDROID_LOG_DEBUG   3
+#define ANDROID_LOG_INFO    4
+#define ANDROID_LOG_WARN    5
+#define ANDROID_LOG_ERROR   6
+
+static inline int __android_log_write(int prio, const char *tag,
+		const char *text)
+{
+	(void)prio;
+	return fprintf(stderr, "%s: %s\n", tag, text);
+}
+
+static inline int __android_log_vprint(int prio, const char *tag,
+		const char *fmt, va_list args)
+{
+	(void)prio;
+	fprintf(stderr, "%s: ", tag);
+	int ret = vfprintf(stderr, fmt, args);
+	fputc('\n', stderr);
+	return ret;
+}
+
+static inline int __android_log_print(int prio, const char *tag,
+		const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	int ret = __android_log_vprint(prio, tag, fmt, args);
+	va_end(args);
+	return ret;
+}
@@ -0,0 +1,256 @@
+/*
+ * A librtmp publisher streams into RtmpIngestServer while two other
+ * clients stall it: one sends a single byte of its handshake, the other
+ * completes the handshake, raises its chunk size and stops halfway into a
+ * chunk bigger than librtmp's socket buffer. The publisher also uses
+ * chunks that size. Both stalls would hold the loop for the I/O timeout
+ * if it waited on them, so every message has to arrive intact well within
+ * it, and stop has to return without waiting for the stalled clients.
+ */
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <vector>
+
+#include "librtmp/rtmp.h"
+#include "librtmp/log.h"
+#include "rtmp-ingest-server.h"
+
+#define MESSAGES        300
+#define CHUNK_SIZE      65536
+#define STALL_CHUNK     200000
+#define SIG_SIZE        1536
+/* the server's I/O timeout is 5 s */
+#define MAX_PUBLISH_MS  2000
+#define MAX_STOP_MS     1000
+
+static int failures;
+
+#define CHECK(cond, ...) \
+	do { \
+		if (!(cond)) { \
+			printf("FAIL: " __VA_ARGS__); \
+			printf("\n"); \
+			failures++; \
+		} \
+	} while (0)
+
+static int64_t now_ms()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+struct received {
+	std::atomic<int>     messages;
+	std::atomic<int>     wrong;
+	std::atomic<int64_t> last_ms;
+};
+
+static uint32_t message_size(int i)
+{
+	if (i & 1)
+		return 300;
+	return i % 30 == 0 ? 150000 : 2000 + (uint32_t)(i * 37) % 20000;
+}
+
+static void on_packet(void *param, int conn_id, const RTMPPacket &packet)
+{
+	received *rx = (received *)param;
+	int i = rx->messages;
+	const uint8_t *body = (const uint8_t *)packet.m_body;
+	uint32_t size = packet.m_nBodySize;
+
+	(void)conn_id;
+	if (size != message_size(i) || body[0] != (uint8_t)i ||
+			body[size - 1] != (uint8_t)i)
+		rx->wrong++;
+	rx->last_ms = now_ms();
+	rx->messages++;
+}
+
+static int connect_to(int port)
+{
+	struct sockaddr_in addr;
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family      = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port        = htons((uint16_t)port);
+	if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static bool send_all(int fd, const void *data, size_t size)
+{
+	const char *p = (const char *)data;
+	while (size) {
+		ssize_t n = send(fd, p, size, 0);
+		if (n <= 0)
+			return false;
+		p += n;
+		size -= (size_t)n;
+	}
+	return true;
+}
+
+static bool recv_all(int fd, void *data, size_t size)
+{
+	char *p = (char *)data;
+	while (size) {
+		ssize_t n = recv(fd, p, size, 0);
+		if (n <= 0)
+			return false;
+		p += n;
+		size -= (size_t)n;
+	}
+	return true;
+}
+
+/* handshakes by hand, then sends part of one chunk of STALL_CHUNK bytes,
+ * more than the server can buffer */
+static int stall_in_chunk(int port)
+{
+	int fd = connect_to(port);
+	std::vector<uint8_t> buf(1 + 2 * SIG_SIZE, 0);
+
+	buf[0] = 3;
+	if (fd < 0 || !send_all(fd, &buf[0], 1 + SIG_SIZE) ||
+			!recv_all(fd, &buf[0], 1 + 2 * SIG_SIZE) ||
+			!send_all(fd, &buf[1], SIG_SIZE)) {
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	static const uint8_t set_chunk_size[16] = {0x02, 0, 0, 0, 0, 0, 4,
+			RTMP_PACKET_TYPE_CHUNK_SIZE, 0, 0, 0, 0, 0, 0x10, 0, 0};
+	static const uint8_t header[12] = {0x04, 0, 0, 0,
+			(uint8_t)(STALL_CHUNK >> 16), (uint8_t)(STALL_CHUNK >> 8),
+			(uint8_t)STALL_CHUNK, RTMP_PACKET_TYPE_VIDEO, 1, 0, 0, 0};
+	std::vector<uint8_t> body(RTMP_BUFFER_CACHE_SIZE + 4096, 0x17);
+
+	if (!send_all(fd, set_chunk_size, sizeof(set_chunk_size)) ||
+			!send_all(fd, header, sizeof(header)) ||
+			!send_all(fd, &body[0], body.size())) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static bool publish(int port, int64_t &sent_ms)
+{
+	char url[64];
+	snprintf(url, sizeof(url), "rtmp://127.0.0.1:%d/live", port);
+
+	RTMP *rtmp = RTMP_Alloc();
+	RTMP_Init(rtmp);
+	bool ok = RTMP_SetupURL(rtmp, url) != 0;
+	RTMP_EnableWrite(rtmp);
+	RTMP_AddStream(rtmp, "stream");
+	rtmp->m_outChunkSize       = CHUNK_SIZE;
+	rtmp->m_bSendChunkSizeInfo = 1;
+
+	ok = ok && RTMP_Connect(rtmp, NULL) && RTMP_ConnectStream(rtmp, 0);
+	CHECK(ok, "publisher could not connect");
+
+	RTMPPacket packet;
+	memset(&packet, 0, sizeof(packet));
+	RTMPPacket_Alloc(&packet, 150000);
+
+	for (int i = 0; i < MESSAGES && ok; i++) {
+		uint32_t size = message_size(i);
+
+		packet.m_headerType  = RTMP_PACKET_SIZE_LARGE;
+		packet.m_packetType  = (i & 1) ? RTMP_PACKET_TYPE_AUDIO :
+				RTMP_PACKET_TYPE_VIDEO;
+		packet.m_nChannel    = (i & 1) ? 0x05 : 0x06;
+		packet.m_nTimeStamp  = i * 10;
+		packet.m_nInfoField2 = rtmp->m_stream_id;
+		packet.m_nBodySize   = size;
+		memset(packet.m_body, (uint8_t)i, size);
+
+		ok = RTMP_SendPacket(rtmp, &packet, FALSE) != 0;
+	}
+	CHECK(ok, "publisher could not send");
+	sent_ms = now_ms();
+
+	RTMPPacket_Free(&packet);
+	RTMP_Close(rtmp);
+	RTMP_Free(rtmp);
+	return ok;
+}
+
+int main()
+{
+	signal(SIGPIPE, SIG_IGN);
+	RTMP_LogSetLevel(RTMP_LOGCRIT);
+
+	received rx;
+	rx.messages = 0;
+	rx.wrong    = 0;
+	rx.last_ms  = 0;
+
+	RtmpIngestServer server;
+	server.sink           = RtmpIngestServer::SINK_CALLBACK;
+	server.callback       = on_packet;
+	server.callback_param = &rx;
+	if (!server.start(0)) {
+		printf("FAIL: server did not start\n");
+		return 1;
+	}
+	int port = server.get_port();
+
+	int in_handshake = connect_to(port);
+	CHECK(in_handshake >= 0 && send_all(in_handshake, "\x03", 1),
+			"first stalling client");
+	int in_chunk = stall_in_chunk(port);
+	CHECK(in_chunk >= 0, "second stalling client");
+	usleep(200000);
+
+	int64_t start_ms = now_ms(), sent_ms = 0;
+	publish(port, sent_ms);
+
+	while (rx.messages < MESSAGES && now_ms() - start_ms < 10000)
+		usleep(1000);
+	int64_t publish_ms = (rx.messages ? (int64_t)rx.last_ms : now_ms()) -
+			start_ms;
+
+	int64_t stop_start = now_ms();
+	server.stop();
+	int64_t stop_ms = now_ms() - stop_start;
+
+	printf("%d of %d messages in %lld ms beside two stalled clients, "
+			"stop in %lld ms\n", (int)rx.messages, MESSAGES,
+			(long long)publish_ms, (long long)stop_ms);
+
+	CHECK(rx.messages == MESSAGES, "%d of %d messages arrived",
+			(int)rx.messages, MESSAGES);
+	CHECK(rx.wrong == 0, "%d messages differ from what was sent",
+			(int)rx.wrong);
+	CHECK(publish_ms < MAX_PUBLISH_MS, "publishing took %lld ms",
+			(long long)publish_ms);
+	CHECK(stop_ms < MAX_STOP_MS, "stop took %lld ms", (long long)stop_ms);
+
+	if (in_handshake >= 0)
+		close(in_handshake);
+	if (in_chunk >= 0)
+		close(in_chunk);
+
+	if (failures)
+		printf("%d checks failed\n", failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,116 @@
+/*
+ * Nanoseconds per LOGD site: with debug off, where the call is the level
+ * compare, with debug captured, where it copies the record into the
+ * thread's ring, and with debug printed as well, the drainer formatting
+ * to stderr (sent to /dev/null here) off the logging thread. The site
+ * logs a string, two ints and a 64 bit value like the send path does.
+ * Every record is stamped with os_gettime_ns(), the time the drainer
+ * merges the threads' rings by, so that read is timed on its own too and
+ * the second column is the site without it.
+ *
+ * Records go in batches that stay under half the ring, flushed between
+ * batches outside the timing, so none are dropped and every one counted
+ * is copied; a dropped record would be cheaper and fails the run.
+ *
+ *   log-bench [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "rtmp-log.h"
+#include "util/platform.h"
+
+#define BATCH          256
+#define TARGET_NS      50.0
+
+static double now_sec()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double bench_site(int iterations)
+{
+	static const char *names[] = {"video", "audio", "metadata"};
+	double elapsed = 0.0;
+
+	for (int done = 0; done < iterations; done += BATCH) {
+		double start = now_sec();
+		for (int i = done; i < done + BATCH; i++)
+			LOGD("send: %s packet %d, %d bytes at %lld", names[i % 3], i,
+					i * 7 & 0xffff, (long long)i * 33);
+		elapsed += now_sec() - start;
+		rtmp_log_flush();
+	}
+
+	return elapsed * 1e9 / (iterations / BATCH * BATCH);
+}
+
+static double bench_clock(int iterations)
+{
+	volatile uint64_t sink = 0;
+
+	double start = now_sec();
+	for (int i = 0; i < iterations; i++)
+		sink += os_gettime_ns();
+	return (now_sec() - start) * 1e9 / iterations;
+}
+
+static bool report(const char *name, double ns, double clock_ns,
+		uint64_t dropped)
+{
+	double site_ns = ns > clock_ns ? ns - clock_ns : 0.0;
+
+	printf("%-18s %8.1f %12.1f%s\n", name, ns, site_ns,
+			site_ns > TARGET_NS ? "  over target" : "");
+	if (dropped)
+		printf("FAIL: %s: %llu records dropped\n", name,
+				(unsigned long long)dropped);
+	return !dropped;
+}
+
+int main(int argc, char **argv)
+{
+	int iterations = argc > 1 ? atoi(argv[1]) : 1000000;
+	bool ok = true;
+
+	if (iterations < BATCH)
+		iterations = BATCH;
+
+	/* the printed run formats every record */
+	if (!freopen("/dev/null", "w", stderr))
+		return 2;
+
+	/* starts the drainer and takes this thread's ring */
+	rtmp_log_set_level(RTMP_LOGINFO);
+	rtmp_log_set_capture_level(RTMP_LOGDEBUG);
+	LOGD("log-bench");
+	rtmp_log_flush();
+
+	double clock_ns = bench_clock(iterations);
+
+	printf("%-18s %8s %12s  (target %.0f)\n", "ns per LOGD", "ns",
+			"less clock", TARGET_NS);
+	printf("%-18s %8.1f\n", "os_gettime_ns", clock_ns);
+
+	/* off, the record is never stamped */
+	rtmp_log_set_capture_level(RTMP_LOGINFO);
+	uint64_t dropped = rtmp_log_dropped();
+	ok &= report("debug off", bench_site(iterations), 0.0,
+			rtmp_log_dropped() - dropped);
+
+	rtmp_log_set_capture_level(RTMP_LOGDEBUG);
+	dropped = rtmp_log_dropped();
+	ok &= report("debug captured", bench_site(iterations), clock_ns,
+			rtmp_log_dropped() - dropped);
+
+	rtmp_log_set_level(RTMP_LOGDEBUG);
+	dropped = rtmp_log_dropped();
+	ok &= report("debug printed", bench_site(iterations), clock_ns,
+			rtmp_log_dropped() - dropped);
+
+	return ok ? 0 : 1;
+}
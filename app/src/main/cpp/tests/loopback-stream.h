@@ -0,0 +1,97 @@
+#pragma once
+
+/* RtmpStream with its socket on one end of a socketpair and no connect,
+ * driven by hand in place of the send thread or by the real one */
+
+#include <pthread.h>
+#include <vector>
+
+#include "rtmp-stream.h"
+
+#define LOOPBACK_CHUNK_SIZE 4096
+
+class LoopbackStream : public RtmpStream {
+public:
+	void attach(int fd)
+	{
+		init_connect();
+
+		rtmp.m_sb.sb_socket     = fd;
+		rtmp.m_outChunkSize     = LOOPBACK_CHUNK_SIZE;
+		rtmp.Link.streams[0].id = 1;
+		rtmp.Link.nStreams      = 1;
+		sent_headers            = true;
+	}
+
+	void detach()
+	{
+		rtmp.m_sb.sb_socket = -1;
+	}
+
+	/* encoded_packet without the parsing and recording, false when the
+	 * packet was dropped on the way in */
+	bool queue(encoder_packet &packet)
+	{
+		pthread_mutex_lock(&packets_mutex);
+		bool added = packet.type == OBS_ENCODER_VIDEO ?
+				add_video_packet(packet) : add_packet(packet);
+		pthread_mutex_unlock(&packets_mutex);
+		return added;
+	}
+
+	size_t queued()
+	{
+		return queued_packets();
+	}
+
+	/* one send thread wakeup, 0 when nothing was queued */
+	int wakeup()
+	{
+		std::vector<encoder_packet_info> batch;
+
+		if (!get_next_packets(batch, batch_room()))
+			return 0;
+		return send_packets(batch) < 0 ? -1 : 1;
+	}
+
+	/* wakeups until the queue is empty */
+	int drain()
+	{
+		int ret;
+		while ((ret = wakeup()) > 0)
+			;
+		return ret;
+	}
+
+	/* the real send thread, fed by post() in place of wakeup() */
+	bool start_send_thread()
+	{
+		return reset_semaphore() &&
+				pthread_create(&send_thread, NULL, send_thread_fun, this) == 0;
+	}
+
+	/* encoded_packet past the connection check */
+	bool post(encoder_packet &packet)
+	{
+		if (!queue(packet))
+			return false;
+		os_sem_post(send_sem);
+		return true;
+	}
+
+	/* a clean stop; the thread closes the socket on its way out */
+	void stop_send_thread()
+	{
+		os_event_signal(stop_event);
+		os_sem_post(send_sem);
+		pthread_join(send_thread, NULL);
+	}
+
+	/* what the send thread does on a clean stop */
+	int stop_flush()
+	{
+		int ret = flush_aggregates(false);
+		clear_aggregates();
+		return ret;
+	}
+};
@@ -0,0 +1,340 @@
+/*
+ * Records ten one second GOPs of video with audio through Mp4Recorder and
+ * walks the boxes: after ftyp and moov every fragment is a moof/mdat pair
+ * holding exactly one GOP, its video run starting on the only sync sample
+ * with tfdt on the GOP's start, and the mdat as big as the runs say. A
+ * packet without a timebase in the middle has to be skipped, not divide
+ * by zero.
+ *
+ * Then repair: the file cut off halfway into its last fragment has to go
+ * back to the end of the one before, the last one indexed that is still
+ * whole, and bytes past the last indexed fragment have to go.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "rtmp-mp4-recorder.h"
+#include "rtmp-video-bitstream.h"
+
+#define GOPS           10
+#define FPS            30
+#define SAMPLE_RATE    48000
+#define VIDEO_SCALE    90000
+#define VIDEO_TRACK    1
+#define AUDIO_TRACK    2
+#define SAMPLE_SYNC    0x02000000
+
+static int failures;
+
+#define CHECK(cond, ...) \
+	do { \
+		if (!(cond)) { \
+			printf("FAIL: " __VA_ARGS__); \
+			printf("\n"); \
+			failures++; \
+		} \
+	} while (0)
+
+struct fragment {
+	size_t   offset;
+	size_t   end;
+	uint64_t video_dts;
+	int      video_samples;
+	int      video_syncs;
+	bool     starts_sync;
+	int      audio_samples;
+	bool     data_matches;
+};
+
+static uint32_t be32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+			(uint32_t)p[2] << 8 | p[3];
+}
+
+static uint64_t be64(const uint8_t *p)
+{
+	return (uint64_t)be32(p) << 32 | be32(p + 4);
+}
+
+static bool read_file(const char *path, std::vector<uint8_t> &data)
+{
+	FILE *f = fopen(path, "rb");
+	if (!f)
+		return false;
+
+	uint8_t buf[65536];
+	size_t n;
+	data.clear();
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+		data.insert(data.end(), buf, buf + n);
+	fclose(f);
+	return true;
+}
+
+static bool write_file(const char *path, const uint8_t *data, size_t size)
+{
+	FILE *f = fopen(path, "wb");
+	if (!f)
+		return false;
+	bool ok = fwrite(data, 1, size, f) == size;
+	return fclose(f) == 0 && ok;
+}
+
+/* one traf: its track, tfdt and trun samples, data bytes summed */
+static void parse_traf(const uint8_t *p, size_t size, fragment &frag,
+		size_t &data_size)
+{
+	uint32_t track = 0;
+	uint64_t dts = 0;
+
+	for (size_t pos = 8; pos + 8 <= size;) {
+		uint32_t box = be32(p + pos);
+		const uint8_t *b = p + pos;
+
+		if (box < 8 || pos + box > size)
+			return;
+
+		if (!memcmp(b + 4, "tfhd", 4))
+			track = be32(b + 12);
+		else if (!memcmp(b + 4, "tfdt", 4))
+			dts = be64(b + 12);
+		else if (!memcmp(b + 4, "trun", 4)) {
+			uint32_t count = be32(b + 12);
+
+			for (uint32_t i = 0; i < count && 20 + 16 * (i + 1) <= box; i++) {
+				const uint8_t *sample = b + 20 + 16 * i;
+				bool sync = be32(sample + 8) == SAMPLE_SYNC;
+
+				data_size += be32(sample + 4);
+				if (track == VIDEO_TRACK) {
+					if (!i)
+						frag.starts_sync = sync;
+					frag.video_samples++;
+					frag.video_syncs += sync;
+				} else {
+					frag.audio_samples++;
+				}
+			}
+		}
+		pos += box;
+	}
+
+	if (track == VIDEO_TRACK)
+		frag.video_dts = dts;
+}
+
+/* top level boxes, false when they don't end exactly at the end */
+static bool parse_mp4(const std::vector<uint8_t> &file,
+		std::vector<fragment> &fragments, bool &has_init)
+{
+	size_t pos = 0;
+	size_t moof_data = 0;
+
+	fragments.clear();
+	has_init = file.size() >= 8 && !memcmp(&file[4], "ftyp", 4);
+
+	while (pos + 8 <= file.size()) {
+		const uint8_t *b = &file[pos];
+		uint32_t box = be32(b);
+
+		if (box < 8 || pos + box > file.size())
+			return false;
+
+		if (!memcmp(b + 4, "moof", 4)) {
+			fragment frag;
+			memset(&frag, 0, sizeof(frag));
+			frag.offset = pos;
+			moof_data = 0;
+
+			for (size_t c = 8; c + 8 <= box;) {
+				uint32_t child = be32(b + c);
+				if (child < 8 || c + child > box)
+					break;
+				if (!memcmp(b + c + 4, "traf", 4))
+					parse_traf(b + c, child, frag, moof_data);
+				c += child;
+			}
+			fragments.push_back(frag);
+		} else if (!memcmp(b + 4, "mdat", 4)) {
+			if (fragments.empty())
+				return false;
+			fragments.back().data_matches = box - 8 == moof_data;
+			fragments.back().end = pos + box;
+		} else if (memcmp(b + 4, "ftyp", 4) && memcmp(b + 4, "moov", 4)) {
+			return false;
+		}
+		pos += box;
+	}
+
+	return pos == file.size();
+}
+
+static void make_packet(encoder_packet &packet, enum obs_encoder_type type,
+		int64_t ts, uint32_t timebase_den, size_t size, bool keyframe)
+{
+	packet.type         = type;
+	packet.timebase_num = 1;
+	packet.timebase_den = timebase_den;
+	packet.pts          = ts;
+	packet.dts          = ts;
+	packet.keyframe     = keyframe;
+	packet.fourcc       = VIDEO_FOURCC_AVC;
+	packet.data.assign(size, (uint8_t)ts);
+}
+
+static bool record(const char *path, int &dropped, int &audio_sent)
+{
+	/* an avcC without parameter sets, the recorder doesn't look inside */
+	static const uint8_t avcc[] = {0x01, 0x42, 0xc0, 0x1e, 0xff, 0xe0, 0x00};
+	/* AAC LC, 48 kHz, stereo */
+	static const uint8_t asc[] = {0x11, 0x90};
+
+	Mp4Recorder recorder;
+	if (!recorder.open(path))
+		return false;
+
+	recorder.write_init(VIDEO_FOURCC_AVC,
+			std::vector<uint8_t>(avcc, avcc + sizeof(avcc)), 1280, 720,
+			std::vector<uint8_t>(asc, asc + sizeof(asc)));
+
+	int64_t a = 0, v = 0;
+	while (v < GOPS * FPS) {
+		encoder_packet packet;
+
+		/* both in seconds * FPS * SAMPLE_RATE to compare them */
+		if (a * 1024 * FPS <= v * SAMPLE_RATE) {
+			make_packet(packet, OBS_ENCODER_AUDIO, a * 1024, SAMPLE_RATE,
+					300, false);
+			a++;
+			/* audio ahead of the first keyframe is left out */
+			if (v)
+				audio_sent++;
+		} else {
+			make_packet(packet, OBS_ENCODER_VIDEO, v, FPS,
+					v % FPS == 0 ? 20000 : 2000, v % FPS == 0);
+			v++;
+		}
+		recorder.write_packet(packet);
+
+		if (v == FPS + FPS / 2 && packet.type == OBS_ENCODER_VIDEO) {
+			make_packet(packet, OBS_ENCODER_VIDEO, v, 0, 2000, false);
+			recorder.write_packet(packet);
+		}
+	}
+
+	dropped = recorder.get_dropped_packets();
+	recorder.close();
+	return true;
+}
+
+static void check_fragments(const char *path)
+{
+	int dropped = 0, audio_sent = 0;
+	CHECK(record(path, dropped, audio_sent), "open %s", path);
+
+	std::vector<uint8_t> file;
+	std::vector<fragment> fragments;
+	bool has_init = false;
+	CHECK(read_file(path, file), "read %s", path);
+	bool whole = parse_mp4(file, fragments, has_init);
+
+	printf("recorded %d GOPs: %d fragments in %u bytes, %d dropped\n", GOPS,
+			(int)fragments.size(), (unsigned)file.size(), dropped);
+
+	CHECK(whole, "boxes do not end at the end of the file");
+	CHECK(has_init, "no ftyp in front");
+	CHECK(dropped == 0, "%d packets dropped", dropped);
+	CHECK(fragments.size() == GOPS, "%d fragments for %d GOPs",
+			(int)fragments.size(), GOPS);
+
+	int audio = 0;
+	for (size_t g = 0; g < fragments.size(); g++) {
+		const fragment &frag = fragments[g];
+
+		CHECK(frag.video_samples == FPS && frag.video_syncs == 1 &&
+				frag.starts_sync, "fragment %d: %d video samples, %d sync, "
+				"%s on one", (int)g, frag.video_samples, frag.video_syncs,
+				frag.starts_sync ? "starting" : "not starting");
+		CHECK(frag.video_dts == (uint64_t)g * VIDEO_SCALE, "fragment %d: "
+				"video tfdt %llu, GOP starts at %llu", (int)g,
+				(unsigned long long)frag.video_dts,
+				(unsigned long long)g * VIDEO_SCALE);
+		CHECK(frag.data_matches && frag.end, "fragment %d: mdat size differs "
+				"from its runs", (int)g);
+		audio += frag.audio_samples;
+	}
+
+	CHECK(audio == audio_sent, "%d audio samples, %d sent", audio,
+			audio_sent);
+}
+
+static void check_repair(const char *path)
+{
+	std::vector<uint8_t> file, repaired;
+	std::vector<fragment> fragments;
+	bool has_init = false;
+
+	if (!read_file(path, file) || !parse_mp4(file, fragments, has_init) ||
+			fragments.size() < 2) {
+		CHECK(false, "no recording to repair");
+		return;
+	}
+
+	/* the process died halfway into writing the last fragment */
+	size_t last = fragments.back().offset;
+	size_t cut = last + (file.size() - last) / 2;
+	CHECK(write_file(path, &file[0], cut), "write %s", path);
+
+	bool ok = Mp4Recorder::repair(path);
+	CHECK(read_file(path, repaired), "read %s", path);
+	bool whole = parse_mp4(repaired, fragments, has_init);
+
+	printf("cut at %u: repaired to %u bytes, %d fragments\n", (unsigned)cut,
+			(unsigned)repaired.size(), (int)fragments.size());
+
+	CHECK(ok, "repair failed on a truncated file");
+	CHECK(repaired.size() == last, "repaired to %u bytes, the last whole "
+			"fragment ends at %u", (unsigned)repaired.size(), (unsigned)last);
+	CHECK(whole && fragments.size() == GOPS - 1, "%d whole fragments after "
+			"repair", (int)fragments.size());
+
+	/* a fragment written out but never indexed */
+	std::vector<uint8_t> longer(file);
+	longer.insert(longer.end(), 4096, 0xab);
+	CHECK(write_file(path, &longer[0], longer.size()), "write %s", path);
+
+	ok = Mp4Recorder::repair(path);
+	CHECK(read_file(path, repaired), "read %s", path);
+
+	printf("%u bytes past the index: repaired to %u bytes\n",
+			(unsigned)(longer.size() - file.size()),
+			(unsigned)repaired.size());
+
+	CHECK(ok && repaired == file, "repair left %u of %u bytes",
+			(unsigned)repaired.size(), (unsigned)file.size());
+}
+
+int main()
+{
+	char path[] = "/tmp/mp4-recorder-test-XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0)
+		return 2;
+	close(fd);
+
+	check_fragments(path);
+	check_repair(path);
+
+	unlink(path);
+	unlink((std::string(path) + ".idx").c_str());
+
+	if (failures)
+		printf("%d checks failed\n", failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,186 @@
+/*
+ * X264Encoder with b-frames: H.264 frames handed over in decode order with
+ * their capture times, pts taken by get_capture_pts, dts rebuilt by
+ * get_dts, then parse_packet and flv_packet_mux as RtmpStream sends them.
+ *
+ * IBBP and IBP at a reorder depth of 1, IBBP and a b-pyramid at 2. dts
+ * has to increase strictly, land on the frame display order says decodes
+ * next and never pass pts; the tag's composition time has to be pts - dts
+ * in ms with dts + cts on pts. A pyramid behind a depth of 1 makes dts
+ * pass pts, which has to come out as a negative composition time.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "librtmp/rtmp.h"
+#include "rtmp-encoder.h"
+#include "rtmp-flv-packager.h"
+#include "rtmp-video-bitstream.h"
+
+#define FPS           30
+#define FRAME_UNITS   100
+#define GOPS          4
+
+static int failures;
+
+#define CHECK(cond, ...) \
+	do { \
+		if (!(cond)) { \
+			printf("FAIL: " __VA_ARGS__); \
+			printf("\n"); \
+			failures++; \
+		} \
+	} while (0)
+
+/* display order of one gop after its I frame, in decode order */
+struct gop_pattern {
+	const char *name;
+	int        length;
+	int        order[8];
+	int        depth;
+	bool       dts_passes_pts;
+};
+
+static uint32_t be24(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2];
+}
+
+static int32_t ms(int64_t units)
+{
+	return (int32_t)(units * 1000 / (FPS * FRAME_UNITS));
+}
+
+/* an annex B slice, IDR for the keyframe */
+static void make_frame(std::vector<uint8_t> &data, bool keyframe, int index)
+{
+	static const uint8_t start[4] = {0, 0, 0, 1};
+
+	data.assign(start, start + 4);
+	data.push_back(keyframe ? 0x65 : 0x41);
+	for (int i = 0; i < 16; i++)
+		data.push_back((uint8_t)(index + i));
+}
+
+static void run(const gop_pattern &gop)
+{
+	X264Encoder encoder;
+	encoder.reorder_frames = gop.depth;
+	encoder.timebase_num   = FRAME_UNITS;
+	encoder.timebase_den   = FPS * FRAME_UNITS;
+	encoder.start_ts       = 1000000000ULL;
+	encoder.reset_reorder();
+
+	CHECK(encoder.active_reorder == gop.depth, "%s: reordering %d frames",
+			gop.name, encoder.active_reorder);
+
+	int frames = 1 + GOPS * gop.length;
+	int64_t last_dts = 0;
+	int32_t dts_offset = 0;
+	int negative = 0;
+
+	for (int k = 0; k < frames; k++) {
+		int display = k ? 1 + (k - 1) / gop.length * gop.length +
+				gop.order[(k - 1) % gop.length] : 0;
+
+		/* capture time a tenth of a ms off the frame grid */
+		uint64_t ts = encoder.start_ts +
+				(uint64_t)display * 1000000000ULL / FPS +
+				(display & 1 ? 100000 : 0);
+
+		encoder_frame frame;
+		make_frame(frame.data, !k, k);
+		frame.frames = 1;
+		frame.pts    = encoder.get_capture_pts(ts);
+
+		encoder_packet packet;
+		bool received = false;
+		packet.timebase_num = encoder.timebase_num;
+		packet.timebase_den = encoder.timebase_den;
+		encoder.encode(frame, packet, received);
+
+		CHECK(received, "%s: frame %d not received", gop.name, k);
+		CHECK(packet.pts == display * FRAME_UNITS, "%s: frame %d pts %lld, "
+				"shown at %d", gop.name, k, (long long)packet.pts,
+				display * FRAME_UNITS);
+		CHECK(packet.keyframe == !k, "%s: frame %d keyframe %d", gop.name,
+				k, packet.keyframe);
+		CHECK(!k || packet.dts > last_dts, "%s: frame %d dts %lld after "
+				"%lld", gop.name, k, (long long)packet.dts,
+				(long long)last_dts);
+		last_dts = packet.dts;
+
+		if (!gop.dts_passes_pts) {
+			/* frame k decodes while the (k - depth)th in display order
+			 * is due */
+			int64_t expect = (int64_t)(k - gop.depth) * FRAME_UNITS;
+			CHECK(packet.dts == expect, "%s: frame %d dts %lld, expected "
+					"%lld", gop.name, k, (long long)packet.dts,
+					(long long)expect);
+			CHECK(packet.dts <= packet.pts, "%s: frame %d dts %lld past pts "
+					"%lld", gop.name, k, (long long)packet.dts,
+					(long long)packet.pts);
+		}
+
+		if (!k)
+			dts_offset = packet.get_ms_time(packet.dts);
+
+		encoder_packet flv = X264Encoder::parse_packet(packet);
+		std::vector<uint8_t> tag;
+		FLVPackager::flv_packet_mux(tag, flv, dts_offset, false);
+
+		if (tag.size() < 11 + 5 + 4) {
+			CHECK(false, "%s: frame %d tag of %zu bytes", gop.name, k,
+					tag.size());
+			continue;
+		}
+
+		const uint8_t *body = &tag[11];
+		int32_t time_ms = (int32_t)(be24(&tag[4]) | (uint32_t)tag[7] << 24);
+		int32_t cts = (int32_t)(be24(body + 2) << 8) >> 8;
+		int32_t expect_cts = ms(packet.pts) - ms(packet.dts);
+
+		CHECK(tag[0] == RTMP_PACKET_TYPE_VIDEO && body[0] ==
+				(k ? 0x27 : 0x17) && body[1] == 1, "%s: frame %d tag "
+				"header %02x %02x %02x", gop.name, k, tag[0], body[0],
+				body[1]);
+		CHECK(time_ms == ms(packet.dts) - dts_offset, "%s: frame %d tag "
+				"time %d, dts %d ms", gop.name, k, time_ms,
+				ms(packet.dts) - dts_offset);
+		CHECK(cts == expect_cts, "%s: frame %d composition time %d, "
+				"expected %d", gop.name, k, cts, expect_cts);
+		CHECK(time_ms + cts == ms(packet.pts) - dts_offset, "%s: frame %d "
+				"dts + cts %d, pts %d ms", gop.name, k, time_ms + cts,
+				ms(packet.pts) - dts_offset);
+		if (packet.dts > packet.pts)
+			CHECK(cts < 0 || ms(packet.dts) == ms(packet.pts), "%s: frame "
+					"%d decodes after display, cts %d", gop.name, k, cts);
+		if (cts < 0)
+			negative++;
+	}
+
+	if (gop.dts_passes_pts)
+		CHECK(negative > 0, "%s: no negative composition time", gop.name);
+	printf("%s, depth %d: %d frames, %d negative composition times\n",
+			gop.name, gop.depth, frames, negative);
+}
+
+int main()
+{
+	static const gop_pattern gops[] = {
+		{"IBBP",      3, {2, 0, 1},       1, false},
+		{"IBP",       2, {1, 0},          1, false},
+		{"IBBP",      3, {2, 0, 1},       2, false},
+		{"b-pyramid", 4, {3, 1, 0, 2},    2, false},
+		{"b-pyramid", 4, {3, 1, 0, 2},    1, true},
+	};
+
+	for (size_t i = 0; i < sizeof(gops) / sizeof(gops[0]); i++)
+		run(gops[i]);
+
+	if (failures)
+		printf("%d checks failed\n", failures);
+	return failures ? 1 : 0;
+}
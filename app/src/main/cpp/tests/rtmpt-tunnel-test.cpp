@@ -0,0 +1,357 @@
+/*
+ * Publishes over rtmpt to a stub tunnel server on a loopback thread that
+ * answers /open, /send, /idle and /close, each reply held back by
+ * REPLY_DELAY_MS. The pipelining server reads requests while replies are
+ * pending, the serial one not before the last one was answered. All the
+ * data has to arrive, no more posts may be unanswered than the
+ * connection's in-flight cap, and raising the cap has to let a slow
+ * pipelining server take the whole stream in fewer round trips. With
+ * replies that carry messages, those read early to make room for more
+ * posts have to come out of RTMP_ReadPacket in order.
+ */
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "librtmp/rtmp.h"
+#include "librtmp/log.h"
+
+#define REPLY_DELAY_MS 20
+#define MESSAGES       2000
+#define MESSAGE_SIZE   4000
+#define FLUSH_EVERY    10
+#define HANDSHAKE_SIZE 1537
+
+static int failures;
+
+#define CHECK(cond, ...) \
+	do { \
+		if (!(cond)) { \
+			printf("FAIL: " __VA_ARGS__); \
+			printf("\n"); \
+			failures++; \
+		} \
+	} while (0)
+
+static int64_t now_us()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+struct reply {
+	int64_t     due;
+	std::string data;
+};
+
+struct tunnel_server {
+	int                listen_fd;
+	int                port;
+	bool               serial;
+	bool               acks;
+
+	int                posts;
+	int                peak_inflight;
+	int                acks_sent;
+	int64_t            body_bytes;
+	int64_t            start_us;
+	int64_t            end_us;
+	std::atomic<bool>  got_end;
+};
+
+static bool send_all(int fd, const std::string &data)
+{
+	size_t off = 0;
+	while (off < data.size()) {
+		ssize_t n = send(fd, data.data() + off, data.size() - off, 0);
+		if (n <= 0)
+			return false;
+		off += (size_t)n;
+	}
+	return true;
+}
+
+/* the payload for one request, behind the polling hint */
+static std::string reply_payload(tunnel_server *srv, const std::string &cmd,
+		const char *body, int body_len)
+{
+	std::string payload(1, '\x01');
+
+	if (cmd == "open")
+		return "abcd\n";
+	if (cmd != "send")
+		return payload;
+
+	int64_t before = srv->body_bytes;
+	srv->body_bytes += body_len;
+
+	if (before < HANDSHAKE_SIZE && srv->body_bytes >= HANDSHAKE_SIZE) {
+		payload.push_back('\x03');
+		payload.append(2 * (HANDSHAKE_SIZE - 1), '\0');
+		srv->start_us = now_us();
+	} else if (srv->acks) {
+		uint32_t seq = (uint32_t)++srv->acks_sent;
+		const char ack[16] = {0x02, 0, 0, 0, 0, 0, 4,
+				RTMP_PACKET_TYPE_BYTES_READ_REPORT, 0, 0, 0, 0,
+				(char)(seq >> 24), (char)(seq >> 16), (char)(seq >> 8),
+				(char)seq};
+		payload.append(ack, sizeof(ack));
+	}
+
+	if (!srv->got_end && memmem(body, body_len, "ENDMARK!", 8)) {
+		srv->end_us = now_us();
+		srv->got_end = true;
+	}
+	return payload;
+}
+
+static void *server_thread(void *data)
+{
+	tunnel_server *srv = (tunnel_server *)data;
+	int fd = accept(srv->listen_fd, NULL, NULL);
+	int one = 1;
+
+	if (fd < 0)
+		return NULL;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	std::vector<char> in;
+	std::deque<reply> pending;
+	char buf[65536];
+	bool closed = false;
+
+	while (!closed || !pending.empty()) {
+		int timeout = -1;
+		if (!pending.empty()) {
+			int64_t wait = pending.front().due - now_us();
+			timeout = wait <= 0 ? 0 : (int)((wait + 999) / 1000);
+		}
+
+		struct pollfd pfd = {fd, POLLIN, 0};
+		if (closed || (srv->serial && !pending.empty()))
+			pfd.events = 0;
+		if (poll(&pfd, 1, timeout) < 0)
+			break;
+		if (pfd.revents & (POLLIN | POLLHUP)) {
+			ssize_t n = recv(fd, buf, sizeof(buf), 0);
+			if (n <= 0)
+				break;
+			in.insert(in.end(), buf, buf + n);
+		}
+
+		int64_t now = now_us();
+		while (!pending.empty() && pending.front().due <= now) {
+			if (!send_all(fd, pending.front().data))
+				goto out;
+			pending.pop_front();
+		}
+
+		while (!closed && !(srv->serial && !pending.empty()) && !in.empty()) {
+			std::string head(&in[0], in.size());
+			size_t end = head.find("\r\n\r\n");
+			const char *length = strcasestr(head.c_str(), "Content-Length:");
+			if (end == std::string::npos || !length)
+				break;
+
+			int header_len = (int)end + 4;
+			int body_len = atoi(length + 15);
+			if ((int)in.size() < header_len + body_len)
+				break;
+
+			char cmd[16] = {0};
+			sscanf(head.c_str(), "POST /%15[a-z]", cmd);
+			srv->posts++;
+
+			std::string payload = reply_payload(srv, cmd, &in[header_len],
+					body_len);
+			char header[256];
+			int n = snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\n"
+					"Content-Type: application/x-fcs\r\n"
+					"Content-Length: %d\r\nConnection: keep-alive\r\n\r\n",
+					(int)payload.size());
+
+			reply r;
+			r.due  = now_us() + REPLY_DELAY_MS * 1000;
+			r.data = std::string(header, n) + payload;
+			pending.push_back(r);
+			if ((int)pending.size() > srv->peak_inflight)
+				srv->peak_inflight = (int)pending.size();
+
+			in.erase(in.begin(), in.begin() + header_len + body_len);
+			if (!strcmp(cmd, "close"))
+				closed = true;
+		}
+	}
+
+out:
+	close(fd);
+	return NULL;
+}
+
+static bool server_start(tunnel_server *srv, pthread_t *thread)
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	int one = 1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family      = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	srv->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	setsockopt(srv->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(srv->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+			listen(srv->listen_fd, 1) != 0 ||
+			getsockname(srv->listen_fd, (struct sockaddr *)&addr, &len) != 0) {
+		close(srv->listen_fd);
+		return false;
+	}
+	srv->port = ntohs(addr.sin_port);
+	return pthread_create(thread, NULL, server_thread, srv) == 0;
+}
+
+/* sends the stream, returns how long the server took to get all of it */
+static double publish(const char *name, bool serial, bool acks,
+		int max_inflight, int messages)
+{
+	tunnel_server srv;
+	srv.serial        = serial;
+	srv.acks          = acks;
+	srv.posts         = 0;
+	srv.peak_inflight = 0;
+	srv.acks_sent     = 0;
+	srv.body_bytes    = 0;
+	srv.start_us      = 0;
+	srv.end_us        = 0;
+	srv.got_end       = false;
+
+	pthread_t thread;
+	if (!server_start(&srv, &thread)) {
+		CHECK(false, "%s: no stub server", name);
+		return 0;
+	}
+
+	char url[64];
+	snprintf(url, sizeof(url), "rtmpt://127.0.0.1:%d/app/stream", srv.port);
+
+	RTMP *rtmp = RTMP_Alloc();
+	RTMP_Init(rtmp);
+	RTMP_SetupURL(rtmp, url);
+	RTMP_EnableWrite(rtmp);
+	if (max_inflight >= 0)
+		RTMP_SetTunnelInflight(rtmp, max_inflight);
+
+	bool ok = RTMP_Connect(rtmp, NULL) != 0;
+	CHECK(ok, "%s: connect", name);
+
+	RTMPPacket packet;
+	memset(&packet, 0, sizeof(packet));
+	RTMPPacket_Alloc(&packet, MESSAGE_SIZE);
+
+	for (int i = 0; i <= messages && ok; i++) {
+		packet.m_headerType  = RTMP_PACKET_SIZE_MEDIUM;
+		packet.m_packetType  = RTMP_PACKET_TYPE_AUDIO;
+		packet.m_nChannel    = 0x04;
+		packet.m_nTimeStamp  = i * 23;
+		packet.m_nBodySize   = MESSAGE_SIZE;
+		packet.m_nInfoField2 = 1;
+		memset(packet.m_body, i, MESSAGE_SIZE);
+		if (i == messages)
+			memcpy(packet.m_body, "ENDMARK!", 8);
+
+		ok = RTMP_SendPacket(rtmp, &packet, FALSE) != 0;
+		if (ok && ((i + 1) % FLUSH_EVERY == 0 || i == messages)) {
+			ok = RTMP_FlushBatch(rtmp) != 0;
+			if (ok && !acks)
+				ok = RTMP_TunnelCollect(rtmp, FALSE) != 0;
+		}
+	}
+	CHECK(ok, "%s: send failed", name);
+
+	for (int waited = 0; ok && !srv.got_end && waited < 10000; waited++)
+		usleep(1000);
+	CHECK(srv.got_end, "%s: the last message never arrived", name);
+
+	if (acks && ok) {
+		RTMPPacket in;
+		memset(&in, 0, sizeof(in));
+		uint32_t expect = 1;
+		int read = 0;
+
+		while (read < srv.acks_sent && RTMP_ReadPacket(rtmp, &in)) {
+			if (!RTMPPacket_IsReady(&in))
+				continue;
+			uint32_t seq = AMF_DecodeInt32(in.m_body);
+			if (in.m_packetType != RTMP_PACKET_TYPE_BYTES_READ_REPORT ||
+					seq != expect) {
+				CHECK(false, "%s: reply %u read where %u was due", name, seq,
+						expect);
+				RTMPPacket_Free(&in);
+				break;
+			}
+			expect++;
+			read++;
+			RTMPPacket_Free(&in);
+		}
+		CHECK(read == srv.acks_sent, "%s: %d of %d replies read", name, read,
+				srv.acks_sent);
+	}
+
+	RTMPPacket_Free(&packet);
+	RTMP_Close(rtmp);
+	RTMP_Free(rtmp);
+	pthread_join(thread, NULL);
+	close(srv.listen_fd);
+
+	int64_t expected = HANDSHAKE_SIZE + (HANDSHAKE_SIZE - 1) +
+			(int64_t)(messages + 1) * MESSAGE_SIZE;
+	CHECK(srv.body_bytes >= expected, "%s: %lld of at least %lld bytes",
+			name, (long long)srv.body_bytes, (long long)expected);
+
+	int cap = max_inflight >= 0 ? max_inflight : RTMPT_MAX_INFLIGHT;
+	if (serial)
+		CHECK(srv.peak_inflight == 1, "%s: %d requests answered at once",
+				name, srv.peak_inflight);
+	else if (cap > 0)
+		CHECK(srv.peak_inflight <= cap + 1, "%s: %d posts unanswered, cap %d",
+				name, srv.peak_inflight, cap);
+
+	double ms = srv.got_end ? (srv.end_us - srv.start_us) / 1000.0 : 0;
+	printf("%s: %d posts, at most %d unanswered, delivered in %.1f ms\n",
+			name, srv.posts, srv.peak_inflight, ms);
+	return ms;
+}
+
+int main()
+{
+	signal(SIGPIPE, SIG_IGN);
+	RTMP_LogSetLevel(RTMP_LOGCRIT);
+
+	/* every post waits out a reply there, so fewer of them */
+	publish("serial", true, false, -1, MESSAGES / 20);
+	double capped = publish("pipelining", false, false, -1, MESSAGES);
+	double raised = publish("pipelining, cap raised", false, false, 1024,
+			MESSAGES);
+	publish("pipelining, replies read early", false, true, 8, MESSAGES / 4);
+
+	CHECK(raised < capped, "raising the cap took %.1f ms against %.1f ms",
+			raised, capped);
+
+	if (failures)
+		printf("%d checks failed\n", failures);
+	return failures ? 1 : 0;
+}
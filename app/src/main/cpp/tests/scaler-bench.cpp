@@ -0,0 +1,108 @@
+/*
+ * Throughput of the video scaler for the two downscales a stream usually
+ * needs, 1080p to 720p and 1440p to 1080p, per source and destination
+ * format: milliseconds per frame and frames per second with the worker
+ * threads the scaler starts for frames that size.
+ *
+ *   scaler-bench [frames]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+
+#include "rtmp-video-scaler.h"
+
+struct scale_case {
+	uint32_t src_width, src_height;
+	uint32_t dst_width, dst_height;
+};
+
+struct format_pair {
+	enum video_format src, dst;
+	const char        *name;
+};
+
+static double now_sec()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv)
+{
+	static const scale_case cases[] = {
+		{1920, 1080, 1280, 720},
+		{2560, 1440, 1920, 1080},
+	};
+	static const format_pair formats[] = {
+		{VIDEO_FORMAT_NV12, VIDEO_FORMAT_NV12, "NV12 -> NV12"},
+		{VIDEO_FORMAT_I420, VIDEO_FORMAT_I420, "I420 -> I420"},
+		{VIDEO_FORMAT_NV12, VIDEO_FORMAT_I420, "NV12 -> I420"},
+		{VIDEO_FORMAT_RGBA, VIDEO_FORMAT_NV12, "RGBA -> NV12"},
+		{VIDEO_FORMAT_BGRA, VIDEO_FORMAT_I420, "BGRA -> I420"},
+		{VIDEO_FORMAT_RGBA, VIDEO_FORMAT_RGBA, "RGBA -> RGBA"},
+		{VIDEO_FORMAT_BGRA, VIDEO_FORMAT_RGBA, "BGRA -> RGBA"},
+	};
+	int frames = argc > 1 ? atoi(argv[1]) : 100;
+
+	if (frames < 1)
+		frames = 1;
+
+	printf("%-11s %-14s %10s %8s %12s\n", "scale", "format", "ms/frame",
+			"fps", "Mpixel/s");
+
+	for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+		const scale_case &sc = cases[c];
+		char scale[32];
+		snprintf(scale, sizeof(scale), "%up->%up", sc.src_height,
+				sc.dst_height);
+
+		for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+			video_scale_info src, dst;
+			src.format = formats[f].src;
+			src.width  = sc.src_width;
+			src.height = sc.src_height;
+			dst.format = formats[f].dst;
+			dst.width  = sc.dst_width;
+			dst.height = sc.dst_height;
+
+			video_scaler_t *scaler = video_scaler_create(&dst, &src,
+					VIDEO_SCALE_DEFAULT);
+			if (!scaler) {
+				printf("%-11s %-14s failed to create\n", scale,
+						formats[f].name);
+				return 1;
+			}
+
+			std::vector<uint8_t> input(video_get_frame_size(src.format,
+					src.width, src.height));
+			std::vector<uint8_t> output;
+			unsigned seed = 1;
+			for (size_t i = 0; i < input.size(); i++) {
+				seed = seed * 1103515245 + 12345;
+				input[i] = (uint8_t)(seed >> 16);
+			}
+
+			/* one frame to size the output and warm the caches */
+			video_scaler_scale(scaler, output, &input[0], input.size());
+
+			double start = now_sec();
+			for (int i = 0; i < frames; i++)
+				video_scaler_scale(scaler, output, &input[0], input.size());
+			double elapsed = now_sec() - start;
+
+			double ms = elapsed * 1000.0 / frames;
+			double mpix = (double)sc.src_width * sc.src_height * frames /
+					elapsed / 1e6;
+			printf("%-11s %-14s %10.2f %8.1f %12.1f\n", scale,
+					formats[f].name, ms, 1000.0 / ms, mpix);
+
+			video_scaler_destroy(scaler);
+		}
+	}
+
+	return 0;
+}
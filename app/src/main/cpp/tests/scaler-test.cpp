@@ -0,0 +1,193 @@
+/*
+ * The SIMD kernels of the video scaler against their scalar loops, on
+ * random rows the way each format uses them: NV12 chroma split and
+ * joined again, I420 planes and interleaved NV12 chroma filtered with
+ * bilinear and area weights, RGBA and BGRA pixels filtered and turned
+ * into luma with the coefficients of either byte order, range and
+ * colorspace.
+ *
+ * Every kernel finishes a row in plain C past the last whole vector, so
+ * calling it for one sample at a time gives the scalar result. Counts
+ * run across the vector widths to cover the tails too.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "rtmp-video-scaler.h"
+
+#define MAX_COUNT 100
+#define MAX_TAPS  10
+#define ROUNDS    200
+#define COEF_ONE  (1 << 14)
+
+static int failures;
+
+#define CHECK(cond, ...) \
+	do { \
+		if (!(cond)) { \
+			printf("FAIL: " __VA_ARGS__); \
+			printf("\n"); \
+			failures++; \
+		} \
+	} while (0)
+
+static unsigned seed = 1;
+
+static uint32_t next_random()
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+/* mostly noise, sometimes saturated so the 16 bit sums run at their top */
+static void fill(std::vector<uint8_t> &buf, size_t size)
+{
+	int mode = next_random() % 4;
+
+	buf.resize(size);
+	for (size_t i = 0; i < size; i++)
+		buf[i] = mode == 0 ? 255 : mode == 1 ? (i & 1) * 255 :
+				(uint8_t)next_random();
+}
+
+static size_t first_diff(const uint8_t *a, const uint8_t *b, size_t size)
+{
+	for (size_t i = 0; i < size; i++)
+		if (a[i] != b[i])
+			return i;
+	return size;
+}
+
+/* taps weights that sum to 256, as build_filter makes them */
+static void make_weights(uint16_t *weights, int taps, bool area)
+{
+	int left = 256;
+
+	for (int k = 0; k < taps - 1; k++) {
+		int w = area ? 256 / taps : (int)(next_random() % (left + 1));
+		weights[k] = (uint16_t)w;
+		left -= w;
+	}
+	weights[taps - 1] = (uint16_t)left;
+}
+
+static void check_filter_rows(const char *format, int channels)
+{
+	for (int round = 0; round < ROUNDS; round++) {
+		bool area = round & 1;
+		int taps = area ? 2 + (int)(next_random() % (MAX_TAPS - 1)) : 2;
+		size_t count = (1 + next_random() % MAX_COUNT) * channels;
+
+		std::vector<uint8_t> src[MAX_TAPS];
+		const uint8_t *rows[MAX_TAPS];
+		uint16_t weights[MAX_TAPS];
+
+		for (int k = 0; k < taps; k++) {
+			fill(src[k], count);
+			rows[k] = &src[k][0];
+		}
+		make_weights(weights, taps, area);
+
+		std::vector<uint8_t> simd(count), scalar(count);
+		video_filter_rows(&simd[0], rows, weights, taps, count);
+
+		for (size_t i = 0; i < count; i++) {
+			const uint8_t *at[MAX_TAPS];
+			for (int k = 0; k < taps; k++)
+				at[k] = rows[k] + i;
+			video_filter_rows(&scalar[i], at, weights, taps, 1);
+		}
+
+		size_t diff = first_diff(&simd[0], &scalar[0], count);
+		CHECK(diff == count, "%s filter_rows, %d taps, %zu samples: %u "
+				"against %u at %zu", format, taps, count,
+				diff < count ? simd[diff] : 0,
+				diff < count ? scalar[diff] : 0, diff);
+	}
+}
+
+static void check_uv(const char *format)
+{
+	for (int round = 0; round < ROUNDS; round++) {
+		size_t count = 1 + next_random() % MAX_COUNT;
+		std::vector<uint8_t> u, v, uv;
+		fill(u, count);
+		fill(v, count);
+		fill(uv, count * 2);
+
+		std::vector<uint8_t> simd_uv(count * 2), scalar_uv(count * 2);
+		video_interleave_uv(&simd_uv[0], &u[0], &v[0], count);
+		for (size_t i = 0; i < count; i++)
+			video_interleave_uv(&scalar_uv[i * 2], &u[i], &v[i], 1);
+
+		std::vector<uint8_t> simd_u(count), simd_v(count);
+		std::vector<uint8_t> scalar_u(count), scalar_v(count);
+		video_deinterleave_uv(&simd_u[0], &simd_v[0], &uv[0], count);
+		for (size_t i = 0; i < count; i++)
+			video_deinterleave_uv(&scalar_u[i], &scalar_v[i], &uv[i * 2], 1);
+
+		CHECK(first_diff(&simd_uv[0], &scalar_uv[0], count * 2) == count * 2,
+				"%s interleave_uv, %zu samples", format, count);
+		CHECK(first_diff(&simd_u[0], &scalar_u[0], count) == count &&
+				first_diff(&simd_v[0], &scalar_v[0], count) == count,
+				"%s deinterleave_uv, %zu samples", format, count);
+	}
+}
+
+/* the luma row of build_rgb_to_yuv in the source's byte order */
+static void luma_coefs(bool bgr, bool bt709, bool full, int16_t *coefs,
+		int32_t *offset)
+{
+	double kr = bt709 ? 0.2126 : 0.299;
+	double kb = bt709 ? 0.0722 : 0.114;
+	double ys = full ? 1.0 : 219.0 / 255.0;
+	double y[3] = {kr * ys, (1.0 - kr - kb) * ys, kb * ys};
+
+	for (int c = 0; c < 3; c++)
+		coefs[c] = (int16_t)lrint(y[bgr ? 2 - c : c] * COEF_ONE);
+	*offset = (full ? 0 : 16) * COEF_ONE + COEF_ONE / 2;
+}
+
+static void check_rgb_to_luma(const char *format, bool bgr)
+{
+	for (int round = 0; round < ROUNDS; round++) {
+		size_t count = 1 + next_random() % MAX_COUNT;
+		bool bt709 = round & 1, full = round & 2;
+		int16_t coefs[3];
+		int32_t offset;
+		std::vector<uint8_t> src;
+
+		luma_coefs(bgr, bt709, full, coefs, &offset);
+		fill(src, count * 4);
+
+		std::vector<uint8_t> simd(count), scalar(count);
+		video_rgb_to_luma(&simd[0], &src[0], coefs, offset, count);
+		for (size_t i = 0; i < count; i++)
+			video_rgb_to_luma(&scalar[i], &src[i * 4], coefs, offset, 1);
+
+		size_t diff = first_diff(&simd[0], &scalar[0], count);
+		CHECK(diff == count, "%s rgb_to_luma, %s %s range, %zu pixels: %u "
+				"against %u at %zu", format, bt709 ? "709" : "601",
+				full ? "full" : "limited", count,
+				diff < count ? simd[diff] : 0,
+				diff < count ? scalar[diff] : 0, diff);
+	}
+}
+
+int main()
+{
+	check_filter_rows("I420", 1);
+	check_filter_rows("NV12", 2);
+	check_uv("NV12");
+	check_filter_rows("RGBA", 4);
+	check_rgb_to_luma("RGBA", false);
+	check_filter_rows("BGRA", 4);
+	check_rgb_to_luma("BGRA", true);
+
+	if (failures)
+		printf("%d checks failed\n", failures);
+	return failures ? 1 : 0;
+}
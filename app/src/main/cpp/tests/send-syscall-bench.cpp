@@ -0,0 +1,242 @@
+/*
+ * Write syscalls per second of media on the RTMP send path, for an
+ * audio + video stream at 30 and 60 fps: one RTMP_Write per tag as the
+ * send thread used to do, against batches flushed once per wakeup with
+ * the send thread's coalesce delay at 0, 10 and 20 ms.
+ *
+ *   send-syscall-bench [seconds of media]
+ *
+ * send() and sendmsg() are interposed to count the calls librtmp makes; a
+ * thread drains the other end of a socketpair.
+ */
+
+#include <dlfcn.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <vector>
+
+#include "librtmp/rtmp.h"
+
+#define AUDIO_RATE        48000
+#define AUDIO_KBPS        128
+#define VIDEO_KBPS        2500
+#define KEYFRAME_SEC      2
+#define CHUNK_SIZE        4096
+
+static volatile long write_calls;
+
+extern "C" ssize_t send(int fd, const void *buf, size_t len, int flags)
+{
+	typedef ssize_t (*send_fn)(int, const void *, size_t, int);
+	static send_fn real = (send_fn)dlsym(RTLD_NEXT, "send");
+
+	__sync_fetch_and_add(&write_calls, 1);
+	return real(fd, buf, len, flags);
+}
+
+extern "C" ssize_t sendmsg(int fd, const struct msghdr *msg, int flags)
+{
+	typedef ssize_t (*sendmsg_fn)(int, const struct msghdr *, int);
+	static sendmsg_fn real = (sendmsg_fn)dlsym(RTLD_NEXT, "sendmsg");
+
+	__sync_fetch_and_add(&write_calls, 1);
+	return real(fd, msg, flags);
+}
+
+struct media_tag {
+	int64_t              ts_ms;
+	std::vector<uint8_t> flv;
+};
+
+static void put_be24(uint8_t *p, uint32_t v)
+{
+	p[0] = (uint8_t)(v >> 16);
+	p[1] = (uint8_t)(v >> 8);
+	p[2] = (uint8_t)v;
+}
+
+static void make_tag(media_tag &tag, uint8_t type, int64_t ts_ms,
+		const uint8_t *prefix, size_t prefix_size, size_t payload)
+{
+	size_t body = prefix_size + payload;
+	tag.ts_ms = ts_ms;
+	tag.flv.assign(11 + body + 4, 0x5A);
+
+	uint8_t *p = &tag.flv[0];
+	p[0] = type;
+	put_be24(p + 1, (uint32_t)body);
+	put_be24(p + 4, (uint32_t)ts_ms & 0xFFFFFF);
+	p[7] = (uint8_t)((uint32_t)ts_ms >> 24);
+	put_be24(p + 8, 0);
+	memcpy(p + 11, prefix, prefix_size);
+
+	uint32_t prev = (uint32_t)(11 + body);
+	p += 11 + body;
+	p[0] = (uint8_t)(prev >> 24);
+	p[1] = (uint8_t)(prev >> 16);
+	p[2] = (uint8_t)(prev >> 8);
+	p[3] = (uint8_t)prev;
+}
+
+/* tags in dts order, timestamps start at 1 so every tag gets a medium
+ * header the way a running stream does */
+static void make_stream(std::vector<media_tag> &tags, int fps, int seconds)
+{
+	static const uint8_t aac[] = {0xAF, 0x01};
+	static const uint8_t key[] = {0x17, 0x01, 0, 0, 0};
+	static const uint8_t inter[] = {0x27, 0x01, 0, 0, 0};
+
+	size_t audio_frames = (size_t)seconds * AUDIO_RATE / 1024;
+	size_t video_frames = (size_t)seconds * fps;
+	size_t audio_bytes = AUDIO_KBPS * 1000 / 8 * 1024 / AUDIO_RATE;
+	size_t video_bytes = VIDEO_KBPS * 1000 / 8 / fps;
+	size_t a = 0, v = 0;
+
+	tags.clear();
+	while (a < audio_frames || v < video_frames) {
+		int64_t ats = 1 + (int64_t)a * 1024 * 1000 / AUDIO_RATE;
+		int64_t vts = 1 + (int64_t)v * 1000 / fps;
+		media_tag tag;
+
+		if (v >= video_frames || (a < audio_frames && ats <= vts)) {
+			make_tag(tag, RTMP_PACKET_TYPE_AUDIO, ats, aac, sizeof(aac),
+					audio_bytes);
+			a++;
+		} else {
+			bool keyframe = v % ((size_t)fps * KEYFRAME_SEC) == 0;
+			make_tag(tag, RTMP_PACKET_TYPE_VIDEO, vts,
+					keyframe ? key : inter, sizeof(key),
+					keyframe ? video_bytes * 8 : video_bytes * 3 / 4);
+			v++;
+		}
+		tags.push_back(tag);
+	}
+}
+
+static void *drain_thread(void *data)
+{
+	int fd = *(int *)data;
+	char buf[65536];
+
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+	return NULL;
+}
+
+static double now_sec()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* coalesce_ms < 0 writes tag by tag without a batch */
+static long run(const std::vector<media_tag> &tags, int coalesce_ms,
+		double &cpu_sec)
+{
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+		return -1;
+
+	pthread_t drain;
+	pthread_create(&drain, NULL, drain_thread, &fds[1]);
+
+	RTMP *r = RTMP_Alloc();
+	RTMP_Init(r);
+	r->m_sb.sb_socket = fds[0];
+	r->m_outChunkSize = CHUNK_SIZE;
+	r->Link.streams[0].id = 1;
+	r->Link.nStreams = 1;
+
+	long start_calls = write_calls;
+	double start = now_sec();
+	size_t i = 0;
+
+	while (i < tags.size()) {
+		/* everything that arrives while the send thread holds the wakeup
+		 * goes out with it */
+		size_t end = i + 1;
+		if (coalesce_ms > 0)
+			while (end < tags.size() &&
+					tags[end].ts_ms <= tags[i].ts_ms + coalesce_ms)
+				end++;
+
+		bool batch = coalesce_ms >= 0;
+		if (batch)
+			RTMP_BeginBatch(r);
+		for (; i < end; i++)
+			RTMP_Write(r, (const char *)&tags[i].flv[0],
+					(int)tags[i].flv.size(), 0);
+		if (batch)
+			RTMP_FlushBatch(r);
+	}
+
+	cpu_sec = now_sec() - start;
+	long calls = write_calls - start_calls;
+
+	shutdown(fds[0], SHUT_WR);
+	pthread_join(drain, NULL);
+	close(fds[0]);
+	close(fds[1]);
+	r->m_sb.sb_socket = -1;
+	RTMP_Free(r);
+
+	return calls;
+}
+
+int main(int argc, char **argv)
+{
+	static const int fps_list[] = {30, 60};
+	static const int coalesce_list[] = {-1, 0, 10, 20};
+	int seconds = argc > 1 ? atoi(argv[1]) : 10;
+	int failed = 0;
+
+	if (seconds < 1)
+		seconds = 1;
+
+	printf("%4s %-16s %12s %14s %10s\n", "fps", "mode", "writes/sec",
+			"bytes/write", "usec/sec");
+
+	for (size_t f = 0; f < sizeof(fps_list) / sizeof(fps_list[0]); f++) {
+		std::vector<media_tag> tags;
+		make_stream(tags, fps_list[f], seconds);
+
+		size_t bytes = 0;
+		for (size_t i = 0; i < tags.size(); i++)
+			bytes += tags[i].flv.size();
+
+		long per_tag = 0;
+		for (size_t c = 0; c < sizeof(coalesce_list) / sizeof(coalesce_list[0]); c++) {
+			int coalesce = coalesce_list[c];
+			double cpu = 0.0;
+			long calls = run(tags, coalesce, cpu);
+			if (calls <= 0) {
+				printf("%4d run failed\n", fps_list[f]);
+				return 1;
+			}
+
+			char mode[32];
+			if (coalesce < 0)
+				snprintf(mode, sizeof(mode), "per tag");
+			else
+				snprintf(mode, sizeof(mode), "batch %d ms", coalesce);
+
+			printf("%4d %-16s %12.1f %14.0f %10.1f\n", fps_list[f], mode,
+					(double)calls / seconds, (double)bytes / calls,
+					cpu * 1e6 / seconds);
+
+			if (coalesce < 0)
+				per_tag = calls;
+			else if (calls > per_tag)
+				failed = 1;
+		}
+	}
+
+	return failed;
+}
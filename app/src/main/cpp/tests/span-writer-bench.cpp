@@ -0,0 +1,266 @@
+/*
+ * Nanoseconds per tag for FLVPackager on span_writer against the path it
+ * replaced: SerializeByte growing an array_output_data one write at a time
+ * and GetDataByte copying it out into a fresh vector, and onMetaData built
+ * with the amf.c encoders into a stack buffer, copied out and wrapped the
+ * same way. The old path is kept here as it was, with today's tag layout,
+ * so both have to come out byte for byte the same.
+ *
+ * Tags go into one reused buffer as RtmpStream muxes them; onMetaData is
+ * returned by value on both sides.
+ *
+ *   span-writer-bench [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include "librtmp/rtmp.h"
+#include "util/array-serializer.h"
+#include "rtmp-defs.h"
+#include "rtmp-flv-packager.h"
+#include "rtmp-helpers.h"
+
+#define AGGREGATE_TAGS 8
+
+class SerializeByte {
+public:
+	SerializeByte()
+	{
+		array_output_serializer_init(&s, &data);
+	}
+
+	~SerializeByte()
+	{
+		if (data.bytes.num > 0)
+			array_output_serializer_free(&data);
+	}
+
+	void write_uint8(uint8_t u8) {s_w8(&s, u8);}
+	void write_uint24(uint32_t u24) {s_wb24(&s, u24);}
+	void write_uint32(uint32_t u32) {s_wb32(&s, u32);}
+	size_t write(const void *buf, size_t size) {return s_write(&s, buf, size);}
+	int64_t get_pos() {return s.get_pos ? s.get_pos(s.data) : -1;}
+
+	std::vector<uint8_t> GetDataByte()
+	{
+		if (data.bytes.num > 0) {
+			std::vector<uint8_t> buffer(data.bytes.num, 0);
+			memcpy(&buffer[0], data.bytes.array, buffer.size());
+			return buffer;
+		}
+		return std::vector<uint8_t>();
+	}
+
+private:
+	array_output_data data;
+	serializer s;
+};
+
+static double now_sec()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void write_tag_header(SerializeByte &s, uint8_t type, size_t size,
+		int32_t time_ms)
+{
+	s.write_uint8(type);
+	s.write_uint24((uint32_t)size);
+	s.write_uint24(time_ms);
+	s.write_uint8((time_ms >> 24) & 0x7F);
+	s.write_uint24(0);
+}
+
+static std::vector<uint8_t> old_packet_mux(encoder_packet &packet,
+		int32_t dts_offset)
+{
+	SerializeByte s;
+	int32_t time_ms = packet.get_ms_time(packet.dts) - dts_offset;
+	size_t size = packet.data.size();
+
+	if (packet.type == OBS_ENCODER_VIDEO) {
+		int32_t cts = packet.get_ms_time(packet.pts) -
+				packet.get_ms_time(packet.dts);
+
+		write_tag_header(s, RTMP_PACKET_TYPE_VIDEO, size + 5, time_ms);
+		s.write_uint8(packet.keyframe ? 0x17 : 0x27);
+		s.write_uint8(1);
+		s.write_uint24((uint32_t)cts);
+	} else {
+		write_tag_header(s, RTMP_PACKET_TYPE_AUDIO, size + 2, time_ms);
+		s.write_uint8(0xaf);
+		s.write_uint8(1);
+	}
+	s.write(&packet.data[0], size);
+	s.write_uint32((uint32_t)s.get_pos());
+
+	return s.GetDataByte();
+}
+
+static std::vector<uint8_t> old_aggregate_mux(const std::vector<uint8_t> &tags,
+		int32_t time_ms)
+{
+	SerializeByte s;
+
+	write_tag_header(s, RTMP_PACKET_TYPE_FLASH_VIDEO, tags.size(), time_ms);
+	s.write(&tags[0], tags.size());
+	s.write_uint32((uint32_t)s.get_pos());
+
+	return s.GetDataByte();
+}
+
+static std::vector<uint8_t> old_meta_data()
+{
+	char buf[4096];
+	char *enc = buf;
+	char *end = enc + sizeof(buf);
+	char encoder_name[64];
+
+	snprintf(encoder_name, sizeof(encoder_name), "%s ( version %d.%d.%d )",
+			"rtmp-output module", MAJOR_VER, MINOR_VER, PATCH_VER);
+
+	enc_str(&enc, end, "onMetaData");
+	*enc++ = AMF_ECMA_ARRAY;
+	enc = AMF_EncodeInt32(enc, end, 8);
+	enc_num_val(&enc, end, "width", 1280);
+	enc_num_val(&enc, end, "height", 720);
+	enc_num_val(&enc, end, "videocodecid", 7);
+	enc_num_val(&enc, end, "framerate", 30);
+	enc_num_val(&enc, end, "audiocodecid", 10);
+	enc_num_val(&enc, end, "audiodatarate", 128);
+	enc_num_val(&enc, end, "audiosamplerate", 48000);
+	enc_str_val(&enc, end, "encoder", encoder_name);
+	*enc++ = 0;
+	*enc++ = 0;
+	*enc++ = AMF_OBJECT_END;
+
+	std::vector<uint8_t> meta_data(enc - buf, 0);
+	memcpy(&meta_data[0], buf, meta_data.size());
+
+	SerializeByte s;
+	write_tag_header(s, RTMP_PACKET_TYPE_INFO, meta_data.size(), 0);
+	s.write(&meta_data[0], meta_data.size());
+	s.write_uint32((uint32_t)s.get_pos());
+
+	return s.GetDataByte();
+}
+
+static void make_packet(encoder_packet &packet, enum obs_encoder_type type,
+		size_t size, bool keyframe)
+{
+	packet.type         = type;
+	packet.timebase_num = 1;
+	packet.timebase_den = 1000;
+	packet.pts          = 1033;
+	packet.dts          = 1000;
+	packet.keyframe     = keyframe;
+	packet.data.resize(size);
+	for (size_t i = 0; i < size; i++)
+		packet.data[i] = (uint8_t)(i * 7);
+}
+
+static bool report(const char *name, double old_ns, double new_ns, bool same)
+{
+	printf("%-22s %12.0f %12.0f %8.1fx%s\n", name, old_ns, new_ns,
+			new_ns > 0 ? old_ns / new_ns : 0.0, same ? "" : "  DIFFERS");
+	return same;
+}
+
+static bool bench_packet(const char *name, encoder_packet &packet,
+		int iterations, volatile size_t &sink)
+{
+	std::vector<uint8_t> tag_buffer;
+
+	double start = now_sec();
+	for (int i = 0; i < iterations; i++)
+		sink += old_packet_mux(packet, 0).size();
+	double old_ns = (now_sec() - start) * 1e9 / iterations;
+
+	start = now_sec();
+	for (int i = 0; i < iterations; i++) {
+		FLVPackager::flv_packet_mux(tag_buffer, packet, 0, false);
+		sink += tag_buffer.size();
+	}
+	double new_ns = (now_sec() - start) * 1e9 / iterations;
+
+	return report(name, old_ns, new_ns, old_packet_mux(packet, 0) ==
+			FLVPackager::flv_packet_mux(packet, 0, false));
+}
+
+int main(int argc, char **argv)
+{
+	int iterations = argc > 1 ? atoi(argv[1]) : 200000;
+	volatile size_t sink = 0;
+	bool same = true;
+
+	if (iterations < 1)
+		iterations = 1;
+
+	printf("%-22s %12s %12s %9s\n", "ns per call",
+			"SerializeByte", "span_writer", "speedup");
+
+	encoder_packet key, inter, audio;
+	make_packet(key, OBS_ENCODER_VIDEO, 30000, true);
+	make_packet(inter, OBS_ENCODER_VIDEO, 3000, false);
+	make_packet(audio, OBS_ENCODER_AUDIO, 400, false);
+
+	same &= bench_packet("video tag, 30000 B", key, iterations, sink);
+	same &= bench_packet("video tag, 3000 B", inter, iterations, sink);
+	same &= bench_packet("audio tag, 400 B", audio, iterations, sink);
+
+	std::vector<uint8_t> tags, aggregate;
+	for (int i = 0; i < AGGREGATE_TAGS; i++) {
+		std::vector<uint8_t> tag = FLVPackager::flv_packet_mux(audio, 0,
+				false);
+		tags.insert(tags.end(), tag.begin(), tag.end());
+	}
+
+	double start = now_sec();
+	for (int i = 0; i < iterations; i++)
+		sink += old_aggregate_mux(tags, 1000).size();
+	double old_ns = (now_sec() - start) * 1e9 / iterations;
+
+	start = now_sec();
+	for (int i = 0; i < iterations; i++) {
+		FLVPackager::flv_aggregate_mux(aggregate, tags, 1000);
+		sink += aggregate.size();
+	}
+	double new_ns = (now_sec() - start) * 1e9 / iterations;
+
+	same &= report("aggregate of 8 tags", old_ns, new_ns,
+			old_aggregate_mux(tags, 1000) == aggregate);
+
+	FLVPackager packager;
+	packager.has_video         = true;
+	packager.width             = 1280;
+	packager.height            = 720;
+	packager.video_codec_id    = 7;
+	packager.frame_rate        = 30;
+	packager.has_audio         = true;
+	packager.audio_codec_id    = 10;
+	packager.audio_data_rate   = 128;
+	packager.audio_sample_rate = 48000;
+
+	start = now_sec();
+	for (int i = 0; i < iterations; i++)
+		sink += old_meta_data().size();
+	old_ns = (now_sec() - start) * 1e9 / iterations;
+
+	start = now_sec();
+	for (int i = 0; i < iterations; i++)
+		sink += packager.flv_meta_data(false).size();
+	new_ns = (now_sec() - start) * 1e9 / iterations;
+
+	same &= report("onMetaData tag", old_ns, new_ns,
+			old_meta_data() == packager.flv_meta_data(false));
+
+	if (!same)
+		printf("FAIL: span_writer tags differ from SerializeByte's\n");
+	return same ? 0 : 1;
+}
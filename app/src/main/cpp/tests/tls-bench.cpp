@@ -0,0 +1,180 @@
+/*
+ * CPU the sending thread spends per Mbit/s of video over rtmps, with the
+ * records sealed by OpenSSL in user space and with the session handed to
+ * kernel TLS, against plain rtmp for a baseline. 64 KB video messages go
+ * through RTMP_SendPacket to the loopback listener as fast as it reads
+ * them; the thread's CPU time, user and system, is what a stream at that
+ * bitrate would cost: % of a core per Mbit/s, and at 6 Mbit/s.
+ *
+ * kTLS needs OpenSSL 3 built with it and the kernel's tls module; where
+ * either is missing the session stays in user space and its row says so.
+ * Without USE_TLS it exits as skipped.
+ *
+ *   tls-bench [megabytes]
+ */
+
+#include <stdio.h>
+
+#ifdef USE_TLS
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tls-listener.h"
+#include "librtmp/log.h"
+
+#define MESSAGE_SIZE   (64 * 1024)
+#define STREAM_MBIT    6.0
+
+enum send_mode {
+	SEND_PLAIN,
+	SEND_USER_TLS,
+	SEND_KERNEL_TLS,
+};
+
+static double now_sec(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* % of a core per Mbit/s, negative when the mode was not available */
+static double run(void *ctx, enum send_mode mode, int megabytes,
+		bool &ok)
+{
+	static const char *names[] = {"rtmp", "user space TLS", "kernel TLS"};
+	tls_listener l;
+	pthread_t thread;
+	char url[128];
+
+	l.keep_media = false;
+	if (!tls_listener_start(&l, ctx, mode != SEND_PLAIN, &thread)) {
+		printf("FAIL: %s: listener\n", names[mode]);
+		ok = false;
+		return -1.0;
+	}
+
+	RTMP *rtmp = tls_client_connect(&l, TLS_HOST, mode == SEND_USER_TLS,
+			url, sizeof(url));
+	RTMPPacket packet;
+	memset(&packet, 0, sizeof(packet));
+
+	if (!rtmp || !RTMPPacket_Alloc(&packet, MESSAGE_SIZE)) {
+		if (rtmp) {
+			RTMP_Close(rtmp);
+			RTMP_Free(rtmp);
+		}
+		tls_listener_stop(&l, thread);
+		printf("FAIL: %s: connect\n", names[mode]);
+		ok = false;
+		return -1.0;
+	}
+
+	bool ktls = rtmp->m_sb.sb_ktls != 0;
+	if (mode == SEND_KERNEL_TLS && !ktls) {
+		RTMP_Close(rtmp);
+		RTMP_Free(rtmp);
+		tls_listener_stop(&l, thread);
+		RTMPPacket_Free(&packet);
+		printf("%-16s not available, the session stayed in user space\n",
+				names[mode]);
+		return -1.0;
+	}
+
+	for (uint32_t i = 0; i < MESSAGE_SIZE; i++)
+		packet.m_body[i] = (uint8_t)(i * 7 + (i >> 8));
+
+	int messages = megabytes * 16;
+	uint64_t sent = 0;
+	double wall = now_sec(CLOCK_MONOTONIC);
+	double cpu = now_sec(CLOCK_THREAD_CPUTIME_ID);
+
+	for (int i = 0; i < messages; i++) {
+		if (!tls_send_video(rtmp, &packet, MESSAGE_SIZE, i * 33))
+			break;
+		sent += MESSAGE_SIZE;
+	}
+
+	cpu = now_sec(CLOCK_THREAD_CPUTIME_ID) - cpu;
+	wall = now_sec(CLOCK_MONOTONIC) - wall;
+
+	RTMP_Close(rtmp);
+	RTMP_Free(rtmp);
+	RTMPPacket_Free(&packet);
+	tls_listener_stop(&l, thread);
+
+	if (l.media_bytes != (uint64_t)messages * MESSAGE_SIZE) {
+		printf("FAIL: %s: %llu of %llu bytes received\n", names[mode],
+				(unsigned long long)l.media_bytes,
+				(unsigned long long)messages * MESSAGE_SIZE);
+		ok = false;
+		return -1.0;
+	}
+
+	double mbit = sent * 8 / 1e6;
+	double core = cpu / mbit * 100.0;
+	printf("%-16s %10.0f %14.4f %14.3f\n", names[mode], mbit / wall, core,
+			core * STREAM_MBIT);
+	return core;
+}
+
+int main(int argc, char **argv)
+{
+	int megabytes = argc > 1 ? atoi(argv[1]) : 256;
+	char cert[] = "/tmp/tls-bench-cert-XXXXXX";
+	char key[] = "/tmp/tls-bench-key-XXXXXX";
+	bool ok = true;
+
+	if (megabytes < 1)
+		megabytes = 1;
+
+	int cert_fd = mkstemp(cert);
+	int key_fd = mkstemp(key);
+	if (cert_fd < 0 || key_fd < 0)
+		return 2;
+	close(cert_fd);
+	close(key_fd);
+
+	RTMP_LogSetLevel(RTMP_LOGCRIT);
+
+	void *ctx = NULL;
+	if (tls_make_cert(cert, key))
+		ctx = RTMP_TLS_AllocServerContext(cert, key);
+	if (!ctx || !RTMP_TLS_LoadCAFile(cert)) {
+		printf("FAIL: self signed certificate\n");
+		unlink(cert);
+		unlink(key);
+		return 1;
+	}
+
+	printf("%d MB in %d KB video messages, %s\n", megabytes,
+			MESSAGE_SIZE / 1024, OpenSSL_version(OPENSSL_VERSION));
+	printf("%-16s %10s %14s %14s\n", "", "Mbit/s", "% core/Mbit/s",
+			"% core at 6M");
+
+	run(ctx, SEND_PLAIN, megabytes, ok);
+	double user = run(ctx, SEND_USER_TLS, megabytes, ok);
+	double kernel = run(ctx, SEND_KERNEL_TLS, megabytes, ok);
+
+	if (user > 0.0 && kernel > 0.0)
+		printf("kernel TLS takes %.0f%% of the CPU user space TLS does\n",
+				kernel / user * 100.0);
+
+	RTMP_TLS_FreeServerContext(ctx);
+	unlink(cert);
+	unlink(key);
+	return ok ? 0 : 1;
+}
+
+#else
+
+int main()
+{
+	printf("built without USE_TLS, skipped\n");
+	return 77;
+}
+
+#endif
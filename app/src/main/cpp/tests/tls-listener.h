@@ -0,0 +1,248 @@
+#pragma once
+
+/* An rtmps listener on the loopback for the TLS test and bench: a self
+ * signed certificate for localhost made on the spot, and a thread that
+ * accepts one client with RTMP_TLS_Accept, handshakes with RTMP_Serve and
+ * reads messages until the client hangs up. Only for the OpenSSL build,
+ * USE_TLS. */
+
+#ifdef USE_TLS
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <string>
+#include <vector>
+
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509v3.h>
+
+#include "librtmp/rtmp.h"
+
+#define TLS_HOST "localhost"
+
+struct tls_listener {
+	int                  listen_fd;
+	int                  port;
+	void                 *ctx;
+	bool                 tls;
+	bool                 keep_media;
+
+	bool                 accepted;
+	bool                 served;
+	bool                 ktls;
+	std::string          app;
+	uint64_t             media_bytes;
+	std::vector<uint8_t> media;
+};
+
+/* a P-256 key and a certificate for TLS_HOST signed with it, as PEM */
+static bool tls_make_cert(const char *cert_path, const char *key_path)
+{
+	EVP_PKEY *key = NULL;
+	EVP_PKEY_CTX *kctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL);
+	X509 *cert = NULL;
+	bool ok = false;
+
+	if (!kctx || EVP_PKEY_keygen_init(kctx) <= 0 ||
+			EVP_PKEY_CTX_set_ec_paramgen_curve_nid(kctx,
+				NID_X9_62_prime256v1) <= 0 ||
+			EVP_PKEY_keygen(kctx, &key) <= 0)
+		goto done;
+
+	cert = X509_new();
+	if (!cert)
+		goto done;
+
+	X509_set_version(cert, 2);
+	ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+	X509_gmtime_adj(X509_getm_notBefore(cert), -60);
+	X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+	X509_set_pubkey(cert, key);
+	X509_NAME_add_entry_by_txt(X509_get_subject_name(cert), "CN",
+			MBSTRING_ASC, (const unsigned char *)TLS_HOST, -1, -1, 0);
+	X509_set_issuer_name(cert, X509_get_subject_name(cert));
+
+	{
+		X509_EXTENSION *san = X509V3_EXT_conf_nid(NULL, NULL,
+				NID_subject_alt_name, (char *)"DNS:" TLS_HOST);
+		if (!san)
+			goto done;
+		X509_add_ext(cert, san, -1);
+		X509_EXTENSION_free(san);
+	}
+
+	if (!X509_sign(cert, key, EVP_sha256()))
+		goto done;
+
+	{
+		FILE *f = fopen(cert_path, "w");
+		if (!f)
+			goto done;
+		ok = PEM_write_X509(f, cert) == 1;
+		ok = fclose(f) == 0 && ok;
+
+		f = fopen(key_path, "w");
+		if (!f) {
+			ok = false;
+			goto done;
+		}
+		ok = PEM_write_PrivateKey(f, key, NULL, NULL, 0, NULL, NULL) == 1 &&
+				ok;
+		ok = fclose(f) == 0 && ok;
+	}
+
+done:
+	X509_free(cert);
+	EVP_PKEY_free(key);
+	EVP_PKEY_CTX_free(kctx);
+	return ok;
+}
+
+static void tls_read_connect(tls_listener *l, RTMPPacket &packet)
+{
+	AMFObject obj, command;
+	AVal name = {(char *)"app", 3};
+	AVal app;
+
+	if (AMF_Decode(&obj, packet.m_body, packet.m_nBodySize, FALSE) < 0)
+		return;
+
+	AMFProp_GetObject(AMF_GetProp(&obj, NULL, 2), &command);
+	AMFProp_GetString(AMF_GetProp(&command, &name, -1), &app);
+	if (app.av_len)
+		l->app.assign(app.av_val, app.av_len);
+	AMF_Reset(&obj);
+}
+
+static void *tls_listener_thread(void *data)
+{
+	tls_listener *l = (tls_listener *)data;
+	int fd = accept(l->listen_fd, NULL, NULL);
+	if (fd < 0)
+		return NULL;
+
+	RTMP *rtmp = RTMP_Alloc();
+	RTMP_Init(rtmp);
+	rtmp->m_sb.sb_socket = fd;
+
+	RTMPPacket packet;
+	memset(&packet, 0, sizeof(packet));
+
+	l->accepted = !l->tls || RTMP_TLS_Accept(rtmp, l->ctx);
+	l->ktls     = rtmp->m_sb.sb_ktls != 0;
+	l->served   = l->accepted && RTMP_Serve(rtmp);
+
+	while (l->served && RTMP_ReadPacket(rtmp, &packet)) {
+		if (!RTMPPacket_IsReady(&packet))
+			continue;
+
+		if (packet.m_packetType == RTMP_PACKET_TYPE_CHUNK_SIZE)
+			rtmp->m_inChunkSize = AMF_DecodeInt32(packet.m_body);
+		else if (packet.m_packetType == RTMP_PACKET_TYPE_INVOKE)
+			tls_read_connect(l, packet);
+		else if (packet.m_packetType == RTMP_PACKET_TYPE_VIDEO) {
+			l->media_bytes += packet.m_nBodySize;
+			if (l->keep_media)
+				l->media.assign(packet.m_body,
+						packet.m_body + packet.m_nBodySize);
+		}
+		RTMPPacket_Free(&packet);
+	}
+
+	RTMPPacket_Free(&packet);
+	RTMP_Close(rtmp);
+	RTMP_Free(rtmp);
+	return NULL;
+}
+
+/* tls false listens for plain rtmp, for a baseline */
+static bool tls_listener_start(tls_listener *l, void *ctx, bool tls,
+		pthread_t *thread)
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	int one = 1;
+
+	l->ctx         = ctx;
+	l->tls         = tls;
+	l->accepted    = false;
+	l->served      = false;
+	l->ktls        = false;
+	l->media_bytes = 0;
+	l->app.clear();
+	l->media.clear();
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family      = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	l->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	setsockopt(l->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(l->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+			listen(l->listen_fd, 1) != 0 ||
+			getsockname(l->listen_fd, (struct sockaddr *)&addr, &len) != 0) {
+		close(l->listen_fd);
+		return false;
+	}
+	l->port = ntohs(addr.sin_port);
+
+	if (pthread_create(thread, NULL, tls_listener_thread, l) != 0) {
+		close(l->listen_fd);
+		return false;
+	}
+	return true;
+}
+
+static void tls_listener_stop(tls_listener *l, pthread_t thread)
+{
+	pthread_join(thread, NULL);
+	close(l->listen_fd);
+}
+
+/* connects to host on the listener's port and sends connect the way
+ * RtmpStream does, NULL when that fails; url has to outlive the RTMP */
+static RTMP *tls_client_connect(const tls_listener *l, const char *host,
+		bool no_ktls, char *url, size_t url_size)
+{
+	snprintf(url, url_size, "%s://%s:%d/live",
+			l->tls ? "rtmps" : "rtmp", host, l->port);
+
+	RTMP *rtmp = RTMP_Alloc();
+	RTMP_Init(rtmp);
+	if (!RTMP_SetupURL(rtmp, url)) {
+		RTMP_Free(rtmp);
+		return NULL;
+	}
+	RTMP_EnableWrite(rtmp);
+	rtmp->m_outChunkSize       = 4096;
+	rtmp->m_bSendChunkSizeInfo = true;
+	if (no_ktls)
+		rtmp->Link.lFlags |= RTMP_LF_NOKTLS;
+
+	if (!RTMP_Connect(rtmp, NULL)) {
+		RTMP_Free(rtmp);
+		return NULL;
+	}
+	return rtmp;
+}
+
+/* packet holds size bytes from RTMPPacket_Alloc */
+static bool tls_send_video(RTMP *rtmp, RTMPPacket *packet, uint32_t size,
+		uint32_t time_ms)
+{
+	packet->m_packetType      = RTMP_PACKET_TYPE_VIDEO;
+	packet->m_nChannel        = 0x06;
+	packet->m_headerType      = RTMP_PACKET_SIZE_LARGE;
+	packet->m_nTimeStamp      = time_ms;
+	packet->m_nInfoField2     = 1;
+	packet->m_hasAbsTimestamp = 0;
+	packet->m_nBodySize       = size;
+	return RTMP_SendPacket(rtmp, packet, FALSE) != 0;
+}
+
+#endif
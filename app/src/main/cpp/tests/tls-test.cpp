@@ -0,0 +1,162 @@
+/*
+ * rtmps end to end on the loopback: a listener with a self signed
+ * certificate for localhost takes the client through RTMP_TLS_Accept and
+ * RTMP_Serve, and has to read the connect command and a video message
+ * of many chunks back byte for byte.
+ *
+ * Before the certificate is trusted the client has to refuse it, and
+ * once it is, a connect by address instead of the name it was issued for
+ * has to be refused as well; the listener must not get to RTMP_Serve in
+ * either case.
+ *
+ * Without USE_TLS there is nothing to test and it exits as skipped.
+ */
+
+#include <stdio.h>
+
+#ifdef USE_TLS
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#include "tls-listener.h"
+#include "librtmp/log.h"
+
+#define MEDIA_SIZE  100000
+
+static int failures;
+
+#define CHECK(cond, ...) \
+	do { \
+		if (!(cond)) { \
+			printf("FAIL: " __VA_ARGS__); \
+			printf("\n"); \
+			failures++; \
+		} \
+	} while (0)
+
+static void refused(void *ctx, const char *host, const char *why)
+{
+	tls_listener l;
+	pthread_t thread;
+	char url[128];
+
+	if (!tls_listener_start(&l, ctx, true, &thread)) {
+		CHECK(false, "%s: listener", why);
+		return;
+	}
+
+	RTMP *rtmp = tls_client_connect(&l, host, false, url, sizeof(url));
+	if (rtmp) {
+		RTMP_Close(rtmp);
+		RTMP_Free(rtmp);
+	}
+	tls_listener_stop(&l, thread);
+
+	printf("%s: client %s, listener %s\n", why,
+			rtmp ? "connected" : "refused",
+			l.served ? "served" : "not served");
+
+	CHECK(!rtmp, "%s: the client connected", why);
+	CHECK(!l.served, "%s: the listener got to RTMP_Serve", why);
+}
+
+static void served(void *ctx)
+{
+	tls_listener l;
+	pthread_t thread;
+	char url[128];
+
+	l.keep_media = true;
+	if (!tls_listener_start(&l, ctx, true, &thread)) {
+		CHECK(false, "listener");
+		return;
+	}
+
+	RTMP *rtmp = tls_client_connect(&l, TLS_HOST, false, url, sizeof(url));
+	bool sent = false, client_ktls = false;
+	std::vector<uint8_t> media(MEDIA_SIZE);
+	RTMPPacket packet;
+	memset(&packet, 0, sizeof(packet));
+
+	for (uint32_t i = 0; i < MEDIA_SIZE; i++)
+		media[i] = (uint8_t)(i * 7 + (i >> 8));
+
+	/* the chunk headers are written over the body as it goes out */
+	if (rtmp && RTMPPacket_Alloc(&packet, MEDIA_SIZE)) {
+		memcpy(packet.m_body, &media[0], MEDIA_SIZE);
+		sent = tls_send_video(rtmp, &packet, MEDIA_SIZE, 0);
+		client_ktls = rtmp->m_sb.sb_ktls != 0;
+	}
+	if (rtmp) {
+		RTMP_Close(rtmp);
+		RTMP_Free(rtmp);
+	}
+	tls_listener_stop(&l, thread);
+
+	printf("rtmps://%s:%d: client %s, listener %s, app \"%s\", %u of %d "
+			"bytes back, %s / %s\n", TLS_HOST, l.port,
+			rtmp ? "connected" : "refused",
+			l.served ? "served" : "not served", l.app.c_str(),
+			(unsigned)l.media.size(), MEDIA_SIZE,
+			client_ktls ? "kernel TLS" : "user space TLS",
+			l.ktls ? "kernel TLS" : "user space TLS");
+
+	CHECK(rtmp, "the client did not connect");
+	CHECK(l.accepted, "RTMP_TLS_Accept failed");
+	CHECK(l.served, "RTMP_Serve failed after the TLS handshake");
+	CHECK(l.app == "live", "connect app \"%s\"", l.app.c_str());
+	CHECK(sent, "the video message was not sent");
+	CHECK(l.media == media, "the video message came back different");
+
+	RTMPPacket_Free(&packet);
+}
+
+int main()
+{
+	char cert[] = "/tmp/tls-test-cert-XXXXXX";
+	char key[] = "/tmp/tls-test-key-XXXXXX";
+	int cert_fd = mkstemp(cert);
+	int key_fd = mkstemp(key);
+
+	if (cert_fd < 0 || key_fd < 0)
+		return 2;
+	close(cert_fd);
+	close(key_fd);
+
+	RTMP_LogSetLevel(RTMP_LOGCRIT);
+
+	void *ctx = NULL;
+	CHECK(tls_make_cert(cert, key), "self signed certificate");
+	CHECK(ctx = RTMP_TLS_AllocServerContext(cert, key),
+			"RTMP_TLS_AllocServerContext");
+
+	if (ctx) {
+		refused(ctx, TLS_HOST, "untrusted certificate");
+
+		CHECK(RTMP_TLS_LoadCAFile(cert), "RTMP_TLS_LoadCAFile");
+		served(ctx);
+		refused(ctx, "127.0.0.1", "certificate for another name");
+
+		RTMP_TLS_FreeServerContext(ctx);
+	}
+
+	unlink(cert);
+	unlink(key);
+
+	if (failures)
+		printf("%d checks failed\n", failures);
+	return failures ? 1 : 0;
+}
+
+#else
+
+int main()
+{
+	printf("built without USE_TLS, skipped\n");
+	return 77;
+}
+
+#endif
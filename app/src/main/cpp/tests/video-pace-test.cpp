@@ -0,0 +1,123 @@
+/*
+ * Raw frames captured at 50 fps through a 30 fps VideoOutput: three in
+ * five must reach the encoder on the 30 fps grid and every frame held back,
+ * repeated timestamps included, must be counted as skipped. Encoded
+ * frames pass untouched apart from exact repeats.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "rtmp-video-output.h"
+
+#define SECONDS     10
+#define CAPTURE_FPS 50
+#define WIDTH       64
+#define HEIGHT      64
+
+static int failures;
+
+#define CHECK(cond, ...) \
+	do { \
+		if (!(cond)) { \
+			printf("FAIL: " __VA_ARGS__); \
+			printf("\n"); \
+			failures++; \
+		} \
+	} while (0)
+
+struct received {
+	int      frames;
+	uint64_t last_ts;
+	uint64_t max_interval;
+	uint64_t min_interval;
+};
+
+static void on_frame(void *param, struct media_data *frame)
+{
+	received *rx = (received *)param;
+
+	if (rx->frames) {
+		uint64_t interval = frame->timestamp - rx->last_ts;
+		if (interval > rx->max_interval)
+			rx->max_interval = interval;
+		if (interval < rx->min_interval)
+			rx->min_interval = interval;
+	}
+	rx->last_ts = frame->timestamp;
+	rx->frames++;
+}
+
+/* every seventh frame is handed over twice, the way a producer that
+ * re-sends the last frame on a timer does */
+static int run(enum video_format format, received &rx, uint32_t &skipped)
+{
+	video_output_info info;
+	info.name    = "video";
+	info.format  = format;
+	info.fps_num = 30;
+	info.fps_den = 1;
+	info.width   = WIDTH;
+	info.height  = HEIGHT;
+
+	VideoOutput output(info);
+	output.output_open();
+
+	rx.frames       = 0;
+	rx.last_ts      = 0;
+	rx.max_interval = 0;
+	rx.min_interval = UINT64_MAX;
+	output.start_raw_video(NULL, on_frame, &rx);
+
+	media_data frame;
+	frame.data.assign(WIDTH * HEIGHT * 3 / 2, 0x80);
+
+	int sent = 0, repeats = 0;
+	for (int k = 0; k < SECONDS * CAPTURE_FPS; k++) {
+		frame.timestamp = 1000000000ULL + (uint64_t)k * 1000000000ULL /
+				CAPTURE_FPS;
+		output.output_frame(frame);
+		sent++;
+
+		if (k % 7 == 6) {
+			output.output_frame(frame);
+			repeats++;
+		}
+	}
+
+	skipped = output.get_skipped_frames();
+	return sent + repeats;
+}
+
+int main()
+{
+	received rx;
+	uint32_t skipped;
+
+	int handed = run(VIDEO_FORMAT_I420, rx, skipped);
+	printf("raw: %d frames handed over, %d delivered, %u skipped, "
+			"interval %.1f to %.1f ms\n", handed, rx.frames, skipped,
+			rx.min_interval / 1e6, rx.max_interval / 1e6);
+
+	CHECK(abs(rx.frames - SECONDS * 30) <= 1, "%d frames delivered for %d s "
+			"at 30 fps", rx.frames, SECONDS);
+	CHECK(rx.frames + (int)skipped == handed,
+			"%d delivered and %u skipped of %d", rx.frames, skipped, handed);
+	/* capture frames are 20 ms apart, so 20 and 40 ms are the only
+	 * intervals that average out to 30 fps */
+	CHECK(rx.min_interval >= 19000000 && rx.max_interval <= 41000000,
+			"uneven pacing");
+
+	handed = run(VIDEO_FORMAT_NONE, rx, skipped);
+	printf("encoded: %d frames handed over, %d delivered, %u skipped\n",
+			handed, rx.frames, skipped);
+
+	CHECK(rx.frames == SECONDS * CAPTURE_FPS,
+			"%d encoded frames delivered of %d", rx.frames,
+			SECONDS * CAPTURE_FPS);
+	CHECK(skipped == 0, "encoded frames counted as skipped");
+
+	if (failures)
+		printf("%d checks failed\n", failures);
+	return failures ? 1 : 0;
+}
@@ -16,6 +16,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <signal.h>
 #include "base.h"
 #include "bmem.h"
 #include "platform.h"
@@ -9,8 +9,20 @@ public class RtmpClient {
     public static native long open(String url,String name);
     public static native int close(long rtmpPointer);
     public static native void init_video_info(int width, int height, int fps);
+    public static native void setVariableFrameRate(boolean enable);
+    public static native void setReorderFrames(int frames);
+    public static native void setVideoCodec(String codec);
+    public static native void setRecordPath(String path);
+    public static native int getRecordDroppedTags();
+    public static native void setMp4RecordPath(String path);
+    public static native int getMp4RecordDroppedPackets();
+    public static native boolean repairMp4Recording(String path);
+    public static native void setLogLevel(int level);
+    public static native void dumpLog();
 
     public static native void pushAudioData(long tms, byte[] data);
+    public static native void pushAudioSourceData(int source, long tms, byte[] data);
+    public static native void setAudioSourceGain(int source, float gain);
     public static native void initAudioHeader(byte[] csd0);
 
     public static native void pushVideoData(long tms, byte[] data);
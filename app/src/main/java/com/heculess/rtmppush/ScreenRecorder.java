@@ -25,7 +25,11 @@ public class ScreenRecorder extends Thread {
     public static final int FRAME_RATE = 30;
     private static final int IFRAME_INTERVAL = 1;
     private static final int TIMEOUT_US = 10000;
+    private static final String MIMETYPE_VIDEO_AV1 = "video/av01";
+    /* MediaFormat.KEY_MAX_FPS_TO_ENCODER, public from api 29 */
+    private static final String KEY_MAX_FPS_TO_ENCODER = "max-fps-to-encoder";
 
+    private String mMimeType = MediaFormat.MIMETYPE_VIDEO_AVC;
     private MediaCodec mEncoder;
     private Surface mSurface;
     private AtomicBoolean mQuit = new AtomicBoolean(false);
@@ -43,6 +47,17 @@ public class ScreenRecorder extends Thread {
         mMediaProjection = mp;
     }
 
+    /* call before the stream starts, hevc and av1 go out as enhanced rtmp */
+    public void setVideoCodec(String mimeType) {
+        mMimeType = mimeType;
+        if (MediaFormat.MIMETYPE_VIDEO_HEVC.equals(mimeType))
+            RtmpClient.setVideoCodec("hevc");
+        else if (MIMETYPE_VIDEO_AV1.equals(mimeType))
+            RtmpClient.setVideoCodec("av1");
+        else
+            RtmpClient.setVideoCodec("h264");
+    }
+
     public final void quit() {
         if(mQuit != null){
             mQuit.set(true);
@@ -70,7 +85,7 @@ public class ScreenRecorder extends Thread {
     }
 
     private void prepareEncoder() throws IOException {
-        MediaFormat format = MediaFormat.createVideoFormat(MediaFormat.MIMETYPE_VIDEO_AVC,
+        MediaFormat format = MediaFormat.createVideoFormat(mMimeType,
                 mWidth, mHeight);
         format.setInteger(MediaFormat.KEY_COLOR_FORMAT,
                 MediaCodecInfo.CodecCapabilities.COLOR_FormatSurface);
@@ -78,8 +93,12 @@ public class ScreenRecorder extends Thread {
         format.setInteger(MediaFormat.KEY_BITRATE_MODE,
                 MediaCodecInfo.EncoderCapabilities.BITRATE_MODE_VBR);
         format.setInteger(MediaFormat.KEY_FRAME_RATE, FRAME_RATE);
+        /* the virtual display can render faster than FRAME_RATE; the input
+         * surface drops what is above it before it is encoded, native
+         * pacing can't skip frames that are already encoded */
+        format.setFloat(KEY_MAX_FPS_TO_ENCODER, FRAME_RATE);
         format.setInteger(MediaFormat.KEY_I_FRAME_INTERVAL, IFRAME_INTERVAL);
-        mEncoder = MediaCodec.createEncoderByType(MediaFormat.MIMETYPE_VIDEO_AVC);
+        mEncoder = MediaCodec.createEncoderByType(mMimeType);
         mEncoder.configure(format, null, null, MediaCodec.CONFIGURE_FLAG_ENCODE);
         mSurface = mEncoder.createInputSurface();
         mEncoder.start();
@@ -124,10 +143,12 @@ public class ScreenRecorder extends Thread {
 
     private void sendAVCDecoderHeader(MediaFormat format) {
 
+        /* hevc keeps all parameter sets in csd-0 and has no csd-1 */
         ByteBuffer SPSByteBuff = format.getByteBuffer("csd-0");
         ByteBuffer PPSByteBuff = format.getByteBuffer("csd-1");
 
-        RtmpClient.initVideoHeader(SPSByteBuff.array(), PPSByteBuff.array());
+        RtmpClient.initVideoHeader(SPSByteBuff.array(),
+                PPSByteBuff != null ? PPSByteBuff.array() : new byte[0]);
     }
 
     private void sendRealData(long tms, ByteBuffer realData){